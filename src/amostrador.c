@@ -0,0 +1,463 @@
+#include "amostrador.h"
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+/** Número de píxels da máscara de ruído azul. */
+#define RUIDO_AZUL_PIXELS (RUIDO_AZUL_LADO * RUIDO_AZUL_LADO)
+
+/** Máscara de ruído azul: a ordem (de 0 a RUIDO_AZUL_PIXELS - 1) de cada
+ * píxel. */
+static unsigned short mascara[RUIDO_AZUL_PIXELS];
+
+static pthread_once_t tabelas_geradas = PTHREAD_ONCE_INIT;
+
+/**
+ * Mistura os índices de uma amostra num número pseudoaleatório (um hash,
+ * para não depender de estado compartilhado entre threads).
+ *
+ * @param i Linha do píxel.
+ * @param j Coluna do píxel.
+ * @param amostra Número da amostra no píxel.
+ * @param dimensao Dimensão (eixo) da amostra.
+ * @return Número pseudoaleatório de 32 bits.
+ */
+unsigned int amostrador_misturar(unsigned int i, unsigned int j,
+    unsigned int amostra, unsigned int dimensao)
+{
+    unsigned int h;
+
+    h = i * 73856093u ^ j * 19349663u ^ amostra * 83492791u ^
+        dimensao * 2654435761u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * Inverte a ordem dos bits de um número de 32 bits.
+ */
+static unsigned int inverter_bits(unsigned int x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+/**
+ * Hash de Laine-Karras: cada bit do resultado depende só dos bits menos
+ * significativos (e da semente).
+ */
+static unsigned int laine_karras(unsigned int x, unsigned int semente)
+{
+    x += semente;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+/**
+ * Embaralhamento de Owen de um número em ponto fixo (0.32), pelo hash de
+ * Laine-Karras sobre os bits invertidos: cada bit é trocado conforme os
+ * bits mais significativos, o que preserva a estratificação da sequência.
+ */
+static unsigned int embaralhar(unsigned int x, unsigned int semente)
+{
+    return inverter_bits(laine_karras(inverter_bits(x), semente));
+}
+
+/**
+ * Segunda dimensão do conjunto de Sobol em ponto fixo (0.32) para índices
+ * de 16 bits, um byte por vez: tabela_sobol[b][x] é a soma (xor) das
+ * direções dos bits ligados do byte x na posição b.
+ */
+static unsigned int tabela_sobol[2][256];
+
+/**
+ * Retorna a amostra n (de 16 bits) da segunda dimensão do conjunto de
+ * Sobol de duas dimensões em ponto fixo (a primeira é a sequência de van
+ * der Corput, inverter_bits(n)).
+ */
+static unsigned int sobol(unsigned int n)
+{
+    return tabela_sobol[0][n & 0xff] ^ tabela_sobol[1][(n >> 8) & 0xff];
+}
+
+/**
+ * Calcula o par p (as dimensões 2p e 2p + 1) do conjunto de Sobol
+ * embaralhado com a semente dada: a ordem das amostras é embaralhada com
+ * a semente do par (só nos 16 bits mais baixos, o que mantém as primeiras
+ * 2^m amostras num bloco alinhado de 2^m pontos, e portanto
+ * estratificadas), e os valores de cada dimensão, com a sua própria.
+ */
+static void sobol_embaralhado(unsigned int semente, unsigned int amostra,
+    unsigned int par, unsigned int valores[2])
+{
+    unsigned int indice;
+
+    indice = embaralhar(amostra, amostrador_misturar(semente, par, 0,
+        0x5eed)) & (AMOSTRADOR_MAX_AMOSTRAS - 1);
+    valores[0] = inverter_bits(laine_karras(indice,
+        amostrador_misturar(semente, par, 1, 2 * par)));
+    valores[1] = embaralhar(sobol(indice),
+        amostrador_misturar(semente, par, 1, 2 * par + 1));
+}
+
+/**
+ * Gerador xorshift de 32 bits (para os pontos iniciais da máscara).
+ */
+static unsigned int xorshift(unsigned int *estado)
+{
+    unsigned int x;
+
+    x = *estado;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *estado = x;
+    return x;
+}
+
+/**
+ * Soma (sinal 1) ou subtrai (sinal -1) o filtro gaussiano centrado no
+ * píxel p à energia de todos os píxels da máscara (na topologia do toro).
+ */
+static void espalhar(double *energia, const double *filtro, int p,
+    double sinal)
+{
+    int i, j, pi, pj;
+
+    pi = p / RUIDO_AZUL_LADO;
+    pj = p % RUIDO_AZUL_LADO;
+    for(i = 0; i < RUIDO_AZUL_LADO; i++)
+    {
+        const double *linha = &filtro[((i - pi) & (RUIDO_AZUL_LADO - 1)) *
+            RUIDO_AZUL_LADO];
+        double *destino = &energia[i * RUIDO_AZUL_LADO];
+
+        for(j = 0; j < RUIDO_AZUL_LADO; j++)
+        {
+            destino[j] += sinal * linha[(j - pj) & (RUIDO_AZUL_LADO - 1)];
+        }
+    }
+}
+
+/**
+ * Retorna o píxel de maior (ou, com maior 0, de menor) energia entre os
+ * píxels com o valor dado no padrão: o aglomerado mais denso (entre os
+ * pontos) ou o maior vazio (entre os que não são pontos).
+ */
+static int extremo(const double *energia, const unsigned char *padrao,
+    int valor, int maior)
+{
+    int p, melhor;
+
+    melhor = -1;
+    for(p = 0; p < RUIDO_AZUL_PIXELS; p++)
+    {
+        if(padrao[p] == valor && (melhor < 0 ||
+            (maior ? energia[p] > energia[melhor] :
+            energia[p] < energia[melhor])))
+        {
+            melhor = p;
+        }
+    }
+    return melhor;
+}
+
+/**
+ * Gera a máscara de ruído azul pelo algoritmo void-and-cluster de
+ * Ulichney: a partir de 10% de pontos sorteados e espalhados (tirando o
+ * ponto do aglomerado mais denso e pondo-o no maior vazio até que ele
+ * volte ao mesmo lugar), os pontos são numerados tirando-os do aglomerado
+ * mais denso, e os outros píxels, pondo pontos nos maiores vazios.
+ */
+static void gerar_mascara(void)
+{
+    static double filtro[RUIDO_AZUL_PIXELS];
+    static double energia[RUIDO_AZUL_PIXELS];
+    static double energia_inicial[RUIDO_AZUL_PIXELS];
+    static unsigned char padrao[RUIDO_AZUL_PIXELS];
+    static unsigned char padrao_inicial[RUIDO_AZUL_PIXELS];
+    int i, j, di, dj, p, vazio, pontos, ordem;
+    unsigned int estado;
+
+    // Filtro gaussiano indexado pela diferença (no toro) entre os píxels.
+    for(i = 0; i < RUIDO_AZUL_LADO; i++)
+    {
+        for(j = 0; j < RUIDO_AZUL_LADO; j++)
+        {
+            di = min(i, RUIDO_AZUL_LADO - i);
+            dj = min(j, RUIDO_AZUL_LADO - j);
+            filtro[i * RUIDO_AZUL_LADO + j] = exp(-(di * di + dj * dj) /
+                (2.0 * RUIDO_AZUL_SIGMA * RUIDO_AZUL_SIGMA));
+        }
+    }
+
+    // Pontos iniciais.
+    memset(padrao, 0, sizeof(padrao));
+    memset(energia, 0, sizeof(energia));
+    estado = 0x9e3779b9u;
+    for(pontos = 0; pontos < RUIDO_AZUL_PIXELS / 10; )
+    {
+        p = xorshift(&estado) % RUIDO_AZUL_PIXELS;
+        if(!padrao[p])
+        {
+            padrao[p] = 1;
+            espalhar(energia, filtro, p, 1.0);
+            pontos++;
+        }
+    }
+
+    for(;;)
+    {
+        p = extremo(energia, padrao, 1, 1);
+        padrao[p] = 0;
+        espalhar(energia, filtro, p, -1.0);
+        vazio = extremo(energia, padrao, 0, 0);
+        padrao[vazio] = 1;
+        espalhar(energia, filtro, vazio, 1.0);
+        if(vazio == p)
+        {
+            break;
+        }
+    }
+    memcpy(padrao_inicial, padrao, sizeof(padrao));
+    memcpy(energia_inicial, energia, sizeof(energia));
+
+    // Os pontos iniciais, do aglomerado mais denso para trás.
+    for(ordem = pontos - 1; ordem >= 0; ordem--)
+    {
+        p = extremo(energia, padrao, 1, 1);
+        padrao[p] = 0;
+        espalhar(energia, filtro, p, -1.0);
+        mascara[p] = ordem;
+    }
+
+    // Os outros píxels, do maior vazio para frente. (A partir da metade,
+    // o aglomerado mais denso de "não pontos" é o maior vazio de pontos,
+    // já que a energia dos dois somada é a mesma em todos os píxels.)
+    memcpy(padrao, padrao_inicial, sizeof(padrao));
+    memcpy(energia, energia_inicial, sizeof(energia));
+    for(ordem = pontos; ordem < RUIDO_AZUL_PIXELS; ordem++)
+    {
+        p = extremo(energia, padrao, 0, 0);
+        padrao[p] = 1;
+        espalhar(energia, filtro, p, 1.0);
+        mascara[p] = ordem;
+    }
+}
+
+/**
+ * Gera as tabelas do Sobol e a máscara de ruído azul.
+ */
+static void gerar_tabelas(void)
+{
+    int b, k, x;
+    unsigned int direcao, direcoes[16];
+
+    // Direções da segunda dimensão: a matriz geradora é a de Pascal
+    // módulo 2.
+    direcao = 1u << 31;
+    for(k = 0; k < 16; k++, direcao ^= direcao >> 1)
+    {
+        direcoes[k] = direcao;
+    }
+    for(b = 0; b < 2; b++)
+    {
+        for(x = 0; x < 256; x++)
+        {
+            tabela_sobol[b][x] = 0;
+            for(k = 0; k < 8; k++)
+            {
+                if(x & (1 << k))
+                {
+                    tabela_sobol[b][x] ^= direcoes[8 * b + k];
+                }
+            }
+        }
+    }
+
+    gerar_mascara();
+}
+
+/**
+ * Gera as tabelas do Sobol e a máscara de ruído azul (pelo algoritmo
+ * void-and-cluster), se ainda não foram geradas. Deve ser chamada antes
+ * de ler valores do Sobol ou do ruído azul, e pode ser chamada por várias
+ * threads.
+ */
+void amostrador_iniciar(void)
+{
+    pthread_once(&tabelas_geradas, gerar_tabelas);
+}
+
+/**
+ * Gira (Cranley-Patterson) um valor em ponto fixo pelo valor da máscara
+ * de ruído azul no píxel, com a máscara deslocada (no toro) para cada
+ * dimensão.
+ */
+static unsigned int girar_ruido_azul(unsigned int valor, unsigned int i,
+    unsigned int j, unsigned int dimensao)
+{
+    unsigned int deslocamento, rotacao;
+
+    deslocamento = amostrador_misturar(0, 0, 0, dimensao);
+    i = (i + deslocamento) & (RUIDO_AZUL_LADO - 1);
+    j = (j + (deslocamento >> 16)) & (RUIDO_AZUL_LADO - 1);
+    rotacao = (unsigned int) ((mascara[i * RUIDO_AZUL_LADO + j] + 0.5) *
+        (4294967296.0 / RUIDO_AZUL_PIXELS));
+    return valor + rotacao;
+}
+
+/**
+ * Calcula, em ponto fixo (0.32), o par p (as dimensões 2p e 2p + 1) de
+ * uma amostra de um píxel. No ruído azul, o Sobol embaralhado é o mesmo em
+ * todos os píxels e só a rotação muda, de modo que a estratificação das
+ * amostras de cada píxel é a do Sobol e o erro dos píxels vizinhos, que
+ * começam em pontos distantes da sequência, fica nas frequências altas.
+ */
+static void amostrar_par(int amostrador, unsigned int i, unsigned int j,
+    unsigned int amostra, unsigned int par, unsigned int valores[2])
+{
+    switch(amostrador)
+    {
+        case AMOSTRADOR_SOBOL:
+            sobol_embaralhado(amostrador_misturar(i, j, 0, 0), amostra, par,
+                valores);
+            break;
+        case AMOSTRADOR_RUIDO_AZUL:
+            sobol_embaralhado(0, amostra, par, valores);
+            valores[0] = girar_ruido_azul(valores[0], i, j, 2 * par);
+            valores[1] = girar_ruido_azul(valores[1], i, j, 2 * par + 1);
+            break;
+        default:
+            valores[0] = amostrador_misturar(i, j, amostra, 2 * par);
+            valores[1] = amostrador_misturar(i, j, amostra, 2 * par + 1);
+            break;
+    }
+}
+
+/**
+ * Converte um valor em ponto fixo (0.32) para [0, 1).
+ */
+static real_t converter(unsigned int valor)
+{
+    real_t x;
+
+    // Em precisão simples, o arredondamento pode chegar a 1.
+    x = (real_t) (valor * (1.0 / 4294967296.0));
+    return x < 1.0 ? x : (real_t) 0.0;
+}
+
+/**
+ * Retorna o valor de uma dimensão de uma amostra de um píxel, sem estado:
+ * o mesmo índice dá sempre o mesmo valor, em qualquer thread. As
+ * dimensões são calculadas aos pares (2p e 2p + 1).
+ *
+ * - AMOSTRADOR_ALEATORIO: hash dos índices.
+ * - AMOSTRADOR_SOBOL: as dimensões vão aos pares, cada par um conjunto de
+ *   Sobol de duas dimensões com embaralhamento de Owen (por hash, de
+ *   Laine-Karras), com a ordem das amostras também embaralhada por píxel
+ *   e por par, para que os pares não fiquem correlacionados. Só os 16
+ *   bits mais baixos da amostra contam (AMOSTRADOR_MAX_AMOSTRAS).
+ * - AMOSTRADOR_RUIDO_AZUL: o mesmo Sobol embaralhado em todos os píxels,
+ *   girado em cada píxel pelo valor da máscara de ruído azul (deslocada
+ *   para cada dimensão), de modo que píxels vizinhos comecem em pontos
+ *   distantes da sequência.
+ *
+ * @param amostrador Amostrador usado.
+ * @param i Linha do píxel.
+ * @param j Coluna do píxel.
+ * @param amostra Número da amostra no píxel.
+ * @param dimensao Dimensão da amostra.
+ * @return Valor em [0, 1).
+ */
+real_t amostrador_valor(int amostrador, unsigned int i, unsigned int j,
+    unsigned int amostra, unsigned int dimensao)
+{
+    unsigned int valores[2];
+
+    amostrar_par(amostrador, i, j, amostra, dimensao >> 1, valores);
+    return converter(valores[dimensao & 1]);
+}
+
+/**
+ * Começa a sequência de uma amostra de um píxel na dimensão dada.
+ *
+ * @param sequencia Ponteiro para a sequência (é preenchida).
+ * @param amostrador Amostrador usado.
+ * @param i Linha do píxel.
+ * @param j Coluna do píxel.
+ * @param amostra Número da amostra no píxel.
+ * @param dimensao Primeira dimensão a ser lida.
+ */
+void sequencia_iniciar(sequencia_t *sequencia, int amostrador,
+    unsigned int i, unsigned int j, unsigned int amostra,
+    unsigned int dimensao)
+{
+    sequencia->amostrador = amostrador;
+    sequencia->i = i;
+    sequencia->j = j;
+    sequencia->amostra = amostra;
+    sequencia->dimensao = dimensao;
+    // Nada calculado ainda: as dimensões lidas só avançam.
+    sequencia->dimensao_seguinte = dimensao - 1;
+}
+
+/**
+ * Lê o valor da próxima dimensão de uma sequência.
+ *
+ * @param sequencia Ponteiro para a sequência (passa à dimensão seguinte).
+ * @return Valor em [0, 1).
+ */
+real_t sequencia_proximo(sequencia_t *sequencia)
+{
+    unsigned int valores[2];
+
+    // As dimensões ímpares costumam vir logo depois do seu par.
+    if(sequencia->dimensao == sequencia->dimensao_seguinte)
+    {
+        sequencia->dimensao++;
+        return sequencia->seguinte;
+    }
+
+    amostrar_par(sequencia->amostrador, sequencia->i, sequencia->j,
+        sequencia->amostra, sequencia->dimensao >> 1, valores);
+    if(sequencia->dimensao & 1)
+    {
+        sequencia->dimensao++;
+        return converter(valores[1]);
+    }
+    sequencia->seguinte = converter(valores[1]);
+    sequencia->dimensao_seguinte = sequencia->dimensao + 1;
+    sequencia->dimensao++;
+    return converter(valores[0]);
+}
+
+/**
+ * Retorna o nome de um amostrador (para as estatísticas).
+ *
+ * @param amostrador Amostrador.
+ * @return Nome do amostrador.
+ */
+const char *amostrador_nome(int amostrador)
+{
+    switch(amostrador)
+    {
+        case AMOSTRADOR_SOBOL:
+            return "Sobol";
+        case AMOSTRADOR_RUIDO_AZUL:
+            return "ruído azul";
+        default:
+            return "aleatório";
+    }
+}
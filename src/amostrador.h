@@ -0,0 +1,116 @@
+#ifndef AMOSTRADOR_H
+#define AMOSTRADOR_H
+
+#include "geometria.h"
+
+/** Amostradores: hash dos índices (ruído branco), Sobol embaralhado e
+ * máscara de ruído azul. */
+#define AMOSTRADOR_ALEATORIO 0
+#define AMOSTRADOR_SOBOL 1
+#define AMOSTRADOR_RUIDO_AZUL 2
+#define NUM_AMOSTRADORES 3
+
+/** Amostras distintas por píxel (índices de 16 bits) do Sobol e do ruído
+ * azul: a amostra n e a n + AMOSTRADOR_MAX_AMOSTRAS dão os mesmos
+ * valores. Quem precisa de mais amostras deve trocar de píxel (i, j) a
+ * cada bloco. */
+#define AMOSTRADOR_MAX_AMOSTRAS (1 << 16)
+
+/** Lado (potência de 2) da máscara de ruído azul, repetida sobre a tela. */
+#define RUIDO_AZUL_LADO 64
+
+/** Desvio padrão (em píxels) do filtro usado para gerar o ruído azul. */
+#define RUIDO_AZUL_SIGMA 1.5
+
+/**
+ * Sequência de números de uma amostra de um píxel, lidos um por um (cada
+ * um numa dimensão) de um amostrador. Fica na pilha de quem traça a
+ * amostra.
+ */
+struct sequencia {
+    int amostrador; // AMOSTRADOR_ALEATORIO, AMOSTRADOR_SOBOL, ...
+    unsigned int i, j; // Linha e coluna do píxel.
+    unsigned int amostra; // Número da amostra no píxel.
+    unsigned int dimensao; // Próxima dimensão a ser lida.
+    unsigned int dimensao_seguinte; // Dimensão (ímpar) já calculada.
+    real_t seguinte; // Valor dessa dimensão.
+};
+
+/**
+ * Mistura os índices de uma amostra num número pseudoaleatório (um hash,
+ * para não depender de estado compartilhado entre threads).
+ *
+ * @param i Linha do píxel.
+ * @param j Coluna do píxel.
+ * @param amostra Número da amostra no píxel.
+ * @param dimensao Dimensão (eixo) da amostra.
+ * @return Número pseudoaleatório de 32 bits.
+ */
+unsigned int amostrador_misturar(unsigned int i, unsigned int j,
+    unsigned int amostra, unsigned int dimensao);
+
+/**
+ * Gera as tabelas do Sobol e a máscara de ruído azul (pelo algoritmo
+ * void-and-cluster), se ainda não foram geradas. Deve ser chamada antes
+ * de ler valores do Sobol ou do ruído azul, e pode ser chamada por várias
+ * threads.
+ */
+void amostrador_iniciar(void);
+
+/**
+ * Retorna o valor de uma dimensão de uma amostra de um píxel, sem estado:
+ * o mesmo índice dá sempre o mesmo valor, em qualquer thread. As
+ * dimensões são calculadas aos pares (2p e 2p + 1).
+ *
+ * - AMOSTRADOR_ALEATORIO: hash dos índices.
+ * - AMOSTRADOR_SOBOL: as dimensões vão aos pares, cada par um conjunto de
+ *   Sobol de duas dimensões com embaralhamento de Owen (por hash, de 
+ *   Laine-Karras), com a ordem das amostras também embaralhada por píxel
+ *   e por par, para que os pares não fiquem correlacionados. Só os 16
+ *   bits mais baixos da amostra contam (AMOSTRADOR_MAX_AMOSTRAS).
+ * - AMOSTRADOR_RUIDO_AZUL: o mesmo Sobol embaralhado em todos os píxels,
+ *   girado em cada píxel pelo valor da máscara de ruído azul (deslocada
+ *   para cada dimensão), de modo que píxels vizinhos comecem em pontos
+ *   distantes da sequência.
+ *
+ * @param amostrador Amostrador usado.
+ * @param i Linha do píxel.
+ * @param j Coluna do píxel.
+ * @param amostra Número da amostra no píxel.
+ * @param dimensao Dimensão da amostra.
+ * @return Valor em [0, 1).
+ */
+real_t amostrador_valor(int amostrador, unsigned int i, unsigned int j,
+    unsigned int amostra, unsigned int dimensao);
+
+/**
+ * Começa a sequência de uma amostra de um píxel na dimensão dada.
+ *
+ * @param sequencia Ponteiro para a sequência (é preenchida).
+ * @param amostrador Amostrador usado.
+ * @param i Linha do píxel.
+ * @param j Coluna do píxel.
+ * @param amostra Número da amostra no píxel.
+ * @param dimensao Primeira dimensão a ser lida.
+ */
+void sequencia_iniciar(sequencia_t *sequencia, int amostrador,
+    unsigned int i, unsigned int j, unsigned int amostra,
+    unsigned int dimensao);
+
+/**
+ * Lê o valor da próxima dimensão de uma sequência.
+ *
+ * @param sequencia Ponteiro para a sequência (passa à dimensão seguinte).
+ * @return Valor em [0, 1).
+ */
+real_t sequencia_proximo(sequencia_t *sequencia);
+
+/**
+ * Retorna o nome de um amostrador (para as estatísticas).
+ *
+ * @param amostrador Amostrador.
+ * @return Nome do amostrador.
+ */
+const char *amostrador_nome(int amostrador);
+
+#endif // AMOSTRADOR_H
@@ -0,0 +1,672 @@
+#include "arquivo_malha.h"
+#include "malha.h"
+#include "bvh.h"
+#include <fcntl.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Número de blocos por thread na leitura do OBJ (equilibra a carga). */
+#define BLOCOS_POR_THREAD 4
+
+/**
+ * Trecho do arquivo OBJ lido por uma thread. As contagens são preenchidas
+ * na primeira passada e as bases (posição do primeiro vértice e do primeiro
+ * triângulo do bloco nos arrays finais) são calculadas entre as passadas.
+ */
+typedef struct {
+    const char *inicio;
+    const char *fim;
+    int num_vertices;
+    int num_triangulos;
+    int base_vertices;
+    int base_triangulos;
+    int erro;
+} bloco_obj_t;
+
+
+/**
+ * Mapeia um arquivo inteiro em memória (somente leitura).
+ *
+ * @return Ponteiro para o início do mapa ou NULL em caso de erro.
+ */
+static void *mapear_arquivo(const char *caminho, size_t *tamanho)
+{
+    int fd;
+    struct stat info;
+    void *mapa;
+
+    fd = open(caminho, O_RDONLY);
+    if(fd < 0)
+    {
+        return NULL;
+    }
+
+    if(fstat(fd, &info) < 0 || info.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    *tamanho = (size_t) info.st_size;
+    mapa = mmap(NULL, *tamanho, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // O mapa continua válido após fechar o descritor.
+
+    if(mapa == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    return mapa;
+}
+
+/**
+ * Avança até o início da próxima linha.
+ */
+static const char *proxima_linha(const char *p, const char *fim)
+{
+    p = memchr(p, '\n', fim - p);
+    return p == NULL ? fim : p + 1;
+}
+
+/**
+ * Pula espaços e tabulações (mas não quebras de linha).
+ */
+static const char *pular_espacos(const char *p, const char *fim)
+{
+    while(p < fim && (*p == ' ' || *p == '\t' || *p == '\r'))
+    {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Lê um número real em notação decimal ou científica. É bem mais rápido
+ * que strtod() e a precisão (cerca de 15 dígitos) basta para as malhas.
+ */
+static const char *ler_real(const char *p, const char *fim, double *valor)
+{
+    double resultado, escala;
+    int negativo, expoente, negativo_exp;
+
+    p = pular_espacos(p, fim);
+    negativo = 0;
+    if(p < fim && (*p == '-' || *p == '+'))
+    {
+        negativo = (*p == '-');
+        p++;
+    }
+
+    resultado = 0.0;
+    while(p < fim && *p >= '0' && *p <= '9')
+    {
+        resultado = resultado * 10.0 + (*p - '0');
+        p++;
+    }
+
+    if(p < fim && *p == '.')
+    {
+        p++;
+        escala = 0.1;
+        while(p < fim && *p >= '0' && *p <= '9')
+        {
+            resultado += (*p - '0') * escala;
+            escala *= 0.1;
+            p++;
+        }
+    }
+
+    if(p < fim && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        negativo_exp = 0;
+        if(p < fim && (*p == '-' || *p == '+'))
+        {
+            negativo_exp = (*p == '-');
+            p++;
+        }
+        expoente = 0;
+        while(p < fim && *p >= '0' && *p <= '9')
+        {
+            expoente = expoente * 10 + (*p - '0');
+            p++;
+        }
+        escala = 1.0;
+        while(expoente-- > 0)
+        {
+            escala *= 10.0;
+        }
+        resultado = negativo_exp ? resultado / escala : resultado * escala;
+    }
+
+    *valor = negativo ? -resultado : resultado;
+    return p;
+}
+
+/**
+ * Lê uma referência de vértice de uma face ("v", "v/vt", "v//vn" ou
+ * "v/vt/vn") e retorna apenas o índice da posição.
+ *
+ * @return Ponteiro após a referência ou NULL se não houver referência.
+ */
+static const char *ler_referencia(const char *p, const char *fim, int *valor)
+{
+    int negativo, lido;
+
+    p = pular_espacos(p, fim);
+    negativo = 0;
+    if(p < fim && *p == '-')
+    {
+        negativo = 1;
+        p++;
+    }
+
+    lido = 0;
+    *valor = 0;
+    while(p < fim && *p >= '0' && *p <= '9')
+    {
+        *valor = *valor * 10 + (*p - '0');
+        lido = 1;
+        p++;
+    }
+
+    if(!lido)
+    {
+        return NULL;
+    }
+
+    // Ignora as coordenadas de textura e normais.
+    while(p < fim && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+    {
+        p++;
+    }
+
+    if(negativo)
+    {
+        *valor = -*valor;
+    }
+    return p;
+}
+
+/**
+ * Lê (ou só conta, se 'vertices' for NULL) os vértices e triângulos de
+ * um bloco do OBJ.
+ */
+static void ler_bloco_obj(bloco_obj_t *bloco, ponto_t *vertices,
+    int *indices, int total_vertices)
+{
+    const char *p, *linha, *fim;
+    int nv, nt, referencias, primeiro, anterior, atual, indice;
+    double x, y, z;
+
+    nv = 0;
+    nt = 0;
+    fim = bloco->fim;
+
+    for(linha = bloco->inicio; linha < fim; linha = proxima_linha(linha, fim))
+    {
+        p = pular_espacos(linha, fim);
+
+        if(fim - p < 2 || (p[1] != ' ' && p[1] != '\t'))
+        {
+            continue;
+        }
+
+        if(p[0] == 'v')
+        {
+            if(vertices != NULL)
+            {
+                p = ler_real(p + 1, fim, &x);
+                p = ler_real(p, fim, &y);
+                ler_real(p, fim, &z);
+                vertices[bloco->base_vertices + nv].x = x;
+                vertices[bloco->base_vertices + nv].y = y;
+                vertices[bloco->base_vertices + nv].z = z;
+            }
+            nv++;
+        }
+        else if(p[0] == 'f')
+        {
+            p++;
+            referencias = 0;
+            primeiro = anterior = 0;
+            while((p = ler_referencia(p, fim, &indice)) != NULL)
+            {
+                // Índices começam em 1; negativos contam a partir do último
+                // vértice já lido.
+                if(indice > 0)
+                {
+                    atual = indice - 1;
+                }
+                else
+                {
+                    atual = bloco->base_vertices + nv + indice;
+                }
+
+                // Na contagem a base ainda não é conhecida, então os
+                // índices só são validados na leitura.
+                if(indice == 0 || (vertices != NULL &&
+                    (atual < 0 || atual >= total_vertices)))
+                {
+                    bloco->erro = 1;
+                    return;
+                }
+
+                if(referencias == 0)
+                {
+                    primeiro = atual;
+                }
+                else if(referencias >= 2)
+                {
+                    // Divide o polígono em leque.
+                    if(indices != NULL)
+                    {
+                        indices[3 * (bloco->base_triangulos + nt) + 0] =
+                            primeiro;
+                        indices[3 * (bloco->base_triangulos + nt) + 1] =
+                            anterior;
+                        indices[3 * (bloco->base_triangulos + nt) + 2] =
+                            atual;
+                    }
+                    nt++;
+                }
+                anterior = atual;
+                referencias++;
+            }
+        }
+    }
+
+    bloco->num_vertices = nv;
+    bloco->num_triangulos = nt;
+}
+
+/**
+ * Carrega uma malha de um arquivo OBJ. O arquivo é dividido em blocos
+ * que são lidos em paralelo: uma primeira passada conta os vértices e
+ * triângulos de cada bloco e a segunda escreve direto na posição final.
+ * Faces com mais de 3 vértices são divididas em leque; só as posições
+ * dos vértices ('v') e as faces ('f') são usadas.
+ *
+ * @param caminho Caminho do arquivo OBJ.
+ * @return Ponteiro para a malha carregada ou NULL em caso de erro.
+ */
+malha_t *malha_carregar_obj(const char *caminho)
+{
+    char *texto;
+    size_t tamanho;
+    int i, num_blocos, total_vertices, total_triangulos, erro;
+    bloco_obj_t *blocos;
+    ponto_t *vertices;
+    int *indices;
+
+    texto = mapear_arquivo(caminho, &tamanho);
+    if(texto == NULL)
+    {
+        return NULL;
+    }
+    madvise(texto, tamanho, MADV_SEQUENTIAL);
+
+    // Divide o arquivo em blocos que terminam em fim de linha.
+    num_blocos = omp_get_max_threads() * BLOCOS_POR_THREAD;
+    blocos = malloc(num_blocos * sizeof(bloco_obj_t));
+    if(blocos == NULL)
+    {
+        munmap(texto, tamanho);
+        return NULL;
+    }
+
+    for(i = 0; i < num_blocos; i++)
+    {
+        blocos[i].inicio = (i == 0) ? texto :
+            proxima_linha(texto + tamanho * i / num_blocos - 1, texto +
+            tamanho);
+        blocos[i].erro = 0;
+        blocos[i].base_vertices = 0;
+        blocos[i].base_triangulos = 0;
+    }
+    for(i = 0; i < num_blocos; i++)
+    {
+        blocos[i].fim = (i == num_blocos - 1) ? texto + tamanho :
+            blocos[i + 1].inicio;
+        if(blocos[i].fim < blocos[i].inicio)
+        {
+            blocos[i].fim = blocos[i].inicio;
+        }
+    }
+
+    // Primeira passada: contagem.
+    # pragma omp parallel for schedule(dynamic, 1)
+    for(i = 0; i < num_blocos; i++)
+    {
+        ler_bloco_obj(&blocos[i], NULL, NULL, 0);
+    }
+
+    // Soma de prefixos para saber onde cada bloco escreve.
+    total_vertices = 0;
+    total_triangulos = 0;
+    erro = 0;
+    for(i = 0; i < num_blocos; i++)
+    {
+        blocos[i].base_vertices = total_vertices;
+        blocos[i].base_triangulos = total_triangulos;
+        total_vertices += blocos[i].num_vertices;
+        total_triangulos += blocos[i].num_triangulos;
+        erro |= blocos[i].erro;
+    }
+
+    vertices = malloc(total_vertices * sizeof(ponto_t) + 1);
+    indices = malloc(3 * total_triangulos * sizeof(int) + 1);
+
+    if(erro || vertices == NULL || indices == NULL)
+    {
+        free(vertices);
+        free(indices);
+        free(blocos);
+        munmap(texto, tamanho);
+        return NULL;
+    }
+
+    // Segunda passada: leitura.
+    # pragma omp parallel for schedule(dynamic, 1)
+    for(i = 0; i < num_blocos; i++)
+    {
+        ler_bloco_obj(&blocos[i], vertices, indices, total_vertices);
+    }
+
+    for(i = 0; i < num_blocos; i++)
+    {
+        erro |= blocos[i].erro;
+    }
+
+    free(blocos);
+    munmap(texto, tamanho);
+
+    if(erro)
+    {
+        free(vertices);
+        free(indices);
+        return NULL;
+    }
+
+    return malha_adotar(vertices, total_vertices, indices, total_triangulos);
+}
+
+/**
+ * Verifica se o trecho [deslocamento, deslocamento + quantidade * tamanho)
+ * cabe no arquivo e está alinhado em 8 bytes.
+ */
+static int trecho_valido(long long deslocamento, long long quantidade,
+    size_t tamanho_elemento, size_t tamanho_arquivo)
+{
+    return deslocamento >= (long long) sizeof(cabecalho_malha_t) &&
+        deslocamento % 8 == 0 && quantidade >= 0 &&
+        (size_t) deslocamento <= tamanho_arquivo &&
+        (size_t) quantidade <= (tamanho_arquivo - (size_t) deslocamento) /
+        tamanho_elemento;
+}
+
+/**
+ * Verifica se todos os valores de um array estão em [0, limite).
+ */
+static int valores_validos(const int *valores, long long quantidade,
+    int limite)
+{
+    long long k;
+
+    for(k = 0; k < quantidade; k++)
+    {
+        if(valores[k] < 0 || valores[k] >= limite)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Verifica se os nós lidos formam uma BVH em profundidade como a de
+ * bvh_construir(): cada nó interno com o filho esquerdo logo depois dele
+ * e o direito logo depois da subárvore esquerda, todos os nós usados, as
+ * folhas dentro dos primitivos e a profundidade dentro de BVH_MAX_PILHA
+ * (o que garante que as buscas terminam sem estourar as suas pilhas).
+ */
+static int nos_validos(const no_bvh_t *nos, int num_nos, int num_primitivos)
+{
+    int topo, indice, profundidade, proximo;
+    int pilha[BVH_MAX_PILHA], profundidades[BVH_MAX_PILHA];
+    const no_bvh_t *no;
+
+    if(num_nos == 0)
+    {
+        return 1;
+    }
+
+    topo = 0;
+    pilha[topo] = 0;
+    profundidades[topo++] = 0;
+    proximo = 0;
+    while(topo > 0)
+    {
+        topo--;
+        indice = pilha[topo];
+        profundidade = profundidades[topo];
+        if(indice != proximo || indice >= num_nos)
+        {
+            return 0;
+        }
+        proximo++;
+
+        no = &nos[indice];
+        if(no->quantidade < 0 || no->inicio < 0)
+        {
+            return 0;
+        }
+        if(no->quantidade > 0)
+        {
+            if((long long) no->inicio + no->quantidade > num_primitivos)
+            {
+                return 0;
+            }
+            continue;
+        }
+
+        // Os dois filhos vão para a pilha, que não passa da profundidade.
+        if(profundidade + 2 > BVH_MAX_PILHA || no->inicio <= indice + 1)
+        {
+            return 0;
+        }
+        pilha[topo] = no->inicio;
+        profundidades[topo++] = profundidade + 1;
+        pilha[topo] = indice + 1;
+        profundidades[topo++] = profundidade + 1;
+    }
+
+    return proximo == num_nos;
+}
+
+/**
+ * Carrega uma malha do formato binário, mapeando o arquivo em memória.
+ * Os arrays da malha apontam direto para o arquivo mapeado.
+ *
+ * @param caminho Caminho do arquivo binário.
+ * @return Ponteiro para a malha carregada ou NULL em caso de erro.
+ */
+malha_t *malha_carregar_binario(const char *caminho)
+{
+    char *mapa;
+    size_t tamanho;
+    cabecalho_malha_t *cabecalho;
+    malha_t *malha;
+
+    mapa = mapear_arquivo(caminho, &tamanho);
+    if(mapa == NULL)
+    {
+        return NULL;
+    }
+
+    cabecalho = (cabecalho_malha_t *) mapa;
+
+    if(tamanho < sizeof(cabecalho_malha_t) ||
+        memcmp(cabecalho->assinatura, MALHA_ASSINATURA,
+        sizeof(MALHA_ASSINATURA)) != 0 ||
+        cabecalho->versao != MALHA_VERSAO ||
+        cabecalho->tamanho_real != sizeof(real_t) ||
+        !trecho_valido(cabecalho->deslocamento_vertices,
+            cabecalho->num_vertices, sizeof(ponto_t), tamanho) ||
+        !trecho_valido(cabecalho->deslocamento_indices,
+            3LL * cabecalho->num_triangulos, sizeof(int), tamanho) ||
+        !trecho_valido(cabecalho->deslocamento_nos,
+            cabecalho->num_nos, sizeof(no_bvh_t), tamanho) ||
+        !trecho_valido(cabecalho->deslocamento_primitivos,
+            cabecalho->num_primitivos, sizeof(int), tamanho))
+    {
+        munmap(mapa, tamanho);
+        return NULL;
+    }
+
+    // O conteúdo também vem do arquivo: um índice fora dos arrays seria
+    // lido sem verificação durante as buscas.
+    if(!valores_validos((int *) (mapa + cabecalho->deslocamento_indices),
+            3LL * cabecalho->num_triangulos, cabecalho->num_vertices) ||
+        !valores_validos((int *) (mapa + cabecalho->deslocamento_primitivos),
+            cabecalho->num_primitivos, cabecalho->num_triangulos) ||
+        !nos_validos((no_bvh_t *) (mapa + cabecalho->deslocamento_nos),
+            cabecalho->num_nos, cabecalho->num_primitivos))
+    {
+        munmap(mapa, tamanho);
+        return NULL;
+    }
+
+    malha = malloc(sizeof(malha_t));
+    if(malha == NULL)
+    {
+        munmap(mapa, tamanho);
+        return NULL;
+    }
+
+    malha->vertices = (ponto_t *) (mapa + cabecalho->deslocamento_vertices);
+    malha->num_vertices = cabecalho->num_vertices;
+    malha->indices = (int *) (mapa + cabecalho->deslocamento_indices);
+    malha->num_triangulos = cabecalho->num_triangulos;
+    malha->bvh.nos = (no_bvh_t *) (mapa + cabecalho->deslocamento_nos);
+    malha->bvh.num_nos = cabecalho->num_nos;
+    malha->bvh.primitivos = (int *) (mapa +
+        cabecalho->deslocamento_primitivos);
+    malha->bvh.num_primitivos = cabecalho->num_primitivos;
+    malha->mapa = mapa;
+    malha->tamanho_mapa = tamanho;
+    malha->compacta = NULL;
+
+    return malha;
+}
+
+/**
+ * Escreve um array no arquivo e completa com zeros até o alinhamento de 8
+ * bytes. Retorna o deslocamento em que o array começou.
+ */
+static long long escrever_alinhado(FILE *arquivo, void *dados,
+    size_t tamanho, int *erro)
+{
+    static const char zeros[8] = {0};
+    long long deslocamento;
+
+    deslocamento = ftell(arquivo);
+    if(tamanho > 0 && fwrite(dados, 1, tamanho, arquivo) != tamanho)
+    {
+        *erro = 1;
+    }
+    if(tamanho % 8 != 0 &&
+        fwrite(zeros, 1, 8 - tamanho % 8, arquivo) != 8 - tamanho % 8)
+    {
+        *erro = 1;
+    }
+    return deslocamento;
+}
+
+/**
+ * Salva uma malha (com a sua BVH) no formato binário. Malhas compactadas
+ * não podem ser salvas.
+ *
+ * @param malha Ponteiro para a malha.
+ * @param caminho Caminho do arquivo a ser criado.
+ * @return 1 em caso de sucesso, 0 caso contrário.
+ */
+int malha_salvar_binario(malha_t *malha, const char *caminho)
+{
+    FILE *arquivo;
+    cabecalho_malha_t cabecalho;
+    int erro;
+
+    // O formato binário só guarda a geometria completa.
+    if(malha->compacta != NULL)
+    {
+        return 0;
+    }
+
+    arquivo = fopen(caminho, "wb");
+    if(arquivo == NULL)
+    {
+        return 0;
+    }
+
+    memset(&cabecalho, 0, sizeof(cabecalho));
+    memcpy(cabecalho.assinatura, MALHA_ASSINATURA, sizeof(MALHA_ASSINATURA));
+    cabecalho.versao = MALHA_VERSAO;
+    cabecalho.tamanho_real = sizeof(real_t);
+    cabecalho.num_vertices = malha->num_vertices;
+    cabecalho.num_triangulos = malha->num_triangulos;
+    cabecalho.num_nos = malha->bvh.num_nos;
+    cabecalho.num_primitivos = malha->bvh.num_primitivos;
+
+    // O cabeçalho é reescrito no fim, com os deslocamentos.
+    erro = fwrite(&cabecalho, sizeof(cabecalho), 1, arquivo) != 1;
+    cabecalho.deslocamento_vertices = escrever_alinhado(arquivo,
+        malha->vertices, malha->num_vertices * sizeof(ponto_t), &erro);
+    cabecalho.deslocamento_indices = escrever_alinhado(arquivo,
+        malha->indices, 3 * malha->num_triangulos * sizeof(int), &erro);
+    cabecalho.deslocamento_nos = escrever_alinhado(arquivo,
+        malha->bvh.nos, malha->bvh.num_nos * sizeof(no_bvh_t), &erro);
+    cabecalho.deslocamento_primitivos = escrever_alinhado(arquivo,
+        malha->bvh.primitivos, malha->bvh.num_primitivos * sizeof(int),
+        &erro);
+
+    if(fseek(arquivo, 0, SEEK_SET) != 0 ||
+        fwrite(&cabecalho, sizeof(cabecalho), 1, arquivo) != 1)
+    {
+        erro = 1;
+    }
+
+    if(fclose(arquivo) != 0)
+    {
+        erro = 1;
+    }
+
+    return !erro;
+}
+
+/**
+ * Carrega uma malha escolhendo o formato pela extensão: '.obj' é lido
+ * como OBJ e qualquer outro arquivo como binário.
+ *
+ * @param caminho Caminho do arquivo.
+ * @return Ponteiro para a malha carregada ou NULL em caso de erro.
+ */
+malha_t *malha_carregar(const char *caminho)
+{
+    size_t tamanho;
+
+    tamanho = strlen(caminho);
+    if(tamanho > 4 && strcasecmp(caminho + tamanho - 4, ".obj") == 0)
+    {
+        return malha_carregar_obj(caminho);
+    }
+
+    return malha_carregar_binario(caminho);
+}
@@ -0,0 +1,76 @@
+#ifndef ARQUIVO_MALHA_H
+#define ARQUIVO_MALHA_H
+
+#include "geometria.h"
+
+/** Assinatura do formato binário de malhas. */
+#define MALHA_ASSINATURA "RTMALHA"
+
+/** Versão do formato binário de malhas. */
+#define MALHA_VERSAO 1
+
+/**
+ * Cabeçalho do formato binário de malhas.
+ *
+ * Logo após o cabeçalho vêm, nesta ordem e alinhados em 8 bytes, os
+ * vértices (ponto_t), os índices (int, 3 por triângulo), os nós da BVH
+ * (no_bvh_t) e os primitivos da BVH (int). Os deslocamentos são contados
+ * a partir do início do arquivo. Como a BVH já vem pronta, o arquivo é
+ * apenas mapeado em memória e usado no lugar, sem cópias. Por isso só 
+ * podem ser lidos arquivos gravados com a mesma precisão (real_t).
+ */
+typedef struct {
+    char assinatura[8];
+    int versao;
+    int num_vertices;
+    int num_triangulos;
+    int num_nos;
+    int num_primitivos;
+    int tamanho_real; // sizeof(real_t) de quem gravou o arquivo.
+    long long deslocamento_vertices;
+    long long deslocamento_indices;
+    long long deslocamento_nos;
+    long long deslocamento_primitivos;
+} cabecalho_malha_t;
+
+/**
+ * Carrega uma malha de um arquivo OBJ. O arquivo é dividido em blocos
+ * que são lidos em paralelo: uma primeira passada conta os vértices e
+ * triângulos de cada bloco e a segunda escreve direto na posição final.
+ * Faces com mais de 3 vértices são divididas em leque; só as posições
+ * dos vértices ('v') e as faces ('f') são usadas.
+ *
+ * @param caminho Caminho do arquivo OBJ.
+ * @return Ponteiro para a malha carregada ou NULL em caso de erro.
+ */
+malha_t *malha_carregar_obj(const char *caminho);
+
+/**
+ * Carrega uma malha do formato binário, mapeando o arquivo em memória.
+ * Os arrays da malha apontam direto para o arquivo mapeado.
+ *
+ * @param caminho Caminho do arquivo binário.
+ * @return Ponteiro para a malha carregada ou NULL em caso de erro.
+ */
+malha_t *malha_carregar_binario(const char *caminho);
+
+/**
+ * Salva uma malha (com a sua BVH) no formato binário. Malhas compactadas
+ * não podem ser salvas.
+ *
+ * @param malha Ponteiro para a malha.
+ * @param caminho Caminho do arquivo a ser criado.
+ * @return 1 em caso de sucesso, 0 caso contrário.
+ */
+int malha_salvar_binario(malha_t *malha, const char *caminho);
+
+/**
+ * Carrega uma malha escolhendo o formato pela extensão: '.obj' é lido
+ * como OBJ e qualquer outro arquivo como binário.
+ *
+ * @param caminho Caminho do arquivo.
+ * @return Ponteiro para a malha carregada ou NULL em caso de erro.
+ */
+malha_t *malha_carregar(const char *caminho);
+
+#endif // ARQUIVO_MALHA_H
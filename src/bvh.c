@@ -0,0 +1,398 @@
+#include "bvh.h"
+#include <stdlib.h>
+#include <omp.h>
+
+/** Número de baldes usados na avaliação da SAH. */
+#define NUM_BALDES 16
+
+/** Profundidade a partir da qual a SAH deixa de ser usada. */
+#define BVH_MAX_PROFUNDIDADE_SAH 32
+
+/** Número mínimo de primitivos para construir uma subárvore em paralelo. */
+#define BVH_MIN_TAREFA 4096
+
+/**
+ * Primitivo em construção: a caixa, o centróide e o índice original são
+ * guardados juntos e movidos durante a partição, de modo que cada nível
+ * da construção lê a memória em sequência.
+ */
+typedef struct {
+    caixa_t caixa;
+    ponto_t centro;
+    int indice;
+} referencia_t;
+
+/**
+ * Balde da SAH: caixa dos primitivos, caixa dos centróides e número de
+ * centróides que caíram nele.
+ */
+typedef struct {
+    caixa_t caixa;
+    caixa_t centros;
+    int contagem;
+} balde_t;
+
+
+/**
+ * Retorna uma caixa vazia (min em +INFINITO e max em -INFINITO).
+ *
+ * @return Caixa vazia, pronta para ser expandida.
+ */
+caixa_t caixa_vazia(void)
+{
+    caixa_t caixa;
+    caixa.min.x = caixa.min.y = caixa.min.z = INFINITO;
+    caixa.max.x = caixa.max.y = caixa.max.z = -INFINITO;
+    return caixa;
+}
+
+/**
+ * Expande uma caixa para que ela contenha um ponto.
+ *
+ * @param caixa Ponteiro para a caixa a ser expandida.
+ * @param ponto Ponteiro para o ponto a ser incluído.
+ */
+void caixa_expandir(caixa_t *caixa, ponto_t *ponto)
+{
+    caixa->min.x = min(caixa->min.x, ponto->x);
+    caixa->min.y = min(caixa->min.y, ponto->y);
+    caixa->min.z = min(caixa->min.z, ponto->z);
+    caixa->max.x = max(caixa->max.x, ponto->x);
+    caixa->max.y = max(caixa->max.y, ponto->y);
+    caixa->max.z = max(caixa->max.z, ponto->z);
+}
+
+/**
+ * Expande uma caixa para que ela contenha outra caixa.
+ *
+ * @param caixa Ponteiro para a caixa a ser expandida.
+ * @param outra Ponteiro para a caixa a ser incluída.
+ */
+void caixa_unir(caixa_t *caixa, caixa_t *outra)
+{
+    caixa->min.x = min(caixa->min.x, outra->min.x);
+    caixa->min.y = min(caixa->min.y, outra->min.y);
+    caixa->min.z = min(caixa->min.z, outra->min.z);
+    caixa->max.x = max(caixa->max.x, outra->max.x);
+    caixa->max.y = max(caixa->max.y, outra->max.y);
+    caixa->max.z = max(caixa->max.z, outra->max.z);
+}
+
+/**
+ * Calcula a área da superfície de uma caixa (usada na SAH).
+ */
+static real_t caixa_area(caixa_t *caixa)
+{
+    real_t dx, dy, dz;
+
+    if(caixa->min.x > caixa->max.x)
+    {
+        return 0.0;
+    }
+
+    dx = caixa->max.x - caixa->min.x;
+    dy = caixa->max.y - caixa->min.y;
+    dz = caixa->max.z - caixa->min.z;
+    return 2.0 * (dx * dy + dy * dz + dz * dx);
+}
+
+/**
+ * Calcula a caixa dos primitivos e a caixa dos seus centróides.
+ */
+static void limites(referencia_t *refs, int inicio, int quantidade,
+    caixa_t *caixa, caixa_t *caixa_centros)
+{
+    int i;
+
+    *caixa = caixa_vazia();
+    *caixa_centros = caixa_vazia();
+    for(i = inicio; i < inicio + quantidade; i++)
+    {
+        caixa_unir(caixa, &refs[i].caixa);
+        caixa_expandir(caixa_centros, &refs[i].centro);
+    }
+}
+
+/**
+ * Constrói recursivamente, na posição 'indice', o nó que cobre os
+ * primitivos [inicio, inicio + quantidade), cujas caixa e caixa dos
+ * centróides já são conhecidas (vêm dos baldes do nó pai). Passada a
+ * profundidade máxima da SAH, os primitivos são apenas divididos ao meio,
+ * o que limita a altura da árvore (e a pilha usada para percorrê-la).
+ *
+ * Uma subárvore com n primitivos nunca usa mais de 2n - 1 nós, então o
+ * filho direito é colocado logo após o espaço reservado ao esquerdo. Assim
+ * as duas subárvores podem ser construídas ao mesmo tempo (tarefas do
+ * OpenMP); os buracos deixados no array são removidos por compactar_no().
+ */
+static void construir_no(bvh_t *bvh, referencia_t *refs, int inicio,
+    int quantidade, caixa_t caixa, caixa_t caixa_centros, int profundidade,
+    int indice)
+{
+    int i, b, eixo, melhor_balde, meio, contagem_esq;
+    referencia_t temp;
+    real_t extensao, base, escala, custo, melhor_custo;
+    caixa_t acumulada, acumulada_centros;
+    caixa_t caixa_esq, centros_esq, caixa_dir, centros_dir;
+    balde_t baldes[NUM_BALDES];
+    caixa_t caixas_dir[NUM_BALDES], centros_baldes_dir[NUM_BALDES];
+    int contagens_dir[NUM_BALDES];
+
+    bvh->nos[indice].caixa = caixa;
+
+    if(quantidade <= BVH_MAX_FOLHA)
+    {
+        for(i = inicio; i < inicio + quantidade; i++)
+        {
+            bvh->primitivos[i] = refs[i].indice;
+        }
+        bvh->nos[indice].inicio = inicio;
+        bvh->nos[indice].quantidade = quantidade;
+        return;
+    }
+
+    // Escolhe o eixo de maior extensão dos centróides.
+    eixo = 0;
+    extensao = caixa_centros.max.x - caixa_centros.min.x;
+    if(caixa_centros.max.y - caixa_centros.min.y > extensao)
+    {
+        eixo = 1;
+        extensao = caixa_centros.max.y - caixa_centros.min.y;
+    }
+    if(caixa_centros.max.z - caixa_centros.min.z > extensao)
+    {
+        eixo = 2;
+        extensao = caixa_centros.max.z - caixa_centros.min.z;
+    }
+
+    meio = -1;
+
+    if(extensao > 0.0 && profundidade < BVH_MAX_PROFUNDIDADE_SAH)
+    {
+        // Distribui os centróides nos baldes.
+        base = componente(&caixa_centros.min, eixo);
+        escala = NUM_BALDES / extensao;
+        for(b = 0; b < NUM_BALDES; b++)
+        {
+            baldes[b].caixa = caixa_vazia();
+            baldes[b].centros = caixa_vazia();
+            baldes[b].contagem = 0;
+        }
+        for(i = inicio; i < inicio + quantidade; i++)
+        {
+            b = (int) (escala * (componente(&refs[i].centro, eixo) - base));
+            if(b >= NUM_BALDES) b = NUM_BALDES - 1;
+            baldes[b].contagem++;
+            caixa_unir(&baldes[b].caixa, &refs[i].caixa);
+            caixa_expandir(&baldes[b].centros, &refs[i].centro);
+        }
+
+        // Acumula da direita para a esquerda.
+        acumulada = caixa_vazia();
+        acumulada_centros = caixa_vazia();
+        contagens_dir[NUM_BALDES - 1] = 0;
+        for(b = NUM_BALDES - 1; b > 0; b--)
+        {
+            caixa_unir(&acumulada, &baldes[b].caixa);
+            caixa_unir(&acumulada_centros, &baldes[b].centros);
+            caixas_dir[b] = acumulada;
+            centros_baldes_dir[b] = acumulada_centros;
+            contagens_dir[b] = (b < NUM_BALDES - 1 ? contagens_dir[b + 1] : 0)
+                + baldes[b].contagem;
+        }
+
+        // Avalia o custo de cada divisão entre os baldes b-1 e b.
+        melhor_custo = INFINITO;
+        melhor_balde = -1;
+        acumulada = caixa_vazia();
+        contagem_esq = 0;
+        for(b = 1; b < NUM_BALDES; b++)
+        {
+            caixa_unir(&acumulada, &baldes[b - 1].caixa);
+            contagem_esq += baldes[b - 1].contagem;
+            if(contagem_esq == 0 || contagens_dir[b] == 0)
+            {
+                continue;
+            }
+            custo = caixa_area(&acumulada) * contagem_esq +
+                caixa_area(&caixas_dir[b]) * contagens_dir[b];
+            if(custo < melhor_custo)
+            {
+                melhor_custo = custo;
+                melhor_balde = b;
+            }
+        }
+
+        if(melhor_balde > 0)
+        {
+            // Particiona os primitivos de acordo com o balde escolhido.
+            i = inicio;
+            meio = inicio + quantidade - 1;
+            while(i <= meio)
+            {
+                b = (int) (escala * (componente(&refs[i].centro, eixo) -
+                    base));
+                if(b >= NUM_BALDES) b = NUM_BALDES - 1;
+                if(b < melhor_balde)
+                {
+                    i++;
+                }
+                else
+                {
+                    temp = refs[i];
+                    refs[i] = refs[meio];
+                    refs[meio] = temp;
+                    meio--;
+                }
+            }
+            meio = i;
+
+            // As caixas dos filhos saem dos baldes, sem reler os primitivos.
+            caixa_esq = caixa_vazia();
+            centros_esq = caixa_vazia();
+            for(b = 0; b < melhor_balde; b++)
+            {
+                caixa_unir(&caixa_esq, &baldes[b].caixa);
+                caixa_unir(&centros_esq, &baldes[b].centros);
+            }
+            caixa_dir = caixas_dir[melhor_balde];
+            centros_dir = centros_baldes_dir[melhor_balde];
+        }
+    }
+
+    // Centróides coincidentes (ou SAH desligada): divide ao meio.
+    if(meio <= inicio || meio >= inicio + quantidade)
+    {
+        meio = inicio + quantidade / 2;
+        limites(refs, inicio, meio - inicio, &caixa_esq, &centros_esq);
+        limites(refs, meio, inicio + quantidade - meio, &caixa_dir,
+            &centros_dir);
+    }
+
+    // O filho esquerdo é sempre o nó seguinte (indice + 1).
+    bvh->nos[indice].quantidade = 0;
+    bvh->nos[indice].inicio = indice + 2 * (meio - inicio);
+
+    # pragma omp task if(quantidade > BVH_MIN_TAREFA)
+    construir_no(bvh, refs, inicio, meio - inicio, caixa_esq, centros_esq,
+        profundidade + 1, indice + 1);
+
+    construir_no(bvh, refs, meio, inicio + quantidade - meio, caixa_dir,
+        centros_dir, profundidade + 1, bvh->nos[indice].inicio);
+}
+
+/**
+ * Copia, em profundidade, a subárvore de 'antigos[indice]' para o fim do
+ * array compacto e retorna a nova posição do nó.
+ */
+static int compactar_no(no_bvh_t *antigos, int indice, no_bvh_t *novos,
+    int *num_novos)
+{
+    int novo;
+
+    novo = (*num_novos)++;
+    novos[novo] = antigos[indice];
+
+    if(antigos[indice].quantidade == 0)
+    {
+        compactar_no(antigos, indice + 1, novos, num_novos);
+        novos[novo].inicio = compactar_no(antigos, antigos[indice].inicio,
+            novos, num_novos);
+    }
+
+    return novo;
+}
+
+/**
+ * Constrói uma BVH a partir das caixas envolventes dos primitivos.
+ *
+ * A divisão dos nós usa a heurística de área de superfície (SAH)
+ * calculada em baldes ao longo do eixo de maior extensão dos centróides.
+ *
+ * @param bvh Ponteiro para a BVH a ser preenchida.
+ * @param caixas Array com a caixa envolvente de cada primitivo.
+ * @param num_primitivos Número de primitivos (tamanho do array de caixas).
+ * @return 1 em caso de sucesso, 0 caso falte memória.
+ */
+int bvh_construir(bvh_t *bvh, caixa_t *caixas, int num_primitivos)
+{
+    int i;
+    referencia_t *refs;
+    no_bvh_t *nos_compactos;
+    caixa_t caixa, caixa_centros;
+
+    bvh->nos = NULL;
+    bvh->num_nos = 0;
+    bvh->primitivos = NULL;
+    bvh->num_primitivos = num_primitivos;
+
+    if(num_primitivos == 0)
+    {
+        return 1;
+    }
+
+    bvh->num_nos = 2 * num_primitivos - 1;
+    bvh->nos = malloc(bvh->num_nos * sizeof(no_bvh_t));
+    bvh->primitivos = malloc(num_primitivos * sizeof(int));
+    refs = malloc(num_primitivos * sizeof(referencia_t));
+
+    if(bvh->nos == NULL || bvh->primitivos == NULL || refs == NULL)
+    {
+        free(refs);
+        bvh_liberar(bvh);
+        return 0;
+    }
+
+    # pragma omp parallel for if(num_primitivos > BVH_MIN_TAREFA)
+    for(i = 0; i < num_primitivos; i++)
+    {
+        refs[i].caixa = caixas[i];
+        refs[i].centro.x = 0.5 * (caixas[i].min.x + caixas[i].max.x);
+        refs[i].centro.y = 0.5 * (caixas[i].min.y + caixas[i].max.y);
+        refs[i].centro.z = 0.5 * (caixas[i].min.z + caixas[i].max.z);
+        refs[i].indice = i;
+    }
+
+    limites(refs, 0, num_primitivos, &caixa, &caixa_centros);
+
+    // As tarefas do OpenMP só são criadas para subárvores grandes.
+    # pragma omp parallel if(num_primitivos > BVH_MIN_TAREFA)
+    # pragma omp single
+    construir_no(bvh, refs, 0, num_primitivos, caixa, caixa_centros, 0, 0);
+
+    free(refs);
+
+    // Remove os buracos deixados pela construção em paralelo.
+    nos_compactos = malloc(bvh->num_nos * sizeof(no_bvh_t));
+    if(nos_compactos == NULL)
+    {
+        bvh_liberar(bvh);
+        return 0;
+    }
+
+    bvh->num_nos = 0;
+    compactar_no(bvh->nos, 0, nos_compactos, &bvh->num_nos);
+    free(bvh->nos);
+    bvh->nos = realloc(nos_compactos, bvh->num_nos * sizeof(no_bvh_t));
+    if(bvh->nos == NULL)
+    {
+        bvh->nos = nos_compactos;
+    }
+
+    return 1;
+}
+
+/**
+ * Libera a memória alocada por uma BVH.
+ *
+ * @param bvh Ponteiro para a BVH a ser liberada.
+ */
+void bvh_liberar(bvh_t *bvh)
+{
+    free(bvh->nos);
+    free(bvh->primitivos);
+    bvh->nos = NULL;
+    bvh->primitivos = NULL;
+    bvh->num_nos = 0;
+    bvh->num_primitivos = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "geometria.h"
+
+/** Número máximo de primitivos guardados numa folha da BVH. */
+#define BVH_MAX_FOLHA 4
+
+/** Profundidade máxima da pilha usada para percorrer a BVH. */
+#define BVH_MAX_PILHA 64
+
+/** 
+ * Constrói uma BVH a partir das caixas envolventes dos primitivos. 
+ * 
+ * A divisão dos nós usa a heurística de área de superfície (SAH) 
+ * calculada em baldes ao longo do eixo de maior extensão dos centróides.
+ * 
+ * @param bvh Ponteiro para a BVH a ser preenchida.
+ * @param caixas Array com a caixa envolvente de cada primitivo.
+ * @param num_primitivos Número de primitivos (tamanho do array de caixas).
+ * @return 1 em caso de sucesso, 0 caso falte memória.
+ */
+int bvh_construir(bvh_t *bvh, caixa_t *caixas, int num_primitivos);
+
+/** 
+ * Libera a memória alocada por uma BVH. 
+ * 
+ * @param bvh Ponteiro para a BVH a ser liberada.
+ */
+void bvh_liberar(bvh_t *bvh);
+
+/** 
+ * Expande uma caixa para que ela contenha um ponto. 
+ * 
+ * @param caixa Ponteiro para a caixa a ser expandida.
+ * @param ponto Ponteiro para o ponto a ser incluído.
+ */
+void caixa_expandir(caixa_t *caixa, ponto_t *ponto);
+
+/** 
+ * Expande uma caixa para que ela contenha outra caixa. 
+ * 
+ * @param caixa Ponteiro para a caixa a ser expandida.
+ * @param outra Ponteiro para a caixa a ser incluída.
+ */
+void caixa_unir(caixa_t *caixa, caixa_t *outra);
+
+/** 
+ * Retorna uma caixa vazia (min em +INFINITO e max em -INFINITO). 
+ * 
+ * @return Caixa vazia, pronta para ser expandida.
+ */
+caixa_t caixa_vazia(void);
+
+#endif // BVH_H
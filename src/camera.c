@@ -0,0 +1,258 @@
+#include "camera.h"
+#include <math.h>
+#include <string.h>
+
+/**
+ * Multiplica duas matrizes 4x4 guardadas por colunas (r = a * b).
+ */
+static void multiplicar_matrizes(double a[16], double b[16], double r[16])
+{
+    int i, j, k;
+
+    for(i = 0; i < 4; i++)
+    {
+        for(j = 0; j < 4; j++)
+        {
+            r[j * 4 + i] = 0.0;
+            for(k = 0; k < 4; k++)
+            {
+                r[j * 4 + i] += a[k * 4 + i] * b[j * 4 + k];
+            }
+        }
+    }
+}
+
+/**
+ * Inverte uma matriz 4x4 por eliminação de Gauss-Jordan com pivoteamento
+ * parcial. Retorna 0 se a matriz for singular.
+ */
+static int inverter_matriz(double m[16], double inversa[16])
+{
+    int i, j, k, pivo;
+    double a[4][8], temp, fator;
+
+    for(i = 0; i < 4; i++)
+    {
+        for(j = 0; j < 4; j++)
+        {
+            a[i][j] = m[j * 4 + i];
+            a[i][j + 4] = (i == j);
+        }
+    }
+
+    for(k = 0; k < 4; k++)
+    {
+        pivo = k;
+        for(i = k + 1; i < 4; i++)
+        {
+            if(fabs(a[i][k]) > fabs(a[pivo][k]))
+            {
+                pivo = i;
+            }
+        }
+
+        if(fabs(a[pivo][k]) < 1.0e-15)
+        {
+            return 0;
+        }
+
+        for(j = 0; j < 8; j++)
+        {
+            temp = a[k][j];
+            a[k][j] = a[pivo][j];
+            a[pivo][j] = temp;
+        }
+
+        fator = 1.0 / a[k][k];
+        for(j = 0; j < 8; j++)
+        {
+            a[k][j] *= fator;
+        }
+
+        for(i = 0; i < 4; i++)
+        {
+            if(i != k && a[i][k] != 0.0)
+            {
+                fator = a[i][k];
+                for(j = 0; j < 8; j++)
+                {
+                    a[i][j] -= fator * a[k][j];
+                }
+            }
+        }
+    }
+
+    for(i = 0; i < 4; i++)
+    {
+        for(j = 0; j < 4; j++)
+        {
+            inversa[j * 4 + i] = a[i][j + 4];
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Leva um ponto da janela (com profundidade z entre 0 e 1) para o mundo
+ * (como o gluUnProject).
+ *
+ * @param camera Ponteiro para a câmera.
+ * @param x Coordenada x na janela (em píxels, pode ser fracionária).
+ * @param y Coordenada y na janela (em píxels, pode ser fracionária).
+ * @param z Profundidade na janela (0 no plano near e 1 no far).
+ * @return Ponto no mundo.
+ */
+ponto_t camera_desprojetar(camera_t *camera, double x, double y, double z)
+{
+    int i;
+    double entrada[4], saida[4];
+    ponto_t p;
+
+    entrada[0] = 2.0 * (x - camera->viewport[0]) / camera->viewport[2] - 1.0;
+    entrada[1] = 2.0 * (y - camera->viewport[1]) / camera->viewport[3] - 1.0;
+    entrada[2] = 2.0 * z - 1.0;
+    entrada[3] = 1.0;
+
+    for(i = 0; i < 4; i++)
+    {
+        saida[i] = camera->inversa[i] * entrada[0] +
+            camera->inversa[4 + i] * entrada[1] +
+            camera->inversa[8 + i] * entrada[2] +
+            camera->inversa[12 + i] * entrada[3];
+    }
+
+    p.x = saida[0] / saida[3];
+    p.y = saida[1] / saida[3];
+    p.z = saida[2] / saida[3];
+    return p;
+}
+
+/**
+ * Define uma câmera a partir das matrizes do OpenGL.
+ *
+ * @param camera Ponteiro para a câmera a ser preenchida.
+ * @param model_view Matriz modelview (por colunas, como no OpenGL).
+ * @param projection Matriz de projeção (por colunas, como no OpenGL).
+ * @param viewport Viewport (x, y, largura e altura).
+ * @return 1 em caso de sucesso, 0 se as matrizes não forem inversíveis.
+ */
+int camera_definir(camera_t *camera, double model_view[16],
+    double projection[16], int viewport[4])
+{
+    multiplicar_matrizes(projection, model_view, camera->matriz);
+    if(!inverter_matriz(camera->matriz, camera->inversa))
+    {
+        return 0;
+    }
+
+    memcpy(camera->viewport, viewport, 4 * sizeof(int));
+    return 1;
+}
+
+/**
+ * Gera o raio que passa por uma posição da janela: parte do plano near
+ * e tem a direção normalizada até o plano far.
+ *
+ * @param camera Ponteiro para a câmera.
+ * @param x Coordenada x na janela (em píxels, pode ser fracionária).
+ * @param y Coordenada y na janela (em píxels, pode ser fracionária).
+ * @param origem Ponteiro para a origem do raio (é modificada na função).
+ * @param direcao Ponteiro para a direção do raio (é modificada na função).
+ */
+void camera_raio(camera_t *camera, double x, double y, ponto_t *origem,
+    vetor_t *direcao)
+{
+    ponto_t longe;
+
+    *origem = camera_desprojetar(camera, x, y, 0.0);
+    longe = camera_desprojetar(camera, x, y, 1.0);
+
+    *direcao = sub_v(&longe, origem);
+    *direcao = normalizar(direcao);
+}
+
+/**
+ * Projeta um ponto do mundo na janela (como o gluProject).
+ *
+ * @param camera Ponteiro para a câmera.
+ * @param ponto Ponteiro para o ponto no mundo.
+ * @param x Ponteiro para a coordenada x na janela (é modificada).
+ * @param y Ponteiro para a coordenada y na janela (é modificada).
+ * @param profundidade Ponteiro para a distância do ponto ao olho, ao longo
+ * do eixo de visão (é modificada).
+ * @return 1 se o ponto está na frente da câmera, 0 caso contrário.
+ */
+int camera_projetar(camera_t *camera, ponto_t *ponto, double *x, double *y,
+    double *profundidade)
+{
+    int i;
+    double saida[4];
+
+    for(i = 0; i < 4; i++)
+    {
+        saida[i] = camera->matriz[i] * ponto->x +
+            camera->matriz[4 + i] * ponto->y +
+            camera->matriz[8 + i] * ponto->z +
+            camera->matriz[12 + i];
+    }
+
+    // Na projeção perspectiva, w é a distância ao longo do eixo de visão.
+    if(saida[3] <= 0.0)
+    {
+        return 0;
+    }
+
+    *x = camera->viewport[0] +
+        camera->viewport[2] * (saida[0] / saida[3] + 1.0) / 2.0;
+    *y = camera->viewport[1] +
+        camera->viewport[3] * (saida[1] / saida[3] + 1.0) / 2.0;
+    *profundidade = saida[3];
+    return 1;
+}
+
+/**
+ * Monta o tronco de visão dos raios que passam por um retângulo da
+ * janela.
+ *
+ * @param camera Ponteiro para a câmera.
+ * @param x0 Menor coordenada x do retângulo (em píxels).
+ * @param y0 Menor coordenada y do retângulo (em píxels).
+ * @param x1 Maior coordenada x do retângulo (em píxels).
+ * @param y1 Maior coordenada y do retângulo (em píxels).
+ * @param tronco Ponteiro para o tronco a ser preenchido.
+ */
+void camera_tronco(camera_t *camera, double x0, double y0, double x1,
+    double y1, tronco_t *tronco)
+{
+    int i;
+    double xs[4], ys[4];
+    ponto_t origens[4], centro;
+    vetor_t direcoes[4], lado, dir_centro;
+
+    // Cantos em sentido anti-horário; cada plano passa por dois seguidos.
+    xs[0] = x0; ys[0] = y0;
+    xs[1] = x1; ys[1] = y0;
+    xs[2] = x1; ys[2] = y1;
+    xs[3] = x0; ys[3] = y1;
+    for(i = 0; i < 4; i++)
+    {
+        camera_raio(camera, xs[i], ys[i], &origens[i], &direcoes[i]);
+    }
+    camera_raio(camera, (x0 + x1) / 2.0, (y0 + y1) / 2.0, &centro,
+        &dir_centro);
+
+    for(i = 0; i < 4; i++)
+    {
+        lado = sub_v(&origens[(i + 1) % 4], &origens[i]);
+        tronco->normais[i] = prod_v(&lado, &direcoes[i]);
+        tronco->distancias[i] = -prod_e(&tronco->normais[i], &origens[i]);
+
+        // A normal aponta para dentro (para o raio do centro).
+        if(prod_e(&tronco->normais[i], &centro) + tronco->distancias[i] < 0)
+        {
+            tronco->normais[i] = neg_v(&tronco->normais[i]);
+            tronco->distancias[i] = -tronco->distancias[i];
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "geometria.h"
+
+/**
+ * Estrutura para armazenar uma câmera capturada das matrizes do OpenGL.
+ *
+ * Guarda projeção * modelview e a sua inversa, de modo que os raios podem
+ * ser gerados (e os pontos projetados) em qualquer thread, sem depender do
+ * contexto do OpenGL, com o mesmo resultado do gluUnProject.
+ */
+typedef struct {
+    double matriz[16]; // Projeção * modelview (por colunas).
+    double inversa[16]; // Inversa de projeção * modelview (por colunas).
+    int viewport[4]; // x, y, largura e altura.
+} camera_t;
+
+/** 
+ * Estrutura para armazenar um tronco de visão formado por quatro planos
+ * (esquerdo, direito, de baixo e de cima). Um ponto p está dentro do
+ * tronco se prod_e(normais[i], p) + distancias[i] >= 0 para todo i.
+ */
+typedef struct {
+    vetor_t normais[4];
+    real_t distancias[4];
+} tronco_t;
+
+/**
+ * Define uma câmera a partir das matrizes do OpenGL.
+ *
+ * @param camera Ponteiro para a câmera a ser preenchida.
+ * @param model_view Matriz modelview (por colunas, como no OpenGL).
+ * @param projection Matriz de projeção (por colunas, como no OpenGL).
+ * @param viewport Viewport (x, y, largura e altura).
+ * @return 1 em caso de sucesso, 0 se as matrizes não forem inversíveis.
+ */
+int camera_definir(camera_t *camera, double model_view[16],
+    double projection[16], int viewport[4]);
+
+/**
+ * Leva um ponto da janela (com profundidade z entre 0 e 1) para o mundo
+ * (como o gluUnProject).
+ *
+ * @param camera Ponteiro para a câmera.
+ * @param x Coordenada x na janela (em píxels, pode ser fracionária).
+ * @param y Coordenada y na janela (em píxels, pode ser fracionária).
+ * @param z Profundidade na janela (0 no plano near e 1 no far).
+ * @return Ponto no mundo.
+ */
+ponto_t camera_desprojetar(camera_t *camera, double x, double y, double z);
+
+/**
+ * Gera o raio que passa por uma posição da janela: parte do plano near
+ * e tem a direção normalizada até o plano far.
+ *
+ * @param camera Ponteiro para a câmera.
+ * @param x Coordenada x na janela (em píxels, pode ser fracionária).
+ * @param y Coordenada y na janela (em píxels, pode ser fracionária).
+ * @param origem Ponteiro para a origem do raio (é modificada na função).
+ * @param direcao Ponteiro para a direção do raio (é modificada na função).
+ */
+void camera_raio(camera_t *camera, double x, double y, ponto_t *origem,
+    vetor_t *direcao);
+
+/**
+ * Projeta um ponto do mundo na janela (como o gluProject).
+ *
+ * @param camera Ponteiro para a câmera.
+ * @param ponto Ponteiro para o ponto no mundo.
+ * @param x Ponteiro para a coordenada x na janela (é modificada).
+ * @param y Ponteiro para a coordenada y na janela (é modificada).
+ * @param profundidade Ponteiro para a distância do ponto ao olho, ao longo
+ * do eixo de visão (é modificada).
+ * @return 1 se o ponto está na frente da câmera, 0 caso contrário.
+ */
+int camera_projetar(camera_t *camera, ponto_t *ponto, double *x, double *y,
+    double *profundidade);
+
+/**
+ * Monta o tronco de visão dos raios que passam por um retângulo da
+ * janela.
+ *
+ * @param camera Ponteiro para a câmera.
+ * @param x0 Menor coordenada x do retângulo (em píxels).
+ * @param y0 Menor coordenada y do retângulo (em píxels).
+ * @param x1 Maior coordenada x do retângulo (em píxels).
+ * @param y1 Maior coordenada y do retângulo (em píxels).
+ * @param tronco Ponteiro para o tronco a ser preenchido.
+ */
+void camera_tronco(camera_t *camera, double x0, double y0, double x1,
+    double y1, tronco_t *tronco);
+
+#endif // CAMERA_H
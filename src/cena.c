@@ -0,0 +1,1048 @@
+#include "cena.h"
+#include "bvh.h"
+#include "malha.h"
+#include "luzes.h"
+#include "onda.h"
+#include <math.h>
+#include <stdlib.h>
+
+/**
+ * Prepara a cena para o raytracing: detecta a forma dos cubos, normaliza
+ * as normais dos planos, separa os objetos infinitos (planos) e constrói a
+ * BVH de objetos (nível de cima) sobre os demais.
+ *
+ * @param cena Ponteiro para a cena a ser preenchida.
+ * @param objetos Array com os objetos colocados no espaço.
+ * @param num_objetos Número de objetos do array.
+ * @return 1 em caso de sucesso, 0 caso falte memória.
+ */
+int cena_construir(cena_t *cena, objeto_t *objetos, int num_objetos)
+{
+    int i, num_limitados, resultado;
+    caixa_t *caixas;
+    int *limitados;
+
+    cena->objetos = objetos;
+    cena->num_objetos = num_objetos;
+    cena->num_ilimitados = 0;
+    arvore_luzes_construir(&cena->luzes, NULL, 0);
+    cena->irradiancia = NULL;
+    cena->fotons = NULL;
+    cena->ilimitados = malloc((num_objetos + 1) * sizeof(int));
+    caixas = malloc((num_objetos + 1) * sizeof(caixa_t));
+    limitados = malloc((num_objetos + 1) * sizeof(int));
+
+    if(cena->ilimitados == NULL || caixas == NULL || limitados == NULL)
+    {
+        free(caixas);
+        free(limitados);
+        free(cena->ilimitados);
+        cena->ilimitados = NULL;
+        return 0;
+    }
+
+    num_limitados = 0;
+    for(i = 0; i < num_objetos; i++)
+    {
+        // Cubos alinhados aos eixos ou orientados dispensam os triângulos.
+        if(objetos[i].tipo == CUBO)
+        {
+            cubo_preparar(objetos[i].cubo);
+        }
+        else if(objetos[i].tipo == PLANO)
+        {
+            objetos[i].plano->normal = normalizar(&objetos[i].plano->normal);
+        }
+        
+        if(caixa_objeto(&objetos[i], &caixas[num_limitados]))
+        {
+            limitados[num_limitados++] = i;
+        }
+        else
+        {
+            cena->ilimitados[cena->num_ilimitados++] = i;
+        }
+    }
+
+    resultado = bvh_construir(&cena->bvh, caixas, num_limitados);
+
+    // Traduz os índices das folhas para índices do array de objetos.
+    for(i = 0; i < cena->bvh.num_primitivos; i++)
+    {
+        cena->bvh.primitivos[i] = limitados[cena->bvh.primitivos[i]];
+    }
+
+    free(caixas);
+    free(limitados);
+    return resultado;
+}
+
+/**
+ * Libera a memória alocada pela cena (os objetos não são liberados).
+ *
+ * @param cena Ponteiro para a cena.
+ */
+void cena_liberar(cena_t *cena)
+{
+    bvh_liberar(&cena->bvh);
+    free(cena->ilimitados);
+    cena->ilimitados = NULL;
+    cena->num_ilimitados = 0;
+    arvore_luzes_liberar(&cena->luzes);
+}
+
+/**
+ * Define as luzes pontuais da cena (além da luz local), construindo a
+ * árvore de luzes usada para escolher as que iluminam cada ponto. As
+ * luzes anteriores são descartadas.
+ *
+ * @param cena Ponteiro para a cena (já construída).
+ * @param luzes Array de luzes (é copiado).
+ * @param num_luzes Número de luzes do array (0 tira todas).
+ * @return 1 em caso de sucesso, 0 caso falte memória (a cena fica sem
+ * luzes).
+ */
+int cena_definir_luzes(cena_t *cena, luz_t *luzes, int num_luzes)
+{
+    arvore_luzes_liberar(&cena->luzes);
+    return arvore_luzes_construir(&cena->luzes, luzes, num_luzes);
+}
+
+/**
+ * Calcula o inverso de cada componente da direção do raio (usado no
+ * teste das caixas da BVH).
+ */
+static vetor_t inverter_direcao(vetor_t *direcao_raio)
+{
+    vetor_t inv;
+    inv.x = 1.0 / direcao_raio->x;
+    inv.y = 1.0 / direcao_raio->y;
+    inv.z = 1.0 / direcao_raio->z;
+    return inv;
+}
+
+/**
+ * Encontra o objeto mais perto da origem do raio.
+ *
+ * @param cena Ponteiro para a cena.
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param t0 Ponteiro para a distância até o objeto mais perto (é
+ * modificada na função).
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @return Ponteiro para o objeto mais perto ou 0 caso nenhum seja tocado.
+ */
+objeto_t *intersecao_cena(cena_t *cena, ponto_t *origem_raio,
+    vetor_t *direcao_raio, real_t *t0, vetor_t *normal)
+{
+    int i, k, topo, indice, esquerda, direita;
+    int pilha[BVH_MAX_PILHA];
+    real_t tperto, t0_temp, t_esq, t_dir;
+    int acerta_esq, acerta_dir;
+    vetor_t normal_temp, inv_direcao;
+    objeto_t *objeto_perto;
+    no_bvh_t *no;
+
+    objeto_perto = 0;
+    tperto = INFINITO;
+
+    // Os objetos infinitos são testados um a um.
+    for(i = 0; i < cena->num_ilimitados; i++)
+    {
+        indice = cena->ilimitados[i];
+        if(intersecao_objeto(origem_raio, direcao_raio, &cena->objetos[indice],
+            &t0_temp, &normal_temp) && t0_temp < tperto)
+        {
+            tperto = t0_temp;
+            objeto_perto = &cena->objetos[indice];
+            *normal = normal_temp;
+        }
+    }
+
+    if(cena->bvh.num_nos == 0)
+    {
+        *t0 = tperto;
+        return objeto_perto;
+    }
+
+    // Percorre a BVH de objetos, visitando primeiro o filho mais perto.
+    inv_direcao = inverter_direcao(direcao_raio);
+    topo = 0;
+
+    if(intersecao_caixa(origem_raio, &inv_direcao, &cena->bvh.nos[0].caixa,
+        tperto, &t0_temp))
+    {
+        pilha[topo++] = 0;
+    }
+
+    while(topo > 0)
+    {
+        no = &cena->bvh.nos[pilha[--topo]];
+
+        if(no->quantidade > 0)
+        {
+            for(k = no->inicio; k < no->inicio + no->quantidade; k++)
+            {
+                indice = cena->bvh.primitivos[k];
+                if(intersecao_objeto(origem_raio, direcao_raio,
+                    &cena->objetos[indice], &t0_temp, &normal_temp) &&
+                    t0_temp < tperto)
+                {
+                    tperto = t0_temp;
+                    objeto_perto = &cena->objetos[indice];
+                    *normal = normal_temp;
+                }
+            }
+            continue;
+        }
+
+        esquerda = (int) (no - cena->bvh.nos) + 1;
+        direita = no->inicio;
+        acerta_esq = intersecao_caixa(origem_raio, &inv_direcao,
+            &cena->bvh.nos[esquerda].caixa, tperto, &t_esq);
+        acerta_dir = intersecao_caixa(origem_raio, &inv_direcao,
+            &cena->bvh.nos[direita].caixa, tperto, &t_dir);
+
+        if(acerta_esq && acerta_dir)
+        {
+            // Empilha o mais longe primeiro para visitar o mais perto antes.
+            if(t_esq < t_dir)
+            {
+                pilha[topo++] = direita;
+                pilha[topo++] = esquerda;
+            }
+            else
+            {
+                pilha[topo++] = esquerda;
+                pilha[topo++] = direita;
+            }
+        }
+        else if(acerta_esq)
+        {
+            pilha[topo++] = esquerda;
+        }
+        else if(acerta_dir)
+        {
+            pilha[topo++] = direita;
+        }
+    }
+
+    *t0 = tperto;
+    return objeto_perto;
+}
+
+/**
+ * Verifica se algum objeto bloqueia o raio (usado nas sombras). Para
+ * no primeiro objeto encontrado.
+ *
+ * @param cena Ponteiro para a cena.
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param tmax Distância máxima a ser considerada.
+ * @param ignorar Objeto que não deve ser considerado (o próprio objeto
+ * de onde o raio parte).
+ * @return 1 se algum objeto bloqueia o raio, 0 caso contrário.
+ */
+int oclusao_cena(cena_t *cena, ponto_t *origem_raio, vetor_t *direcao_raio,
+    real_t tmax, objeto_t *ignorar)
+{
+    int i, k, topo, indice;
+    int pilha[BVH_MAX_PILHA];
+    real_t t0_temp;
+    vetor_t normal_temp, inv_direcao;
+    objeto_t *objeto;
+    no_bvh_t *no;
+
+    for(i = 0; i < cena->num_ilimitados; i++)
+    {
+        objeto = &cena->objetos[cena->ilimitados[i]];
+        if(objeto != ignorar && intersecao_objeto(origem_raio, direcao_raio,
+            objeto, &t0_temp, &normal_temp) && t0_temp < tmax)
+        {
+            return 1;
+        }
+    }
+
+    if(cena->bvh.num_nos == 0)
+    {
+        return 0;
+    }
+
+    inv_direcao = inverter_direcao(direcao_raio);
+    topo = 0;
+    pilha[topo++] = 0;
+
+    while(topo > 0)
+    {
+        indice = pilha[--topo];
+        no = &cena->bvh.nos[indice];
+
+        if(!intersecao_caixa(origem_raio, &inv_direcao, &no->caixa, tmax,
+            &t0_temp))
+        {
+            continue;
+        }
+
+        if(no->quantidade > 0)
+        {
+            for(k = no->inicio; k < no->inicio + no->quantidade; k++)
+            {
+                objeto = &cena->objetos[cena->bvh.primitivos[k]];
+                if(objeto != ignorar && intersecao_objeto(origem_raio,
+                    direcao_raio, objeto, &t0_temp, &normal_temp) &&
+                    t0_temp < tmax)
+                {
+                    return 1;
+                }
+            }
+            continue;
+        }
+
+        pilha[topo++] = no->inicio;
+        pilha[topo++] = indice + 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Cone que contém os segmentos de um ponto (o ápice) a uma esfera que
+ * envolve a luz.
+ */
+typedef struct {
+    ponto_t apice;
+    vetor_t eixo; // Direção (normalizada) do centro da luz.
+    vetor_t u, v; // Base do plano perpendicular ao eixo.
+    real_t distancia; // Do ápice ao centro da luz.
+    real_t raio_luz;
+    real_t seno, cosseno, tangente; // Da metade da abertura.
+} cone_sombra_t;
+
+/**
+ * Verifica se uma esfera pode tocar o cone de sombra: ela fica fora se
+ * estiver toda além da luz ou se a sua distância à borda do cone passar
+ * do seu raio.
+ */
+static int esfera_no_cone(cone_sombra_t *cone, ponto_t *centro, real_t raio)
+{
+    real_t distancia, projecao, cosseno, seno, cos_fora, sen_fora;
+    vetor_t v;
+
+    v = sub_v(centro, &cone->apice);
+    distancia = modulo(&v);
+    if(distancia <= raio)
+    {
+        return 1;
+    }
+
+    projecao = prod_e(&v, &cone->eixo);
+    if(projecao - raio > cone->distancia + cone->raio_luz)
+    {
+        return 0;
+    }
+
+    cosseno = projecao / distancia;
+    if(cosseno >= cone->cosseno)
+    {
+        return 1;
+    }
+
+    // Ângulo entre o centro da esfera e a borda do cone; acima de 90
+    // graus, o ponto do cone mais perto dela é o ápice.
+    seno = sqrt(max(0.0, 1.0 - cosseno * cosseno));
+    cos_fora = cosseno * cone->cosseno + seno * cone->seno;
+    sen_fora = seno * cone->cosseno - cosseno * cone->seno;
+    return cos_fora > 0.0 && distancia * sen_fora < raio;
+}
+
+/**
+ * Verifica se uma esfera cobre o cone de sombra: ela precisa estar toda
+ * entre o ápice e a luz, e o seu raio angular, visto do ápice, precisa
+ * vencer o ângulo entre ela e o eixo mais a metade da abertura.
+ */
+static int esfera_cobre_cone(cone_sombra_t *cone, ponto_t *centro,
+    real_t raio)
+{
+    real_t distancia, cosseno, seno, cos_raio;
+    vetor_t v;
+
+    v = sub_v(centro, &cone->apice);
+    distancia = modulo(&v);
+    if(distancia - raio <= EPSILON ||
+        distancia >= cone->distancia - cone->raio_luz)
+    {
+        return 0;
+    }
+
+    cosseno = prod_e(&v, &cone->eixo) / distancia;
+    seno = sqrt(max(0.0, 1.0 - cosseno * cosseno));
+    cos_raio = sqrt(1.0 - (raio / distancia) * (raio / distancia));
+    return cosseno * cone->cosseno - seno * cone->seno >= cos_raio;
+}
+
+/**
+ * Distância da origem ao segmento de a a b, no plano.
+ */
+static real_t distancia_segmento(real_t ax, real_t ay, real_t bx, real_t by)
+{
+    real_t dx, dy, comprimento2, t;
+
+    dx = bx - ax;
+    dy = by - ay;
+    comprimento2 = dx * dx + dy * dy;
+    t = comprimento2 > 0.0 ? -(ax * dx + ay * dy) / comprimento2 : 0.0;
+    t = max(0.0, min(1.0, t));
+    return sqrt((ax + t * dx) * (ax + t * dx) + (ay + t * dy) * (ay + t * dy));
+}
+
+/**
+ * Compara o fecho convexo de pontos com o cone de sombra, projetando-os
+ * no plano perpendicular ao eixo a uma unidade do ápice, onde o cone vira
+ * o círculo de raio cone->tangente em volta da origem: o fecho não toca o
+ * cone se a sua projeção fica fora do círculo, e, sendo ele o próprio
+ * objeto, cobre o cone se a projeção contém o círculo e todos os pontos
+ * estão mais perto do ápice que a luz. Pontos atrás do ápice (ou quase)
+ * não têm projeção, e o resultado é incerto.
+ *
+ * @return SOMBRA_LIVRE, SOMBRA_TOTAL ou SOMBRA_INCERTA.
+ */
+static int fecho_no_cone(cone_sombra_t *cone, ponto_t *vertices, int n,
+    int convexo)
+{
+    int i, k, num_fecho, inicio, dentro;
+    real_t x[8], y[8], fecho_x[17], fecho_y[17];
+    real_t profundidade, mais_perto, mais_longe, temp, distancia, menor;
+    real_t dx, dy, aresta;
+    vetor_t w;
+
+    mais_perto = INFINITO;
+    mais_longe = 0.0;
+    for(i = 0; i < n; i++)
+    {
+        w = sub_v(&vertices[i], &cone->apice);
+        profundidade = prod_e(&w, &cone->eixo);
+        if(profundidade <= EPSILON)
+        {
+            return SOMBRA_INCERTA;
+        }
+        mais_perto = min(mais_perto, profundidade);
+        mais_longe = max(mais_longe, modulo(&w));
+        x[i] = prod_e(&w, &cone->u) / profundidade;
+        y[i] = prod_e(&w, &cone->v) / profundidade;
+    }
+    if(mais_perto > cone->distancia + cone->raio_luz)
+    {
+        return SOMBRA_LIVRE;
+    }
+
+    // Ordena os pontos por x (e y) para a cadeia monótona de Andrew.
+    for(i = 1; i < n; i++)
+    {
+        for(k = i; k > 0 && (x[k] < x[k - 1] ||
+            (x[k] == x[k - 1] && y[k] < y[k - 1])); k--)
+        {
+            temp = x[k];
+            x[k] = x[k - 1];
+            x[k - 1] = temp;
+            temp = y[k];
+            y[k] = y[k - 1];
+            y[k - 1] = temp;
+        }
+    }
+
+    // Fecho no sentido anti-horário: a parte de baixo e depois a de cima.
+    num_fecho = 0;
+    for(inicio = 0, i = 0; i < 2 * n - 1; i++)
+    {
+        k = i < n ? i : 2 * n - 2 - i;
+        if(i == n)
+        {
+            inicio = num_fecho - 1;
+        }
+        while(num_fecho >= inicio + 2 &&
+            (fecho_x[num_fecho - 1] - fecho_x[num_fecho - 2]) *
+            (y[k] - fecho_y[num_fecho - 2]) -
+            (fecho_y[num_fecho - 1] - fecho_y[num_fecho - 2]) *
+            (x[k] - fecho_x[num_fecho - 2]) <= 0.0)
+        {
+            num_fecho--;
+        }
+        fecho_x[num_fecho] = x[k];
+        fecho_y[num_fecho++] = y[k];
+    }
+    num_fecho--; // O último ponto repete o primeiro.
+
+    // Dentro do fecho, a distância da origem à borda é a menor distância
+    // às retas das arestas; fora, a menor distância às arestas.
+    dentro = num_fecho >= 3;
+    menor = INFINITO;
+    for(i = 0; i < num_fecho; i++)
+    {
+        k = (i + 1) % num_fecho;
+        dx = fecho_x[k] - fecho_x[i];
+        dy = fecho_y[k] - fecho_y[i];
+        aresta = sqrt(dx * dx + dy * dy);
+        distancia = aresta > 0.0 ?
+            (dx * -fecho_y[i] - dy * -fecho_x[i]) / aresta : -1.0;
+        if(distancia <= 0.0)
+        {
+            dentro = 0;
+        }
+        menor = min(menor, distancia);
+    }
+
+    if(dentro)
+    {
+        return convexo && menor >= cone->tangente &&
+            mais_longe < cone->distancia - cone->raio_luz ?
+            SOMBRA_TOTAL : SOMBRA_INCERTA;
+    }
+
+    menor = INFINITO;
+    for(i = 0; i < max(num_fecho, 1); i++)
+    {
+        k = (i + 1) % max(num_fecho, 1);
+        menor = min(menor, distancia_segmento(fecho_x[i], fecho_y[i],
+            fecho_x[k], fecho_y[k]));
+    }
+    return menor > cone->tangente ? SOMBRA_LIVRE : SOMBRA_INCERTA;
+}
+
+/**
+ * Classifica, sem traçar raios, a sombra que os objetos da cena fazem num
+ * ponto iluminado por uma luz contida numa esfera. Os segmentos do ponto
+ * à luz ficam dentro de um cone: um objeto que não toca o cone (a sua
+ * esfera envolvente ou, projetado a partir do ponto, o fecho dos seus
+ * vértices) não bloqueia nenhum deles, e uma esfera ou um poliedro
+ * convexo que cobre o cone entre o ponto e a luz bloqueia todos. Um
+ * plano bloqueia todos se a esfera da luz está toda do outro lado dele,
+ * e nenhum se ela está toda do lado do ponto. Os testes são
+ * conservadores: na dúvida, o ponto é dado como incerto.
+ *
+ * @param cena Ponteiro para a cena.
+ * @param ponto Ponteiro para o ponto iluminado.
+ * @param centro_luz Ponteiro para o centro da esfera da luz.
+ * @param raio_luz Raio da esfera da luz.
+ * @param ignorar Objeto que não deve ser considerado (o próprio objeto
+ * do ponto).
+ * @return SOMBRA_LIVRE, SOMBRA_TOTAL ou SOMBRA_INCERTA.
+ */
+int sombra_cena(cena_t *cena, ponto_t *ponto, ponto_t *centro_luz,
+    real_t raio_luz, objeto_t *ignorar)
+{
+    int i, k, n, topo, indice, resultado, sombra, convexo;
+    int pilha[BVH_MAX_PILHA];
+    real_t raio, lado_ponto, lado_luz;
+    ponto_t centro, vertices[8];
+    vetor_t normal, diferenca;
+    cone_sombra_t cone;
+    objeto_t *objeto;
+    no_bvh_t *no;
+
+    cone.apice = *ponto;
+    cone.eixo = sub_v(centro_luz, ponto);
+    cone.distancia = modulo(&cone.eixo);
+    if(cone.distancia <= raio_luz)
+    {
+        return SOMBRA_INCERTA;
+    }
+    cone.eixo = mult_e(&cone.eixo, 1.0 / cone.distancia);
+    cone.raio_luz = raio_luz;
+    cone.seno = raio_luz / cone.distancia;
+    cone.cosseno = sqrt(1.0 - cone.seno * cone.seno);
+    cone.tangente = cone.seno / cone.cosseno;
+    normal.x = fabs(cone.eixo.x) < 0.9 ? 1.0 : 0.0;
+    normal.y = 1.0 - normal.x;
+    normal.z = 0.0;
+    cone.u = prod_v(&cone.eixo, &normal);
+    cone.u = normalizar(&cone.u);
+    cone.v = prod_v(&cone.eixo, &cone.u);
+
+    resultado = SOMBRA_LIVRE;
+    for(i = 0; i < cena->num_ilimitados; i++)
+    {
+        objeto = &cena->objetos[cena->ilimitados[i]];
+        if(objeto == ignorar)
+        {
+            continue;
+        }
+        if(objeto->tipo != PLANO)
+        {
+            resultado = SOMBRA_INCERTA;
+            continue;
+        }
+
+        diferenca = sub_v(ponto, &objeto->plano->ponto);
+        lado_ponto = prod_e(&diferenca, &objeto->plano->normal);
+        diferenca = sub_v(centro_luz, &objeto->plano->ponto);
+        lado_luz = prod_e(&diferenca, &objeto->plano->normal);
+        if(fabs(lado_luz) <= raio_luz || fabs(lado_ponto) <= EPSILON)
+        {
+            resultado = SOMBRA_INCERTA;
+        }
+        else if((lado_ponto > 0.0) != (lado_luz > 0.0))
+        {
+            return SOMBRA_TOTAL;
+        }
+    }
+
+    if(cena->bvh.num_nos == 0)
+    {
+        return resultado;
+    }
+
+    topo = 0;
+    pilha[topo++] = 0;
+    while(topo > 0)
+    {
+        indice = pilha[--topo];
+        no = &cena->bvh.nos[indice];
+
+        diferenca = sub_v(&no->caixa.max, &no->caixa.min);
+        centro.x = 0.5 * (no->caixa.min.x + no->caixa.max.x);
+        centro.y = 0.5 * (no->caixa.min.y + no->caixa.max.y);
+        centro.z = 0.5 * (no->caixa.min.z + no->caixa.max.z);
+        if(!esfera_no_cone(&cone, &centro, 0.5 * modulo(&diferenca)))
+        {
+            continue;
+        }
+
+        if(no->quantidade > 0)
+        {
+            for(k = no->inicio; k < no->inicio + no->quantidade; k++)
+            {
+                objeto = &cena->objetos[cena->bvh.primitivos[k]];
+                if(objeto == ignorar ||
+                    !esfera_envolvente(objeto, &centro, &raio) ||
+                    !esfera_no_cone(&cone, &centro, raio))
+                {
+                    continue;
+                }
+                if(objeto->tipo == ESFERA)
+                {
+                    sombra = esfera_cobre_cone(&cone, &centro, raio) ?
+                        SOMBRA_TOTAL : SOMBRA_INCERTA;
+                }
+                else
+                {
+                    n = vertices_objeto(objeto, vertices, &convexo);
+                    sombra = n > 0 ? fecho_no_cone(&cone, vertices, n,
+                        convexo) : SOMBRA_INCERTA;
+                }
+                if(sombra == SOMBRA_TOTAL)
+                {
+                    return SOMBRA_TOTAL;
+                }
+                if(sombra == SOMBRA_INCERTA)
+                {
+                    resultado = SOMBRA_INCERTA;
+                }
+            }
+            continue;
+        }
+
+        pilha[topo++] = no->inicio;
+        pilha[topo++] = indice + 1;
+    }
+
+    return resultado;
+}
+
+/**
+ * Verifica se uma caixa pode tocar um tronco de visão: ela só fica fora
+ * se o seu canto mais à frente de algum dos planos estiver atrás dele.
+ */
+static int caixa_no_tronco(caixa_t *caixa, tronco_t *tronco)
+{
+    int i;
+    vetor_t *n;
+    ponto_t p;
+
+    for(i = 0; i < 4; i++)
+    {
+        n = &tronco->normais[i];
+        p.x = n->x >= 0 ? caixa->max.x : caixa->min.x;
+        p.y = n->y >= 0 ? caixa->max.y : caixa->min.y;
+        p.z = n->z >= 0 ? caixa->max.z : caixa->min.z;
+
+        if(prod_e(n, &p) + tronco->distancias[i] < 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Adiciona um raio de sombra ao pacote.
+ *
+ * @param pacote Ponteiro para o pacote.
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param ignorar Objeto que não deve ser considerado (o próprio objeto
+ * de onde o raio parte).
+ * @return Posição do raio no pacote ou -1 se o pacote estiver cheio.
+ */
+int pacote_sombra_adicionar(pacote_sombra_t *pacote, ponto_t *origem_raio,
+    vetor_t *direcao_raio, objeto_t *ignorar)
+{
+    int k;
+    vetor_t inv_direcao;
+
+    if(pacote->num_raios >= PACOTE_MAX_RAIOS)
+    {
+        return -1;
+    }
+
+    k = pacote->num_raios++;
+    inv_direcao = inverter_direcao(direcao_raio);
+    pacote->origem_x[k] = origem_raio->x;
+    pacote->origem_y[k] = origem_raio->y;
+    pacote->origem_z[k] = origem_raio->z;
+    pacote->direcao_x[k] = direcao_raio->x;
+    pacote->direcao_y[k] = direcao_raio->y;
+    pacote->direcao_z[k] = direcao_raio->z;
+    pacote->inv_x[k] = inv_direcao.x;
+    pacote->inv_y[k] = inv_direcao.y;
+    pacote->inv_z[k] = inv_direcao.z;
+    pacote->ignorar[k] = ignorar;
+    pacote->ocluido[k] = 0;
+    return k;
+}
+
+/**
+ * Testa um raio do pacote contra um objeto e o marca se for bloqueado.
+ *
+ * @return 1 se o raio foi bloqueado pelo objeto, 0 caso contrário.
+ */
+static int ocluir_raio_pacote(pacote_sombra_t *pacote, int k,
+    objeto_t *objeto, real_t tmax)
+{
+    ponto_t origem;
+    vetor_t direcao, normal_temp;
+    real_t t0_temp;
+
+    if(objeto == pacote->ignorar[k])
+    {
+        return 0;
+    }
+
+    origem.x = pacote->origem_x[k];
+    origem.y = pacote->origem_y[k];
+    origem.z = pacote->origem_z[k];
+    direcao.x = pacote->direcao_x[k];
+    direcao.y = pacote->direcao_y[k];
+    direcao.z = pacote->direcao_z[k];
+
+    if(intersecao_objeto(&origem, &direcao, objeto, &t0_temp, &normal_temp) &&
+        t0_temp < tmax)
+    {
+        pacote->ocluido[k] = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Verifica, para cada raio de um pacote de raios de sombra, se algum
+ * objeto o bloqueia (o resultado fica em pacote->ocluido). A BVH de
+ * objetos é percorrida uma vez só para o pacote inteiro, levando em cada
+ * nó a lista dos raios que tocam a caixa dele: os filhos só testam esses
+ * raios, e os ramos que nenhum raio toca são pulados. Nas folhas, cada
+ * objeto é testado contra todos os raios da lista seguidos, para que os
+ * seus dados continuem no cache, e as malhas (que não sejam compactas)
+ * percorrem a própria BVH com o pacote da mesma forma. O resultado de cada
+ * raio é o mesmo de oclusao_cena().
+ *
+ * @param cena Ponteiro para a cena.
+ * @param pacote Ponteiro para o pacote.
+ * @param tmax Distância máxima a ser considerada.
+ */
+void oclusao_cena_pacote(cena_t *cena, pacote_sombra_t *pacote, real_t tmax)
+{
+    int i, k, m, n, topo, indice, inicio, num, fim, num_candidatos;
+    int restantes;
+    int pilha[BVH_MAX_PILHA], inicios[BVH_MAX_PILHA], quantos[BVH_MAX_PILHA];
+    unsigned char raios[BVH_MAX_PILHA * PACOTE_MAX_RAIOS];
+    unsigned char candidatos[PACOTE_MAX_RAIOS];
+    objeto_t *objeto;
+    no_bvh_t *no;
+
+    n = pacote->num_raios;
+    restantes = n;
+
+    for(i = 0; i < cena->num_ilimitados; i++)
+    {
+        objeto = &cena->objetos[cena->ilimitados[i]];
+        for(k = 0; k < n; k++)
+        {
+            if(!pacote->ocluido[k] &&
+                ocluir_raio_pacote(pacote, k, objeto, tmax))
+            {
+                restantes--;
+            }
+        }
+    }
+
+    if(cena->bvh.num_nos == 0 || restantes == 0)
+    {
+        return;
+    }
+
+    // As listas de raios ficam empilhadas em 'raios': a de um nó é escrita
+    // logo depois da lista do pai, já que as dos ramos terminados não são
+    // mais usadas.
+    num = 0;
+    for(k = 0; k < n; k++)
+    {
+        if(!pacote->ocluido[k])
+        {
+            raios[num++] = k;
+        }
+    }
+
+    topo = 0;
+    pilha[topo] = 0;
+    inicios[topo] = 0;
+    quantos[topo++] = num;
+
+    while(topo > 0 && restantes > 0)
+    {
+        topo--;
+        indice = pilha[topo];
+        no = &cena->bvh.nos[indice];
+        inicio = inicios[topo];
+        fim = inicio + quantos[topo];
+
+        num = 0;
+        for(m = inicio; m < fim; m++)
+        {
+            k = raios[m];
+            if(!pacote->ocluido[k] &&
+                intersecao_caixa_pacote(pacote, k, &no->caixa, tmax))
+            {
+                raios[fim + num++] = k;
+            }
+        }
+        if(num == 0)
+        {
+            continue;
+        }
+
+        if(no->quantidade > 0)
+        {
+            for(i = no->inicio; i < no->inicio + no->quantidade; i++)
+            {
+                objeto = &cena->objetos[cena->bvh.primitivos[i]];
+
+                // As malhas percorrem a própria BVH com o pacote.
+                if(objeto->tipo == MALHA && objeto->malha->compacta == NULL)
+                {
+                    num_candidatos = 0;
+                    for(m = fim; m < fim + num; m++)
+                    {
+                        k = raios[m];
+                        if(!pacote->ocluido[k] && pacote->ignorar[k] != objeto)
+                        {
+                            candidatos[num_candidatos++] = k;
+                        }
+                    }
+                    restantes -= oclusao_malha_pacote(objeto->malha, pacote,
+                        candidatos, num_candidatos, tmax);
+                    continue;
+                }
+
+                for(m = fim; m < fim + num; m++)
+                {
+                    k = raios[m];
+                    if(!pacote->ocluido[k] &&
+                        ocluir_raio_pacote(pacote, k, objeto, tmax))
+                    {
+                        restantes--;
+                    }
+                }
+            }
+            continue;
+        }
+
+        pilha[topo] = no->inicio;
+        inicios[topo] = fim;
+        quantos[topo++] = num;
+        pilha[topo] = indice + 1;
+        inicios[topo] = fim;
+        quantos[topo++] = num;
+    }
+}
+
+/**
+ * Seleciona os objetos da cena cuja caixa envolvente toca um tronco de
+ * visão (os planos são sempre selecionados), percorrendo a BVH de objetos.
+ *
+ * @param cena Ponteiro para a cena.
+ * @param tronco Ponteiro para o tronco de visão.
+ * @param recorte Ponteiro para o recorte a ser preenchido.
+ */
+void cena_recortar(cena_t *cena, tronco_t *tronco, recorte_t *recorte)
+{
+    int i, k, topo, n;
+    int pilha[BVH_MAX_PILHA];
+    no_bvh_t *no;
+
+    n = 0;
+    recorte->num_objetos = -1;
+
+    for(i = 0; i < cena->num_ilimitados; i++)
+    {
+        if(n == RECORTE_MAX_OBJETOS)
+        {
+            return;
+        }
+        recorte->objetos[n++] = cena->ilimitados[i];
+    }
+    recorte->num_ilimitados = n;
+
+    topo = 0;
+    if(cena->bvh.num_nos > 0)
+    {
+        pilha[topo++] = 0;
+    }
+
+    while(topo > 0)
+    {
+        no = &cena->bvh.nos[pilha[--topo]];
+
+        if(!caixa_no_tronco(&no->caixa, tronco))
+        {
+            continue;
+        }
+
+        if(no->quantidade > 0)
+        {
+            for(k = no->inicio; k < no->inicio + no->quantidade; k++)
+            {
+                if(n == RECORTE_MAX_OBJETOS)
+                {
+                    return;
+                }
+                recorte->objetos[n] = cena->bvh.primitivos[k];
+                caixa_objeto(&cena->objetos[recorte->objetos[n]],
+                    &recorte->caixas[n]);
+                n++;
+            }
+            continue;
+        }
+
+        pilha[topo++] = no->inicio;
+        pilha[topo++] = (int) (no - cena->bvh.nos) + 1;
+    }
+
+    recorte->num_objetos = n;
+}
+
+/**
+ * Encontra o objeto mais perto da origem do raio entre os de um recorte.
+ * O raio precisa estar dentro do tronco usado no recorte.
+ *
+ * @param cena Ponteiro para a cena.
+ * @param recorte Ponteiro para o recorte (se num_objetos for -1, a cena
+ * inteira é testada).
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param t0 Ponteiro para a distância até o objeto mais perto (é
+ * modificada na função).
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @return Ponteiro para o objeto mais perto ou 0 caso nenhum seja tocado.
+ */
+objeto_t *intersecao_recorte(cena_t *cena, recorte_t *recorte,
+    ponto_t *origem_raio, vetor_t *direcao_raio, real_t *t0,
+    vetor_t *normal)
+{
+    int i;
+    real_t tperto, t0_temp;
+    vetor_t normal_temp;
+    objeto_t *objeto, *objeto_perto;
+
+    if(recorte->num_objetos < 0)
+    {
+        return intersecao_cena(cena, origem_raio, direcao_raio, t0, normal);
+    }
+
+    objeto_perto = 0;
+    tperto = INFINITO;
+
+    for(i = 0; i < recorte->num_objetos; i++)
+    {
+        objeto = &cena->objetos[recorte->objetos[i]];
+        if(intersecao_objeto(origem_raio, direcao_raio, objeto, &t0_temp,
+            &normal_temp) && t0_temp < tperto)
+        {
+            tperto = t0_temp;
+            objeto_perto = objeto;
+            *normal = normal_temp;
+        }
+    }
+
+    *t0 = tperto;
+    return objeto_perto;
+}
+
+/**
+ * Verifica se algum objeto de um recorte bloqueia o raio antes de tmax.
+ * Para no primeiro objeto encontrado. O raio precisa estar dentro do
+ * tronco usado no recorte.
+ *
+ * @param cena Ponteiro para a cena.
+ * @param recorte Ponteiro para o recorte (se num_objetos for -1, a cena
+ * inteira é testada).
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param tmax Distância máxima a ser considerada.
+ * @param ignorar Objeto que não deve ser considerado.
+ * @return 1 se algum objeto bloqueia o raio, 0 caso contrário.
+ */
+int oclusao_recorte(cena_t *cena, recorte_t *recorte,
+    ponto_t *origem_raio, vetor_t *direcao_raio, real_t tmax,
+    objeto_t *ignorar)
+{
+    int i;
+    real_t t0_temp;
+    vetor_t normal_temp, inv_direcao;
+    objeto_t *objeto;
+
+    if(recorte->num_objetos < 0)
+    {
+        return oclusao_cena(cena, origem_raio, direcao_raio, tmax, ignorar);
+    }
+
+    // A caixa descarta de graça os objetos que ficam depois de tmax.
+    inv_direcao = inverter_direcao(direcao_raio);
+    for(i = 0; i < recorte->num_objetos; i++)
+    {
+        objeto = &cena->objetos[recorte->objetos[i]];
+        if(objeto == ignorar || (i >= recorte->num_ilimitados &&
+            !intersecao_caixa(origem_raio, &inv_direcao, &recorte->caixas[i],
+            tmax, &t0_temp)))
+        {
+            continue;
+        }
+
+        if(intersecao_objeto(origem_raio, direcao_raio, objeto, &t0_temp,
+            &normal_temp) && t0_temp < tmax)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,198 @@
+#ifndef CENA_H
+#define CENA_H
+
+#include "geometria.h"
+#include "camera.h"
+
+/** Sombra de uma luz de área sobre um ponto, segundo sombra_cena(): a luz
+ * chega toda, não chega ou é preciso amostrá-la. */
+#define SOMBRA_LIVRE 0
+#define SOMBRA_TOTAL 1
+#define SOMBRA_INCERTA 2
+
+/** Número máximo de objetos num recorte (acima disso, usa-se a BVH). */
+#define RECORTE_MAX_OBJETOS 64
+
+/** 
+ * Estrutura para armazenar os objetos da cena que podem ser vistos por 
+ * um tronco de visão (índices do array de objetos da cena), primeiro os
+ * ilimitados e depois os limitados, com as suas caixas. Se forem mais
+ * de RECORTE_MAX_OBJETOS, num_objetos é -1 e a BVH inteira é usada.
+ */
+typedef struct {
+    int objetos[RECORTE_MAX_OBJETOS];
+    caixa_t caixas[RECORTE_MAX_OBJETOS]; // Só as dos objetos limitados.
+    int num_ilimitados;
+    int num_objetos;
+} recorte_t;
+
+/** 
+ * Prepara a cena para o raytracing: detecta a forma dos cubos, normaliza
+ * as normais dos planos, separa os objetos infinitos (planos) e constrói a
+ * BVH de objetos (nível de cima) sobre os demais.
+ * 
+ * @param cena Ponteiro para a cena a ser preenchida.
+ * @param objetos Array com os objetos colocados no espaço.
+ * @param num_objetos Número de objetos do array.
+ * @return 1 em caso de sucesso, 0 caso falte memória.
+ */
+int cena_construir(cena_t *cena, objeto_t *objetos, int num_objetos);
+
+/** 
+ * Libera a memória alocada pela cena (os objetos não são liberados).
+ * 
+ * @param cena Ponteiro para a cena.
+ */
+void cena_liberar(cena_t *cena);
+
+/** 
+ * Define as luzes pontuais da cena (além da luz local), construindo a 
+ * árvore de luzes usada para escolher as que iluminam cada ponto. As 
+ * luzes anteriores são descartadas.
+ * 
+ * @param cena Ponteiro para a cena (já construída).
+ * @param luzes Array de luzes (é copiado).
+ * @param num_luzes Número de luzes do array (0 tira todas).
+ * @return 1 em caso de sucesso, 0 caso falte memória (a cena fica sem 
+ * luzes).
+ */
+int cena_definir_luzes(cena_t *cena, luz_t *luzes, int num_luzes);
+
+/** 
+ * Encontra o objeto mais perto da origem do raio.
+ * 
+ * @param cena Ponteiro para a cena.
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param t0 Ponteiro para a distância até o objeto mais perto (é 
+ * modificada na função).
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @return Ponteiro para o objeto mais perto ou 0 caso nenhum seja tocado.
+ */
+objeto_t *intersecao_cena(cena_t *cena, ponto_t *origem_raio, 
+    vetor_t *direcao_raio, real_t *t0, vetor_t *normal);
+
+/** 
+ * Verifica se algum objeto bloqueia o raio (usado nas sombras). Para 
+ * no primeiro objeto encontrado.
+ * 
+ * @param cena Ponteiro para a cena.
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param tmax Distância máxima a ser considerada.
+ * @param ignorar Objeto que não deve ser considerado (o próprio objeto 
+ * de onde o raio parte).
+ * @return 1 se algum objeto bloqueia o raio, 0 caso contrário.
+ */
+int oclusao_cena(cena_t *cena, ponto_t *origem_raio, vetor_t *direcao_raio, 
+    real_t tmax, objeto_t *ignorar);
+
+/**
+ * Classifica, sem traçar raios, a sombra que os objetos da cena fazem num
+ * ponto iluminado por uma luz contida numa esfera. Os segmentos do ponto
+ * à luz ficam dentro de um cone: um objeto que não toca o cone (a sua
+ * esfera envolvente ou, projetado a partir do ponto, o fecho dos seus
+ * vértices) não bloqueia nenhum deles, e uma esfera ou um poliedro
+ * convexo que cobre o cone entre o ponto e a luz bloqueia todos. Um
+ * plano bloqueia todos se a esfera da luz está toda do outro lado dele,
+ * e nenhum se ela está toda do lado do ponto. Os testes são
+ * conservadores: na dúvida, o ponto é dado como incerto.
+ *
+ * @param cena Ponteiro para a cena.
+ * @param ponto Ponteiro para o ponto iluminado.
+ * @param centro_luz Ponteiro para o centro da esfera da luz.
+ * @param raio_luz Raio da esfera da luz.
+ * @param ignorar Objeto que não deve ser considerado (o próprio objeto
+ * do ponto).
+ * @return SOMBRA_LIVRE, SOMBRA_TOTAL ou SOMBRA_INCERTA.
+ */
+int sombra_cena(cena_t *cena, ponto_t *ponto, ponto_t *centro_luz,
+    real_t raio_luz, objeto_t *ignorar);
+
+/**
+ * Adiciona um raio de sombra ao pacote.
+ *
+ * @param pacote Ponteiro para o pacote.
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param ignorar Objeto que não deve ser considerado (o próprio objeto
+ * de onde o raio parte).
+ * @return Posição do raio no pacote ou -1 se o pacote estiver cheio.
+ */
+int pacote_sombra_adicionar(pacote_sombra_t *pacote, ponto_t *origem_raio,
+    vetor_t *direcao_raio, objeto_t *ignorar);
+
+/**
+ * Verifica, para cada raio de um pacote de raios de sombra, se algum
+ * objeto o bloqueia (o resultado fica em pacote->ocluido). A BVH de
+ * objetos é percorrida uma vez só para o pacote inteiro, levando em cada
+ * nó a lista dos raios que tocam a caixa dele: os filhos só testam esses
+ * raios, e os ramos que nenhum raio toca são pulados. Nas folhas, cada
+ * objeto é testado contra todos os raios da lista seguidos, para que os
+ * seus dados continuem no cache, e as malhas (que não sejam compactas)
+ * percorrem a própria BVH com o pacote da mesma forma. O resultado de cada
+ * raio é o mesmo de oclusao_cena().
+ *
+ * @param cena Ponteiro para a cena.
+ * @param pacote Ponteiro para o pacote.
+ * @param tmax Distância máxima a ser considerada.
+ */
+void oclusao_cena_pacote(cena_t *cena, pacote_sombra_t *pacote, real_t tmax);
+
+/** 
+ * Seleciona os objetos da cena cuja caixa envolvente toca um tronco de 
+ * visão (os planos são sempre selecionados), percorrendo a BVH de objetos.
+ * 
+ * @param cena Ponteiro para a cena.
+ * @param tronco Ponteiro para o tronco de visão.
+ * @param recorte Ponteiro para o recorte a ser preenchido.
+ */
+void cena_recortar(cena_t *cena, tronco_t *tronco, recorte_t *recorte);
+
+/** 
+ * Encontra o objeto mais perto da origem do raio entre os de um recorte.
+ * O raio precisa estar dentro do tronco usado no recorte.
+ * 
+ * @param cena Ponteiro para a cena.
+ * @param recorte Ponteiro para o recorte (se num_objetos for -1, a cena
+ * inteira é testada).
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param t0 Ponteiro para a distância até o objeto mais perto (é 
+ * modificada na função).
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @return Ponteiro para o objeto mais perto ou 0 caso nenhum seja tocado.
+ */
+objeto_t *intersecao_recorte(cena_t *cena, recorte_t *recorte, 
+    ponto_t *origem_raio, vetor_t *direcao_raio, real_t *t0, 
+    vetor_t *normal);
+
+/** 
+ * Verifica se algum objeto de um recorte bloqueia o raio antes de tmax.
+ * Para no primeiro objeto encontrado. O raio precisa estar dentro do
+ * tronco usado no recorte.
+ * 
+ * @param cena Ponteiro para a cena.
+ * @param recorte Ponteiro para o recorte (se num_objetos for -1, a cena
+ * inteira é testada).
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param tmax Distância máxima a ser considerada.
+ * @param ignorar Objeto que não deve ser considerado.
+ * @return 1 se algum objeto bloqueia o raio, 0 caso contrário.
+ */
+int oclusao_recorte(cena_t *cena, recorte_t *recorte, 
+    ponto_t *origem_raio, vetor_t *direcao_raio, real_t tmax, 
+    objeto_t *ignorar);
+
+#endif // CENA_H
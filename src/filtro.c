@@ -0,0 +1,433 @@
+#include "filtro.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+/** Menor valor dos denominadores dos pesos (para não dividir por zero). */
+#define FILTRO_EPSILON 1e-4f
+
+/** Pesos da B-spline cúbica em cada eixo do núcleo 5x5. */
+static const float pesos_spline[5] = {
+    1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f
+};
+
+/**
+ * Luminância de uma cor.
+ */
+static float luminancia(float r, float g, float b)
+{
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+/**
+ * Aproxima exp(-x), para x >= 0, por (1 - x / 32)^32 (zero a partir de
+ * 32), sem chamadas de biblioteca, de modo que os laços que a usam possam
+ * ser vetorizados.
+ */
+static float exp_negativo(float x)
+{
+    float y;
+
+    y = 1.0f - x * (1.0f / 32.0f);
+    y = 0.5f * (y + fabsf(y)); // max(y, 0) sem desvio.
+    y *= y;
+    y *= y;
+    y *= y;
+    y *= y;
+    y *= y;
+    return y;
+}
+
+/**
+ * Cria um filtro vazio.
+ *
+ * @return Ponteiro para o filtro ou NULL se faltar memória.
+ */
+filtro_t *filtro_criar(void)
+{
+    return calloc(1, sizeof(filtro_t));
+}
+
+/**
+ * Prepara o filtro para imagens de largura x altura píxels, cujas guias
+ * devem ser escritas com filtro_guia().
+ *
+ * @param filtro Ponteiro para o filtro.
+ * @param largura Largura das imagens.
+ * @param altura Altura das imagens.
+ * @param num_threads Número de threads usadas.
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+int filtro_preparar(filtro_t *filtro, int largura, int altura,
+    int num_threads)
+{
+    int n;
+
+    n = largura * altura;
+    if(n > filtro->capacidade)
+    {
+        filtro->capacidade = 0;
+        if(!realocar((void **) &filtro->normais, 3 * n, sizeof(float)) ||
+            !realocar((void **) &filtro->profundidades, n, sizeof(float)) ||
+            !realocar((void **) &filtro->albedos, 3 * n, sizeof(float)) ||
+            !realocar((void **) &filtro->momentos, n, sizeof(float)) ||
+            !realocar((void **) &filtro->entrada, 3 * n, sizeof(float)) ||
+            !realocar((void **) &filtro->cores[0], 3 * n, sizeof(float)) ||
+            !realocar((void **) &filtro->cores[1], 3 * n, sizeof(float)) ||
+            !realocar((void **) &filtro->variancias[0], n, sizeof(float)) ||
+            !realocar((void **) &filtro->variancias[1], n, sizeof(float)) ||
+            !realocar((void **) &filtro->escalas, n, sizeof(float)))
+        {
+            return 0;
+        }
+        filtro->capacidade = n;
+    }
+
+    if(5 * largura * num_threads > filtro->capacidade_somas)
+    {
+        filtro->capacidade_somas = 0;
+        if(!realocar((void **) &filtro->somas, 5 * largura * num_threads,
+            sizeof(float)))
+        {
+            return 0;
+        }
+        filtro->capacidade_somas = 5 * largura * num_threads;
+    }
+
+    filtro->largura = largura;
+    filtro->altura = altura;
+    return 1;
+}
+
+/**
+ * Guarda as guias do píxel k: a normal, a profundidade e o albedo do
+ * ponto tocado pelo seu raio primário.
+ *
+ * @param filtro Ponteiro para o filtro.
+ * @param k Índice do píxel (linha vezes largura mais coluna).
+ * @param objeto Ponteiro para o objeto tocado (ou NULL).
+ * @param t Distância até o ponto tocado.
+ * @param normal Ponteiro para a normal no ponto tocado.
+ */
+void filtro_guia(filtro_t *filtro, int k, objeto_t *objeto, real_t t,
+    vetor_t *normal)
+{
+    int n;
+    vetor_t unitaria;
+
+    // Sem objeto, a normal nula zera o peso de todos os vizinhos.
+    n = filtro->largura * filtro->altura;
+    if(objeto == NULL)
+    {
+        filtro->normais[k] = filtro->normais[k + n] =
+            filtro->normais[k + 2 * n] = 0.0f;
+        filtro->profundidades[k] = 0.0f;
+        filtro->albedos[k] = filtro->albedos[k + n] =
+            filtro->albedos[k + 2 * n] = 0.0f;
+        return;
+    }
+
+    // O cosseno entre as normais é elevado a 32: elas devem ser unitárias.
+    unitaria = normalizar(normal);
+    filtro->normais[k] = unitaria.x;
+    filtro->normais[k + n] = unitaria.y;
+    filtro->normais[k + 2 * n] = unitaria.z;
+    filtro->profundidades[k] = t;
+    filtro->albedos[k] = objeto->cor.x;
+    filtro->albedos[k + n] = objeto->cor.y;
+    filtro->albedos[k + 2 * n] = objeto->cor.z;
+}
+
+/**
+ * Soma o quadrado da luminância de uma amostra aos momentos do píxel k.
+ *
+ * @param filtro Ponteiro para o filtro.
+ * @param k Índice do píxel.
+ * @param cor Ponteiro para a cor da amostra.
+ */
+void filtro_somar_amostra(filtro_t *filtro, int k, cor_t *cor)
+{
+    float l;
+
+    l = luminancia(cor->x, cor->y, cor->z);
+    filtro->momentos[k] += l * l;
+}
+
+/**
+ * Separa a imagem em planos e estima a variância da luminância média de
+ * cada píxel: pelos momentos das suas amostras, ou, com menos de
+ * FILTRO_MIN_AMOSTRAS amostras, pela dos 3x3 píxels em volta.
+ */
+static void estimar_variancias(filtro_t *filtro, float *cores, int amostras,
+    int num_threads)
+{
+    int i, j, a, b, k, n, largura, altura, vizinhos;
+    float l, soma, soma_quadrados, *planos, *variancias;
+
+    largura = filtro->largura;
+    altura = filtro->altura;
+    n = largura * altura;
+    planos = filtro->cores[0];
+    variancias = filtro->variancias[0];
+
+    # pragma omp parallel for num_threads(num_threads) private(l)
+    for(k = 0; k < n; k++)
+    {
+        planos[k] = cores[3 * k];
+        planos[k + n] = cores[3 * k + 1];
+        planos[k + 2 * n] = cores[3 * k + 2];
+        l = luminancia(cores[3 * k], cores[3 * k + 1], cores[3 * k + 2]);
+        if(amostras == 1)
+        {
+            filtro->momentos[k] = l * l;
+        }
+        variancias[k] = max(0.0f, filtro->momentos[k] / amostras - l * l) /
+            amostras;
+    }
+
+    if(amostras >= FILTRO_MIN_AMOSTRAS)
+    {
+        return;
+    }
+
+    # pragma omp parallel for num_threads(num_threads) \
+        private(j, a, b, k, l, soma, soma_quadrados, vizinhos)
+    for(i = 0; i < altura; i++)
+    {
+        for(j = 0; j < largura; j++)
+        {
+            soma = soma_quadrados = 0.0f;
+            vizinhos = 0;
+            for(a = max(0, i - 1); a <= min(altura - 1, i + 1); a++)
+            {
+                for(b = max(0, j - 1); b <= min(largura - 1, j + 1); b++)
+                {
+                    k = a * largura + b;
+                    l = luminancia(planos[k], planos[k + n],
+                        planos[k + 2 * n]);
+                    soma += l;
+                    soma_quadrados += l * l;
+                    vizinhos++;
+                }
+            }
+            soma /= vizinhos;
+            variancias[i * largura + j] = max(0.0f,
+                soma_quadrados / vizinhos - soma * soma);
+        }
+    }
+}
+
+/**
+ * Calcula o inverso da diferença de luminância aceita em cada píxel pelo
+ * desvio padrão do ruído, com a variância suavizada pelos 3x3 píxels em
+ * volta (pesos 1/4, 1/2, 1/4 em cada eixo): sozinha, a de poucas amostras
+ * é quase nula em muitos píxels ruidosos, que assim não seriam filtrados.
+ */
+static void calcular_escalas(filtro_t *filtro, const float *variancias,
+    int num_threads)
+{
+    int i, j, a, b, largura, altura;
+    float soma, peso, soma_pesos;
+
+    largura = filtro->largura;
+    altura = filtro->altura;
+
+    # pragma omp parallel for num_threads(num_threads) \
+        private(j, a, b, soma, peso, soma_pesos)
+    for(i = 0; i < altura; i++)
+    {
+        for(j = 0; j < largura; j++)
+        {
+            soma = soma_pesos = 0.0f;
+            for(a = max(0, i - 1); a <= min(altura - 1, i + 1); a++)
+            {
+                for(b = max(0, j - 1); b <= min(largura - 1, j + 1); b++)
+                {
+                    peso = (a == i ? 0.5f : 0.25f) * (b == j ? 0.5f : 0.25f);
+                    soma += peso * variancias[a * largura + b];
+                    soma_pesos += peso;
+                }
+            }
+            filtro->escalas[i * largura + j] = 1.0f /
+                (FILTRO_SIGMA_LUMINANCIA * sqrtf(soma / soma_pesos) +
+                FILTRO_EPSILON);
+        }
+    }
+}
+
+/**
+ * Filtra a linha i numa iteração com o passo dado, somando em cada píxel
+ * os 5x5 vizinhos ponderados (cada deslocamento do núcleo é um laço SIMD
+ * sobre a linha). A variância da saída é a da média ponderada.
+ */
+static void filtrar_linha(filtro_t *filtro, int i, int passo,
+    const float *cores, const float *variancias, float *cores_saida,
+    float *variancias_saida, float *somas)
+{
+    int a, b, j, j0, j1, p, q, n, largura, linha, deslocamento;
+    float h, inverso_distancia, x, w, cosseno, lp, lq;
+    float *soma_r, *soma_g, *soma_b, *soma_w, *soma_v;
+    const float *normais, *profundidades, *albedos, *escalas;
+
+    largura = filtro->largura;
+    n = largura * filtro->altura;
+    normais = filtro->normais;
+    profundidades = filtro->profundidades;
+    albedos = filtro->albedos;
+    escalas = filtro->escalas;
+    soma_r = somas;
+    soma_g = somas + largura;
+    soma_b = somas + 2 * largura;
+    soma_w = somas + 3 * largura;
+    soma_v = somas + 4 * largura;
+    memset(somas, 0, 5 * largura * sizeof(float));
+    linha = i * largura;
+
+    for(a = -2; a <= 2; a++)
+    {
+        if(i + a * passo < 0 || i + a * passo >= filtro->altura)
+        {
+            continue;
+        }
+
+        for(b = -2; b <= 2; b++)
+        {
+            deslocamento = (i + a * passo) * largura + b * passo - linha;
+            j0 = max(0, -b * passo);
+            j1 = min(largura, largura - b * passo);
+            h = pesos_spline[a + 2] * pesos_spline[b + 2];
+            inverso_distancia = a == 0 && b == 0 ? 0.0f :
+                1.0f / ((abs(a) + abs(b)) * passo);
+
+            # pragma omp simd private(p, q, x, w, cosseno, lp, lq)
+            for(j = j0; j < j1; j++)
+            {
+                p = linha + j;
+                q = p + deslocamento;
+
+                cosseno = normais[p] * normais[q] +
+                    normais[p + n] * normais[q + n] +
+                    normais[p + 2 * n] * normais[q + 2 * n];
+                cosseno = 0.5f * (cosseno + fabsf(cosseno));
+                cosseno *= cosseno; // 2
+                cosseno *= cosseno; // 4
+                cosseno *= cosseno; // 8
+                cosseno *= cosseno; // 16
+                cosseno *= cosseno; // 32 = 2^FILTRO_QUADRADOS_NORMAL
+
+                lp = luminancia(cores[p], cores[p + n], cores[p + 2 * n]);
+                lq = luminancia(cores[q], cores[q + n], cores[q + 2 * n]);
+                x = fabsf(lp - lq) * escalas[p] +
+                    fabsf(profundidades[p] - profundidades[q]) *
+                    inverso_distancia / (FILTRO_SIGMA_PROFUNDIDADE *
+                    profundidades[p] + FILTRO_EPSILON) +
+                    (fabsf(albedos[p] - albedos[q]) +
+                    fabsf(albedos[p + n] - albedos[q + n]) +
+                    fabsf(albedos[p + 2 * n] - albedos[q + 2 * n])) *
+                    (1.0f / FILTRO_SIGMA_ALBEDO);
+                w = h * cosseno * exp_negativo(x);
+
+                soma_r[j] += w * cores[q];
+                soma_g[j] += w * cores[q + n];
+                soma_b[j] += w * cores[q + 2 * n];
+                soma_w[j] += w;
+                soma_v[j] += w * w * variancias[q];
+            }
+        }
+    }
+
+    // Sem vizinhos parecidos (como no fundo), o píxel fica como está.
+    for(j = 0; j < largura; j++)
+    {
+        p = linha + j;
+        if(soma_w[j] > 0.0f)
+        {
+            w = 1.0f / soma_w[j];
+            cores_saida[p] = soma_r[j] * w;
+            cores_saida[p + n] = soma_g[j] * w;
+            cores_saida[p + 2 * n] = soma_b[j] * w;
+            variancias_saida[p] = soma_v[j] * w * w;
+        }
+        else
+        {
+            cores_saida[p] = cores[p];
+            cores_saida[p + n] = cores[p + n];
+            cores_saida[p + 2 * n] = cores[p + 2 * n];
+            variancias_saida[p] = variancias[p];
+        }
+    }
+}
+
+/**
+ * Filtra uma imagem (RGB) já com as guias de todos os píxels. Na primeira
+ * amostra, os momentos são os da própria imagem; depois, devem ter sido
+ * somados com filtro_somar_amostra(). A imagem original fica em
+ * filtro->entrada.
+ *
+ * @param filtro Ponteiro para o filtro.
+ * @param cores Imagem (média das amostras de cada píxel), que é
+ * substituída pela filtrada.
+ * @param amostras Número de amostras por píxel da imagem.
+ * @param num_threads Número de threads usadas.
+ */
+void filtro_aplicar(filtro_t *filtro, float *cores, int amostras,
+    int num_threads)
+{
+    int i, k, n, iteracao, atual;
+    float *somas;
+
+    n = filtro->largura * filtro->altura;
+    memcpy(filtro->entrada, cores, 3 * n * sizeof(float));
+    estimar_variancias(filtro, cores, amostras, num_threads);
+
+    atual = 0;
+    for(iteracao = 0; iteracao < FILTRO_ITERACOES; iteracao++)
+    {
+        calcular_escalas(filtro, filtro->variancias[atual], num_threads);
+
+        # pragma omp parallel for num_threads(num_threads) private(somas) \
+            schedule(dynamic, 4)
+        for(i = 0; i < filtro->altura; i++)
+        {
+            somas = filtro->somas + 5 * filtro->largura * omp_get_thread_num();
+            filtrar_linha(filtro, i, 1 << iteracao, filtro->cores[atual],
+                filtro->variancias[atual], filtro->cores[!atual],
+                filtro->variancias[!atual], somas);
+        }
+        atual = !atual;
+    }
+
+    for(k = 0; k < n; k++)
+    {
+        cores[3 * k] = filtro->cores[atual][k];
+        cores[3 * k + 1] = filtro->cores[atual][k + n];
+        cores[3 * k + 2] = filtro->cores[atual][k + 2 * n];
+    }
+}
+
+/**
+ * Libera a memória do filtro.
+ *
+ * @param filtro Ponteiro para o filtro.
+ */
+void filtro_liberar(filtro_t *filtro)
+{
+    if(filtro == NULL)
+    {
+        return;
+    }
+
+    free(filtro->normais);
+    free(filtro->profundidades);
+    free(filtro->albedos);
+    free(filtro->momentos);
+    free(filtro->entrada);
+    free(filtro->cores[0]);
+    free(filtro->cores[1]);
+    free(filtro->variancias[0]);
+    free(filtro->variancias[1]);
+    free(filtro->escalas);
+    free(filtro->somas);
+    free(filtro);
+}
@@ -0,0 +1,122 @@
+#ifndef FILTRO_H
+#define FILTRO_H
+
+#include "geometria.h"
+
+/** Iterações do filtro à-trous (o passo entre os píxels dobra a cada uma,
+ * de 1 a 2^(FILTRO_ITERACOES - 1)). */
+#define FILTRO_ITERACOES 5
+
+/** Diferença de luminância aceita, em desvios padrão do ruído do píxel. */
+#define FILTRO_SIGMA_LUMINANCIA 4.0f
+
+/** Diferença de profundidade aceita por píxel de distância, em relação à
+ * profundidade do píxel. */
+#define FILTRO_SIGMA_PROFUNDIDADE 0.05f
+
+/** Diferença de albedo aceita (soma dos três canais). */
+#define FILTRO_SIGMA_ALBEDO 0.1f
+
+/** Quadrados do cosseno entre as normais no peso delas (o peso é o
+ * cosseno elevado a 2^FILTRO_QUADRADOS_NORMAL). */
+#define FILTRO_QUADRADOS_NORMAL 5
+
+/** Amostras por píxel a partir das quais a variância de cada píxel vem das
+ * suas amostras (antes, ela vem dos píxels vizinhos). */
+#define FILTRO_MIN_AMOSTRAS 4
+
+/**
+ * Filtro que tira o ruído das imagens de Monte Carlo.
+ *
+ * É o filtro à-trous guiado pelas arestas: a cada iteração, cada píxel
+ * vira a média dos 5x5 píxels em volta (com os pesos da B-spline cúbica),
+ * espaçados pelo passo da iteração, ponderados pela semelhança com ele
+ * no que o traçado já calculou para o raio primário: a normal, a
+ * profundidade e o albedo (a cor do objeto) do ponto tocado. A luminância
+ * também entra, medida em desvios padrão do ruído do píxel (a variância
+ * da média das suas amostras), que é filtrada junto com as cores; assim,
+ * as regiões ruidosas são mais suavizadas que as já convergidas.
+ *
+ * As imagens são guardadas em planos (um array por canal), de modo que
+ * cada linha é filtrada por uma thread com instruções SIMD sobre os
+ * píxels vizinhos na linha.
+ */
+typedef struct {
+    int largura, altura, capacidade;
+    float *normais; // Planos x, y e z (zero se o raio escapou).
+    float *profundidades; // Distância do ponto tocado.
+    float *albedos; // Planos r, g e b.
+    float *momentos; // Soma dos quadrados das luminâncias das amostras.
+    float *entrada; // Cópia (RGB) da última imagem filtrada.
+    float *cores[2]; // Planos r, g e b (entrada e saída das iterações).
+    float *variancias[2]; // Idem, da variância da luminância.
+    float *escalas; // Inverso da diferença de luminância aceita.
+    float *somas; // Somas de uma linha (5 arrays) de cada thread.
+    int capacidade_somas;
+} filtro_t;
+
+/**
+ * Cria um filtro vazio.
+ *
+ * @return Ponteiro para o filtro ou NULL se faltar memória.
+ */
+filtro_t *filtro_criar(void);
+
+/**
+ * Prepara o filtro para imagens de largura x altura píxels, cujas guias
+ * devem ser escritas com filtro_guia().
+ *
+ * @param filtro Ponteiro para o filtro.
+ * @param largura Largura das imagens.
+ * @param altura Altura das imagens.
+ * @param num_threads Número de threads usadas.
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+int filtro_preparar(filtro_t *filtro, int largura, int altura,
+    int num_threads);
+
+/**
+ * Guarda as guias do píxel k: a normal, a profundidade e o albedo do
+ * ponto tocado pelo seu raio primário.
+ *
+ * @param filtro Ponteiro para o filtro.
+ * @param k Índice do píxel (linha vezes largura mais coluna).
+ * @param objeto Ponteiro para o objeto tocado (ou NULL).
+ * @param t Distância até o ponto tocado.
+ * @param normal Ponteiro para a normal no ponto tocado.
+ */
+void filtro_guia(filtro_t *filtro, int k, objeto_t *objeto, real_t t,
+    vetor_t *normal);
+
+/**
+ * Soma o quadrado da luminância de uma amostra aos momentos do píxel k.
+ *
+ * @param filtro Ponteiro para o filtro.
+ * @param k Índice do píxel.
+ * @param cor Ponteiro para a cor da amostra.
+ */
+void filtro_somar_amostra(filtro_t *filtro, int k, cor_t *cor);
+
+/**
+ * Filtra uma imagem (RGB) já com as guias de todos os píxels. Na primeira
+ * amostra, os momentos são os da própria imagem; depois, devem ter sido
+ * somados com filtro_somar_amostra(). A imagem original fica em
+ * filtro->entrada.
+ *
+ * @param filtro Ponteiro para o filtro.
+ * @param cores Imagem (média das amostras de cada píxel), que é
+ * substituída pela filtrada.
+ * @param amostras Número de amostras por píxel da imagem.
+ * @param num_threads Número de threads usadas.
+ */
+void filtro_aplicar(filtro_t *filtro, float *cores, int amostras,
+    int num_threads);
+
+/**
+ * Libera a memória do filtro.
+ *
+ * @param filtro Ponteiro para o filtro.
+ */
+void filtro_liberar(filtro_t *filtro);
+
+#endif // FILTRO_H
@@ -0,0 +1,751 @@
+#include "fotons.h"
+#include "amostrador.h"
+#include "bvh.h"
+#include "cena.h"
+#include "onda.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+extern real_t kr;
+
+/** Tamanho da pilha da busca (um nó pendente por nível da árvore). */
+#define PILHA_FOTONS 64
+
+/**
+ * Fóton em construção: a posição e o índice dos seus dados são movidos
+ * juntos durante a partição, de modo que cada nível da construção lê a
+ * memória em sequência.
+ */
+typedef struct {
+    ponto_t posicao;
+    int indice;
+} referencia_foton_t;
+
+/**
+ * Subárvore pendente na busca dos vizinhos, com o quadrado da distância
+ * do ponto à sua célula e a distância à célula em cada eixo.
+ */
+typedef struct {
+    int indice;
+    real_t distancia;
+    real_t afastamentos[3];
+} pendente_foton_t;
+
+/**
+ * Alvo da emissão: o cone, visto da luz local, da esfera que envolve um
+ * objeto limitado refletível ou transparente.
+ */
+typedef struct {
+    vetor_t eixo; // Direção (normalizada) do centro da esfera.
+    real_t cosseno; // Cosseno da metade da abertura do cone.
+    real_t angulo_solido;
+} alvo_foton_t;
+
+/**
+ * Cria um mapa de fótons vazio.
+ *
+ * @param num_threads Número de threads que traçam e consultam o mapa (uma
+ * thread fora delas pode consultá-lo, mas não entra nas contagens).
+ * @return Ponteiro para o mapa ou NULL se faltar memória.
+ */
+mapa_fotons_t *fotons_criar(int num_threads)
+{
+    mapa_fotons_t *mapa;
+
+    mapa = calloc(1, sizeof(mapa_fotons_t));
+    if(mapa == NULL)
+    {
+        return NULL;
+    }
+
+    mapa->buffers = calloc(num_threads, sizeof(buffer_fotons_t));
+    if(mapa->buffers == NULL)
+    {
+        free(mapa);
+        return NULL;
+    }
+    mapa->num_buffers = num_threads;
+    mapa->vizinhos = 1;
+    return mapa;
+}
+
+/**
+ * Guarda um fóton no buffer de uma thread.
+ *
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+static int guardar_foton(buffer_fotons_t *buffer, ponto_t *posicao,
+    vetor_t *direcao, cor_t *potencia)
+{
+    int capacidade;
+
+    if(buffer->num_fotons == buffer->capacidade)
+    {
+        capacidade = 2 * buffer->capacidade + 256;
+        if(!realocar((void **) &buffer->posicoes, capacidade,
+            sizeof(ponto_t)) || !realocar((void **) &buffer->fotons,
+            capacidade, sizeof(foton_t)))
+        {
+            return 0;
+        }
+        buffer->capacidade = capacidade;
+    }
+
+    buffer->posicoes[buffer->num_fotons] = *posicao;
+    buffer->fotons[buffer->num_fotons].direcao = *direcao;
+    buffer->fotons[buffer->num_fotons].potencia = *potencia;
+    buffer->num_fotons++;
+    return 1;
+}
+
+/**
+ * Calcula os alvos da emissão (os cones dos objetos limitados que podem
+ * desviar a luz; os planos ficam de fora).
+ *
+ * @return Número de alvos.
+ */
+static int calcular_alvos(cena_t *cena, luz_t *luz_local,
+    alvo_foton_t *alvos)
+{
+    int k, num_alvos;
+    real_t raio, distancia, seno;
+    ponto_t centro;
+    vetor_t diagonal;
+    caixa_t caixa;
+    objeto_t *objeto;
+
+    num_alvos = 0;
+    for(k = 0; k < cena->num_objetos; k++)
+    {
+        objeto = &cena->objetos[k];
+        if(!(objeto->refletivel && kr > 0.0) && objeto->transparencia <= 0.0)
+        {
+            continue;
+        }
+        if(!caixa_objeto(objeto, &caixa))
+        {
+            continue;
+        }
+
+        centro.x = 0.5 * (caixa.min.x + caixa.max.x);
+        centro.y = 0.5 * (caixa.min.y + caixa.max.y);
+        centro.z = 0.5 * (caixa.min.z + caixa.max.z);
+        diagonal = sub_v(&caixa.max, &caixa.min);
+        raio = 0.5 * modulo(&diagonal);
+        alvos[num_alvos].eixo = sub_v(&centro, &luz_local->posicao);
+        distancia = modulo(&alvos[num_alvos].eixo);
+
+        // Com a luz dentro da esfera, o alvo é a esfera de direções toda.
+        if(distancia <= raio)
+        {
+            alvos[num_alvos].eixo.x = alvos[num_alvos].eixo.y = 0.0;
+            alvos[num_alvos].eixo.z = 1.0;
+            alvos[num_alvos].cosseno = -1.0;
+        }
+        else
+        {
+            alvos[num_alvos].eixo = mult_e(&alvos[num_alvos].eixo,
+                1.0 / distancia);
+            seno = raio / distancia;
+            alvos[num_alvos].cosseno = sqrt(1.0 - seno * seno);
+        }
+        alvos[num_alvos].angulo_solido = 2.0 * PI *
+            (1.0 - alvos[num_alvos].cosseno);
+        num_alvos++;
+    }
+
+    return num_alvos;
+}
+
+/**
+ * Sorteia a direção de emissão do fóton: o alvo (com probabilidade
+ * proporcional ao ângulo sólido) e um ponto uniforme no seu cone.
+ *
+ * @return Número de cones que contêm a direção (a densidade dela é esse
+ * número sobre o ângulo sólido total dos alvos).
+ */
+static int emitir_foton(alvo_foton_t *alvos, int num_alvos,
+    real_t angulo_total, sequencia_t *sequencia, vetor_t *direcao)
+{
+    int k, cones;
+    real_t u1, u2, sorteio, z, r, angulo;
+    vetor_t eixo, u, v, temp1_v;
+
+    u1 = sequencia_proximo(sequencia);
+    u2 = sequencia_proximo(sequencia);
+    sorteio = sequencia_proximo(sequencia) * angulo_total;
+    for(k = 0; k < num_alvos - 1 && sorteio >= alvos[k].angulo_solido; k++)
+    {
+        sorteio -= alvos[k].angulo_solido;
+    }
+
+    eixo.x = fabs(alvos[k].eixo.x) < 0.9 ? 1.0 : 0.0;
+    eixo.y = 1.0 - eixo.x;
+    eixo.z = 0.0;
+    u = prod_v(&alvos[k].eixo, &eixo);
+    u = normalizar(&u);
+    v = prod_v(&alvos[k].eixo, &u);
+
+    z = 1.0 - u1 * (1.0 - alvos[k].cosseno);
+    r = sqrt(max((real_t) 0.0, 1.0 - z * z));
+    angulo = 2.0 * PI * u2;
+    *direcao = mult_e(&alvos[k].eixo, z);
+    temp1_v = mult_e(&u, r * cos(angulo));
+    *direcao = soma_v(direcao, &temp1_v);
+    temp1_v = mult_e(&v, r * sin(angulo));
+    *direcao = soma_v(direcao, &temp1_v);
+    *direcao = normalizar(direcao);
+
+    cones = 0;
+    for(k = 0; k < num_alvos; k++)
+    {
+        cones += prod_e(direcao, &alvos[k].eixo) >= alvos[k].cosseno;
+    }
+    return max(cones, 1);
+}
+
+/**
+ * Traça o fóton k: a direção sai de um par de Sobol no cone de um alvo
+ * (sorteado pelo número seguinte da sequência), e cada rebote sorteia,
+ * com mais um número, entre os raios secundários do ponto tocado (com
+ * probabilidade igual ao peso de cada um, ou proporcional a ele se a soma
+ * passa de 1) e a absorção.
+ *
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+static int tracar_foton(cena_t *cena, luz_t *luz_local, alvo_foton_t *alvos,
+    int num_alvos, real_t angulo_total, int k, int num_emitidos,
+    buffer_fotons_t *buffer)
+{
+    int rebote, dentro, num_secundarios, cones, i;
+    real_t t, soma, escala, sorteio;
+    ponto_t origem, ponto_intersec;
+    vetor_t direcao, normal, temp1_v;
+    cor_t potencia;
+    objeto_t *objeto;
+    sequencia_t sequencia;
+    raio_pendente_t secundarios[2];
+
+    // Cada bloco de AMOSTRADOR_MAX_AMOSTRAS fótons usa a sequência de um
+    // "píxel" diferente, já que o Sobol se repete depois disso.
+    sequencia_iniciar(&sequencia, AMOSTRADOR_SOBOL,
+        k / AMOSTRADOR_MAX_AMOSTRAS, 0, k % AMOSTRADOR_MAX_AMOSTRAS, 0);
+    cones = emitir_foton(alvos, num_alvos, angulo_total, &sequencia,
+        &direcao);
+    origem = luz_local->posicao;
+    potencia = mult_e(&luz_local->cor, angulo_total /
+        ((real_t) cones * num_emitidos));
+
+    for(rebote = 0; ; rebote++)
+    {
+        objeto = intersecao_cena(cena, &origem, &direcao, &t, &normal);
+        if(objeto == NULL)
+        {
+            break;
+        }
+
+        // A luz local não se atenua até o primeiro ponto tocado.
+        if(rebote == 0)
+        {
+            potencia = mult_e(&potencia, t * t);
+        }
+
+        dentro = prod_e(&direcao, &normal) > 0;
+        if(dentro)
+        {
+            normal = neg_v(&normal);
+        }
+        temp1_v = mult_e(&direcao, t);
+        ponto_intersec = soma_v(&origem, &temp1_v);
+
+        if(rebote > 0 && objeto->transparencia < 1.0 &&
+            !guardar_foton(buffer, &ponto_intersec, &direcao, &potencia))
+        {
+            return 0;
+        }
+        if(rebote == FOTONS_MAX_REBOTES)
+        {
+            break;
+        }
+
+        num_secundarios = raios_secundarios(objeto, &direcao,
+            &ponto_intersec, &normal, dentro, secundarios);
+        soma = 0.0;
+        for(i = 0; i < num_secundarios; i++)
+        {
+            soma += secundarios[i].peso;
+        }
+        escala = max((real_t) 1.0, soma);
+        sorteio = sequencia_proximo(&sequencia) * escala;
+        if(sorteio >= soma)
+        {
+            break;
+        }
+
+        for(i = 0; i < num_secundarios - 1 &&
+            sorteio >= secundarios[i].peso; i++)
+        {
+            sorteio -= secundarios[i].peso;
+        }
+        origem = secundarios[i].origem;
+        direcao = secundarios[i].direcao;
+        potencia = mult_e(&potencia, escala);
+    }
+
+    return 1;
+}
+
+/**
+ * Número de nós na subárvore esquerda de uma árvore balanceada à
+ * esquerda com n nós (os níveis completos e, no último, os nós mais à
+ * esquerda), que é o que mantém o heap sem buracos.
+ */
+static int tamanho_esquerda(int n)
+{
+    int cheios;
+
+    // Nós nos níveis completos (2^h - 1).
+    for(cheios = 1; cheios <= (n - 1) / 2; cheios = 2 * cheios + 1);
+
+    return (cheios - 1) / 2 + min(n - cheios, (cheios + 1) / 2);
+}
+
+/**
+ * Particiona refs[inicio..fim) de modo que refs[k] seja o que ficaria
+ * nessa posição com o array ordenado no eixo, os anteriores não maiores
+ * que ele e os seguintes não menores (seleção de Hoare).
+ */
+static void selecionar(referencia_foton_t *refs, int inicio, int fim, int k,
+    int eixo)
+{
+    int i, j;
+    real_t pivo;
+    referencia_foton_t temp;
+
+    fim--;
+    while(inicio < fim)
+    {
+        pivo = componente(&refs[inicio + (fim - inicio) / 2].posicao, eixo);
+        i = inicio;
+        j = fim;
+        while(i <= j)
+        {
+            while(componente(&refs[i].posicao, eixo) < pivo)
+            {
+                i++;
+            }
+            while(componente(&refs[j].posicao, eixo) > pivo)
+            {
+                j--;
+            }
+            if(i <= j)
+            {
+                temp = refs[i];
+                refs[i] = refs[j];
+                refs[j] = temp;
+                i++;
+                j--;
+            }
+        }
+
+        if(k <= j)
+        {
+            fim = j;
+        }
+        else if(k >= i)
+        {
+            inicio = i;
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * Constrói a subárvore do nó 'indice' com os fótons refs[inicio..inicio +
+ * quantidade): a mediana no eixo mais comprido da caixa deles (na posição
+ * que deixa a árvore balanceada à esquerda) vai para o nó, e as duas
+ * metades para os filhos, a esquerda numa tarefa do OpenMP se for grande.
+ */
+static void construir_no(mapa_fotons_t *mapa, referencia_foton_t *refs,
+    foton_t *dados, int inicio, int quantidade, int indice)
+{
+    int k, eixo, meio;
+    real_t dx, dy, dz;
+    caixa_t caixa;
+
+    if(quantidade == 0)
+    {
+        return;
+    }
+
+    caixa = caixa_vazia();
+    for(k = inicio; k < inicio + quantidade; k++)
+    {
+        caixa_expandir(&caixa, &refs[k].posicao);
+    }
+    dx = caixa.max.x - caixa.min.x;
+    dy = caixa.max.y - caixa.min.y;
+    dz = caixa.max.z - caixa.min.z;
+    eixo = dx >= dy && dx >= dz ? 0 : (dy >= dz ? 1 : 2);
+
+    meio = inicio + tamanho_esquerda(quantidade);
+    selecionar(refs, inicio, inicio + quantidade, meio, eixo);
+    mapa->nos[indice].posicao = refs[meio].posicao;
+    mapa->nos[indice].eixo = eixo;
+    mapa->fotons[indice] = dados[refs[meio].indice];
+
+    # pragma omp task if(quantidade > FOTONS_MIN_TAREFA)
+    construir_no(mapa, refs, dados, inicio, meio - inicio, 2 * indice + 1);
+
+    construir_no(mapa, refs, dados, meio + 1, inicio + quantidade - meio - 1,
+        2 * indice + 2);
+}
+
+/**
+ * Refaz o mapa: emite fótons da posição da luz local só para os cones das
+ * esferas que envolvem os objetos limitados refletíveis ou transparentes
+ * (Sobol no cone, como num mapa de projeção; os planos não geram
+ * cáusticas), e segue cada um pelas reflexões e refrações que sorteia com
+ * probabilidade igual ao peso delas (o resto da luz fica na superfície).
+ * Cada ponto tocado depois da primeira reflexão ou refração guarda um
+ * fóton. Como a luz local não se atenua com a distância, a potência de um
+ * fóton é a que cobre, no primeiro ponto que ele toca, o ângulo sólido de
+ * um fóton. O traçado e a construção da
+ * árvore (a mediana de cada subárvore no eixo mais comprido da sua caixa,
+ * com tarefas do OpenMP) usam as threads do mapa, e os seus tempos ficam
+ * no mapa.
+ *
+ * @param mapa Ponteiro para o mapa.
+ * @param cena Ponteiro para a cena.
+ * @param luz_local Ponteiro para a luz local.
+ * @param num_emitidos Número de fótons emitidos.
+ * @return 1 em caso de sucesso, 0 se faltar memória (o mapa fica vazio).
+ */
+int fotons_preparar(mapa_fotons_t *mapa, cena_t *cena, luz_t *luz_local,
+    int num_emitidos)
+{
+    int k, t, n, num_alvos, falhas, resultado;
+    real_t angulo_total;
+    double inicio;
+    alvo_foton_t *alvos;
+    referencia_foton_t *refs;
+    foton_t *dados;
+    buffer_fotons_t *buffer;
+
+    mapa->num_fotons = 0;
+    mapa->num_emitidos = 0;
+    for(t = 0; t < mapa->num_buffers; t++)
+    {
+        mapa->buffers[t].num_fotons = 0;
+    }
+
+    inicio = omp_get_wtime();
+    alvos = malloc((cena->num_objetos + 1) * sizeof(alvo_foton_t));
+    if(alvos == NULL)
+    {
+        return 0;
+    }
+    num_alvos = calcular_alvos(cena, luz_local, alvos);
+    angulo_total = 0.0;
+    for(k = 0; k < num_alvos; k++)
+    {
+        angulo_total += alvos[k].angulo_solido;
+    }
+
+    // Com a divisão estática, os buffers em ordem seguem a dos fótons.
+    falhas = 0;
+    if(num_alvos > 0)
+    {
+        # pragma omp parallel for num_threads(mapa->num_buffers) \
+            schedule(static) reduction(+:falhas)
+        for(k = 0; k < num_emitidos; k++)
+        {
+            falhas += !tracar_foton(cena, luz_local, alvos, num_alvos,
+                angulo_total, k, num_emitidos,
+                &mapa->buffers[omp_get_thread_num()]);
+        }
+    }
+    free(alvos);
+    mapa->segundos_tracado = omp_get_wtime() - inicio;
+
+    inicio = omp_get_wtime();
+    n = 0;
+    for(t = 0; t < mapa->num_buffers; t++)
+    {
+        n += mapa->buffers[t].num_fotons;
+    }
+
+    resultado = 0;
+    refs = NULL;
+    dados = NULL;
+    if(falhas > 0 || n == 0)
+    {
+        mapa->num_emitidos = falhas == 0 ? num_emitidos : 0;
+        resultado = falhas == 0;
+        goto fim;
+    }
+
+    if(n > mapa->capacidade)
+    {
+        if(!realocar((void **) &mapa->nos, n, sizeof(no_foton_t)) ||
+            !realocar((void **) &mapa->fotons, n, sizeof(foton_t)))
+        {
+            goto fim;
+        }
+        mapa->capacidade = n;
+    }
+
+    refs = malloc(n * sizeof(referencia_foton_t));
+    dados = malloc(n * sizeof(foton_t));
+    if(refs == NULL || dados == NULL)
+    {
+        goto fim;
+    }
+
+    n = 0;
+    mapa->caixa = caixa_vazia();
+    for(t = 0; t < mapa->num_buffers; t++)
+    {
+        buffer = &mapa->buffers[t];
+        memcpy(&dados[n], buffer->fotons, buffer->num_fotons *
+            sizeof(foton_t));
+        for(k = 0; k < buffer->num_fotons; k++, n++)
+        {
+            refs[n].posicao = buffer->posicoes[k];
+            refs[n].indice = n;
+            caixa_expandir(&mapa->caixa, &buffer->posicoes[k]);
+        }
+    }
+
+    // As tarefas do OpenMP só são criadas para subárvores grandes.
+    # pragma omp parallel num_threads(mapa->num_buffers) \
+        if(n > FOTONS_MIN_TAREFA)
+    # pragma omp single
+    construir_no(mapa, refs, dados, 0, n, 0);
+
+    mapa->num_fotons = n;
+    mapa->num_emitidos = num_emitidos;
+    resultado = 1;
+
+fim:
+    free(refs);
+    free(dados);
+    for(t = 0; t < mapa->num_buffers; t++)
+    {
+        free(mapa->buffers[t].posicoes);
+        free(mapa->buffers[t].fotons);
+        mapa->buffers[t].posicoes = NULL;
+        mapa->buffers[t].fotons = NULL;
+        mapa->buffers[t].num_fotons = mapa->buffers[t].capacidade = 0;
+    }
+    mapa->segundos_construcao = omp_get_wtime() - inicio;
+    return resultado;
+}
+
+/**
+ * Põe um fóton entre os vizinhos achados, um heap com o mais distante na
+ * raiz. Com o heap cheio, o fóton (mais perto que a raiz) toma o lugar
+ * dela.
+ *
+ * @return Quadrado do novo raio da busca.
+ */
+static real_t guardar_vizinho(int *indices, real_t *distancias,
+    int *num_achados, int vizinhos, int indice, real_t distancia,
+    real_t raio2)
+{
+    int k, filho;
+
+    if(*num_achados < vizinhos)
+    {
+        for(k = (*num_achados)++; k > 0 &&
+            distancias[(k - 1) / 2] < distancia; k = (k - 1) / 2)
+        {
+            indices[k] = indices[(k - 1) / 2];
+            distancias[k] = distancias[(k - 1) / 2];
+        }
+        indices[k] = indice;
+        distancias[k] = distancia;
+        return *num_achados == vizinhos ? distancias[0] : raio2;
+    }
+
+    for(k = 0; 2 * k + 1 < vizinhos; k = filho)
+    {
+        filho = 2 * k + 1;
+        if(filho + 1 < vizinhos && distancias[filho + 1] > distancias[filho])
+        {
+            filho++;
+        }
+        if(distancias[filho] <= distancia)
+        {
+            break;
+        }
+        indices[k] = indices[filho];
+        distancias[k] = distancias[filho];
+    }
+    indices[k] = indice;
+    distancias[k] = distancia;
+    return distancias[0];
+}
+
+/**
+ * Estima a irradiância das cáusticas num ponto pelos mapa->vizinhos fótons
+ * mais próximos (até FOTONS_RAIO_MAX), filtrados em cone: a soma das
+ * potências dos que chegaram pelo lado da normal dividida pela área do
+ * disco que os contém. Pode ser chamada por várias threads ao mesmo
+ * tempo, e cada uma conta as suas consultas no seu buffer
+ * (omp_get_thread_num()).
+ *
+ * @param mapa Ponteiro para o mapa.
+ * @param ponto Ponteiro para o ponto.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @return Irradiância das cáusticas no ponto.
+ */
+cor_t fotons_irradiancia(mapa_fotons_t *mapa, ponto_t *ponto,
+    vetor_t *normal)
+{
+    int indices[FOTONS_MAX_VIZINHOS];
+    int num_pendentes, num_achados, vizinhos, indice, perto, longe, k;
+    int thread;
+    real_t distancias[FOTONS_MAX_VIZINHOS];
+    real_t raio2, raio, delta, distancia, peso;
+    pendente_foton_t pilha[PILHA_FOTONS], atual;
+    double inicio;
+    vetor_t diferenca;
+    no_foton_t *no;
+    foton_t *foton;
+    cor_t soma, temp1_v;
+
+    soma.x = soma.y = soma.z = 0.0;
+    if(mapa->num_fotons == 0)
+    {
+        return soma;
+    }
+
+    thread = omp_get_thread_num();
+    inicio = omp_get_wtime();
+    vizinhos = min(FOTONS_MAX_VIZINHOS, max(1, mapa->vizinhos));
+    raio2 = FOTONS_RAIO_MAX * FOTONS_RAIO_MAX;
+    num_achados = 0;
+
+    // Desce primeiro pelo lado do ponto; o outro lado fica na pilha com a
+    // distância à sua célula, que só muda no eixo do nó (onde passa a ser
+    // a distância ao plano dele). A célula da raiz é a caixa dos fótons.
+    pilha[0].indice = 0;
+    pilha[0].distancia = 0.0;
+    for(k = 0; k < 3; k++)
+    {
+        delta = max(componente(&mapa->caixa.min, k) - componente(ponto, k),
+            componente(ponto, k) - componente(&mapa->caixa.max, k));
+        pilha[0].afastamentos[k] = max(delta, 0.0);
+        pilha[0].distancia += pilha[0].afastamentos[k] *
+            pilha[0].afastamentos[k];
+    }
+    num_pendentes = 1;
+    while(num_pendentes > 0)
+    {
+        atual = pilha[--num_pendentes];
+        if(atual.distancia >= raio2)
+        {
+            continue;
+        }
+
+        for(indice = atual.indice; indice < mapa->num_fotons; indice = perto)
+        {
+            no = &mapa->nos[indice];
+            delta = componente(ponto, no->eixo) -
+                componente(&no->posicao, no->eixo);
+            perto = 2 * indice + (delta < 0.0 ? 1 : 2);
+            longe = 2 * indice + (delta < 0.0 ? 2 : 1);
+            distancia = atual.distancia + delta * delta -
+                atual.afastamentos[no->eixo] * atual.afastamentos[no->eixo];
+            if(longe < mapa->num_fotons && distancia < raio2)
+            {
+                pilha[num_pendentes] = atual;
+                pilha[num_pendentes].indice = longe;
+                pilha[num_pendentes].distancia = distancia;
+                pilha[num_pendentes++].afastamentos[no->eixo] = fabs(delta);
+            }
+
+            diferenca = sub_v(ponto, &no->posicao);
+            distancia = prod_e(&diferenca, &diferenca);
+            if(distancia < raio2)
+            {
+                raio2 = guardar_vizinho(indices, distancias, &num_achados,
+                    vizinhos, indice, distancia, raio2);
+            }
+        }
+    }
+
+    raio2 = max(raio2, (real_t) (EPSILON * EPSILON));
+    raio = sqrt(raio2);
+    for(k = 0; k < num_achados; k++)
+    {
+        foton = &mapa->fotons[indices[k]];
+        if(prod_e(&foton->direcao, normal) >= 0.0)
+        {
+            continue;
+        }
+
+        peso = 1.0 - sqrt(distancias[k]) / (FOTONS_CONE * raio);
+        temp1_v = mult_e(&foton->potencia, peso);
+        soma = soma_v(&soma, &temp1_v);
+    }
+    soma = mult_e(&soma, 1.0 / ((1.0 - 2.0 / (3.0 * FOTONS_CONE)) * PI *
+        raio2));
+
+    if(thread < mapa->num_buffers)
+    {
+        mapa->buffers[thread].consultas++;
+        mapa->buffers[thread].segundos += omp_get_wtime() - inicio;
+    }
+    return soma;
+}
+
+/**
+ * Passa as contagens de consultas dos buffers das threads para os totais
+ * do mapa (sem nenhuma thread consultando o mapa).
+ *
+ * @param mapa Ponteiro para o mapa.
+ */
+void fotons_somar_consultas(mapa_fotons_t *mapa)
+{
+    int t;
+
+    for(t = 0; t < mapa->num_buffers; t++)
+    {
+        mapa->consultas += mapa->buffers[t].consultas;
+        mapa->segundos_consultas += mapa->buffers[t].segundos;
+        mapa->buffers[t].consultas = 0;
+        mapa->buffers[t].segundos = 0.0;
+    }
+}
+
+/**
+ * Libera a memória do mapa.
+ *
+ * @param mapa Ponteiro para o mapa.
+ */
+void fotons_liberar(mapa_fotons_t *mapa)
+{
+    int t;
+
+    if(mapa == NULL)
+    {
+        return;
+    }
+
+    for(t = 0; t < mapa->num_buffers; t++)
+    {
+        free(mapa->buffers[t].posicoes);
+        free(mapa->buffers[t].fotons);
+    }
+    free(mapa->buffers);
+    free(mapa->nos);
+    free(mapa->fotons);
+    free(mapa);
+}
@@ -0,0 +1,137 @@
+#ifndef FOTONS_H
+#define FOTONS_H
+
+#include "geometria.h"
+
+/** Maior número de vizinhos de uma estimativa (tamanho do heap da busca). */
+#define FOTONS_MAX_VIZINHOS 256
+
+/** Raio máximo da busca: com menos vizinhos que isso dentro dele, a
+ * estimativa usa o disco inteiro. */
+#define FOTONS_RAIO_MAX 0.25
+
+/** Reflexões e refrações seguidas por um fóton. */
+#define FOTONS_MAX_REBOTES 8
+
+/** Inclinação do filtro em cone das estimativas (o peso de um fóton cai
+ * de 1 no centro a 1 - 1/FOTONS_CONE na borda do disco). */
+#define FOTONS_CONE 1.1
+
+/** Número mínimo de fótons para construir uma subárvore em paralelo. */
+#define FOTONS_MIN_TAREFA 4096
+
+/**
+ * Nó da árvore k-d do mapa de fótons: a posição de um fóton, que divide o
+ * espaço da sua subárvore num eixo.
+ */
+typedef struct {
+    ponto_t posicao;
+    int eixo; // 0, 1 ou 2 (x, y ou z).
+} no_foton_t;
+
+/**
+ * Fóton guardado numa superfície: a direção em que chegou e a potência
+ * que leva.
+ */
+typedef struct {
+    vetor_t direcao;
+    cor_t potencia;
+} foton_t;
+
+/**
+ * Fótons guardados por uma thread durante o traçado, e as buscas feitas
+ * por ela nos quadros.
+ */
+typedef struct {
+    ponto_t *posicoes;
+    foton_t *fotons;
+    int num_fotons, capacidade;
+    long long consultas; // Contagem desde a última soma.
+    double segundos; // Tempo dessas consultas.
+} buffer_fotons_t;
+
+/**
+ * Mapa de fótons das cáusticas (Jensen): os pontos onde chegam fótons
+ * emitidos pela luz local depois de ao menos uma reflexão ou refração,
+ * numa árvore k-d implícita e balanceada (os filhos do nó i nos índices
+ * 2i + 1 e 2i + 2, sem ponteiros) para a busca dos k vizinhos mais
+ * próximos. Durante os quadros o mapa só é lido.
+ */
+struct mapa_fotons {
+    no_foton_t *nos; // Em ordem de heap.
+    foton_t *fotons; // Na mesma ordem dos nós.
+    int num_fotons, capacidade;
+    caixa_t caixa; // Envolve todos os fótons (a célula da raiz).
+    int num_emitidos; // Fótons emitidos pela luz (0 se o mapa está vazio).
+    int vizinhos; // Fótons usados em cada estimativa (o k da busca).
+    buffer_fotons_t *buffers; // Um por thread.
+    int num_buffers;
+    double segundos_tracado, segundos_construcao; // Do último preparo.
+    long long consultas; // Totais das consultas já somadas.
+    double segundos_consultas;
+};
+
+/**
+ * Cria um mapa de fótons vazio.
+ *
+ * @param num_threads Número de threads que traçam e consultam o mapa (uma
+ * thread fora delas pode consultá-lo, mas não entra nas contagens).
+ * @return Ponteiro para o mapa ou NULL se faltar memória.
+ */
+mapa_fotons_t *fotons_criar(int num_threads);
+
+/**
+ * Refaz o mapa: emite fótons da posição da luz local só para os cones das
+ * esferas que envolvem os objetos limitados refletíveis ou transparentes
+ * (Sobol no cone, como num mapa de projeção; os planos não geram
+ * cáusticas), e segue cada um pelas reflexões e refrações que sorteia com
+ * probabilidade igual ao peso delas (o resto da luz fica na superfície).
+ * Cada ponto tocado depois da primeira reflexão ou refração guarda um
+ * fóton. Como a luz local não se atenua com a distância, a potência de um
+ * fóton é a que cobre, no primeiro ponto que ele toca, o ângulo sólido de
+ * um fóton. O traçado e a construção da
+ * árvore (a mediana de cada subárvore no eixo mais comprido da sua caixa,
+ * com tarefas do OpenMP) usam as threads do mapa, e os seus tempos ficam
+ * no mapa.
+ *
+ * @param mapa Ponteiro para o mapa.
+ * @param cena Ponteiro para a cena.
+ * @param luz_local Ponteiro para a luz local.
+ * @param num_emitidos Número de fótons emitidos.
+ * @return 1 em caso de sucesso, 0 se faltar memória (o mapa fica vazio).
+ */
+int fotons_preparar(mapa_fotons_t *mapa, cena_t *cena, luz_t *luz_local,
+    int num_emitidos);
+
+/**
+ * Estima a irradiância das cáusticas num ponto pelos mapa->vizinhos fótons
+ * mais próximos (até FOTONS_RAIO_MAX), filtrados em cone: a soma das
+ * potências dos que chegaram pelo lado da normal dividida pela área do
+ * disco que os contém. Pode ser chamada por várias threads ao mesmo
+ * tempo, e cada uma conta as suas consultas no seu buffer
+ * (omp_get_thread_num()).
+ *
+ * @param mapa Ponteiro para o mapa.
+ * @param ponto Ponteiro para o ponto.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @return Irradiância das cáusticas no ponto.
+ */
+cor_t fotons_irradiancia(mapa_fotons_t *mapa, ponto_t *ponto,
+    vetor_t *normal);
+
+/**
+ * Passa as contagens de consultas dos buffers das threads para os totais
+ * do mapa (sem nenhuma thread consultando o mapa).
+ *
+ * @param mapa Ponteiro para o mapa.
+ */
+void fotons_somar_consultas(mapa_fotons_t *mapa);
+
+/**
+ * Libera a memória do mapa.
+ *
+ * @param mapa Ponteiro para o mapa.
+ */
+void fotons_liberar(mapa_fotons_t *mapa);
+
+#endif // FOTONS_H
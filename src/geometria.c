@@ -1,13 +1,23 @@
 #include "geometria.h"
+#include "bvh.h"
+#include "cena.h"
+#include "amostrador.h"
+#include "luzes.h"
+#include "fotons.h"
+#include "irradiancia.h"
+#include "malha.h"
+#include "onda.h"
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-extern double ka;
-extern double kd;
-extern double ks;
-extern double eta;
-extern double os;
+extern real_t ka;
+extern real_t kd;
+extern real_t ks;
+extern real_t eta;
+extern real_t os;
+extern real_t kr;
 
 /** 
  * Esta função faz a soma de dois vetores.
@@ -48,7 +58,7 @@ vetor_t sub_v(vetor_t *v1, vetor_t *v2)
  * @param k Escalar que multiplica o vetor v1.
  * @return Produto de k por v1.
  */
-vetor_t mult_e(vetor_t *v1, double k)
+vetor_t mult_e(vetor_t *v1, real_t k)
 {
     vetor_t v2;
     v2.x = v1->x * k;
@@ -94,7 +104,7 @@ vetor_t neg_v(vetor_t *v1)
  * @param v1 Ponteiro para o vetor.
  * @return Módulo (norma) do vetor v1.
  */
-double modulo(vetor_t *v1)
+real_t modulo(vetor_t *v1)
 {
     return sqrt(v1->x * v1->x + v1->y * v1->y + v1->z * v1->z);
 }
@@ -109,7 +119,7 @@ double modulo(vetor_t *v1)
 vetor_t normalizar(vetor_t *v1)
 {
     vetor_t v2;
-    double norma = modulo(v1);
+    real_t norma = modulo(v1);
     v2.x = v1->x/norma;
     v2.y = v1->y/norma;
     v2.z = v1->z/norma;
@@ -123,7 +133,7 @@ vetor_t normalizar(vetor_t *v1)
  * @param v2 Ponteiro para o segundo vetor.
  * @return Resultado do produto escalar entre v1 e v2.
  */
-double prod_e(vetor_t *v1, vetor_t *v2)
+real_t prod_e(vetor_t *v1, vetor_t *v2)
 {
     return v1->x * v2->x + v1->y * v2->y + v1->z * v2->z;
 }
@@ -145,6 +155,68 @@ vetor_t prod_v(vetor_t *v1, vetor_t *v2)
     return v3;
 }
 
+/**
+ * Retorna a componente de um ponto (ou vetor) num eixo.
+ *
+ * @param p Ponteiro para o ponto.
+ * @param eixo Eixo (0 = x, 1 = y, 2 = z).
+ * @return Coordenada do ponto no eixo.
+ */
+real_t componente(ponto_t *p, int eixo)
+{
+    return eixo == 0 ? p->x : (eixo == 1 ? p->y : p->z);
+}
+
+/**
+ * Realoca um array para n elementos de um tamanho dado. Se faltar
+ * memória, o array antigo fica como estava.
+ *
+ * @param array Ponteiro para o ponteiro do array (trocado pelo novo).
+ * @param n Número de elementos.
+ * @param tamanho Tamanho de cada elemento.
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+int realocar(void **array, int n, size_t tamanho)
+{
+    void *temp;
+
+    temp = realloc(*array, (size_t) n * tamanho);
+    if(temp == NULL)
+    {
+        return 0;
+    }
+
+    *array = temp;
+    return 1;
+}
+
+/** 
+ * Afasta um ponto de uma superfície ao longo da normal, para o lado em 
+ * que segue a direção dada. O afastamento é proporcional ao tamanho das 
+ * coordenadas do ponto, já que o erro de arredondamento também é.
+ * 
+ * @param ponto Ponteiro para o ponto na superfície.
+ * @param normal Ponteiro para a normal (normalizada) da superfície.
+ * @param direcao Ponteiro para a direção do raio que sairá do ponto.
+ * @return Ponto deslocado.
+ */
+ponto_t deslocar_ponto(ponto_t *ponto, vetor_t *normal, vetor_t *direcao)
+{
+    real_t escala;
+    vetor_t deslocamento;
+    
+    escala = max(fabs(ponto->x), max(fabs(ponto->y), fabs(ponto->z)));
+    escala = DESLOCAMENTO_RELATIVO * max(escala, (real_t) 1.0);
+    
+    if(prod_e(normal, direcao) < 0)
+    {
+        escala = -escala;
+    }
+    
+    deslocamento = mult_e(normal, escala);
+    return soma_v(ponto, &deslocamento);
+}
+
 /**
  * Verifica se um determinado raio intersecta uma esfera no espaço.
  * 
@@ -160,10 +232,10 @@ vetor_t prod_v(vetor_t *v1, vetor_t *v2)
  * @return 1 se o raio intersecta a esfera, 0 caso contrário.
  */ 
 int intersecao_esfera(ponto_t *origem_raio, vetor_t *direcao_raio, 
-    esfera_t *esfera, double *t0, double *t1, vetor_t *normal)
+    esfera_t *esfera, real_t *t0, real_t *t1, vetor_t *normal)
 {
     vetor_t distancia, temp1_v, ponto_intersec;
-    double res, quad_raio, quad_cateto, diferenca;
+    real_t res, quad_raio, quad_cateto, diferenca;
     
     quad_raio = (esfera->raio * esfera->raio);
     
@@ -174,7 +246,8 @@ int intersecao_esfera(ponto_t *origem_raio, vetor_t *direcao_raio,
     // entre -90° e +90°.
     res = prod_e(&distancia, direcao_raio);
     
-    if(res < 0)
+    // Só um raio de dentro da esfera (refratado) pode se afastar do centro.
+    if(res < 0 && prod_e(&distancia, &distancia) > quad_raio)
     {
         return 0;
     }
@@ -193,8 +266,8 @@ int intersecao_esfera(ponto_t *origem_raio, vetor_t *direcao_raio,
     *t0 = res - diferenca;
     *t1 = res + diferenca;
     
-    // Calcula a normal.
-    temp1_v = mult_e(direcao_raio, *t0);
+    // Calcula a normal (na saída, se o raio partir de dentro da esfera).
+    temp1_v = mult_e(direcao_raio, *t0 >= 0 ? *t0 : *t1);
     ponto_intersec = soma_v(origem_raio, &temp1_v);
 
     *normal = sub_v(&ponto_intersec, &esfera->centro);
@@ -218,12 +291,12 @@ int intersecao_esfera(ponto_t *origem_raio, vetor_t *direcao_raio,
  * @return 1 se o raio intersecta o piramide, 0 caso contrário.
  */ 
 int intersecao_triangulo(ponto_t *origem_raio, vetor_t *direcao_raio, 
-    triangulo_t *triangulo, double *t0, vetor_t *normal)
+    triangulo_t *triangulo, real_t *t0, vetor_t *normal)
 {
     vetor_t v1, v2, temp1_v, temp2_v;
     ponto_t ponto_intersec;
-    double denominador;
-    double d, t0_temp;
+    real_t denominador;
+    real_t d, t0_temp;
     
     // Calcula os vetores a partir dos vértices o triângulo. 
     v1 = sub_v(&triangulo->vertices[1], &triangulo->vertices[0]);
@@ -302,9 +375,9 @@ int intersecao_triangulo(ponto_t *origem_raio, vetor_t *direcao_raio,
  * @return 1 se o raio intersecta o piramide, 0 caso contrário.
  */ 
 int intersecao_piramide(ponto_t *origem_raio, vetor_t *direcao_raio, 
-    piramide_t *piramide, double *t0, double *t1, vetor_t *normal)
+    piramide_t *piramide, real_t *t0, real_t *t1, vetor_t *normal)
 {
-    double temp; // Usado no swap de t0 e t1
+    real_t temp; // Usado no swap de t0 e t1
     int i, contagem;
     triangulo_t triangulos[4];
     
@@ -373,10 +446,10 @@ int intersecao_piramide(ponto_t *origem_raio, vetor_t *direcao_raio,
  * @return 1 se o raio intersecta o piramide, 0 caso contrário.
  */ 
 int intersecao_plano(ponto_t *origem_raio, vetor_t *direcao_raio, 
-    plano_t *plano, double *t0)
+    plano_t *plano, real_t *t0)
 {
 
-    double denominador, d, t0_temp;
+    real_t denominador, d, t0_temp;
     
     // Resultado parcial para encontrar o ponto de intersecção.
     denominador = prod_e(&plano->normal, direcao_raio);
@@ -404,22 +477,14 @@ int intersecao_plano(ponto_t *origem_raio, vetor_t *direcao_raio,
 
 
 /**
- * Verifica se um determinado raio intersecta uma cubo no espaço.
- * 
- * @param origem_raio Ponteiro para o ponto no espaço de onde o 
- * raio parte.
- * @param direcao_raio Ponteiro para o vetor que determina a direção
- * do raio.
- * @param esf Ponteiro para o cubo a ser intersectado.
- * @param t0 Ponteiro para a distância horizontal entre o ponto de 
- * origem e o primeiro ponto de interseção (é modificada na função).
- * @param t1 Ponteiro para a distância horizontal entre o ponto de 
- * origem e o segundo ponto de interseção (é modificada na função).
- * @return 1 se o raio intersecta o cubo, 0 caso contrário.
+ * Verifica se um determinado raio intersecta um cubo testando os seus 12
+ * triângulos (usado quando os vértices não formam um paralelepípedo reto).
  */ 
-int intersecao_cubo(ponto_t *origem_raio, vetor_t *direcao_raio, cubo_t *cubo, double *t0, double *t1, vetor_t *normal)
+static int intersecao_cubo_triangulos(ponto_t *origem_raio, 
+    vetor_t *direcao_raio, cubo_t *cubo, real_t *t0, real_t *t1, 
+    vetor_t *normal)
 {
-    double t0_temp;
+    real_t t0_temp;
 	vetor_t normal_temp;
     int i;
    
@@ -517,339 +582,1420 @@ int intersecao_cubo(ponto_t *origem_raio, vetor_t *direcao_raio, cubo_t *cubo, d
 
 
 
-/** 
- * Faz a operação de raytracing resursiva. 
- * 
- * @param origem_raio Ponteiro para o ponto no espaço de onde o 
- * raio parte.
- * @param direcao_raio Ponteiro para o vetor que determina a direção
- * do raio.
- * @param luz_local Ponteiro para a luz local (pontual).
- * @param luz_ambiente Ponteiro para a luz ambiente.
- * @param objetos Array com objetos colocados no espaço.
- * @param num_objetos Número de objetos do array de objetos.
- * @param num_reflexoes Número de reflexões (usado na versão recursiva).
- * @param max_recursoes Número máximo de reflexões (usado na versão recursiva).
- * @param num_esferas Número de esferas do array anterior.
- * 
+/**
+ * Teste das placas com uma caixa que também retorna a normal da face 
+ * tocada. As escolhas de eixo e de sinal são feitas por seleção (sem 
+ * desvios dependentes dos dados), apenas o resultado final é testado.
+ * Se a origem estiver dentro da caixa, a normal é a da face de saída.
  */
-cor_t raytrace(ponto_t *origem_raio, vetor_t *direcao_raio, luz_t *luz_local,  
-    luz_t *luz_ambiente, objeto_t *objetos, int num_objetos, int num_reflexoes,  
-    int max_recursoes)
-
+static int intersecao_placas(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    caixa_t *caixa, real_t *t0, real_t *t1, vetor_t *normal)
 {
-    cor_t cor_final;
-    double tperto, t0_esfera, t1_esfera, t0_piramide, t1_piramide, t0_plano, t0_cubo, t1_cubo;
-    int i;
-    objeto_t *objeto_perto;
-    vetor_t normal, normal_pir, normal_cubo, normal_esf, temp1_v;
-    ponto_t ponto_intersec;
+    real_t ta, tb, ex, ey, ez, sx, sy, sz, tentrada, tsaida, t;
+    int eixo, dentro;
     
-    objeto_perto = 0;
-    tperto = INFINITO; 
-
-    // Se não tocar nenhum objeto, então a cor será negativa. 
-    cor_final.x = -1.0;
-    cor_final.y = -1.0;
-    cor_final.z = -1.0;
+    ta = (caixa->min.x - origem_raio->x) / direcao_raio->x;
+    tb = (caixa->max.x - origem_raio->x) / direcao_raio->x;
+    ex = ta < tb ? ta : tb;
+    sx = ta < tb ? tb : ta;
     
+    ta = (caixa->min.y - origem_raio->y) / direcao_raio->y;
+    tb = (caixa->max.y - origem_raio->y) / direcao_raio->y;
+    ey = ta < tb ? ta : tb;
+    sy = ta < tb ? tb : ta;
     
-    // Encontra o objeto mais perto da câmera (caso exista).
-    for (i = 0; i < num_objetos; ++i)
-    {
-        t0_esfera = INFINITO; 
-        t1_esfera = INFINITO;
-        t0_piramide = INFINITO; 
-        t1_piramide = INFINITO;
-        t0_cubo = INFINITO;
-        t1_cubo = INFINITO;
-        t0_plano = INFINITO; 
-        
-        if (objetos[i].tipo == ESFERA)
-        {
-            intersecao_esfera(origem_raio, direcao_raio, objetos[i].esfera, 
-            &t0_esfera, &t1_esfera, &normal_esf);
-
-            if(t0_esfera == INFINITO) // Verifica se não tocou nenhuma.
-            {
-                continue;
-            }
-
-            if (t0_esfera  < 0) // Caso o raio tenha intersectado a borda.
-            { 
-                t0_esfera  = t1_esfera;
-            }
-            if (t0_esfera < tperto)
-            {
-                tperto = t0_esfera;        
-                objeto_perto = &objetos[i];
-                normal = normal_esf;
-                
-            }     
-        }
-        else if (objetos[i].tipo == PIRAMIDE)
-        {
-            intersecao_piramide(origem_raio, direcao_raio, 
-            objetos[i].piramide, &t0_piramide, &t1_piramide, 
-            &normal_pir);
-
-            if(t0_piramide == INFINITO) // Verifica se não tocou nenhuma.
-            {
-                continue;
-            }
-
-            if (t0_piramide  < 0) // Caso o raio tenha intersectado a borda.
-            { 
-                t0_piramide  = t1_piramide;
-            }
-
-            // Caso esta pirâmide seja a mais perto do observador.
-            if (t0_piramide < tperto)
-            {
-                tperto = t0_piramide;
-                objeto_perto = &objetos[i];
-                normal = normal_pir;
-            }
-        }
-        else if (objetos[i].tipo == CUBO)
-        {
-            
-            intersecao_cubo(origem_raio, direcao_raio, 
-                objetos[i].cubo, &t0_cubo, &t1_cubo, 
-                &normal_cubo);
-                
-            if(t0_cubo == INFINITO) // Verifica se não tocou nenhuma.
-            {
-                continue;
-            }  
-
-            if (t0_cubo  < 0) // Caso o raio tenha intersectado a borda.
-            { 
-                t0_cubo  = t1_cubo;
-            }
-
-            // Caso esta pirâmide seja a mais perto do observador.
-            if (t0_cubo < tperto)
-            {
-                tperto = t0_cubo;
-                objeto_perto = &objetos[i];
-                normal = normal_cubo;    
-            }              
-        }
-        
-        else if (objetos[i].tipo == PLANO)
-        {
-            intersecao_plano(origem_raio, direcao_raio, 
-                objetos[i].plano, &t0_plano);
-            
-                
-            if(t0_plano == INFINITO) // Verifica se não tocou nenhuma.
-            {
-               continue;
-            }
-
-            // Caso esta pirâmide seja a mais perto do observador.
-            if (t0_plano < tperto)
-            {
-                tperto = t0_plano;
-                objeto_perto = &objetos[i];
-                normal = objeto_perto->plano->normal;
-            }
-        }
-        else
-        {
-        }
-          
-    }
+    ta = (caixa->min.z - origem_raio->z) / direcao_raio->z;
+    tb = (caixa->max.z - origem_raio->z) / direcao_raio->z;
+    ez = ta < tb ? ta : tb;
+    sz = ta < tb ? tb : ta;
     
-    // Verifica se algum objeto não foi intersectado.
-    if(objeto_perto == 0) 
-    {
-        return cor_final;
-    }
+    tentrada = max(ex, max(ey, ez));
+    tsaida = min(sx, min(sy, sz));
     
-    // Inverte o sentido da normal caso ela esteja dentro da esfera.
-    if(prod_e(direcao_raio, &normal) > 0)
+    if(tsaida < tentrada || tsaida < 0)
     {
-        normal = neg_v(&normal);
+        return 0;
     }
     
-    // Calcula o ponto de intersecção do objeto.
-    temp1_v = mult_e(direcao_raio, tperto);
-    ponto_intersec = soma_v(origem_raio, &temp1_v);    
-    
-    cor_final = calcular_iluminacao(origem_raio, direcao_raio, 
-        luz_local, luz_ambiente, objetos, num_objetos, 
-        objeto_perto, &ponto_intersec, &normal);
+    // Escolhe a face de entrada ou, com a origem dentro, a de saída.
+    dentro = tentrada < 0;
+    t = dentro ? tsaida : tentrada;
+    eixo = dentro ? (t == sx ? 0 : (t == sy ? 1 : 2)) : 
+        (t == ex ? 0 : (t == ey ? 1 : 2));
     
-  
-    return cor_final;
+    // A normal aponta contra o raio na entrada e a favor dele na saída.
+    normal->x = (eixo == 0) * ((direcao_raio->x > 0) == dentro ? 1.0 : -1.0);
+    normal->y = (eixo == 1) * ((direcao_raio->y > 0) == dentro ? 1.0 : -1.0);
+    normal->z = (eixo == 2) * ((direcao_raio->z > 0) == dentro ? 1.0 : -1.0);
     
+    *t0 = tentrada;
+    *t1 = tsaida;
+    return 1;
 }
 
 
 /**
- * Equação de Phong da iluminação, que serve para calcular a cor do objeto.
+ * Verifica se um determinado raio intersecta uma cubo no espaço.
  * 
  * @param origem_raio Ponteiro para o ponto no espaço de onde o 
  * raio parte.
- * @param luz_local Ponteiro para a luz local (pontual).
- * @param luz_ambiente Ponteiro para a luz ambiente.
- * @param pos_ponto Posição do ponto do objeto a ser avaliado.
- * @param normal_ponto Vetor normal que indica o plano onde está o ponto.
- * @param cor_ponto Cor do ponto a ser pintado.
- * 
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param esf Ponteiro para o cubo a ser intersectado.
+ * @param t0 Ponteiro para a distância horizontal entre o ponto de 
+ * origem e o primeiro ponto de interseção (é modificada na função).
+ * @param t1 Ponteiro para a distância horizontal entre o ponto de 
+ * origem e o segundo ponto de interseção (é modificada na função).
+ * @return 1 se o raio intersecta o cubo, 0 caso contrário.
  */ 
-cor_t equacao_phong(ponto_t *origem_raio, luz_t *luz_local, 
-    luz_t *luz_ambiente, ponto_t *pos_ponto, vetor_t *normal_ponto, 
-    cor_t *cor_ponto)
+int intersecao_cubo(ponto_t *origem_raio, vetor_t *direcao_raio, cubo_t *cubo, 
+    real_t *t0, real_t *t1, vetor_t *normal)
 {
-    cor_t ambiente, difusa, especular, cor_final;
-    vetor_t dir_luz, dir_obs, raio_refletido;
-
-    // Variáveis auxiliares no cálculo vetorial.
-    double temp1_d;
-    vetor_t temp1_v;
+    ponto_t origem_local;
+    vetor_t direcao_local, normal_local, temp1_v;
     
-    // Calcula a direção para o observador do ponto para o observador.
-    dir_obs = sub_v(origem_raio, pos_ponto);
-    dir_obs = normalizar(&dir_obs);
-    
-    // Calcula a direção do raio refletido e normaliza-o.
-    dir_luz = neg_v(&dir_luz);
-    temp1_v = mult_e(normal_ponto, 2 * prod_e(&dir_luz, normal_ponto));
-    raio_refletido = sub_v(&dir_luz, &temp1_v);
-    raio_refletido = normalizar(&raio_refletido);    
+    if(cubo->forma == CUBO_ALINHADO)
+    {
+        return intersecao_placas(origem_raio, direcao_raio, &cubo->caixa, 
+            t0, t1, normal);
+    }
     
-    // Calcula a direção da luz (ponto intersec até a luz).
-    dir_luz = sub_v(&luz_local->posicao, pos_ponto);
-    dir_luz = normalizar(&dir_luz);
+    if(cubo->forma == CUBO_TRIANGULOS)
+    {
+        return intersecao_cubo_triangulos(origem_raio, direcao_raio, cubo, 
+            t0, t1, normal);
+    }
     
-    // Calcula a luz ambiente;.
-    ambiente = mult_e(&luz_ambiente->cor, ka);
+    // Caixa orientada: leva o raio para o espaço local do cubo.
+    temp1_v = sub_v(origem_raio, &cubo->centro);
+    origem_local.x = prod_e(&temp1_v, &cubo->eixos[0]);
+    origem_local.y = prod_e(&temp1_v, &cubo->eixos[1]);
+    origem_local.z = prod_e(&temp1_v, &cubo->eixos[2]);
+    direcao_local.x = prod_e(direcao_raio, &cubo->eixos[0]);
+    direcao_local.y = prod_e(direcao_raio, &cubo->eixos[1]);
+    direcao_local.z = prod_e(direcao_raio, &cubo->eixos[2]);
     
-    // Calcula a luz difusa
-    difusa = mult_e(&luz_local->cor, kd * max(0.0f, prod_e(normal_ponto, &dir_luz)));
-
-    // Calcula a luz especular
-    temp1_d = max(0.0f, prod_e(&raio_refletido, &dir_obs));
-    especular = mult_e(&luz_local->cor, os * ks * pow(temp1_d, eta));
+    if(!intersecao_placas(&origem_local, &direcao_local, &cubo->caixa, 
+        t0, t1, &normal_local))
+    {
+        return 0;
+    }
     
-    // Calcula a cor final (soma das luzes).
-    cor_final = soma_v(&ambiente, &difusa);
-    cor_final = soma_v(&cor_final, &especular);
-    cor_final = mult_v(cor_ponto, &cor_final);
-
-    return cor_final;
+    // Volta a normal para o mundo.
+    *normal = mult_e(&cubo->eixos[0], normal_local.x);
+    temp1_v = mult_e(&cubo->eixos[1], normal_local.y);
+    *normal = soma_v(normal, &temp1_v);
+    temp1_v = mult_e(&cubo->eixos[2], normal_local.z);
+    *normal = soma_v(normal, &temp1_v);
+    return 1;
 }
 
 
 /**
- * Equação de Phong da iluminação, que serve para calcular a cor do objeto.
- * 
- * @param origem_raio Ponteiro para o ponto no espaço de onde o 
- * raio parte.
- * @param luz_local Ponteiro para a luz local (pontual).
- * @param luz_ambiente Ponteiro para a luz ambiente.
- * @param objetos Array de objetos.
- * @param num_objetos Número e objetos no array.
- * @param objeto_perto Objeto mais perto da câmera.
- * @param ponto_intersec Ponto de interseção entre o raio e o objeto.
- * @param normal Vetor normal que indica o plano onde está o ponto.
+ * Detecta a forma de um cubo a partir dos seus 8 vértices. Se eles 
+ * formarem uma caixa alinhada aos eixos, guarda apenas os cantos min/max; 
+ * se formarem um paralelepípedo reto qualquer, guarda o centro, os eixos 
+ * e a caixa no espaço local. Caso contrário, o cubo continua sendo 
+ * testado pelos seus 12 triângulos.
  * 
+ * @param cubo Ponteiro para o cubo a ser preparado.
  */ 
-cor_t calcular_iluminacao(ponto_t *origem_raio, vetor_t *direcao_raio, 
-    luz_t *luz_local, luz_t *luz_ambiente, objeto_t *objetos, int num_objetos, 
-    objeto_t *objeto_perto, ponto_t *ponto_intersec, vetor_t *normal)
+void cubo_preparar(cubo_t *cubo)
 {
+    vetor_t arestas[3], temp1_v;
+    real_t tamanhos[3], coord, tolerancia;
+    int i, k, alinhado, cantos, canto;
     
-    int j, luz_direta;
-    vetor_t direcao_luz;
-    luz_t luz_local_final;
-    cor_t cor_final;
-    double t0, t1;
-    vetor_t temp1_v;
+    cubo->forma = CUBO_TRIANGULOS;
     
-    // Percore os demais objetos para ver se há algum na frente.
-    luz_direta = 1;
+    // As arestas saem do vértice 0 (para baixo, para a direita e para trás).
+    arestas[0] = sub_v(&cubo->vertices[1], &cubo->vertices[0]);
+    arestas[1] = sub_v(&cubo->vertices[2], &cubo->vertices[0]);
+    arestas[2] = sub_v(&cubo->vertices[4], &cubo->vertices[0]);
     
-    // Calcula a direção do vetor que sai do ponto até a fonte de luz.
-    direcao_luz = sub_v(&luz_local->posicao, ponto_intersec);
-    direcao_luz = normalizar(&direcao_luz);
-    
-    for(j = 0; j < num_objetos; j++)
-    {		
-        if (objetos[j].tipo == ESFERA)
+    for(k = 0; k < 3; k++)
+    {
+        tamanhos[k] = modulo(&arestas[k]);
+        if(tamanhos[k] < EPSILON)
         {
-            if(intersecao_esfera(ponto_intersec, &direcao_luz, 
-                objetos[j].esfera, &t0, &t1, &temp1_v))
-            {
-                if(objeto_perto != &objetos[j])
-                {
-					luz_direta = 0;
-                }
-            }
+            return;
         }
-        else if (objetos[j].tipo == PIRAMIDE)
+        cubo->eixos[k] = mult_e(&arestas[k], 1.0 / tamanhos[k]);
+    }
+    
+    // As arestas precisam ser perpendiculares entre si.
+    if(fabs(prod_e(&cubo->eixos[0], &cubo->eixos[1])) > EPSILON ||
+        fabs(prod_e(&cubo->eixos[0], &cubo->eixos[2])) > EPSILON ||
+        fabs(prod_e(&cubo->eixos[1], &cubo->eixos[2])) > EPSILON)
+    {
+        return;
+    }
+    
+    // Cada vértice precisa ser um canto diferente do paralelepípedo.
+    cantos = 0;
+    for(i = 0; i < 8; i++)
+    {
+        canto = 0;
+        temp1_v = sub_v(&cubo->vertices[i], &cubo->vertices[0]);
+        for(k = 0; k < 3; k++)
         {
-            if(intersecao_piramide(ponto_intersec, &direcao_luz, 
-                objetos[j].piramide, &t0, &t1, 
-                &temp1_v))
+            coord = prod_e(&temp1_v, &cubo->eixos[k]);
+            tolerancia = EPSILON * tamanhos[k];
+            if(fabs(coord - tamanhos[k]) < tolerancia)
             {
-                if(objeto_perto != &objetos[j])
-                {
-					luz_direta = 0;
-                }
+                canto |= 1 << k;
             }
-        }
-        else if (objetos[j].tipo == CUBO)
-        {
-                        
-            if(intersecao_cubo(ponto_intersec, &direcao_luz, 
-                objetos[j].cubo, &t0, &t1, 
-                &temp1_v))
+            else if(fabs(coord) >= tolerancia)
             {
-                if(objeto_perto != &objetos[j])
-                {
-					luz_direta = 0;
-                }
+                return;
             }
         }
-        else if (objetos[j].tipo == PLANO)
+        cantos |= 1 << canto;
+    }
+    
+    if(cantos != 0xFF)
+    {
+        return;
+    }
+    
+    // Caixa orientada, com o centro na origem do espaço local.
+    temp1_v = soma_v(&arestas[0], &arestas[1]);
+    temp1_v = soma_v(&temp1_v, &arestas[2]);
+    temp1_v = mult_e(&temp1_v, 0.5);
+    cubo->centro = soma_v(&cubo->vertices[0], &temp1_v);
+    
+    // Verifica se cada eixo é paralelo a um dos eixos do mundo.
+    alinhado = 1;
+    for(k = 0; k < 3; k++)
+    {
+        if(fabs(cubo->eixos[k].x) < 1.0 - EPSILON && 
+            fabs(cubo->eixos[k].y) < 1.0 - EPSILON &&
+            fabs(cubo->eixos[k].z) < 1.0 - EPSILON)
         {
-            if(intersecao_plano(ponto_intersec, &direcao_luz, 
-            objetos[j].plano, &t0))
-            {
-                if(objeto_perto != &objetos[j])
-                {
-                    luz_direta = 0;
-                }
-            }
+            alinhado = 0;
         }
-        else
+    }
+    
+    if(alinhado)
+    {
+        cubo->forma = CUBO_ALINHADO;
+        cubo->caixa = caixa_vazia();
+        for(i = 0; i < 8; i++)
         {
+            caixa_expandir(&cubo->caixa, &cubo->vertices[i]);
         }
-        
-       if (!luz_direta)
-       {
-           break;
-       }
+        return;
     }
+    
+    cubo->forma = CUBO_ORIENTADO;
+    cubo->caixa.min.x = -0.5 * tamanhos[0];
+    cubo->caixa.min.y = -0.5 * tamanhos[1];
+    cubo->caixa.min.z = -0.5 * tamanhos[2];
+    cubo->caixa.max.x = 0.5 * tamanhos[0];
+    cubo->caixa.max.y = 0.5 * tamanhos[1];
+    cubo->caixa.max.z = 0.5 * tamanhos[2];
+}
 
-    luz_local_final = *luz_local;
-        
-    if(!luz_direta)
+
+/**
+ * Verifica se um determinado raio intersecta uma caixa alinhada aos eixos
+ * (teste das placas).
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param inv_direcao Ponteiro para o inverso de cada componente da 
+ * direção do raio.
+ * @param caixa Ponteiro para a caixa a ser intersectada.
+ * @param tmax Distância máxima a ser considerada.
+ * @param t0 Ponteiro para a distância de entrada na caixa (é modificada 
+ * na função).
+ * @return 1 se o raio intersecta a caixa antes de tmax, 0 caso contrário.
+ */ 
+int intersecao_caixa(ponto_t *origem_raio, vetor_t *inv_direcao, 
+    caixa_t *caixa, real_t tmax, real_t *t0)
+{
+    real_t ta, tb, tentrada, tsaida;
+
+    ta = (caixa->min.x - origem_raio->x) * inv_direcao->x;
+    tb = (caixa->max.x - origem_raio->x) * inv_direcao->x;
+    tentrada = ta < tb ? ta : tb;
+    tsaida = ta < tb ? tb : ta;
+
+    ta = (caixa->min.y - origem_raio->y) * inv_direcao->y;
+    tb = (caixa->max.y - origem_raio->y) * inv_direcao->y;
+    tentrada = max(tentrada, ta < tb ? ta : tb);
+    tsaida = min(tsaida, ta < tb ? tb : ta);
+
+    ta = (caixa->min.z - origem_raio->z) * inv_direcao->z;
+    tb = (caixa->max.z - origem_raio->z) * inv_direcao->z;
+    tentrada = max(tentrada, ta < tb ? ta : tb);
+    tsaida = min(tsaida, ta < tb ? tb : ta);
+
+    if(tsaida < tentrada || tsaida < 0 || tentrada > tmax)
     {
-        luz_local_final.cor.x = 0.0;
-        luz_local_final.cor.y = 0.0;
-        luz_local_final.cor.z = 0.0;
+        return 0;
     }
 
-	// Calcula a cor a partir da equação de Phong.
-    cor_final = equacao_phong(origem_raio, &luz_local_final, luz_ambiente, 
-        ponto_intersec, normal, &objeto_perto->cor);    
-    
-    return cor_final;
-    
+    *t0 = tentrada;
+    return 1;
+}
+
+
+/**
+ * Verifica se um raio de um pacote de raios de sombra intersecta uma
+ * caixa (as mesmas contas de intersecao_caixa(), lidas dos arrays do
+ * pacote).
+ *
+ * @param pacote Ponteiro para o pacote.
+ * @param k Posição do raio no pacote.
+ * @param caixa Ponteiro para a caixa.
+ * @param tmax Distância máxima a ser considerada.
+ * @return 1 se o raio intersecta a caixa, 0 caso contrário.
+ */
+int intersecao_caixa_pacote(pacote_sombra_t *pacote, int k, caixa_t *caixa,
+    real_t tmax)
+{
+    real_t ta, tb, tentrada, tsaida;
+
+    ta = (caixa->min.x - pacote->origem_x[k]) * pacote->inv_x[k];
+    tb = (caixa->max.x - pacote->origem_x[k]) * pacote->inv_x[k];
+    tentrada = ta < tb ? ta : tb;
+    tsaida = ta < tb ? tb : ta;
+
+    ta = (caixa->min.y - pacote->origem_y[k]) * pacote->inv_y[k];
+    tb = (caixa->max.y - pacote->origem_y[k]) * pacote->inv_y[k];
+    tentrada = max(tentrada, ta < tb ? ta : tb);
+    tsaida = min(tsaida, ta < tb ? tb : ta);
+
+    ta = (caixa->min.z - pacote->origem_z[k]) * pacote->inv_z[k];
+    tb = (caixa->max.z - pacote->origem_z[k]) * pacote->inv_z[k];
+    tentrada = max(tentrada, ta < tb ? ta : tb);
+    tsaida = min(tsaida, ta < tb ? tb : ta);
+
+    return !(tsaida < tentrada || tsaida < 0 || tentrada > tmax);
 }
 
+/**
+ * Verifica se um determinado raio intersecta um objeto qualquer da cena.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param objeto Ponteiro para o objeto a ser intersectado.
+ * @param t0 Ponteiro para a menor distância positiva de interseção 
+ * (é modificada na função).
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @return 1 se o raio intersecta o objeto, 0 caso contrário.
+ */ 
+int intersecao_objeto(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    objeto_t *objeto, real_t *t0, vetor_t *normal)
+{
+    real_t t0_temp, t1_temp;
+    
+    t0_temp = INFINITO;
+    t1_temp = INFINITO;
+    
+    if (objeto->tipo == ESFERA)
+    {
+        intersecao_esfera(origem_raio, direcao_raio, objeto->esfera, 
+            &t0_temp, &t1_temp, normal);
+    }
+    else if (objeto->tipo == PIRAMIDE)
+    {
+        intersecao_piramide(origem_raio, direcao_raio, objeto->piramide, 
+            &t0_temp, &t1_temp, normal);
+    }
+    else if (objeto->tipo == CUBO)
+    {
+        intersecao_cubo(origem_raio, direcao_raio, objeto->cubo, 
+            &t0_temp, &t1_temp, normal);
+    }
+    else if (objeto->tipo == PLANO)
+    {
+        intersecao_plano(origem_raio, direcao_raio, objeto->plano, &t0_temp);
+        *normal = objeto->plano->normal;
+    }
+    else if (objeto->tipo == INSTANCIA)
+    {
+        intersecao_instancia(origem_raio, direcao_raio, objeto->instancia, 
+            &t0_temp, normal);
+    }
+    else if (objeto->tipo == MALHA)
+    {
+        if(intersecao_malha(origem_raio, direcao_raio, objeto->malha, 
+            &t0_temp, normal))
+        {
+            *normal = normalizar(normal);
+        }
+    }
+    
+    if(t0_temp == INFINITO) // Verifica se não tocou o objeto.
+    {
+        return 0;
+    }
+
+    if (t0_temp < 0) // Caso o raio tenha intersectado a borda.
+    { 
+        t0_temp = t1_temp;
+    }
+    
+    *t0 = t0_temp;
+    return 1;
+}
+
+
+/**
+ * Calcula a caixa envolvente (no mundo) de um objeto.
+ * 
+ * @param objeto Ponteiro para o objeto.
+ * @param caixa Ponteiro para a caixa a ser preenchida.
+ * @return 1 se o objeto é limitado, 0 caso seja infinito (plano).
+ */ 
+int caixa_objeto(objeto_t *objeto, caixa_t *caixa)
+{
+    int i;
+    
+    *caixa = caixa_vazia();
+    
+    if (objeto->tipo == ESFERA)
+    {
+        caixa->min.x = objeto->esfera->centro.x - objeto->esfera->raio;
+        caixa->min.y = objeto->esfera->centro.y - objeto->esfera->raio;
+        caixa->min.z = objeto->esfera->centro.z - objeto->esfera->raio;
+        caixa->max.x = objeto->esfera->centro.x + objeto->esfera->raio;
+        caixa->max.y = objeto->esfera->centro.y + objeto->esfera->raio;
+        caixa->max.z = objeto->esfera->centro.z + objeto->esfera->raio;
+    }
+    else if (objeto->tipo == PIRAMIDE)
+    {
+        for(i = 0; i < 4; i++)
+        {
+            caixa_expandir(caixa, &objeto->piramide->vertices[i]);
+        }
+    }
+    else if (objeto->tipo == CUBO)
+    {
+        for(i = 0; i < 8; i++)
+        {
+            caixa_expandir(caixa, &objeto->cubo->vertices[i]);
+        }
+    }
+    else if (objeto->tipo == INSTANCIA)
+    {
+        *caixa = objeto->instancia->caixa;
+    }
+    else if (objeto->tipo == MALHA)
+    {
+        if(objeto->malha->bvh.num_nos > 0)
+        {
+            *caixa = objeto->malha->bvh.nos[0].caixa;
+        }
+    }
+    else
+    {
+        return 0;
+    }
+    
+    return 1;
+}
+
+
+/**
+ * Calcula uma esfera que envolve um objeto limitado: a própria esfera, a
+ * da caixa orientada de um cubo ou, nos outros objetos, a da caixa
+ * envolvente.
+ * 
+ * @param objeto Ponteiro para o objeto.
+ * @param centro Ponteiro para o centro da esfera (é modificado).
+ * @param raio Ponteiro para o raio da esfera (é modificado).
+ * @return 1 se o objeto é limitado, 0 caso seja infinito (plano).
+ */ 
+int esfera_envolvente(objeto_t *objeto, ponto_t *centro, real_t *raio)
+{
+    caixa_t caixa;
+    vetor_t diagonal;
+    
+    if(objeto->tipo == ESFERA)
+    {
+        *centro = objeto->esfera->centro;
+        *raio = objeto->esfera->raio;
+        return 1;
+    }
+    
+    if(objeto->tipo == CUBO && objeto->cubo->forma == CUBO_ORIENTADO)
+    {
+        diagonal = sub_v(&objeto->cubo->caixa.max, &objeto->cubo->caixa.min);
+        *centro = objeto->cubo->centro;
+        *raio = 0.5 * modulo(&diagonal);
+        return 1;
+    }
+    
+    if(!caixa_objeto(objeto, &caixa))
+    {
+        return 0;
+    }
+    diagonal = sub_v(&caixa.max, &caixa.min);
+    centro->x = 0.5 * (caixa.min.x + caixa.max.x);
+    centro->y = 0.5 * (caixa.min.y + caixa.max.y);
+    centro->z = 0.5 * (caixa.min.z + caixa.max.z);
+    *raio = 0.5 * modulo(&diagonal);
+    return 1;
+}
+
+
+/**
+ * Calcula pontos cujo fecho convexo contém um objeto limitado: os
+ * vértices da pirâmide e do cubo ou os cantos da caixa envolvente das
+ * malhas e instâncias. A esfera e o plano não têm esses pontos.
+ * 
+ * @param objeto Ponteiro para o objeto.
+ * @param vertices Array de 8 pontos (é preenchido).
+ * @param convexo Ponteiro para o indicador de que o fecho é o próprio 
+ * objeto, e não só uma região que o contém (é modificado).
+ * @return Número de pontos.
+ */ 
+int vertices_objeto(objeto_t *objeto, ponto_t vertices[8], int *convexo)
+{
+    int i;
+    caixa_t caixa;
+    
+    *convexo = 0;
+    if(objeto->tipo == PIRAMIDE)
+    {
+        memcpy(vertices, objeto->piramide->vertices, 4 * sizeof(ponto_t));
+        *convexo = 1;
+        return 4;
+    }
+    
+    if(objeto->tipo == CUBO)
+    {
+        memcpy(vertices, objeto->cubo->vertices, 8 * sizeof(ponto_t));
+        *convexo = objeto->cubo->forma != CUBO_TRIANGULOS;
+        return 8;
+    }
+    
+    if(objeto->tipo == ESFERA || !caixa_objeto(objeto, &caixa))
+    {
+        return 0;
+    }
+    for(i = 0; i < 8; i++)
+    {
+        vertices[i].x = i & 1 ? caixa.max.x : caixa.min.x;
+        vertices[i].y = i & 2 ? caixa.max.y : caixa.min.y;
+        vertices[i].z = i & 4 ? caixa.max.z : caixa.min.z;
+    }
+    return 8;
+}
+
+
+/** 
+ * Faz a operação de raytracing resursiva. 
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param cena Ponteiro para a cena com os objetos colocados no espaço.
+ * @param num_reflexoes Número de reflexões (usado na versão recursiva).
+ * @param max_recursoes Número máximo de reflexões (usado na versão recursiva).
+ * 
+ */
+cor_t raytrace(ponto_t *origem_raio, vetor_t *direcao_raio, luz_t *luz_local,  
+    luz_t *luz_ambiente, cena_t *cena, int num_reflexoes, int max_recursoes)
+
+{
+    cor_t cor_final;
+    real_t tperto;
+    objeto_t *objeto_perto;
+    vetor_t normal;
+    unsigned int semente;
+    
+    // Se não tocar nenhum objeto, então a cor será negativa. 
+    cor_final.x = -1.0;
+    cor_final.y = -1.0;
+    cor_final.z = -1.0;
+    
+    // Encontra o objeto mais perto da câmera (caso exista).
+    objeto_perto = intersecao_cena(cena, origem_raio, direcao_raio, &tperto, 
+        &normal);
+    
+    // Verifica se algum objeto não foi intersectado.
+    if(objeto_perto == 0) 
+    {
+        return cor_final;
+    }
+    
+    cor_final.x = cor_final.y = cor_final.z = 0.0;
+    semente = 1;
+    return colorir_caminho(origem_raio, direcao_raio, luz_local, 
+        luz_ambiente, cena, &cor_final, objeto_perto, tperto, &normal, -1, 
+        max_recursoes - num_reflexoes, MAX_RAIOS_SECUNDARIOS, &semente);
+    
+}
+
+
+/**
+ * Calcula a cor vista por um raio que já se sabe tocar um objeto.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param cena Ponteiro para a cena com os objetos colocados no espaço.
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param t Distância até o ponto de interseção.
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @param luz_direta Fração da luz local que chega ao ponto (de 0 a 1),
+ * quando a visibilidade da luz já foi calculada, ou -1 para calculá-la aqui.
+ * @return Cor do ponto de interseção.
+ */
+cor_t colorir_intersecao(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    luz_t *luz_local, luz_t *luz_ambiente, cena_t *cena, objeto_t *objeto, 
+    real_t t, vetor_t *normal, real_t luz_direta)
+{
+    vetor_t normal_ponto, temp1_v;
+    ponto_t ponto_intersec;
+    
+    // Inverte o sentido da normal caso ela esteja dentro da esfera.
+    normal_ponto = *normal;
+    if(prod_e(direcao_raio, &normal_ponto) > 0)
+    {
+        normal_ponto = neg_v(&normal_ponto);
+    }
+    
+    // Calcula o ponto de intersecção do objeto.
+    temp1_v = mult_e(direcao_raio, t);
+    ponto_intersec = soma_v(origem_raio, &temp1_v);    
+    
+    if(luz_direta >= 0)
+    {
+        return iluminar_ponto(origem_raio, luz_local, luz_ambiente, cena, 
+            objeto, &ponto_intersec, &normal_ponto, luz_direta);
+    }
+    
+    return calcular_iluminacao(origem_raio, direcao_raio, luz_local, 
+        luz_ambiente, cena, objeto, &ponto_intersec, &normal_ponto);
+    
+}
+
+
+/**
+ * Gera um número pseudoaleatório em [0, 1) (xorshift de 32 bits).
+ */
+static real_t aleatorio(unsigned int *semente)
+{
+    unsigned int x;
+    
+    x = *semente != 0 ? *semente : 0x9e3779b9u;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *semente = x;
+    return x / 4294967296.0;
+}
+
+
+/**
+ * Aplica a roleta russa a um raio secundário: os que pesam menos que
+ * ROLETA_LIMIAR sobrevivem com probabilidade proporcional ao peso e 
+ * passam a pesar ROLETA_LIMIAR (para que a média não mude).
+ * 
+ * @param peso Peso do raio.
+ * @param semente Ponteiro para o estado do gerador de números aleatórios
+ * (é modificado).
+ * @return Peso corrigido do raio ou 0 se ele foi descartado.
+ */
+real_t roleta_russa(real_t peso, unsigned int *semente)
+{
+    if(peso <= 0.0)
+    {
+        return 0.0;
+    }
+    
+    if(peso < ROLETA_LIMIAR)
+    {
+        if(aleatorio(semente) * ROLETA_LIMIAR >= peso)
+        {
+            return 0.0;
+        }
+        peso = ROLETA_LIMIAR;
+    }
+    
+    return peso;
+}
+
+
+/**
+ * Gera os raios secundários de um ponto tocado: a refração (lei de Snell,
+ * se o objeto é transparente) e a reflexão (se o objeto é refletível ou se
+ * houve reflexão interna total, que reflete a luz transmitida).
+ * 
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param direcao_raio Ponteiro para a direção (normalizada) do raio.
+ * @param ponto_intersec Ponteiro para o ponto de interseção.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @param dentro Se o raio vem de dentro do objeto.
+ * @param secundarios Array de 2 raios preenchido com a origem, a direção e
+ * a fração da cor do raio que cada um carrega (a profundidade não é
+ * preenchida).
+ * @return Número de raios gerados.
+ */
+int raios_secundarios(objeto_t *objeto, vetor_t *direcao_raio, 
+    ponto_t *ponto_intersec, vetor_t *normal, int dentro, 
+    raio_pendente_t *secundarios)
+{
+    int num;
+    real_t cosseno, razao, k, reflexao, transmissao;
+    vetor_t direcao, temp1_v;
+    
+    num = 0;
+    transmissao = objeto->transparencia;
+    reflexao = objeto->refletivel ? kr : 0.0;
+    cosseno = -prod_e(direcao_raio, normal);
+    
+    if(transmissao > 0.0)
+    {
+        razao = dentro ? objeto->indice_refracao : 
+            1.0 / objeto->indice_refracao;
+        k = 1.0 - razao * razao * (1.0 - cosseno * cosseno);
+        if(k < 0.0)
+        {
+            reflexao += transmissao;
+        }
+        else
+        {
+            direcao = mult_e(direcao_raio, razao);
+            temp1_v = mult_e(normal, razao * cosseno - sqrt(k));
+            direcao = soma_v(&direcao, &temp1_v);
+            direcao = normalizar(&direcao);
+            secundarios[num].origem = deslocar_ponto(ponto_intersec, normal, 
+                &direcao);
+            secundarios[num].direcao = direcao;
+            secundarios[num].peso = transmissao;
+            num++;
+        }
+    }
+    
+    if(reflexao > 0.0)
+    {
+        temp1_v = mult_e(normal, 2 * cosseno);
+        direcao = soma_v(direcao_raio, &temp1_v);
+        direcao = normalizar(&direcao);
+        secundarios[num].origem = deslocar_ponto(ponto_intersec, normal, 
+            &direcao);
+        secundarios[num].direcao = direcao;
+        secundarios[num].peso = reflexao;
+        num++;
+    }
+    
+    return num;
+}
+
+
+/**
+ * Empilha um raio secundário com o peso dado, aplicando a roleta russa
+ * aos raios leves e respeitando o limite de raios e o tamanho da pilha.
+ */
+static void empilhar_raio(raio_pendente_t *pilha, int *num_pendentes, 
+    int *raios, int max_raios, raio_pendente_t *raio, real_t peso, 
+    int profundidade, unsigned int *semente)
+{
+    if(peso <= 0.0 || *raios >= max_raios || 
+        *num_pendentes >= PILHA_MAX_RAIOS)
+    {
+        return;
+    }
+    
+    peso = roleta_russa(peso, semente);
+    if(peso <= 0.0)
+    {
+        return;
+    }
+    
+    pilha[*num_pendentes].origem = raio->origem;
+    pilha[*num_pendentes].direcao = raio->direcao;
+    pilha[*num_pendentes].peso = peso;
+    pilha[*num_pendentes].profundidade = profundidade;
+    (*num_pendentes)++;
+    (*raios)++;
+}
+
+
+/**
+ * Calcula a cor vista por um raio que já se sabe tocar um objeto, somando
+ * as reflexões (objetos refletíveis, com peso kr) e as refrações (objetos
+ * transparentes). Em vez de recursão, os raios secundários ficam numa
+ * pilha com o peso que carregam desde o raio original; os que pesam menos
+ * que ROLETA_LIMIAR sobrevivem com probabilidade proporcional ao peso (e
+ * têm o peso corrigido, para que a média não mude).
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor (normalizado) que determina a
+ * direção do raio.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param cena Ponteiro para a cena com os objetos colocados no espaço.
+ * @param fundo Ponteiro para a cor dos raios secundários que não tocam nada.
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param t Distância até o ponto de interseção.
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @param luz_direta Fração da luz local que chega ao primeiro ponto (de 0
+ * a 1), quando a visibilidade da luz já foi calculada, ou -1 para
+ * calculá-la aqui.
+ * @param max_recursoes Número máximo de reflexões (ou refrações) seguidas.
+ * @param max_raios Número máximo de raios secundários traçados.
+ * @param semente Ponteiro para o estado do gerador de números aleatórios
+ * da roleta russa (é modificado).
+ * @return Cor do ponto de interseção.
+ */
+cor_t colorir_caminho(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    luz_t *luz_local, luz_t *luz_ambiente, cena_t *cena, cor_t *fundo, 
+    objeto_t *objeto, real_t t, vetor_t *normal, real_t luz_direta, 
+    int max_recursoes, int max_raios, unsigned int *semente)
+{
+    raio_pendente_t pilha[PILHA_MAX_RAIOS], atual, secundarios[2];
+    int num_pendentes, raios, dentro, num_secundarios, i;
+    real_t transmissao;
+    vetor_t normal_ponto, temp1_v;
+    ponto_t ponto_intersec;
+    cor_t cor_final, cor_local;
+    
+    cor_final.x = cor_final.y = cor_final.z = 0.0;
+    
+    pilha[0].origem = *origem_raio;
+    pilha[0].direcao = *direcao_raio;
+    pilha[0].peso = 1.0;
+    pilha[0].profundidade = 0;
+    num_pendentes = 1;
+    raios = 0;
+    
+    while(num_pendentes > 0)
+    {
+        atual = pilha[--num_pendentes];
+        
+        // O primeiro raio já foi intersectado por quem chamou.
+        if(atual.profundidade > 0)
+        {
+            objeto = intersecao_cena(cena, &atual.origem, &atual.direcao, 
+                &t, &normal_ponto);
+            if(objeto == NULL)
+            {
+                temp1_v = mult_e(fundo, atual.peso);
+                cor_final = soma_v(&cor_final, &temp1_v);
+                continue;
+            }
+        }
+        else
+        {
+            normal_ponto = *normal;
+        }
+        
+        // A normal é virada para o lado de onde o raio vem.
+        dentro = prod_e(&atual.direcao, &normal_ponto) > 0;
+        if(dentro)
+        {
+            normal_ponto = neg_v(&normal_ponto);
+        }
+        
+        temp1_v = mult_e(&atual.direcao, t);
+        ponto_intersec = soma_v(&atual.origem, &temp1_v);
+        
+        transmissao = objeto->transparencia;
+        
+        // A sombra do primeiro ponto pode já ter sido testada por quem chamou.
+        if(atual.profundidade == 0 && luz_direta >= 0)
+        {
+            cor_local = iluminar_ponto(&atual.origem, luz_local, 
+                luz_ambiente, cena, objeto, &ponto_intersec, &normal_ponto, 
+                luz_direta);
+        }
+        else
+        {
+            cor_local = calcular_iluminacao(&atual.origem, &atual.direcao, 
+                luz_local, luz_ambiente, cena, objeto, &ponto_intersec, 
+                &normal_ponto);
+        }
+        temp1_v = mult_e(&cor_local, atual.peso * (1.0 - transmissao));
+        cor_final = soma_v(&cor_final, &temp1_v);
+        
+        if(atual.profundidade >= max_recursoes)
+        {
+            continue;
+        }
+        
+        num_secundarios = raios_secundarios(objeto, &atual.direcao, 
+            &ponto_intersec, &normal_ponto, dentro, secundarios);
+        for(i = 0; i < num_secundarios; i++)
+        {
+            empilhar_raio(pilha, &num_pendentes, &raios, max_raios, 
+                &secundarios[i], atual.peso * secundarios[i].peso, 
+                atual.profundidade + 1, semente);
+        }
+    }
+    
+    return cor_final;
+}
+
+
+/**
+ * Leva um ponto (u1, u2) do quadrado unitário a uma direção no hemisfério
+ * da normal com densidade proporcional ao cosseno com ela (pelo disco
+ * unitário projetado no hemisfério).
+ * 
+ * @param normal Ponteiro para a normal (normalizada).
+ * @param u1 Primeira coordenada, em [0, 1).
+ * @param u2 Segunda coordenada, em [0, 1).
+ * @return Direção (normalizada).
+ */
+vetor_t direcao_difusa(vetor_t *normal, real_t u1, real_t u2)
+{
+    real_t r, angulo, x, y;
+    vetor_t eixo, u, v, direcao, temp1_v;
+    
+    eixo.x = fabs(normal->x) < 0.9 ? 1.0 : 0.0;
+    eixo.y = 1.0 - eixo.x;
+    eixo.z = 0.0;
+    u = prod_v(normal, &eixo);
+    u = normalizar(&u);
+    v = prod_v(normal, &u);
+    
+    r = sqrt(u1);
+    angulo = 2.0 * PI * u2;
+    x = r * cos(angulo);
+    y = r * sin(angulo);
+    
+    direcao = mult_e(normal, sqrt(max((real_t) 0.0, 1.0 - x * x - y * y)));
+    temp1_v = mult_e(&u, x);
+    direcao = soma_v(&direcao, &temp1_v);
+    temp1_v = mult_e(&v, y);
+    direcao = soma_v(&direcao, &temp1_v);
+    return normalizar(&direcao);
+}
+
+
+/**
+ * Calcula por Monte Carlo (traçado de caminhos) a cor vista por um raio
+ * que já se sabe tocar um objeto, com a iluminação global difusa. Em cada
+ * ponto do caminho soma-se a luz direta (equação de Phong sem a luz
+ * ambiente, com a sombra de visibilidade_luz()) e o caminho segue por um
+ * só evento, sorteado com probabilidade proporcional ao peso: o rebote 
+ * difuso (direção com densidade proporcional ao cosseno, peso kd vezes a
+ * cor do objeto), a reflexão ou a refração. A partir de MONTE_CARLO_ROLETA
+ * rebotes, a roleta russa descarta os caminhos que carregam pouca luz.
+ * Os sorteios de cada rebote saem de dimensões fixas da sequência (a
+ * direção difusa de um par, o evento e a roleta do par seguinte), de modo
+ * que a mesma amostra gera o mesmo caminho em qualquer thread e que os
+ * amostradores estratificados distribuam bem as direções.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor (normalizado) que determina a
+ * direção do raio.
+ * @param luz_local Ponteiro para a luz local.
+ * @param cena Ponteiro para a cena com os objetos colocados no espaço.
+ * @param fundo Ponteiro para a cor dos raios que não tocam nada.
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param t Distância até o ponto de interseção.
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @param max_rebotes Número máximo de rebotes do caminho.
+ * @param sequencia Ponteiro para a sequência da amostra, cuja dimensão
+ * atual deve ser par (é modificada).
+ * @return Estimativa da cor do ponto de interseção.
+ */
+cor_t colorir_monte_carlo(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    luz_t *luz_local, cena_t *cena, cor_t *fundo, objeto_t *objeto, 
+    real_t t, vetor_t *normal, int max_rebotes, sequencia_t *sequencia)
+{
+    int rebote, dentro, num_secundarios, i;
+    unsigned int dimensao;
+    real_t opacidade, peso_difuso, soma, sorteio, sobrevivencia, u1, u2;
+    ponto_t origem, ponto_intersec;
+    vetor_t direcao, normal_ponto, temp1_v;
+    cor_t cor_final, caminho, cor_local;
+    luz_t escuro;
+    raio_pendente_t secundarios[2];
+    
+    cor_final.x = cor_final.y = cor_final.z = 0.0;
+    caminho.x = caminho.y = caminho.z = 1.0;
+    escuro.cor = cor_final;
+    origem = *origem_raio;
+    direcao = *direcao_raio;
+    normal_ponto = *normal;
+    dimensao = sequencia->dimensao;
+    
+    for(rebote = 0; ; rebote++)
+    {
+        // A normal é virada para o lado de onde o raio vem.
+        dentro = prod_e(&direcao, &normal_ponto) > 0;
+        if(dentro)
+        {
+            normal_ponto = neg_v(&normal_ponto);
+        }
+        
+        temp1_v = mult_e(&direcao, t);
+        ponto_intersec = soma_v(&origem, &temp1_v);
+        
+        // Luz direta (a ambiente é substituída pelos rebotes difusos).
+        opacidade = 1.0 - objeto->transparencia;
+        cor_local = iluminar_ponto(&origem, luz_local, &escuro, cena, 
+            objeto, &ponto_intersec, &normal_ponto, 
+            visibilidade_luz(cena, luz_local, &ponto_intersec, 
+            &normal_ponto, objeto));
+        cor_local = mult_v(&cor_local, &caminho);
+        temp1_v = mult_e(&cor_local, opacidade);
+        cor_final = soma_v(&cor_final, &temp1_v);
+        
+        if(rebote >= max_rebotes)
+        {
+            break;
+        }
+        
+        // Sorteio do próximo evento entre o rebote difuso e os raios
+        // secundários, com probabilidade proporcional ao peso de cada um.
+        num_secundarios = raios_secundarios(objeto, &direcao, 
+            &ponto_intersec, &normal_ponto, dentro, secundarios);
+        peso_difuso = opacidade * kd * max(objeto->cor.x, 
+            max(objeto->cor.y, objeto->cor.z));
+        soma = peso_difuso;
+        for(i = 0; i < num_secundarios; i++)
+        {
+            soma += secundarios[i].peso;
+        }
+        if(soma <= 0.0)
+        {
+            break;
+        }
+        
+        sequencia->dimensao = dimensao + 4 * rebote;
+        u1 = sequencia_proximo(sequencia);
+        u2 = sequencia_proximo(sequencia);
+        sorteio = sequencia_proximo(sequencia) * soma;
+        if(sorteio < peso_difuso)
+        {
+            direcao = direcao_difusa(&normal_ponto, u1, u2);
+            origem = deslocar_ponto(&ponto_intersec, &normal_ponto, 
+                &direcao);
+            temp1_v = mult_e(&objeto->cor, opacidade * kd * soma / 
+                peso_difuso);
+            caminho = mult_v(&caminho, &temp1_v);
+        }
+        else
+        {
+            sorteio -= peso_difuso;
+            for(i = 0; i < num_secundarios - 1 && 
+                sorteio >= secundarios[i].peso; i++)
+            {
+                sorteio -= secundarios[i].peso;
+            }
+            origem = secundarios[i].origem;
+            direcao = secundarios[i].direcao;
+            caminho = mult_e(&caminho, soma);
+        }
+        
+        // Roleta russa: o caminho sobrevive com probabilidade igual ao
+        // maior canal do que ainda pode levar (e é corrigido por ela).
+        if(rebote + 1 >= MONTE_CARLO_ROLETA)
+        {
+            sobrevivencia = min((real_t) 1.0, max(caminho.x, 
+                max(caminho.y, caminho.z)));
+            if(sequencia_proximo(sequencia) >= sobrevivencia)
+            {
+                break;
+            }
+            caminho = mult_e(&caminho, 1.0 / sobrevivencia);
+        }
+        
+        objeto = intersecao_cena(cena, &origem, &direcao, &t, 
+            &normal_ponto);
+        if(objeto == NULL)
+        {
+            temp1_v = mult_v(fundo, &caminho);
+            cor_final = soma_v(&cor_final, &temp1_v);
+            break;
+        }
+    }
+    
+    return cor_final;
+}
+
+
+/**
+ * Equação de Phong da iluminação, que serve para calcular a cor do objeto.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param pos_ponto Posição do ponto do objeto a ser avaliado.
+ * @param normal_ponto Vetor normal que indica o plano onde está o ponto.
+ * @param cor_ponto Cor do ponto a ser pintado.
+ * 
+ */ 
+cor_t equacao_phong(ponto_t *origem_raio, luz_t *luz_local, 
+    luz_t *luz_ambiente, ponto_t *pos_ponto, vetor_t *normal_ponto, 
+    cor_t *cor_ponto)
+{
+    cor_t ambiente, difusa, especular, cor_final;
+    vetor_t dir_luz, dir_obs, raio_refletido;
+
+    // Variáveis auxiliares no cálculo vetorial.
+    real_t temp1_d;
+    vetor_t temp1_v;
+    
+    // Calcula a direção para o observador do ponto para o observador.
+    dir_obs = sub_v(origem_raio, pos_ponto);
+    dir_obs = normalizar(&dir_obs);
+    
+    // Calcula a direção da luz (ponto intersec até a luz).
+    dir_luz = sub_v(&luz_local->posicao, pos_ponto);
+    dir_luz = normalizar(&dir_luz);
+    
+    // Calcula a direção do raio refletido e normaliza-o.
+    temp1_v = neg_v(&dir_luz);
+    raio_refletido = mult_e(normal_ponto, 2 * prod_e(&temp1_v, normal_ponto));
+    raio_refletido = sub_v(&temp1_v, &raio_refletido);
+    raio_refletido = normalizar(&raio_refletido);    
+    
+    // Calcula a luz ambiente;.
+    ambiente = mult_e(&luz_ambiente->cor, ka);
+    
+    // Calcula a luz difusa
+    difusa = mult_e(&luz_local->cor, kd * max(0.0f, prod_e(normal_ponto, &dir_luz)));
+
+    // Calcula a luz especular
+    temp1_d = max(0.0f, prod_e(&raio_refletido, &dir_obs));
+    especular = mult_e(&luz_local->cor, os * ks * pow(temp1_d, eta));
+    
+    // Calcula a cor final (soma das luzes).
+    cor_final = soma_v(&ambiente, &difusa);
+    cor_final = soma_v(&cor_final, &especular);
+    cor_final = mult_v(cor_ponto, &cor_final);
+
+    return cor_final;
+}
+
+
+/**
+ * Calcula o raio de sombra de um ponto: a direção (normalizada) até a luz
+ * local e a origem, um pouco afastada da superfície, do lado da luz.
+ * 
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param ponto_intersec Ponteiro para o ponto de interseção.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @param origem_sombra Ponteiro para a origem do raio de sombra (é 
+ * modificada na função).
+ * @param direcao_sombra Ponteiro para a direção do raio de sombra (é 
+ * modificada na função).
+ */
+void raio_sombra(luz_t *luz_local, ponto_t *ponto_intersec, vetor_t *normal,
+    ponto_t *origem_sombra, vetor_t *direcao_sombra)
+{
+    *direcao_sombra = sub_v(&luz_local->posicao, ponto_intersec);
+    *direcao_sombra = normalizar(direcao_sombra);
+    *origem_sombra = deslocar_ponto(ponto_intersec, normal, direcao_sombra);
+}
+
+
+/**
+ * Gera um número pseudoaleatório inicial a partir das coordenadas de um
+ * ponto, para que os sorteios de um ponto não dependam da ordem em que os
+ * pontos são traçados (nem da thread).
+ * 
+ * @param ponto Ponteiro para o ponto.
+ * @return Semente do ponto.
+ */
+unsigned int semente_ponto(ponto_t *ponto)
+{
+    float coordenadas[3];
+    unsigned int bits, h;
+    int i;
+    
+    coordenadas[0] = ponto->x;
+    coordenadas[1] = ponto->y;
+    coordenadas[2] = ponto->z;
+    h = 0x811c9dc5u;
+    for(i = 0; i < 3; i++)
+    {
+        memcpy(&bits, &coordenadas[i], sizeof(bits));
+        h = (h ^ bits) * 0x01000193u;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+
+/**
+ * Converte (s, t) em [0, 1) x [0, 1) num ponto da luz de área: no
+ * retângulo, pelos lados; na esfera, no disco do seu contorno visto do
+ * ponto iluminado (base u, v).
+ */
+static ponto_t ponto_luz(luz_t *luz, vetor_t *u, vetor_t *v, real_t s, 
+    real_t t)
+{
+    real_t r, angulo;
+    vetor_t temp;
+    ponto_t ponto;
+    
+    if(luz->forma == LUZ_RETANGULAR)
+    {
+        temp = mult_e(&luz->lado_u, s - 0.5);
+        ponto = soma_v(&luz->posicao, &temp);
+        temp = mult_e(&luz->lado_v, t - 0.5);
+        return soma_v(&ponto, &temp);
+    }
+    
+    r = luz->raio * sqrt(s);
+    angulo = 2.0 * PI * t;
+    temp = mult_e(u, r * cos(angulo));
+    ponto = soma_v(&luz->posicao, &temp);
+    temp = mult_e(v, r * sin(angulo));
+    return soma_v(&ponto, &temp);
+}
+
+
+/**
+ * Traça um raio de sombra do ponto até um ponto da luz de área e retorna
+ * 1 se ele chega lá. Os pontos da luz abaixo do plano da superfície contam
+ * como na sombra.
+ */
+static int alvo_visivel(cena_t *cena, ponto_t *alvo, ponto_t *ponto_intersec,
+    vetor_t *normal, objeto_t *objeto)
+{
+    real_t distancia;
+    ponto_t origem;
+    vetor_t direcao;
+    
+    direcao = sub_v(alvo, ponto_intersec);
+    distancia = modulo(&direcao);
+    if(distancia <= 0.0 || prod_e(&direcao, normal) <= 0.0)
+    {
+        return 0;
+    }
+    direcao = mult_e(&direcao, 1.0 / distancia);
+    origem = deslocar_ponto(ponto_intersec, normal, &direcao);
+    return !oclusao_cena(cena, &origem, &direcao, distancia, objeto);
+}
+
+
+/**
+ * Traça lado x lado raios de sombra do ponto à luz de área, a um ponto
+ * sorteado em cada faixa de uma grade sobre ela, e conta os que chegam.
+ */
+static int amostrar_luz(cena_t *cena, luz_t *luz, vetor_t *u, vetor_t *v, 
+    ponto_t *ponto_intersec, vetor_t *normal, objeto_t *objeto, int lado, 
+    unsigned int *semente)
+{
+    int i, j, visiveis;
+    ponto_t alvo;
+    
+    visiveis = 0;
+    for(i = 0; i < lado; i++)
+    {
+        for(j = 0; j < lado; j++)
+        {
+            alvo = ponto_luz(luz, u, v, (i + aleatorio(semente)) / lado, 
+                (j + aleatorio(semente)) / lado);
+            visiveis += alvo_visivel(cena, &alvo, ponto_intersec, normal, 
+                objeto);
+        }
+    }
+    
+    return visiveis;
+}
+
+
+/**
+ * Calcula a fração da luz local que chega a um ponto. Para a luz pontual,
+ * é um raio de sombra só (0 ou 1). Para a luz de área, a esfera que a
+ * envolve é comparada com o plano da superfície e com os objetos da cena
+ * (sombra_cena()): se ela fica toda acima do plano e a cena a deixa toda
+ * visível ou toda escondida, nenhum raio é traçado. Senão (na penumbra ou
+ * na dúvida), AMOSTRAS_PENUMBRA_LADO x AMOSTRAS_PENUMBRA_LADO raios vão a
+ * pontos sorteados em faixas da luz, e a fração é a média deles. Os
+ * sorteios dependem só do ponto.
+ * 
+ * @param cena Ponteiro para a cena.
+ * @param luz_local Ponteiro para a luz local.
+ * @param ponto_intersec Ponteiro para o ponto de interseção.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @param objeto Ponteiro para o objeto de onde os raios partem.
+ * @return Fração (de 0 a 1) da luz que chega ao ponto.
+ */
+real_t visibilidade_luz(cena_t *cena, luz_t *luz_local, 
+    ponto_t *ponto_intersec, vetor_t *normal, objeto_t *objeto)
+{
+    int sombra;
+    unsigned int semente;
+    real_t raio_luz, altura;
+    ponto_t origem_sombra;
+    vetor_t direcao, u, v, eixo;
+    
+    if(luz_local->forma == LUZ_PONTUAL)
+    {
+        raio_sombra(luz_local, ponto_intersec, normal, &origem_sombra, 
+            &direcao);
+        return !oclusao_cena(cena, &origem_sombra, &direcao, INFINITO, 
+            objeto);
+    }
+    
+    // Esfera que envolve a luz: com ela toda abaixo do plano da
+    // superfície, nada chega; com ela toda acima, a cena decide.
+    if(luz_local->forma == LUZ_RETANGULAR)
+    {
+        raio_luz = 0.5 * sqrt(prod_e(&luz_local->lado_u, 
+            &luz_local->lado_u) + prod_e(&luz_local->lado_v, 
+            &luz_local->lado_v));
+    }
+    else
+    {
+        raio_luz = luz_local->raio;
+    }
+    direcao = sub_v(&luz_local->posicao, ponto_intersec);
+    altura = prod_e(&direcao, normal);
+    if(altura <= -raio_luz)
+    {
+        return 0.0;
+    }
+    if(altura >= raio_luz)
+    {
+        sombra = sombra_cena(cena, ponto_intersec, &luz_local->posicao, 
+            raio_luz, objeto);
+        if(sombra != SOMBRA_INCERTA)
+        {
+            return sombra == SOMBRA_LIVRE;
+        }
+    }
+    
+    // Base do disco da luz esférica, perpendicular à direção até o ponto.
+    u = luz_local->lado_u;
+    v = luz_local->lado_v;
+    if(luz_local->forma == LUZ_ESFERICA)
+    {
+        direcao = sub_v(ponto_intersec, &luz_local->posicao);
+        direcao = normalizar(&direcao);
+        eixo.x = fabs(direcao.x) < 0.9 ? 1.0 : 0.0;
+        eixo.y = 1.0 - eixo.x;
+        eixo.z = 0.0;
+        u = prod_v(&direcao, &eixo);
+        u = normalizar(&u);
+        v = prod_v(&direcao, &u);
+    }
+    
+    semente = semente_ponto(ponto_intersec);
+    return (real_t) amostrar_luz(cena, luz_local, &u, &v, ponto_intersec, 
+        normal, objeto, AMOSTRAS_PENUMBRA_LADO, &semente) / 
+        (AMOSTRAS_PENUMBRA_LADO * AMOSTRAS_PENUMBRA_LADO);
+}
+
+
+/**
+ * Calcula a cor de um ponto pela equação de Phong, já sabendo quanto da
+ * luz local chega a ele (se nada chega, só a luz ambiente conta), somada à
+ * das luzes da árvore de luzes da cena. Se a cena tem um cache de
+ * irradiância, a luz ambiente é trocada pela indireta difusa do cache, e
+ * se tem um mapa de fótons, as cáusticas dele entram como luz difusa.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente (ou NULL para só a luz
+ * direta, sem a ambiente, a do cache nem as cáusticas).
+ * @param cena Ponteiro para a cena.
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param ponto_intersec Ponteiro para o ponto de interseção.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @param luz_direta Fração da luz local que chega ao ponto (de 0 a 1).
+ * @return Cor do ponto.
+ */
+cor_t iluminar_ponto(ponto_t *origem_raio, luz_t *luz_local, 
+    luz_t *luz_ambiente, cena_t *cena, objeto_t *objeto, 
+    ponto_t *ponto_intersec, vetor_t *normal, real_t luz_direta)
+{
+    luz_t luz_local_final, escuro;
+    cor_t cor, cor_luzes, indireta, causticas;
+
+    luz_local_final = *luz_local;
+        
+    if(luz_direta < 1.0)
+    {
+        luz_local_final.cor = mult_e(&luz_local->cor, luz_direta);
+    }
+
+    // A luz indireta do cache (ou nenhuma) toma o lugar da ambiente.
+    if(luz_ambiente == NULL || cena->irradiancia != NULL)
+    {
+        escuro.cor.x = escuro.cor.y = escuro.cor.z = 0.0;
+        cor = equacao_phong(origem_raio, &luz_local_final, &escuro, 
+            ponto_intersec, normal, &objeto->cor);
+    }
+    else
+    {
+        cor = equacao_phong(origem_raio, &luz_local_final, luz_ambiente, 
+            ponto_intersec, normal, &objeto->cor);
+    }
+    
+    if(luz_ambiente != NULL && cena->irradiancia != NULL)
+    {
+        indireta = irradiancia_obter(cena->irradiancia, cena, luz_local, 
+            ponto_intersec, normal);
+        indireta = mult_v(&indireta, &objeto->cor);
+        indireta = mult_e(&indireta, kd);
+        cor = soma_v(&cor, &indireta);
+    }
+    
+    if(luz_ambiente != NULL && cena->fotons != NULL)
+    {
+        causticas = fotons_irradiancia(cena->fotons, ponto_intersec, normal);
+        causticas = mult_v(&causticas, &objeto->cor);
+        causticas = mult_e(&causticas, kd);
+        cor = soma_v(&cor, &causticas);
+    }
+    
+    if(cena->luzes.num_luzes > 0)
+    {
+        cor_luzes = iluminar_luzes(cena, origem_raio, objeto, ponto_intersec,
+            normal, &cor);
+        cor = soma_v(&cor, &cor_luzes);
+    }
+    
+    return cor;
+}
+
+
+/**
+ * Equação de Phong da iluminação, que serve para calcular a cor do objeto.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param objetos Array de objetos.
+ * @param num_objetos Número e objetos no array.
+ * @param objeto_perto Objeto mais perto da câmera.
+ * @param ponto_intersec Ponto de interseção entre o raio e o objeto.
+ * @param normal Vetor normal que indica o plano onde está o ponto.
+ * 
+ */ 
+cor_t calcular_iluminacao(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    luz_t *luz_local, luz_t *luz_ambiente, cena_t *cena, 
+    objeto_t *objeto_perto, ponto_t *ponto_intersec, vetor_t *normal)
+{
+    
+    real_t luz_direta;
+    
+    // Percore os demais objetos para ver se há algum entre o ponto e a 
+    // fonte de luz.
+    luz_direta = visibilidade_luz(cena, luz_local, ponto_intersec, normal, 
+        objeto_perto);
+
+	// Calcula a cor a partir da equação de Phong.
+    return iluminar_ponto(origem_raio, luz_local, luz_ambiente, cena, 
+        objeto_perto, ponto_intersec, normal, luz_direta);
+    
+}
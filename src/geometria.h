@@ -1,11 +1,18 @@
 #ifndef GEOMETRIA_H
 #define GEOMETRIA_H
 
+#include <stddef.h>
+
 #define max(a,b) \
    ({ __typeof__ (a) _a = (a); \
        __typeof__ (b) _b = (b); \
      _a > _b ? _a : _b; })
 
+#define min(a,b) \
+   ({ __typeof__ (a) _a = (a); \
+       __typeof__ (b) _b = (b); \
+     _a < _b ? _a : _b; })
+
 /** Representa o maior valor de distância dos objetos. */
 #define INFINITO 1.0e10
 
@@ -14,15 +21,53 @@
 
 #define EPSILON 0.0001
 
+/** Peso abaixo do qual os raios secundários passam pela roleta russa. */
+#define ROLETA_LIMIAR 0.1
+
+/** Tamanho da pilha de raios secundários pendentes de cada raio. */
+#define PILHA_MAX_RAIOS 64
+
+/** Número padrão de raios secundários (reflexões e refrações) por raio. */
+#define MAX_RAIOS_SECUNDARIOS 32
+
+/** Rebotes a partir dos quais os caminhos de Monte Carlo passam pela
+ * roleta russa. */
+#define MONTE_CARLO_ROLETA 2
+
+/** Formas da luz local: um ponto, um retângulo ou uma esfera. */
+#define LUZ_PONTUAL 0
+#define LUZ_RETANGULAR 1
+#define LUZ_ESFERICA 2
+
+/** Lado da grade de amostras da sombra de uma luz de área, traçadas nos
+ * pontos que podem estar na penumbra. */
+#define AMOSTRAS_PENUMBRA_LADO 4
+
+/** 
+ * Tipo real usado na geometria e no traçado dos raios. Por padrão é 
+ * double; compilando com PRECISAO_SIMPLES (make PRECISAO=simples) passa a 
+ * ser float, o que reduz pela metade a memória das malhas e das BVHs. 
+ * DESLOCAMENTO_RELATIVO é o quanto a origem dos raios secundários é 
+ * afastada da superfície, relativo ao tamanho das coordenadas do ponto, 
+ * para que o erro de arredondamento da interseção não gere auto-sombra.
+ */
+#ifdef PRECISAO_SIMPLES
+typedef float real_t;
+#define DESLOCAMENTO_RELATIVO 1.0e-5f
+#else
+typedef double real_t;
+#define DESLOCAMENTO_RELATIVO 1.0e-9
+#endif
+
 /** 
  * Estrutura que define um vetor ou ponto no espaço. 
  * Ela contém apenas as 3 componentes para representar o vetor 
  * no espaço.
  */
 typedef struct {
-    double x;
-    double y;
-    double z;
+    real_t x;
+    real_t y;
+    real_t z;
 } vetor_t;
 
 /** 
@@ -37,6 +82,17 @@ typedef vetor_t ponto_t;
  */
 typedef vetor_t cor_t;
 
+/** 
+ * Estrutura para armazenar uma caixa alinhada aos eixos (AABB). 
+ * 
+ * Ela é definida pelos cantos de menor e de maior coordenada.
+ */
+typedef struct {
+    ponto_t min;
+    ponto_t max;
+} caixa_t;
+
+
 /** 
  * Estrutura para armazenar uma esfera. 
  * 
@@ -44,7 +100,7 @@ typedef vetor_t cor_t;
  */
 typedef struct {
     ponto_t centro;
-    double raio;
+    real_t raio;
 } esfera_t;
 
 
@@ -79,12 +135,22 @@ typedef struct {
  */
 typedef struct {
     ponto_t vertices[8];
+    
+    /** 
+     * Forma detectada ao carregar a cena (cubo_preparar()): caixa 
+     * alinhada aos eixos, caixa orientada ou, se os vértices não formarem 
+     * um paralelepípedo reto, os 12 triângulos.
+     */
+    enum {CUBO_TRIANGULOS, CUBO_ALINHADO, CUBO_ORIENTADO} forma;
+    caixa_t caixa; // Cantos da caixa (no espaço local se orientada).
+    ponto_t centro; // Centro da caixa orientada.
+    vetor_t eixos[3]; // Eixos (normalizados) da caixa orientada.
 } cubo_t;
 
 
 /** 
- * Estrutura para armazenar um plano. 
- * 
+ * Estrutura para armazenar um plano. A normal é normalizada em
+ * cena_construir().
  */
 typedef struct {
     ponto_t ponto;
@@ -92,13 +158,121 @@ typedef struct {
 } plano_t;
 
 
+/** 
+ * Estrutura para armazenar um nó da hierarquia de volumes envolventes (BVH). 
+ * 
+ * Os nós são guardados em profundidade: o filho esquerdo de um nó interno 
+ * é sempre o nó seguinte do array e o campo 'inicio' guarda o índice do 
+ * filho direito. Numa folha, 'inicio' é o primeiro primitivo e 'quantidade'
+ * o número de primitivos (0 indica um nó interno).
+ */
+typedef struct {
+    caixa_t caixa;
+    int inicio;
+    int quantidade;
+} no_bvh_t;
+
+/** 
+ * Estrutura para armazenar uma BVH. 
+ * 
+ * O array 'primitivos' guarda os índices dos primitivos originais na 
+ * ordem em que as folhas os referenciam.
+ */
+typedef struct {
+    no_bvh_t *nos;
+    int num_nos;
+    int *primitivos;
+    int num_primitivos;
+} bvh_t;
+
+
+/** 
+ * Grupo de triângulos de um aglomerado compactado (uma folha da BVH 
+ * original). A caixa é guardada em 8 bits por coordenada, na grade do 
+ * aglomerado deslocada de 'deslocamento' bits.
+ */
+typedef struct {
+    unsigned char caixa[6]; // Mínimo e máximo (x, y, z).
+    unsigned char inicio; // Primeiro triângulo (local ao aglomerado).
+    unsigned char quantidade;
+} grupo_compacto_t;
+
+/** 
+ * Aglomerado de uma malha compactada: até 256 vértices, quantizados em 
+ * 16 bits relativos ao seu canto mínimo na grade da malha, e triângulos 
+ * com índices locais de 8 bits.
+ */
+typedef struct {
+    int origem[3]; // Canto mínimo na grade da malha.
+    unsigned short extensao[3]; // Tamanho na grade.
+    unsigned char deslocamento[3]; // Bits descartados nas caixas dos grupos.
+    unsigned char num_grupos;
+    int primeiro_vertice;
+    int primeiro_triangulo;
+    int primeiro_grupo;
+} aglomerado_t;
+
+/** 
+ * Geometria compactada de uma malha. Todos os aglomerados usam a mesma 
+ * grade (ponto = base + (origem + q) * escala), então vértices 
+ * compartilhados entre aglomerados são decodificados exatamente iguais e 
+ * a malha continua sem frestas.
+ */
+typedef struct {
+    ponto_t base;
+    vetor_t escala;
+    aglomerado_t *aglomerados;
+    int num_aglomerados;
+    grupo_compacto_t *grupos;
+    int num_grupos;
+    unsigned short *vertices; // 3 por vértice.
+    unsigned char *indices; // 3 por triângulo (locais ao aglomerado).
+} malha_compacta_t;
+
+/** 
+ * Estrutura para armazenar uma malha de triângulos. 
+ * 
+ * A geometria é guardada apenas uma vez (vértices e índices, 3 por 
+ * triângulo), no espaço do objeto, junto da sua BVH (nível de baixo). 
+ * Várias instâncias podem compartilhar a mesma malha. Se a malha veio 
+ * de um arquivo binário, os arrays apontam direto para o arquivo mapeado 
+ * em memória ('mapa'), sem cópias. Se a malha foi compactada 
+ * ('compacta'), os vértices e índices deixam de existir e a BVH passa a 
+ * ser sobre os aglomerados.
+ */
+typedef struct {
+    ponto_t *vertices;
+    int num_vertices;
+    int *indices;
+    int num_triangulos;
+    bvh_t bvh;
+    void *mapa;
+    size_t tamanho_mapa;
+    malha_compacta_t *compacta;
+} malha_t;
+
+/** 
+ * Estrutura para armazenar uma instância de uma malha. 
+ * 
+ * A instância guarda apenas a matriz 3x4 (linha a linha) que leva do 
+ * espaço do objeto para o mundo, a sua inversa e a caixa envolvente 
+ * no mundo. O material fica no objeto que contém a instância.
+ */
+typedef struct {
+    malha_t *malha;
+    real_t matriz[12];
+    real_t inversa[12];
+    caixa_t caixa;
+} instancia_t;
+
+
 /** 
  * Estrutura para armazenar um objeto (pode ser esfera ou cubo).
  * 
  */
 typedef struct 
 {
-    enum {ESFERA, PIRAMIDE, CUBO, PLANO} tipo;
+    enum {ESFERA, PIRAMIDE, CUBO, PLANO, INSTANCIA, MALHA} tipo;
     
     union 
     {
@@ -106,22 +280,82 @@ typedef struct
         piramide_t *piramide;
         cubo_t *cubo;
         plano_t *plano;
+        instancia_t *instancia;
+        malha_t *malha;
     };
     
     cor_t cor;
-    char refletivel;
+    char refletivel; // Se reflete a cena (com o coeficiente kr).
+    real_t transparencia; // Fração da luz transmitida (0 é opaco).
+    real_t indice_refracao; // Índice de refração (se transparente).
     
 } objeto_t;
 
 /** 
- * Estrutura para definir a fonte de luz.
+ * Estrutura para definir a fonte de luz. A luz local pode ter área (um
+ * retângulo ou uma esfera centrados na posição), o que só muda a sombra:
+ * a equação de Phong continua a usar o centro.
  * 
  */
 typedef struct {
     ponto_t posicao;
     cor_t cor;
+    int forma; // LUZ_PONTUAL, LUZ_RETANGULAR ou LUZ_ESFERICA.
+    vetor_t lado_u, lado_v; // Lados do retângulo.
+    real_t raio; // Raio da esfera.
 } luz_t;
 
+/** Nó da árvore de luzes (definido em luzes.h). */
+typedef struct no_luz no_luz_t;
+
+/**
+ * Árvore de luzes (lightcuts) sobre um array de luzes pontuais. Ao
+ * contrário da luz local, estas luzes perdem intensidade com o quadrado da
+ * distância e só iluminam o lado da superfície virado para elas.
+ */
+typedef struct {
+    luz_t *luzes;
+    int num_luzes;
+    no_luz_t *nos;
+    int num_nos;
+} arvore_luzes_t;
+
+/** Cache de irradiância (definido em irradiancia.h). */
+typedef struct cache_irradiancia cache_irradiancia_t;
+
+/** Mapa de fótons das cáusticas (definido em fotons.h). */
+typedef struct mapa_fotons mapa_fotons_t;
+
+/** 
+ * Estrutura para armazenar a cena. 
+ * 
+ * Os objetos limitados (todos menos os planos) ficam numa BVH de objetos 
+ * (nível de cima). Os planos, por serem infinitos, são testados um a um.
+ * As luzes pontuais da cena (além da luz local) ficam numa árvore de luzes.
+ * Com um cache de irradiância, a luz ambiente dá lugar à indireta difusa,
+ * e um mapa de fótons soma as cáusticas à luz direta.
+ */
+typedef struct {
+    objeto_t *objetos;
+    int num_objetos;
+    bvh_t bvh;
+    int *ilimitados;
+    int num_ilimitados;
+    arvore_luzes_t luzes; // Luzes pontuais além da luz local.
+    cache_irradiancia_t *irradiancia; // Cache da luz indireta (ou NULL).
+    mapa_fotons_t *fotons; // Mapa das cáusticas (ou NULL).
+} cena_t;
+
+/** Sequência de números de uma amostra de um píxel (definida em
+ * amostrador.h). */
+typedef struct sequencia sequencia_t;
+
+/** Raio secundário à espera de ser traçado (definido em onda.h). */
+typedef struct raio_pendente raio_pendente_t;
+
+/** Pacote de raios de sombra (definido em onda.h). */
+typedef struct pacote_sombra pacote_sombra_t;
+
 
 /** 
  * Esta função faz a soma de dois vetores.
@@ -148,7 +382,7 @@ vetor_t sub_v(vetor_t *v1, vetor_t *v2);
  * @param k Escalar que multiplica o vetor v1.
  * @return Produto de k por v1.
  */
-vetor_t mult_e(vetor_t *v1, double k);
+vetor_t mult_e(vetor_t *v1, real_t k);
 
 /** 
  * Esta função faz a multiplicação elemento a elemento de dois vetores.
@@ -173,7 +407,7 @@ vetor_t neg_v(vetor_t *v1);
  * @param v1 Ponteiro para o vetor.
  * @return Módulo (norma) do vetor v1.
  */
-double modulo(vetor_t *v1);
+real_t modulo(vetor_t *v1);
 
 /** 
  * Esta função normaliza um vetor, isto é, faz com que seu módulo seja
@@ -191,7 +425,7 @@ vetor_t normalizar(vetor_t *v1);
  * @param v2 Ponteiro para o segundo vetor.
  * @return Resultado do produto escalar entre v1 e v2.
  */
-double prod_e(vetor_t *v1, vetor_t *v2);
+real_t prod_e(vetor_t *v1, vetor_t *v2);
 
 
 /** 
@@ -203,6 +437,38 @@ double prod_e(vetor_t *v1, vetor_t *v2);
  */
 vetor_t prod_v(vetor_t *v1, vetor_t *v2);
 
+/**
+ * Retorna a componente de um ponto (ou vetor) num eixo.
+ *
+ * @param p Ponteiro para o ponto.
+ * @param eixo Eixo (0 = x, 1 = y, 2 = z).
+ * @return Coordenada do ponto no eixo.
+ */
+real_t componente(ponto_t *p, int eixo);
+
+/**
+ * Realoca um array para n elementos de um tamanho dado. Se faltar
+ * memória, o array antigo fica como estava.
+ *
+ * @param array Ponteiro para o ponteiro do array (trocado pelo novo).
+ * @param n Número de elementos.
+ * @param tamanho Tamanho de cada elemento.
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+int realocar(void **array, int n, size_t tamanho);
+
+/** 
+ * Afasta um ponto de uma superfície ao longo da normal, para o lado em 
+ * que segue a direção dada. O afastamento é proporcional ao tamanho das 
+ * coordenadas do ponto, já que o erro de arredondamento também é.
+ * 
+ * @param ponto Ponteiro para o ponto na superfície.
+ * @param normal Ponteiro para a normal (normalizada) da superfície.
+ * @param direcao Ponteiro para a direção do raio que sairá do ponto.
+ * @return Ponto deslocado.
+ */
+ponto_t deslocar_ponto(ponto_t *ponto, vetor_t *normal, vetor_t *direcao);
+
 /**
  * Verifica se um determinado raio intersecta uma esfera no espaço.
  * 
@@ -218,7 +484,7 @@ vetor_t prod_v(vetor_t *v1, vetor_t *v2);
  * @return 1 se o raio intersecta a esfera, 0 caso contrário.
  */ 
 int intersecao_esfera(ponto_t *origem_raio, vetor_t *direcao_raio, 
-    esfera_t *esfera, double *t0, double *t1, vetor_t *normal);
+    esfera_t *esfera, real_t *t0, real_t *t1, vetor_t *normal);
 
 
 /**
@@ -237,7 +503,7 @@ int intersecao_esfera(ponto_t *origem_raio, vetor_t *direcao_raio,
  * @return 1 se o raio intersecta o piramide, 0 caso contrário.
  */ 
 int intersecao_piramide(ponto_t *origem_raio, vetor_t *direcao_raio, 
-    piramide_t *piramide, double *t0, double *t1, vetor_t *normal);
+    piramide_t *piramide, real_t *t0, real_t *t1, vetor_t *normal);
 
 
 
@@ -256,7 +522,18 @@ int intersecao_piramide(ponto_t *origem_raio, vetor_t *direcao_raio,
  * @return 1 se o raio intersecta o cubo, 0 caso contrário.
  */ 
 int intersecao_cubo(ponto_t *origem_raio, vetor_t *direcao_raio, cubo_t *cubo, 
-    double *t0, double *t1, vetor_t *normal);
+    real_t *t0, real_t *t1, vetor_t *normal);
+
+/**
+ * Detecta a forma de um cubo a partir dos seus 8 vértices. Se eles 
+ * formarem uma caixa alinhada aos eixos, guarda apenas os cantos min/max; 
+ * se formarem um paralelepípedo reto qualquer, guarda o centro, os eixos 
+ * e a caixa no espaço local. Caso contrário, o cubo continua sendo 
+ * testado pelos seus 12 triângulos.
+ * 
+ * @param cubo Ponteiro para o cubo a ser preparado.
+ */ 
+void cubo_preparar(cubo_t *cubo);
 
 /**
  * Verifica se um determinado raio intersecta um triângulo no espaço.
@@ -273,7 +550,7 @@ int intersecao_cubo(ponto_t *origem_raio, vetor_t *direcao_raio, cubo_t *cubo,
  * @return 1 se o raio intersecta o piramide, 0 caso contrário.
  */ 
 int intersecao_triangulo(ponto_t *origem_raio, vetor_t *direcao_raio, 
-    triangulo_t *triangulo, double *t0, vetor_t *normal);
+    triangulo_t *triangulo, real_t *t0, vetor_t *normal);
     
     
 /**
@@ -291,10 +568,92 @@ int intersecao_triangulo(ponto_t *origem_raio, vetor_t *direcao_raio,
  * @return 1 se o raio intersecta o piramide, 0 caso contrário.
  */ 
 int intersecao_plano(ponto_t *origem_raio, vetor_t *direcao_raio, 
-    plano_t *plano, double *t0);    
+    plano_t *plano, real_t *t0);    
+
+/**
+ * Verifica se um determinado raio intersecta uma caixa alinhada aos eixos
+ * (teste das placas).
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param inv_direcao Ponteiro para o inverso de cada componente da 
+ * direção do raio.
+ * @param caixa Ponteiro para a caixa a ser intersectada.
+ * @param tmax Distância máxima a ser considerada.
+ * @param t0 Ponteiro para a distância de entrada na caixa (é modificada 
+ * na função).
+ * @return 1 se o raio intersecta a caixa antes de tmax, 0 caso contrário.
+ */ 
+int intersecao_caixa(ponto_t *origem_raio, vetor_t *inv_direcao, 
+    caixa_t *caixa, real_t tmax, real_t *t0);
+
+/**
+ * Verifica se um raio de um pacote de raios de sombra intersecta uma
+ * caixa (as mesmas contas de intersecao_caixa(), lidas dos arrays do
+ * pacote).
+ *
+ * @param pacote Ponteiro para o pacote.
+ * @param k Posição do raio no pacote.
+ * @param caixa Ponteiro para a caixa.
+ * @param tmax Distância máxima a ser considerada.
+ * @return 1 se o raio intersecta a caixa, 0 caso contrário.
+ */
+int intersecao_caixa_pacote(pacote_sombra_t *pacote, int k, caixa_t *caixa,
+    real_t tmax);
+
+/**
+ * Verifica se um determinado raio intersecta um objeto qualquer da cena.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param objeto Ponteiro para o objeto a ser intersectado.
+ * @param t0 Ponteiro para a menor distância positiva de interseção 
+ * (é modificada na função).
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @return 1 se o raio intersecta o objeto, 0 caso contrário.
+ */ 
+int intersecao_objeto(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    objeto_t *objeto, real_t *t0, vetor_t *normal);
+
+/**
+ * Calcula a caixa envolvente (no mundo) de um objeto.
+ * 
+ * @param objeto Ponteiro para o objeto.
+ * @param caixa Ponteiro para a caixa a ser preenchida.
+ * @return 1 se o objeto é limitado, 0 caso seja infinito (plano).
+ */ 
+int caixa_objeto(objeto_t *objeto, caixa_t *caixa);
+
+/**
+ * Calcula uma esfera que envolve um objeto limitado: a própria esfera, a
+ * da caixa orientada de um cubo ou, nos outros objetos, a da caixa
+ * envolvente.
+ * 
+ * @param objeto Ponteiro para o objeto.
+ * @param centro Ponteiro para o centro da esfera (é modificado).
+ * @param raio Ponteiro para o raio da esfera (é modificado).
+ * @return 1 se o objeto é limitado, 0 caso seja infinito (plano).
+ */ 
+int esfera_envolvente(objeto_t *objeto, ponto_t *centro, real_t *raio);
+
+/**
+ * Calcula pontos cujo fecho convexo contém um objeto limitado: os
+ * vértices da pirâmide e do cubo ou os cantos da caixa envolvente das
+ * malhas e instâncias. A esfera e o plano não têm esses pontos.
+ * 
+ * @param objeto Ponteiro para o objeto.
+ * @param vertices Array de 8 pontos (é preenchido).
+ * @param convexo Ponteiro para o indicador de que o fecho é o próprio 
+ * objeto, e não só uma região que o contém (é modificado).
+ * @return Número de pontos.
+ */ 
+int vertices_objeto(objeto_t *objeto, ponto_t vertices[8], int *convexo);
 
 /** 
- * Faz a operação de raytracing resursiva. 
+ * Faz a operação de raytracing, com as reflexões e refrações traçadas por
+ * colorir_caminho() (os raios secundários que escapam da cena são pretos).
  * 
  * @param origem_raio Ponteiro para o ponto no espaço de onde o 
  * raio parte.
@@ -302,17 +661,143 @@ int intersecao_plano(ponto_t *origem_raio, vetor_t *direcao_raio,
  * do raio.
  * @param luz_local Ponteiro para a luz local (pontual).
  * @param luz_ambiente Ponteiro para a luz ambiente.
- * @param objetos Array com objetos colocados no espaço.
- * @param num_objetos Número de objetos do array de objetos.
- * @param num_reflexoes Número de reflexões (usado na versão recursiva).
- * @param max_recursoes Número máximo de reflexões (usado na versão recursiva).
- * @param num_esferas Número de esferas do array anterior.
- * 
+ * @param cena Ponteiro para a cena com os objetos colocados no espaço.
+ * @param num_reflexoes Número de reflexões que já levaram a este raio.
+ * @param max_recursoes Número máximo de reflexões.
+ * @return Cor vista pelo raio ou (-1, -1, -1) se ele não tocar nada.
  */
 cor_t raytrace(ponto_t *origem_raio, vetor_t *direcao_raio, luz_t *luz_local,  
-    luz_t *luz_ambiente, objeto_t *objetos, int num_objetos, int num_reflexoes,  
-    int max_recursoes);
+    luz_t *luz_ambiente, cena_t *cena, int num_reflexoes, int max_recursoes);
+
+/**
+ * Calcula a cor vista por um raio que já se sabe tocar um objeto.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param cena Ponteiro para a cena com os objetos colocados no espaço.
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param t Distância até o ponto de interseção.
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @param luz_direta Fração da luz local que chega ao ponto (de 0 a 1),
+ * quando a visibilidade da luz já foi calculada, ou -1 para calculá-la aqui.
+ * @return Cor do ponto de interseção.
+ */
+cor_t colorir_intersecao(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    luz_t *luz_local, luz_t *luz_ambiente, cena_t *cena, objeto_t *objeto, 
+    real_t t, vetor_t *normal, real_t luz_direta);
+
+/**
+ * Calcula a cor vista por um raio que já se sabe tocar um objeto, somando
+ * as reflexões (objetos refletíveis, com peso kr) e as refrações (objetos
+ * transparentes). Em vez de recursão, os raios secundários ficam numa
+ * pilha com o peso que carregam desde o raio original; os que pesam menos
+ * que ROLETA_LIMIAR sobrevivem com probabilidade proporcional ao peso (e
+ * têm o peso corrigido, para que a média não mude).
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor (normalizado) que determina a
+ * direção do raio.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param cena Ponteiro para a cena com os objetos colocados no espaço.
+ * @param fundo Ponteiro para a cor dos raios secundários que não tocam nada.
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param t Distância até o ponto de interseção.
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @param luz_direta Fração da luz local que chega ao primeiro ponto (de 0
+ * a 1), quando a visibilidade da luz já foi calculada, ou -1 para
+ * calculá-la aqui.
+ * @param max_recursoes Número máximo de reflexões (ou refrações) seguidas.
+ * @param max_raios Número máximo de raios secundários traçados.
+ * @param semente Ponteiro para o estado do gerador de números aleatórios
+ * da roleta russa (é modificado).
+ * @return Cor do ponto de interseção.
+ */
+cor_t colorir_caminho(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    luz_t *luz_local, luz_t *luz_ambiente, cena_t *cena, cor_t *fundo, 
+    objeto_t *objeto, real_t t, vetor_t *normal, real_t luz_direta, 
+    int max_recursoes, int max_raios, unsigned int *semente);
+
+/**
+ * Calcula por Monte Carlo (traçado de caminhos) a cor vista por um raio
+ * que já se sabe tocar um objeto, com a iluminação global difusa. Em cada
+ * ponto do caminho soma-se a luz direta (equação de Phong sem a luz
+ * ambiente, com a sombra de visibilidade_luz()) e o caminho segue por um
+ * só evento, sorteado com probabilidade proporcional ao peso: o rebote 
+ * difuso (direção com densidade proporcional ao cosseno, peso kd vezes a
+ * cor do objeto), a reflexão ou a refração. A partir de MONTE_CARLO_ROLETA
+ * rebotes, a roleta russa descarta os caminhos que carregam pouca luz.
+ * Os sorteios de cada rebote saem de dimensões fixas da sequência (a
+ * direção difusa de um par, o evento e a roleta do par seguinte), de modo
+ * que a mesma amostra gera o mesmo caminho em qualquer thread e que os
+ * amostradores estratificados distribuam bem as direções.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor (normalizado) que determina a
+ * direção do raio.
+ * @param luz_local Ponteiro para a luz local.
+ * @param cena Ponteiro para a cena com os objetos colocados no espaço.
+ * @param fundo Ponteiro para a cor dos raios que não tocam nada.
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param t Distância até o ponto de interseção.
+ * @param normal Ponteiro para o vetor normal no ponto de interseção.
+ * @param max_rebotes Número máximo de rebotes do caminho.
+ * @param sequencia Ponteiro para a sequência da amostra, cuja dimensão
+ * atual deve ser par (é modificada).
+ * @return Estimativa da cor do ponto de interseção.
+ */
+cor_t colorir_monte_carlo(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    luz_t *luz_local, cena_t *cena, cor_t *fundo, objeto_t *objeto, 
+    real_t t, vetor_t *normal, int max_rebotes, sequencia_t *sequencia);
 
+/**
+ * Leva um ponto (u1, u2) do quadrado unitário a uma direção no hemisfério
+ * da normal com densidade proporcional ao cosseno com ela (pelo disco
+ * unitário projetado no hemisfério).
+ * 
+ * @param normal Ponteiro para a normal (normalizada).
+ * @param u1 Primeira coordenada, em [0, 1).
+ * @param u2 Segunda coordenada, em [0, 1).
+ * @return Direção (normalizada).
+ */
+vetor_t direcao_difusa(vetor_t *normal, real_t u1, real_t u2);
+
+/**
+ * Aplica a roleta russa a um raio secundário: os que pesam menos que
+ * ROLETA_LIMIAR sobrevivem com probabilidade proporcional ao peso e 
+ * passam a pesar ROLETA_LIMIAR (para que a média não mude).
+ * 
+ * @param peso Peso do raio.
+ * @param semente Ponteiro para o estado do gerador de números aleatórios
+ * (é modificado).
+ * @return Peso corrigido do raio ou 0 se ele foi descartado.
+ */
+real_t roleta_russa(real_t peso, unsigned int *semente);
+
+/**
+ * Gera os raios secundários de um ponto tocado: a refração (lei de Snell,
+ * se o objeto é transparente) e a reflexão (se o objeto é refletível ou se
+ * houve reflexão interna total, que reflete a luz transmitida).
+ * 
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param direcao_raio Ponteiro para a direção (normalizada) do raio.
+ * @param ponto_intersec Ponteiro para o ponto de interseção.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @param dentro Se o raio vem de dentro do objeto.
+ * @param secundarios Array de 2 raios preenchido com a origem, a direção e
+ * a fração da cor do raio que cada um carrega (a profundidade não é
+ * preenchida).
+ * @return Número de raios gerados.
+ */
+int raios_secundarios(objeto_t *objeto, vetor_t *direcao_raio, 
+    ponto_t *ponto_intersec, vetor_t *normal, int dentro, 
+    raio_pendente_t *secundarios);
 
 /**
  * Equação de Phong da iluminação, que serve para calcular a cor do objeto.
@@ -331,6 +816,74 @@ cor_t equacao_phong(ponto_t *origem_raio, luz_t *luz_local,
     cor_t *cor_ponto);
     
     
+/**
+ * Calcula o raio de sombra de um ponto: a direção (normalizada) até a luz
+ * local e a origem, um pouco afastada da superfície, do lado da luz.
+ * 
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param ponto_intersec Ponteiro para o ponto de interseção.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @param origem_sombra Ponteiro para a origem do raio de sombra (é 
+ * modificada na função).
+ * @param direcao_sombra Ponteiro para a direção do raio de sombra (é 
+ * modificada na função).
+ */
+void raio_sombra(luz_t *luz_local, ponto_t *ponto_intersec, vetor_t *normal,
+    ponto_t *origem_sombra, vetor_t *direcao_sombra);
+
+/**
+ * Gera um número pseudoaleatório inicial a partir das coordenadas de um
+ * ponto, para que os sorteios de um ponto não dependam da ordem em que os
+ * pontos são traçados (nem da thread).
+ * 
+ * @param ponto Ponteiro para o ponto.
+ * @return Semente do ponto.
+ */
+unsigned int semente_ponto(ponto_t *ponto);
+
+/**
+ * Calcula a fração da luz local que chega a um ponto. Para a luz pontual,
+ * é um raio de sombra só (0 ou 1). Para a luz de área, a esfera que a
+ * envolve é comparada com o plano da superfície e com os objetos da cena
+ * (sombra_cena()): se ela fica toda acima do plano e a cena a deixa toda
+ * visível ou toda escondida, nenhum raio é traçado. Senão (na penumbra ou
+ * na dúvida), AMOSTRAS_PENUMBRA_LADO x AMOSTRAS_PENUMBRA_LADO raios vão a
+ * pontos sorteados em faixas da luz, e a fração é a média deles. Os
+ * sorteios dependem só do ponto.
+ * 
+ * @param cena Ponteiro para a cena.
+ * @param luz_local Ponteiro para a luz local.
+ * @param ponto_intersec Ponteiro para o ponto de interseção.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @param objeto Ponteiro para o objeto de onde os raios partem.
+ * @return Fração (de 0 a 1) da luz que chega ao ponto.
+ */
+real_t visibilidade_luz(cena_t *cena, luz_t *luz_local, 
+    ponto_t *ponto_intersec, vetor_t *normal, objeto_t *objeto);
+
+/**
+ * Calcula a cor de um ponto pela equação de Phong, já sabendo quanto da
+ * luz local chega a ele (se nada chega, só a luz ambiente conta), somada à
+ * das luzes da árvore de luzes da cena. Se a cena tem um cache de
+ * irradiância, a luz ambiente é trocada pela indireta difusa do cache, e
+ * se tem um mapa de fótons, as cáusticas dele entram como luz difusa.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente (ou NULL para só a luz
+ * direta, sem a ambiente, a do cache nem as cáusticas).
+ * @param cena Ponteiro para a cena.
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param ponto_intersec Ponteiro para o ponto de interseção.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @param luz_direta Fração da luz local que chega ao ponto (de 0 a 1).
+ * @return Cor do ponto.
+ */
+cor_t iluminar_ponto(ponto_t *origem_raio, luz_t *luz_local, 
+    luz_t *luz_ambiente, cena_t *cena, objeto_t *objeto, 
+    ponto_t *ponto_intersec, vetor_t *normal, real_t luz_direta);
+
 /**
  * Equação de Phong da iluminação, que serve para calcular a cor do objeto.
  * 
@@ -338,15 +891,14 @@ cor_t equacao_phong(ponto_t *origem_raio, luz_t *luz_local,
  * raio parte.
  * @param luz_local Ponteiro para a luz local (pontual).
  * @param luz_ambiente Ponteiro para a luz ambiente.
- * @param objetos Array de objetos.
- * @param num_objetos Número e objetos no array.
+ * @param cena Ponteiro para a cena.
  * @param objeto_perto Objeto mais perto da câmera.
  * @param ponto_intersec Ponto de interseção entre o raio e o objeto.
  * @param normal Vetor normal que indica o plano onde está o ponto.
  * 
  */ 
 cor_t calcular_iluminacao(ponto_t *origem_raio, vetor_t *direcao_raio, 
-    luz_t *luz_local, luz_t *luz_ambiente, objeto_t *objetos, int num_objetos, 
+    luz_t *luz_local, luz_t *luz_ambiente, cena_t *cena, 
     objeto_t *objeto_perto, ponto_t *ponto_intersec, vetor_t *normal);
 
 #endif // GEOMETRIA_H
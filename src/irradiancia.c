@@ -0,0 +1,544 @@
+#include "irradiancia.h"
+#include "amostrador.h"
+#include "bvh.h"
+#include "cena.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+/** Tamanho da pilha da busca na octree (7 irmãos pendentes por nível). */
+#define PILHA_IRRADIANCIA (7 * IRRADIANCIA_MAX_PROFUNDIDADE + 8)
+
+/**
+ * Cria um cache de irradiância vazio.
+ *
+ * @param num_threads Número de threads que consultam o cache (uma thread
+ * fora delas pode consultá-lo, mas não guarda os registros que cria).
+ * @return Ponteiro para o cache ou NULL se faltar memória.
+ */
+cache_irradiancia_t *irradiancia_criar(int num_threads)
+{
+    cache_irradiancia_t *cache;
+
+    cache = calloc(1, sizeof(cache_irradiancia_t));
+    if(cache == NULL)
+    {
+        return NULL;
+    }
+
+    cache->buffers = calloc(num_threads, sizeof(buffer_irradiancia_t));
+    if(cache->buffers == NULL)
+    {
+        free(cache);
+        return NULL;
+    }
+    cache->num_buffers = num_threads;
+    return cache;
+}
+
+/**
+ * Raio de validade de um registro: a distância (com a mesma normal) em
+ * que o erro de Ward chega a IRRADIANCIA_ERRO.
+ */
+static real_t raio_registro(registro_irradiancia_t *registro)
+{
+    return IRRADIANCIA_ERRO * registro->distancia;
+}
+
+/**
+ * Soma a irradiância de um registro, pesada pela validade dele no ponto,
+ * à média em andamento. O erro é o de Ward (a distância relativa à média
+ * harmônica somada à diferença entre as normais), e o peso cai a zero
+ * quando ele chega a IRRADIANCIA_ERRO. Registros à frente do ponto (cujo
+ * hemisfério não vê o que o ponto vê) ficam de fora.
+ */
+static void somar_registro(registro_irradiancia_t *registro, ponto_t *ponto,
+    vetor_t *normal, cor_t *soma, real_t *soma_pesos)
+{
+    real_t erro, peso, raio;
+    vetor_t distancia, normais;
+    cor_t temp1_v;
+
+    distancia = sub_v(ponto, &registro->posicao);
+    raio = raio_registro(registro);
+    if(prod_e(&distancia, &distancia) >= raio * raio)
+    {
+        return;
+    }
+
+    normais = soma_v(normal, &registro->normal);
+    if(prod_e(&distancia, &normais) < -EPSILON)
+    {
+        return;
+    }
+
+    erro = modulo(&distancia) / registro->distancia +
+        sqrt(max((real_t) 0.0, 1.0 - prod_e(normal, &registro->normal)));
+    if(erro >= IRRADIANCIA_ERRO)
+    {
+        return;
+    }
+
+    peso = 1.0 / max(erro, (real_t) EPSILON) - 1.0 / IRRADIANCIA_ERRO;
+    temp1_v = mult_e(&registro->irradiancia, peso);
+    *soma = soma_v(soma, &temp1_v);
+    *soma_pesos += peso;
+}
+
+/**
+ * Soma os registros da octree que valem para o ponto, descendo só pelos
+ * nós cujo alcance (o cubo que cobre as esferas de validade dos registros
+ * da subárvore) contém o ponto.
+ */
+static void somar_octree(cache_irradiancia_t *cache, ponto_t *ponto,
+    vetor_t *normal, cor_t *soma, real_t *soma_pesos)
+{
+    int pilha[PILHA_IRRADIANCIA];
+    int num_pendentes, indice, registro, octante;
+    no_irradiancia_t *no;
+
+    if(cache->num_nos == 0)
+    {
+        return;
+    }
+
+    pilha[0] = 0;
+    num_pendentes = 1;
+    while(num_pendentes > 0)
+    {
+        indice = pilha[--num_pendentes];
+        no = &cache->nos[indice];
+        if(fabs(ponto->x - no->centro.x) > no->alcance ||
+            fabs(ponto->y - no->centro.y) > no->alcance ||
+            fabs(ponto->z - no->centro.z) > no->alcance)
+        {
+            continue;
+        }
+
+        for(registro = no->primeiro; registro >= 0;
+            registro = cache->registros[registro].proximo)
+        {
+            somar_registro(&cache->registros[registro], ponto, normal, soma,
+                soma_pesos);
+        }
+
+        for(octante = 0; octante < 8; octante++)
+        {
+            if(no->filhos[octante] >= 0)
+            {
+                pilha[num_pendentes++] = no->filhos[octante];
+            }
+        }
+    }
+}
+
+/**
+ * Calcula um registro novo: a média da luz direta dos pontos tocados por
+ * IRRADIANCIA_AMOSTRAS raios com densidade proporcional ao cosseno (pares
+ * de Sobol embaralhados pela semente do ponto) e a média harmônica das
+ * distâncias até eles.
+ */
+static void calcular_registro(cena_t *cena, luz_t *luz_local,
+    ponto_t *ponto, vetor_t *normal, registro_irradiancia_t *registro)
+{
+    int k;
+    unsigned int semente;
+    real_t t, inversos, u1, u2;
+    ponto_t origem, ponto_tocado;
+    vetor_t direcao, normal_tocado, temp1_v;
+    objeto_t *objeto;
+    cor_t soma, cor;
+
+    soma.x = soma.y = soma.z = 0.0;
+    inversos = 0.0;
+    semente = semente_ponto(ponto);
+    for(k = 0; k < IRRADIANCIA_AMOSTRAS; k++)
+    {
+        u1 = amostrador_valor(AMOSTRADOR_SOBOL, semente, 0, k, 0);
+        u2 = amostrador_valor(AMOSTRADOR_SOBOL, semente, 0, k, 1);
+        direcao = direcao_difusa(normal, u1, u2);
+        origem = deslocar_ponto(ponto, normal, &direcao);
+        objeto = intersecao_cena(cena, &origem, &direcao, &t,
+            &normal_tocado);
+        if(objeto == NULL)
+        {
+            continue;
+        }
+
+        if(prod_e(&direcao, &normal_tocado) > 0)
+        {
+            normal_tocado = neg_v(&normal_tocado);
+        }
+        temp1_v = mult_e(&direcao, t);
+        ponto_tocado = soma_v(&origem, &temp1_v);
+
+        // Só a luz direta: o ponto tocado não consulta o cache.
+        cor = iluminar_ponto(ponto, luz_local, NULL, cena, objeto,
+            &ponto_tocado, &normal_tocado, visibilidade_luz(cena, luz_local,
+            &ponto_tocado, &normal_tocado, objeto));
+        cor = mult_e(&cor, 1.0 - objeto->transparencia);
+        soma = soma_v(&soma, &cor);
+        inversos += 1.0 / max(t, (real_t) EPSILON);
+    }
+
+    registro->posicao = *ponto;
+    registro->normal = *normal;
+    registro->irradiancia = mult_e(&soma, 1.0 / IRRADIANCIA_AMOSTRAS);
+    registro->distancia = inversos > 0.0 ? IRRADIANCIA_AMOSTRAS / inversos :
+        IRRADIANCIA_DISTANCIA_MAX;
+    registro->distancia = min(IRRADIANCIA_DISTANCIA_MAX,
+        max((real_t) IRRADIANCIA_DISTANCIA_MIN, registro->distancia));
+    registro->proximo = -1;
+}
+
+/**
+ * Calcula a luz indireta difusa que chega a um ponto (a média, pesada
+ * pelo cosseno, da luz vinda do hemisfério da normal). Se registros do
+ * cache valem para o ponto, ela é a média deles, com pesos que vão a zero
+ * no limite de validade de cada um (sem saltos na imagem); senão,
+ * IRRADIANCIA_AMOSTRAS raios (Sobol, estratificados no hemisfério) levam
+ * à luz direta dos pontos que tocam, e o resultado vira um registro no
+ * buffer da thread (omp_get_thread_num()). O fundo não ilumina a cena.
+ * Pode ser chamada por várias threads ao mesmo tempo, mas não junto com
+ * irradiancia_mesclar().
+ *
+ * @param cache Ponteiro para o cache.
+ * @param cena Ponteiro para a cena.
+ * @param luz_local Ponteiro para a luz local.
+ * @param ponto Ponteiro para o ponto.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @return Luz indireta que chega ao ponto.
+ */
+cor_t irradiancia_obter(cache_irradiancia_t *cache, cena_t *cena,
+    luz_t *luz_local, ponto_t *ponto, vetor_t *normal)
+{
+    int thread, k;
+    real_t soma_pesos;
+    cor_t soma;
+    buffer_irradiancia_t *buffer;
+    registro_irradiancia_t registro;
+
+    thread = omp_get_thread_num();
+    buffer = thread < cache->num_buffers ? &cache->buffers[thread] : NULL;
+
+    soma.x = soma.y = soma.z = 0.0;
+    soma_pesos = 0.0;
+    somar_octree(cache, ponto, normal, &soma, &soma_pesos);
+    if(buffer != NULL)
+    {
+        for(k = max(0, buffer->num_registros - IRRADIANCIA_RECENTES);
+            k < buffer->num_registros; k++)
+        {
+            somar_registro(&buffer->registros[k], ponto, normal, &soma,
+                &soma_pesos);
+        }
+        buffer->consultas++;
+    }
+
+    if(soma_pesos > 0.0)
+    {
+        if(buffer != NULL)
+        {
+            buffer->interpoladas++;
+        }
+        return mult_e(&soma, 1.0 / soma_pesos);
+    }
+
+    calcular_registro(cena, luz_local, ponto, normal, &registro);
+    if(buffer != NULL)
+    {
+        if(buffer->num_registros == buffer->capacidade &&
+            realocar((void **) &buffer->registros,
+            2 * buffer->capacidade + 16, sizeof(registro_irradiancia_t)))
+        {
+            buffer->capacidade = 2 * buffer->capacidade + 16;
+        }
+        if(buffer->num_registros < buffer->capacidade)
+        {
+            buffer->registros[buffer->num_registros++] = registro;
+        }
+    }
+    return registro.irradiancia;
+}
+
+/**
+ * Cria um nó vazio no fim do array de nós.
+ *
+ * @return Índice do nó ou -1 se faltar memória.
+ */
+static int criar_no(cache_irradiancia_t *cache, ponto_t *centro, real_t meio)
+{
+    int k;
+    no_irradiancia_t *no;
+
+    if(cache->num_nos == cache->capacidade_nos)
+    {
+        if(!realocar((void **) &cache->nos, 2 * cache->capacidade_nos + 8,
+            sizeof(no_irradiancia_t)))
+        {
+            return -1;
+        }
+        cache->capacidade_nos = 2 * cache->capacidade_nos + 8;
+    }
+
+    no = &cache->nos[cache->num_nos];
+    no->centro = *centro;
+    no->meio = meio;
+    no->alcance = 0.0;
+    for(k = 0; k < 8; k++)
+    {
+        no->filhos[k] = -1;
+    }
+    no->primeiro = -1;
+    return cache->num_nos++;
+}
+
+/**
+ * Põe um registro (já no array do cache) no nó mais fundo cuja metade do
+ * lado cobre o seu raio de validade, criando os nós que faltam e
+ * aumentando o alcance dos nós do caminho.
+ *
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+static int inserir_registro(cache_irradiancia_t *cache, int registro)
+{
+    int indice, profundidade, octante, filho;
+    real_t raio, meio;
+    ponto_t *posicao, centro;
+    no_irradiancia_t *no;
+
+    raio = raio_registro(&cache->registros[registro]);
+    posicao = &cache->registros[registro].posicao;
+    indice = 0;
+    for(profundidade = 0; ; profundidade++)
+    {
+        no = &cache->nos[indice];
+        no->alcance = max(no->alcance, raio + max(fabs(posicao->x -
+            no->centro.x), max(fabs(posicao->y - no->centro.y),
+            fabs(posicao->z - no->centro.z))));
+        if(profundidade == IRRADIANCIA_MAX_PROFUNDIDADE ||
+            no->meio / 2.0 < raio)
+        {
+            break;
+        }
+
+        octante = (posicao->x > no->centro.x) |
+            (posicao->y > no->centro.y) << 1 |
+            (posicao->z > no->centro.z) << 2;
+        if(no->filhos[octante] < 0)
+        {
+            // O nó pode mudar de lugar ao criar o filho.
+            meio = no->meio / 2.0;
+            centro = no->centro;
+            centro.x += octante & 1 ? meio : -meio;
+            centro.y += octante & 2 ? meio : -meio;
+            centro.z += octante & 4 ? meio : -meio;
+            filho = criar_no(cache, &centro, meio);
+            if(filho < 0)
+            {
+                return 0;
+            }
+            cache->nos[indice].filhos[octante] = filho;
+        }
+        indice = cache->nos[indice].filhos[octante];
+    }
+
+    cache->registros[registro].proximo = cache->nos[indice].primeiro;
+    cache->nos[indice].primeiro = registro;
+    return 1;
+}
+
+/**
+ * Diz se um registro cabe na raiz da octree: o centro dentro do cubo e o
+ * raio de validade até metade do lado.
+ */
+static int cabe_na_raiz(cache_irradiancia_t *cache,
+    registro_irradiancia_t *registro)
+{
+    no_irradiancia_t *raiz;
+
+    raiz = &cache->nos[0];
+    return fabs(registro->posicao.x - raiz->centro.x) <= raiz->meio &&
+        fabs(registro->posicao.y - raiz->centro.y) <= raiz->meio &&
+        fabs(registro->posicao.z - raiz->centro.z) <= raiz->meio &&
+        raio_registro(registro) <= raiz->meio;
+}
+
+/**
+ * Refaz a octree com uma raiz que cobre as esferas de validade de todos
+ * os registros e os põe de novo nela.
+ *
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+static int refazer_octree(cache_irradiancia_t *cache)
+{
+    int k;
+    real_t raio;
+    caixa_t caixa;
+    ponto_t canto, centro;
+
+    caixa = caixa_vazia();
+    for(k = 0; k < cache->num_registros; k++)
+    {
+        raio = raio_registro(&cache->registros[k]);
+        canto = cache->registros[k].posicao;
+        canto.x -= raio;
+        canto.y -= raio;
+        canto.z -= raio;
+        caixa_expandir(&caixa, &canto);
+        canto.x += 2.0 * raio;
+        canto.y += 2.0 * raio;
+        canto.z += 2.0 * raio;
+        caixa_expandir(&caixa, &canto);
+    }
+
+    centro.x = 0.5 * (caixa.min.x + caixa.max.x);
+    centro.y = 0.5 * (caixa.min.y + caixa.max.y);
+    centro.z = 0.5 * (caixa.min.z + caixa.max.z);
+    cache->num_nos = 0;
+    if(criar_no(cache, &centro, 0.5 * max(caixa.max.x - caixa.min.x,
+        max(caixa.max.y - caixa.min.y, caixa.max.z - caixa.min.z))) < 0)
+    {
+        return 0;
+    }
+
+    for(k = 0; k < cache->num_registros; k++)
+    {
+        if(!inserir_registro(cache, k))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Passa os registros dos buffers das threads para a octree (entre as
+ * passadas, sem nenhuma thread consultando o cache). Cada registro fica
+ * no nó mais fundo cuja metade do lado ainda cobre o seu raio de validade
+ * (IRRADIANCIA_ERRO vezes a média harmônica das distâncias); se algum cair
+ * fora da raiz, a octree é refeita para caber todos. Acima de
+ * IRRADIANCIA_MAX_REGISTROS registros, o cache é esvaziado.
+ *
+ * @param cache Ponteiro para o cache.
+ * @return 1 em caso de sucesso, 0 se faltar memória (os registros dos
+ * buffers são descartados).
+ */
+int irradiancia_mesclar(cache_irradiancia_t *cache)
+{
+    int t, k, n, inicio, refazer, resultado;
+    buffer_irradiancia_t *buffer;
+
+    n = cache->num_registros;
+    for(t = 0; t < cache->num_buffers; t++)
+    {
+        cache->consultas += cache->buffers[t].consultas;
+        cache->interpoladas += cache->buffers[t].interpoladas;
+        cache->buffers[t].consultas = cache->buffers[t].interpoladas = 0;
+        n += cache->buffers[t].num_registros;
+    }
+    if(n == cache->num_registros)
+    {
+        return 1;
+    }
+    if(n > IRRADIANCIA_MAX_REGISTROS)
+    {
+        irradiancia_esvaziar(cache);
+        return 1;
+    }
+
+    resultado = 0;
+    if(n > cache->capacidade_registros)
+    {
+        if(!realocar((void **) &cache->registros, n,
+            sizeof(registro_irradiancia_t)))
+        {
+            goto fim;
+        }
+        cache->capacidade_registros = n;
+    }
+
+    inicio = cache->num_registros;
+    for(t = 0; t < cache->num_buffers; t++)
+    {
+        buffer = &cache->buffers[t];
+        memcpy(&cache->registros[cache->num_registros], buffer->registros,
+            buffer->num_registros * sizeof(registro_irradiancia_t));
+        cache->num_registros += buffer->num_registros;
+    }
+
+    refazer = cache->num_nos == 0;
+    for(k = inicio; k < cache->num_registros && !refazer; k++)
+    {
+        refazer = !cabe_na_raiz(cache, &cache->registros[k]);
+    }
+
+    if(refazer)
+    {
+        resultado = refazer_octree(cache);
+    }
+    else
+    {
+        resultado = 1;
+        for(k = inicio; k < cache->num_registros && resultado; k++)
+        {
+            resultado = inserir_registro(cache, k);
+        }
+    }
+
+    // Sem memória, a octree pode ter ficado pela metade.
+    if(!resultado)
+    {
+        cache->num_registros = 0;
+        cache->num_nos = 0;
+    }
+
+fim:
+    for(t = 0; t < cache->num_buffers; t++)
+    {
+        cache->buffers[t].num_registros = 0;
+    }
+    return resultado;
+}
+
+/**
+ * Descarta todos os registros do cache (o da octree e os dos buffers).
+ *
+ * @param cache Ponteiro para o cache.
+ */
+void irradiancia_esvaziar(cache_irradiancia_t *cache)
+{
+    int t;
+
+    cache->num_registros = 0;
+    cache->num_nos = 0;
+    for(t = 0; t < cache->num_buffers; t++)
+    {
+        cache->buffers[t].num_registros = 0;
+    }
+}
+
+/**
+ * Libera a memória do cache.
+ *
+ * @param cache Ponteiro para o cache.
+ */
+void irradiancia_liberar(cache_irradiancia_t *cache)
+{
+    int t;
+
+    if(cache == NULL)
+    {
+        return;
+    }
+
+    for(t = 0; t < cache->num_buffers; t++)
+    {
+        free(cache->buffers[t].registros);
+    }
+    free(cache->buffers);
+    free(cache->registros);
+    free(cache->nos);
+    free(cache);
+}
@@ -0,0 +1,141 @@
+#ifndef IRRADIANCIA_H
+#define IRRADIANCIA_H
+
+#include "geometria.h"
+
+/** Erro aceito na interpolação (o 'a' de Ward): um registro vale para os
+ * pontos cuja distância (relativa à média harmônica do registro) somada à
+ * diferença entre as normais fique abaixo dele. */
+#define IRRADIANCIA_ERRO 0.3
+
+/** Raios traçados no hemisfério de cada registro novo. */
+#define IRRADIANCIA_AMOSTRAS 64
+
+/** Limites da média harmônica das distâncias de um registro: o menor
+ * evita registros demais nos cantos, e o maior, que um registro no meio
+ * do nada valha para a cena inteira. */
+#define IRRADIANCIA_DISTANCIA_MIN 0.1
+#define IRRADIANCIA_DISTANCIA_MAX 4.0
+
+/** Registros mais recentes do buffer da thread consultados antes de criar
+ * um registro novo (os anteriores só valem depois da mescla). */
+#define IRRADIANCIA_RECENTES 64
+
+/** Profundidade máxima da octree. */
+#define IRRADIANCIA_MAX_PROFUNDIDADE 20
+
+/** Registros a partir dos quais o cache é esvaziado na mescla. */
+#define IRRADIANCIA_MAX_REGISTROS (1 << 20)
+
+/**
+ * Registro do cache de irradiância: a luz indireta difusa que chega a um
+ * ponto (a média da luz vinda do hemisfério da normal, pesada pelo
+ * cosseno) e a média harmônica das distâncias até os objetos vistos dele,
+ * que limita o quanto essa luz pode variar em volta do ponto.
+ */
+typedef struct {
+    ponto_t posicao;
+    vetor_t normal;
+    cor_t irradiancia;
+    real_t distancia; // Média harmônica (limitada) das distâncias.
+    int proximo; // Próximo registro do mesmo nó da octree (-1 no último).
+} registro_irradiancia_t;
+
+/**
+ * Nó da octree do cache de irradiância: um cubo com os registros cujo
+ * raio de validade cabe em metade do seu lado. Só são criados os filhos
+ * que recebem registros.
+ */
+typedef struct {
+    ponto_t centro;
+    real_t meio; // Metade do lado do cubo.
+    real_t alcance; // Até onde vão, do centro, as esferas da subárvore.
+    int filhos[8]; // Índice do filho de cada octante (-1 se não existe).
+    int primeiro; // Primeiro registro do nó (-1 se não há nenhum).
+} no_irradiancia_t;
+
+/**
+ * Registros criados por uma thread durante uma passada, que só entram na
+ * octree entre as passadas.
+ */
+typedef struct {
+    registro_irradiancia_t *registros;
+    int num_registros, capacidade;
+    long long consultas, interpoladas; // Contagem desde a última mescla.
+} buffer_irradiancia_t;
+
+/**
+ * Cache de irradiância (Ward): registros esparsos da luz indireta difusa,
+ * guardados numa octree no espaço do mundo e interpolados nos pontos
+ * vizinhos. Durante uma passada a octree só é lida (por qualquer número de
+ * threads), e cada thread guarda os registros que cria no seu buffer.
+ */
+struct cache_irradiancia {
+    no_irradiancia_t *nos;
+    int num_nos, capacidade_nos;
+    registro_irradiancia_t *registros;
+    int num_registros, capacidade_registros;
+    buffer_irradiancia_t *buffers; // Um por thread.
+    int num_buffers;
+    long long consultas, interpoladas; // Totais das passadas já mescladas.
+};
+
+/**
+ * Cria um cache de irradiância vazio.
+ *
+ * @param num_threads Número de threads que consultam o cache (uma thread
+ * fora delas pode consultá-lo, mas não guarda os registros que cria).
+ * @return Ponteiro para o cache ou NULL se faltar memória.
+ */
+cache_irradiancia_t *irradiancia_criar(int num_threads);
+
+/**
+ * Calcula a luz indireta difusa que chega a um ponto (a média, pesada
+ * pelo cosseno, da luz vinda do hemisfério da normal). Se registros do
+ * cache valem para o ponto, ela é a média deles, com pesos que vão a zero
+ * no limite de validade de cada um (sem saltos na imagem); senão,
+ * IRRADIANCIA_AMOSTRAS raios (Sobol, estratificados no hemisfério) levam
+ * à luz direta dos pontos que tocam, e o resultado vira um registro no
+ * buffer da thread (omp_get_thread_num()). O fundo não ilumina a cena.
+ * Pode ser chamada por várias threads ao mesmo tempo, mas não junto com
+ * irradiancia_mesclar().
+ *
+ * @param cache Ponteiro para o cache.
+ * @param cena Ponteiro para a cena.
+ * @param luz_local Ponteiro para a luz local.
+ * @param ponto Ponteiro para o ponto.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @return Luz indireta que chega ao ponto.
+ */
+cor_t irradiancia_obter(cache_irradiancia_t *cache, cena_t *cena,
+    luz_t *luz_local, ponto_t *ponto, vetor_t *normal);
+
+/**
+ * Passa os registros dos buffers das threads para a octree (entre as
+ * passadas, sem nenhuma thread consultando o cache). Cada registro fica
+ * no nó mais fundo cuja metade do lado ainda cobre o seu raio de validade
+ * (IRRADIANCIA_ERRO vezes a média harmônica das distâncias); se algum cair
+ * fora da raiz, a octree é refeita para caber todos. Acima de
+ * IRRADIANCIA_MAX_REGISTROS registros, o cache é esvaziado.
+ *
+ * @param cache Ponteiro para o cache.
+ * @return 1 em caso de sucesso, 0 se faltar memória (os registros dos
+ * buffers são descartados).
+ */
+int irradiancia_mesclar(cache_irradiancia_t *cache);
+
+/**
+ * Descarta todos os registros do cache (o da octree e os dos buffers).
+ *
+ * @param cache Ponteiro para o cache.
+ */
+void irradiancia_esvaziar(cache_irradiancia_t *cache);
+
+/**
+ * Libera a memória do cache.
+ *
+ * @param cache Ponteiro para o cache.
+ */
+void irradiancia_liberar(cache_irradiancia_t *cache);
+
+#endif // IRRADIANCIA_H
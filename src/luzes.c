@@ -0,0 +1,376 @@
+#include "luzes.h"
+#include "bvh.h"
+#include "cena.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern real_t kd;
+extern real_t ks;
+extern real_t os;
+
+/**
+ * Luz em construção: a coordenada da posição no eixo da divisão do nó
+ * atual e o índice da luz no array.
+ */
+typedef struct {
+    real_t chave;
+    int luz;
+} luz_ordenada_t;
+
+/**
+ * Nó de um corte da árvore de luzes: a luz que ele leva ao ponto (pelo
+ * representante) e o limite do erro dessa estimativa.
+ */
+typedef struct {
+    int no;
+    cor_t estimativa;
+    real_t erro;
+} no_corte_t;
+
+/**
+ * Compara duas luzes pela chave (usado no qsort).
+ */
+static int comparar_chaves(const void *a, const void *b)
+{
+    real_t ca = ((luz_ordenada_t *) a)->chave;
+    real_t cb = ((luz_ordenada_t *) b)->chave;
+    return ca < cb ? -1 : ca > cb;
+}
+
+/**
+ * Retorna o maior canal de uma cor.
+ */
+static real_t maior_canal(cor_t *cor)
+{
+    return max(cor->x, max(cor->y, cor->z));
+}
+
+/**
+ * Gera um número em [0, 1) fixo para cada nó (hash do índice), usado no
+ * sorteio dos representantes.
+ */
+static real_t sorteio_no(unsigned int indice)
+{
+    indice ^= indice >> 16;
+    indice *= 0x7feb352du;
+    indice ^= indice >> 15;
+    indice *= 0x846ca68bu;
+    indice ^= indice >> 16;
+    return (indice >> 8) * (1.0 / 16777216.0);
+}
+
+/**
+ * Constrói o nó (e a subárvore) das luzes ordem[inicio .. inicio +
+ * quantidade - 1], na próxima posição livre do array de nós.
+ */
+static void construir_no_luz(arvore_luzes_t *arvore, luz_ordenada_t *ordem,
+    int inicio, int quantidade)
+{
+    int i, indice, eixo, meio;
+    real_t extensao, brilho_esq, brilho_dir;
+    luz_t *luz;
+    no_luz_t *no, *esq, *dir;
+
+    indice = arvore->num_nos++;
+    no = &arvore->nos[indice];
+    no->caixa = caixa_vazia();
+    no->intensidade.x = no->intensidade.y = no->intensidade.z = 0.0;
+    for(i = inicio; i < inicio + quantidade; i++)
+    {
+        luz = &arvore->luzes[ordem[i].luz];
+        caixa_expandir(&no->caixa, &luz->posicao);
+        no->intensidade = soma_v(&no->intensidade, &luz->cor);
+    }
+
+    if(quantidade == 1)
+    {
+        no->representante = ordem[inicio].luz;
+        no->direito = -1;
+        return;
+    }
+
+    // Divide as luzes ao meio no eixo de maior extensão.
+    eixo = 0;
+    extensao = no->caixa.max.x - no->caixa.min.x;
+    if(no->caixa.max.y - no->caixa.min.y > extensao)
+    {
+        eixo = 1;
+        extensao = no->caixa.max.y - no->caixa.min.y;
+    }
+    if(no->caixa.max.z - no->caixa.min.z > extensao)
+    {
+        eixo = 2;
+    }
+
+    for(i = inicio; i < inicio + quantidade; i++)
+    {
+        luz = &arvore->luzes[ordem[i].luz];
+        ordem[i].chave = eixo == 0 ? luz->posicao.x :
+            (eixo == 1 ? luz->posicao.y : luz->posicao.z);
+    }
+    qsort(&ordem[inicio], quantidade, sizeof(luz_ordenada_t),
+        comparar_chaves);
+
+    meio = quantidade / 2;
+    construir_no_luz(arvore, ordem, inicio, meio);
+    no->direito = arvore->num_nos;
+    construir_no_luz(arvore, ordem, inicio + meio, quantidade - meio);
+
+    esq = &arvore->nos[indice + 1];
+    dir = &arvore->nos[no->direito];
+    brilho_esq = esq->intensidade.x + esq->intensidade.y + esq->intensidade.z;
+    brilho_dir = dir->intensidade.x + dir->intensidade.y + dir->intensidade.z;
+    if(brilho_esq + brilho_dir <= 0.0)
+    {
+        brilho_esq = brilho_dir = 1.0;
+    }
+    no->representante = sorteio_no(indice) * (brilho_esq + brilho_dir) <
+        brilho_esq ? esq->representante : dir->representante;
+}
+
+/**
+ * Constrói a árvore de luzes: cada nó divide as suas luzes ao meio ao
+ * longo do eixo de maior extensão das posições, até sobrar uma luz por
+ * folha. O representante de cada nó interno é o de um dos filhos, sorteado
+ * (de forma fixa) com probabilidade proporcional à intensidade.
+ *
+ * @param arvore Ponteiro para a árvore a ser preenchida.
+ * @param luzes Array de luzes (é copiado).
+ * @param num_luzes Número de luzes do array.
+ * @return 1 em caso de sucesso, 0 caso falte memória.
+ */
+int arvore_luzes_construir(arvore_luzes_t *arvore, luz_t *luzes,
+    int num_luzes)
+{
+    int i;
+    luz_ordenada_t *ordem;
+
+    arvore->luzes = NULL;
+    arvore->num_luzes = 0;
+    arvore->nos = NULL;
+    arvore->num_nos = 0;
+
+    if(num_luzes <= 0)
+    {
+        return 1;
+    }
+
+    arvore->luzes = malloc(num_luzes * sizeof(luz_t));
+    arvore->nos = malloc((2 * num_luzes - 1) * sizeof(no_luz_t));
+    ordem = malloc(num_luzes * sizeof(luz_ordenada_t));
+    if(arvore->luzes == NULL || arvore->nos == NULL || ordem == NULL)
+    {
+        free(ordem);
+        arvore_luzes_liberar(arvore);
+        return 0;
+    }
+
+    memcpy(arvore->luzes, luzes, num_luzes * sizeof(luz_t));
+    arvore->num_luzes = num_luzes;
+    for(i = 0; i < num_luzes; i++)
+    {
+        ordem[i].luz = i;
+    }
+
+    construir_no_luz(arvore, ordem, 0, num_luzes);
+
+    free(ordem);
+    return 1;
+}
+
+/**
+ * Libera a memória da árvore de luzes (que fica vazia).
+ *
+ * @param arvore Ponteiro para a árvore.
+ */
+void arvore_luzes_liberar(arvore_luzes_t *arvore)
+{
+    free(arvore->luzes);
+    free(arvore->nos);
+    arvore->luzes = NULL;
+    arvore->num_luzes = 0;
+    arvore->nos = NULL;
+    arvore->num_nos = 0;
+}
+
+/**
+ * Limita a luz que um nó pode levar ao ponto, usado como erro da
+ * estimativa do nó (0 numa folha, cuja estimativa é exata). O limite é a
+ * intensidade do nó vezes o maior termo de Phong (com o cosseno limitado
+ * pela caixa) sobre o quadrado da menor distância até a caixa.
+ */
+static real_t limitar_erro(no_luz_t *no, ponto_t *ponto, vetor_t *normal,
+    real_t material)
+{
+    real_t frente, dx, dy, dz, dist2, cosseno;
+
+    if(no->direito < 0)
+    {
+        return 0.0;
+    }
+
+    // Maior altura de um ponto da caixa acima do plano da superfície: se
+    // não for positiva, nenhuma luz do nó ilumina o ponto.
+    frente = max(normal->x * (no->caixa.min.x - ponto->x),
+        normal->x * (no->caixa.max.x - ponto->x));
+    frente += max(normal->y * (no->caixa.min.y - ponto->y),
+        normal->y * (no->caixa.max.y - ponto->y));
+    frente += max(normal->z * (no->caixa.min.z - ponto->z),
+        normal->z * (no->caixa.max.z - ponto->z));
+    if(frente <= 0.0)
+    {
+        return 0.0;
+    }
+
+    dx = max((real_t) 0.0, max(no->caixa.min.x - ponto->x,
+        ponto->x - no->caixa.max.x));
+    dy = max((real_t) 0.0, max(no->caixa.min.y - ponto->y,
+        ponto->y - no->caixa.max.y));
+    dz = max((real_t) 0.0, max(no->caixa.min.z - ponto->z,
+        ponto->z - no->caixa.max.z));
+    dist2 = dx * dx + dy * dy + dz * dz;
+    if(dist2 <= 0.0)
+    {
+        return INFINITO;
+    }
+
+    cosseno = min((real_t) 1.0, frente / sqrt(dist2));
+    return maior_canal(&no->intensidade) * (kd * cosseno + ks * os) *
+        material / dist2;
+}
+
+/**
+ * Estima a luz que um nó leva ao ponto pelo seu representante: um raio de
+ * sombra até ele e a equação de Phong com a intensidade do nó inteiro,
+ * atenuada pelo quadrado da distância.
+ */
+static cor_t avaliar_no(cena_t *cena, no_luz_t *no, ponto_t *origem_raio,
+    objeto_t *objeto, ponto_t *ponto_intersec, vetor_t *normal)
+{
+    real_t distancia;
+    vetor_t direcao;
+    ponto_t origem_sombra;
+    luz_t *luz, luz_no, escuro;
+    cor_t cor;
+
+    cor.x = cor.y = cor.z = 0.0;
+    luz = &cena->luzes.luzes[no->representante];
+    direcao = sub_v(&luz->posicao, ponto_intersec);
+    distancia = modulo(&direcao);
+    if(distancia <= 0.0 || prod_e(normal, &direcao) <= 0.0)
+    {
+        return cor;
+    }
+
+    direcao = mult_e(&direcao, 1.0 / distancia);
+    origem_sombra = deslocar_ponto(ponto_intersec, normal, &direcao);
+    if(oclusao_cena(cena, &origem_sombra, &direcao, distancia, objeto))
+    {
+        return cor;
+    }
+
+    luz_no.posicao = luz->posicao;
+    luz_no.cor = mult_e(&no->intensidade, 1.0 / (distancia * distancia));
+    escuro.cor = cor;
+    return equacao_phong(origem_raio, &luz_no, &escuro, ponto_intersec,
+        normal, &objeto->cor);
+}
+
+/**
+ * Calcula a luz que as luzes da árvore da cena levam a um ponto, por um
+ * corte da árvore (lightcuts): cada nó do corte é avaliado só pelo seu
+ * representante (com um raio de sombra), com a intensidade do nó inteiro.
+ * O corte começa na raiz, e o nó de maior erro possível (limitado pela
+ * intensidade, pela distância até a caixa e pelo ângulo com a normal) é
+ * trocado pelos filhos até que todos os erros fiquem abaixo de
+ * LUZES_ERRO_RELATIVO da cor estimada do ponto (somada à que ele recebe
+ * das outras luzes) ou o corte chegue a LUZES_MAX_CORTE nós. Assim o custo
+ * cresce com o log do número de luzes, e não com ele.
+ *
+ * @param cena Ponteiro para a cena.
+ * @param origem_raio Ponteiro para o ponto de onde o raio parte.
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param ponto_intersec Ponteiro para o ponto de interseção.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @param cor_base Ponteiro para a cor que o ponto recebe das outras luzes
+ * (só entra no critério de erro).
+ * @return Cor do ponto devida às luzes da árvore (sem a luz ambiente).
+ */
+cor_t iluminar_luzes(cena_t *cena, ponto_t *origem_raio, objeto_t *objeto,
+    ponto_t *ponto_intersec, vetor_t *normal, cor_t *cor_base)
+{
+    int i, k, pior, num_corte, filhos[2];
+    real_t material;
+    no_luz_t *no, *filho;
+    no_corte_t corte[LUZES_MAX_CORTE], pai;
+    cor_t total, estimativa, cor;
+
+    total.x = total.y = total.z = 0.0;
+    if(cena->luzes.num_nos == 0)
+    {
+        return total;
+    }
+
+    material = maior_canal(&objeto->cor);
+    no = &cena->luzes.nos[0];
+    corte[0].no = 0;
+    corte[0].estimativa = avaliar_no(cena, no, origem_raio, objeto,
+        ponto_intersec, normal);
+    corte[0].erro = limitar_erro(no, ponto_intersec, normal, material);
+    total = corte[0].estimativa;
+    num_corte = 1;
+
+    while(num_corte < LUZES_MAX_CORTE)
+    {
+        pior = 0;
+        for(i = 1; i < num_corte; i++)
+        {
+            if(corte[i].erro > corte[pior].erro)
+            {
+                pior = i;
+            }
+        }
+        cor = soma_v(&total, cor_base);
+        if(corte[pior].erro <= LUZES_ERRO_RELATIVO * maior_canal(&cor))
+        {
+            break;
+        }
+
+        // Troca o nó pelos filhos. O filho que tem o mesmo representante
+        // do pai reaproveita a estimativa dele (na proporção da sua
+        // intensidade), sem outro raio de sombra.
+        pai = corte[pior];
+        no = &cena->luzes.nos[pai.no];
+        total = sub_v(&total, &pai.estimativa);
+        filhos[0] = pai.no + 1;
+        filhos[1] = no->direito;
+        for(k = 0; k < 2; k++)
+        {
+            filho = &cena->luzes.nos[filhos[k]];
+            if(filho->representante == no->representante)
+            {
+                estimativa.x = no->intensidade.x > 0.0 ? pai.estimativa.x *
+                    filho->intensidade.x / no->intensidade.x : 0.0;
+                estimativa.y = no->intensidade.y > 0.0 ? pai.estimativa.y *
+                    filho->intensidade.y / no->intensidade.y : 0.0;
+                estimativa.z = no->intensidade.z > 0.0 ? pai.estimativa.z *
+                    filho->intensidade.z / no->intensidade.z : 0.0;
+            }
+            else
+            {
+                estimativa = avaliar_no(cena, filho, origem_raio, objeto,
+                    ponto_intersec, normal);
+            }
+
+            i = k == 0 ? pior : num_corte++;
+            corte[i].no = filhos[k];
+            corte[i].estimativa = estimativa;
+            corte[i].erro = limitar_erro(filho, ponto_intersec, normal,
+                material);
+            total = soma_v(&total, &estimativa);
+        }
+    }
+
+    return total;
+}
@@ -0,0 +1,68 @@
+#ifndef LUZES_H
+#define LUZES_H
+
+#include "geometria.h"
+
+/** Erro (em relação à luz estimada) aceito no corte de luzes de um ponto. */
+#define LUZES_ERRO_RELATIVO 0.02
+
+/** Número máximo de nós no corte de luzes de um ponto. */
+#define LUZES_MAX_CORTE 64
+
+/**
+ * Nó da árvore de luzes. Os nós são guardados em profundidade, como na
+ * BVH: o filho esquerdo de um nó interno é o nó seguinte do array e
+ * 'direito' é o índice do filho direito (-1 numa folha, que tem uma luz só).
+ */
+struct no_luz {
+    caixa_t caixa; // Caixa das posições das luzes do nó.
+    cor_t intensidade; // Soma das cores das luzes do nó.
+    int representante; // Luz que faz as vezes do nó inteiro num corte.
+    int direito;
+};
+
+/**
+ * Constrói a árvore de luzes: cada nó divide as suas luzes ao meio ao
+ * longo do eixo de maior extensão das posições, até sobrar uma luz por
+ * folha. O representante de cada nó interno é o de um dos filhos, sorteado
+ * (de forma fixa) com probabilidade proporcional à intensidade.
+ *
+ * @param arvore Ponteiro para a árvore a ser preenchida.
+ * @param luzes Array de luzes (é copiado).
+ * @param num_luzes Número de luzes do array.
+ * @return 1 em caso de sucesso, 0 caso falte memória.
+ */
+int arvore_luzes_construir(arvore_luzes_t *arvore, luz_t *luzes,
+    int num_luzes);
+
+/**
+ * Libera a memória da árvore de luzes (que fica vazia).
+ *
+ * @param arvore Ponteiro para a árvore.
+ */
+void arvore_luzes_liberar(arvore_luzes_t *arvore);
+
+/**
+ * Calcula a luz que as luzes da árvore da cena levam a um ponto, por um
+ * corte da árvore (lightcuts): cada nó do corte é avaliado só pelo seu
+ * representante (com um raio de sombra), com a intensidade do nó inteiro.
+ * O corte começa na raiz, e o nó de maior erro possível (limitado pela
+ * intensidade, pela distância até a caixa e pelo ângulo com a normal) é
+ * trocado pelos filhos até que todos os erros fiquem abaixo de
+ * LUZES_ERRO_RELATIVO da cor estimada do ponto (somada à que ele recebe
+ * das outras luzes) ou o corte chegue a LUZES_MAX_CORTE nós. Assim o custo
+ * cresce com o log do número de luzes, e não com ele.
+ *
+ * @param cena Ponteiro para a cena.
+ * @param origem_raio Ponteiro para o ponto de onde o raio parte.
+ * @param objeto Ponteiro para o objeto tocado.
+ * @param ponto_intersec Ponteiro para o ponto de interseção.
+ * @param normal Ponteiro para a normal virada para o lado do raio.
+ * @param cor_base Ponteiro para a cor que o ponto recebe das outras luzes
+ * (só entra no critério de erro).
+ * @return Cor do ponto devida às luzes da árvore (sem a luz ambiente).
+ */
+cor_t iluminar_luzes(cena_t *cena, ponto_t *origem_raio, objeto_t *objeto,
+    ponto_t *ponto_intersec, vetor_t *normal, cor_t *cor_base);
+
+#endif // LUZES_H
@@ -4,6 +4,15 @@
 #include <GL/glu.h>
 #include <GL/glut.h>
 #include "geometria.h"
+#include "cena.h"
+#include "malha.h"
+#include "arquivo_malha.h"
+#include "malha_compacta.h"
+#include "camera.h"
+#include "renderizador.h"
+#include "amostrador.h"
+#include <string.h>
+#include <unistd.h>
 #include <omp.h>
 
 /** Paralelismo */
@@ -15,7 +24,28 @@
 #define NUM_PIRAMIDES 1
 #define NUM_CUBOS 1
 #define NUM_PLANOS 1
-#define NUM_OBJETOS (NUM_ESFERAS + NUM_PIRAMIDES + NUM_CUBOS + NUM_PLANOS)
+#define NUM_INSTANCIAS 0 // Cópias da pirâmide compartilhando a mesma malha.
+#define NUM_OBJETOS (NUM_ESFERAS + NUM_PIRAMIDES + NUM_CUBOS + NUM_PLANOS + \
+    NUM_INSTANCIAS)
+#define MAX_MALHAS 8 // Malhas carregadas de arquivo (linha de comando).
+
+/** Configurações das instâncias (grade no plano xz, atrás da cena). */
+#define INSTANCIAS_POR_LINHA 100
+#define ESPACO_INSTANCIAS 0.5
+#define ESCALA_INSTANCIAS 0.2
+
+/** Luzes pontuais além da luz local (grade acima da cena), que dividem 
+ * entre si a energia ENERGIA_LUZES e são escolhidas pela árvore de luzes. */
+#define NUM_LUZES 0
+#define LUZES_POR_LINHA 32
+#define ESPACO_LUZES 0.5
+#define ALTURA_LUZES 6.0
+#define ENERGIA_LUZES 20.0
+
+/** Forma da luz local (LUZ_PONTUAL, LUZ_RETANGULAR ou LUZ_ESFERICA) e o
+ * seu tamanho: o lado do quadrado (no plano xy) ou o raio da esfera. */
+#define FORMA_LUZ LUZ_PONTUAL
+#define TAMANHO_LUZ 1.0
 
 /** Configurações de visualização (câmera). */
 #define Z_NEAR 1.0
@@ -38,8 +68,25 @@
 #define PASSO_PAN 0.1 // Em metros
 #define PASSO_GIRO 15 // 15°
 
-/** Configurações da recursão. */
-#define MAX_REC 0
+/** Intervalo (ms) com que a interface procura quadros novos. */
+#define INTERVALO_ATUALIZACAO 16
+
+/** Orçamento (ms) de cada quadro para o governador ('g' liga/desliga). */
+#define ORCAMENTO_QUADRO 41
+
+/** Erro (RMSE) que cada amostrador deve atingir na comparação ('z'). */
+#define ALVO_RMSE 0.01
+
+/** Intervalo (µs) com que a comparação procura amostras novas. */
+#define INTERVALO_COMPARACAO 100
+
+/** Fótons emitidos para as cáusticas ('u' liga/desliga) e fótons usados
+ * em cada estimativa delas. */
+#define NUM_FOTONS 200000
+#define VIZINHOS_FOTONS 64
+
+/** Configurações da recursão (reflexões e refrações seguidas). */
+#define MAX_REC 4
 
 /** Configurações da animação. */
 //#define GERAR_ANIMACAO
@@ -47,17 +94,67 @@
  
 /** Variáveis globais. */
 luz_t luz_ambiente; // Luz ambiente
-luz_t luz_local; // Fonte de luz local (pontual)
-
-objeto_t objetos[NUM_OBJETOS]; // Lista de objetos
-float *pixels; // Matriz de píxels de 3 canais.
+luz_t luz_local; // Fonte de luz local (pontual ou de área)
+
+objeto_t objetos[NUM_OBJETOS + MAX_MALHAS]; // Lista de objetos
+int num_objetos; // Objetos da cena mais as malhas carregadas
+cena_t cena; // Cena (objetos e BVH de objetos)
+malha_t *malha_piramide; // Malha compartilhada pelas instâncias
+renderizador_t *renderizador; // Traça os quadros em segundo plano.
+int versao_exibida; // Versão do último quadro enviado para a tela.
+int progressivo = 1; // Refinamento progressivo ('r' liga/desliga).
+int governador = 1; // Governador do tempo de quadro ('g' liga/desliga).
+int reprojecao = 1; // Reprojeção do último quadro ('c' liga/desliga).
+int suavizacao = 1; // Superamostragem das bordas ('x' liga/desliga).
+int rasterizacao = 0; // Visibilidade primária rasterizada ('v' liga/desliga).
+int ondas = 0; // Raios secundários traçados em ondas ('f' liga/desliga).
+int sombras_em_pacote = 0; // Sombras primárias em pacotes ('b' liga/desliga).
+int monte_carlo = 0; // Iluminação global por Monte Carlo ('m' liga/desliga).
+int amostrador = AMOSTRADOR_SOBOL; // Amostrador ('n' troca).
+int filtragem = 1; // Filtro do ruído de Monte Carlo ('e' liga/desliga).
+int irradiancia = 0; // Cache de irradiância ('i' liga/desliga).
+int causticas = 0; // Cáusticas do mapa de fótons ('u' liga/desliga).
 int altura, largura;
 
-double ka; // Coeficiente da luz ambiente.
-double kd; // Coeficiente da luz difusa.
-double ks; // Coeficiente da luz especular.
-double eta; // Índice de brilho
-double os; // Propriedade de reflexão do material
+real_t ka; // Coeficiente da luz ambiente.
+real_t kd; // Coeficiente da luz difusa.
+real_t ks; // Coeficiente da luz especular.
+real_t eta; // Índice de brilho
+real_t os; // Propriedade de reflexão do material
+real_t kr; // Coeficiente de reflexão dos objetos refletíveis.
+
+/** 
+ * Captura as matrizes atuais do OpenGL e pede um novo quadro ao 
+ * renderizador (o quadro em andamento, se houver, é cancelado).
+ */
+void pedir_quadro(void)
+{
+    GLint view_port[4];  
+    GLdouble model_view[16];
+    GLdouble projection[16]; 
+    camera_t camera;
+    
+    glGetIntegerv(GL_VIEWPORT, view_port); // Obtém x, y, largura e altura.
+    glGetDoublev(GL_MODELVIEW_MATRIX, model_view); 
+    glGetDoublev(GL_PROJECTION_MATRIX, projection);
+    
+    if(camera_definir(&camera, model_view, projection, view_port))
+    {
+        renderizador_pedir(renderizador, &camera);
+    }
+}
+
+/** 
+ * Verifica periodicamente se o renderizador publicou um quadro novo.
+ */
+void atualizar(int x)
+{
+    if(renderizador_versao(renderizador) != versao_exibida)
+    {
+        glutPostRedisplay();
+    }
+    glutTimerFunc(INTERVALO_ATUALIZACAO, atualizar, 0);
+}
 
 #ifdef GERAR_ANIMACAO
 
@@ -67,7 +164,7 @@ void loop(int x)
     glRotatef(-5.0, 1.0, 0.0, 0.0);
     glRotatef(6.0, 0.0, 1.0, 0.0);
     glRotatef(-7.0, 0.0, 0.0, 1.0);
-    glutPostRedisplay();
+    pedir_quadro();
     glutTimerFunc(1000 / SCREEN_FPS, loop, 0); // Configura o timer novamente.
 }
 #endif
@@ -76,6 +173,7 @@ void init(void)
 {
     glClearColor(1.0, 1.0, 1.0, 0.0);
     glShadeModel(GL_SMOOTH);
+    glutTimerFunc(INTERVALO_ATUALIZACAO, atualizar, 0);
 #ifdef GERAR_ANIMACAO
     glutTimerFunc(1000 / SCREEN_FPS, loop, 0);
 #endif
@@ -83,112 +181,262 @@ void init(void)
 
 void display(void)
 {
-    GLint view_port[4];  
-    GLdouble model_view[16];
-    GLdouble projection[16]; 
-    GLdouble win_x, win_y; // Coornadas x e y.
-    GLdouble x_near, y_near, z_near;
-    GLdouble x_far, y_far, z_far;
-
-    int i, j, nova_largura, nova_altura;
-    ponto_t origem; // Ponto de origem
-    vetor_t dir; // Vetor direção.
-    cor_t pixel;
+    int largura_quadro, altura_quadro;
+    float *pixels;
     
     glClear(GL_COLOR_BUFFER_BIT);
     glColor3f(1.0, 1.0, 1.0);
     glPushMatrix();    
-        
-    // Fazendo a rasterização.
-    glGetIntegerv(GL_VIEWPORT, view_port); // Obtém x, y, largura e altura.
-    glGetDoublev(GL_MODELVIEW_MATRIX, model_view); 
-    glGetDoublev(GL_PROJECTION_MATRIX, projection);
     
-    nova_largura = view_port[2];
-    nova_altura = view_port[3];
+    // O traçado é feito pelo renderizador; aqui o último quadro completo 
+    // é apenas enviado para a tela.
+    versao_exibida = renderizador_versao(renderizador);
+    pixels = renderizador_travar_quadro(renderizador, &largura_quadro, 
+        &altura_quadro);
+    if(pixels != NULL)
+    {
+        // O quadro pode ter resolução menor (governador): é ampliado.
+        glPixelZoom((float) glutGet(GLUT_WINDOW_WIDTH) / largura_quadro, 
+            (float) glutGet(GLUT_WINDOW_HEIGHT) / altura_quadro);
+        glDrawPixels(largura_quadro, altura_quadro, GL_RGB, GL_FLOAT, pixels);
+    }
+    renderizador_soltar(renderizador);
+    
+    glPopMatrix();
+    glutSwapBuffers();
+
+}
+
+void reshape (int w, int h)
+{
+    glViewport(0, 0, (GLsizei) w, (GLsizei) h); 
+    glMatrixMode (GL_PROJECTION);
+    glLoadIdentity ();
+    gluPerspective(60.0, (GLfloat) w/(GLfloat) h, Z_NEAR, Z_FAR);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    gluLookAt (LF_X, LF_Y, LF_Z, LA_X, LA_Y, LA_Z, 0.0, 1.0, 0.0);
+    pedir_quadro();
+}
+
+/** 
+ * Imprime os percentis do tempo de quadro e a resolução atual (e, no modo
+ * de Monte Carlo, a vazão de amostras; com o cache de irradiância ou as
+ * cáusticas, os números deles).
+ */
+void imprimir_estatisticas(void)
+{
+    int n, largura_quadro, altura_quadro;
+    double p50, p95, p99, interpolacao, tracado, construcao, consulta;
+    
+    n = renderizador_estatisticas(renderizador, &p50, &p95, &p99);
+    renderizador_travar_quadro(renderizador, &largura_quadro, &altura_quadro);
+    renderizador_soltar(renderizador);
     
-    // Verifica se a janela mudou de tamanho.
-    if(nova_largura != largura || nova_altura != altura)       
+    if(n > 0)
     {
-        altura = nova_altura;
-        largura = nova_largura;
-        
-        if(pixels != NULL)
+        printf("Quadro (%d últimos): p50 %.1f ms, p95 %.1f ms, p99 %.1f ms; "
+            "resolução %dx%d; %.1f%% dos raios primários reprojetados; "
+            "%.2f raios por píxel\n", n, 1000.0 * p50, 1000.0 * p95, 
+            1000.0 * p99, largura_quadro, altura_quadro, 
+            100.0 * renderizador_reaproveitamento(renderizador),
+            renderizador_amostras_por_pixel(renderizador));
+    }
+    
+    if(monte_carlo)
+    {
+        printf("Monte Carlo: %.0f amostras por segundo por thread\n", 
+            renderizador_amostras_por_segundo(renderizador));
+    }
+    else if(irradiancia)
+    {
+        n = renderizador_irradiancia_estatisticas(renderizador, 
+            &interpolacao);
+        printf("Cache de irradiância: %d registros, %.1f%% das consultas "
+            "interpoladas\n", n, 100.0 * interpolacao);
+    }
+    
+    if(causticas)
+    {
+        n = renderizador_fotons_estatisticas(renderizador, &tracado, 
+            &construcao, &consulta);
+        printf("Mapa de fótons: %d fótons; traçado %.1f ms, construção "
+            "%.1f ms, %.2f µs por consulta\n", n, 1000.0 * tracado, 
+            1000.0 * construcao, 1e6 * consulta);
+    }
+}
+
+/**
+ * Pede um quadro com o amostrador dado e espera o renderizador publicar
+ * a sua primeira amostra (os quadros publicados antes dela, com mais
+ * amostras, são os do pedido anterior).
+ */
+void pedir_quadro_amostrador(int amostrador_quadro)
+{
+    int versao;
+    
+    versao = renderizador_versao(renderizador);
+    renderizador_amostrador(renderizador, amostrador_quadro);
+    pedir_quadro();
+    while(renderizador_versao(renderizador) == versao || 
+        renderizador_amostras(renderizador) != 1)
+    {
+        usleep(INTERVALO_COMPARACAO);
+    }
+}
+
+/**
+ * Copia o último quadro publicado, se ele tem o tamanho dado, e retorna
+ * as suas amostras por píxel (0 se ele mudou durante a cópia ou tem
+ * outro tamanho).
+ */
+int copiar_quadro(float *copia, int largura_copia, int altura_copia)
+{
+    int versao, amostras, largura_quadro, altura_quadro;
+    float *pixels;
+    
+    versao = renderizador_versao(renderizador);
+    amostras = renderizador_amostras(renderizador);
+    pixels = renderizador_travar_quadro(renderizador, &largura_quadro, 
+        &altura_quadro);
+    if(pixels == NULL || renderizador_versao(renderizador) != versao ||
+        largura_quadro != largura_copia || altura_quadro != altura_copia)
+    {
+        amostras = 0;
+    }
+    else
+    {
+        memcpy(copia, pixels, 3 * largura_copia * altura_copia * 
+            sizeof(float));
+    }
+    renderizador_soltar(renderizador);
+    return amostras;
+}
+
+/**
+ * Erro quadrático médio (RMSE) entre dois quadros de n valores.
+ */
+double erro_quadros(float *a, float *b, int n)
+{
+    int k;
+    double diferenca, soma;
+    
+    soma = 0.0;
+    for(k = 0; k < n; k++)
+    {
+        diferenca = a[k] - b[k];
+        soma += diferenca * diferenca;
+    }
+    return sqrt(soma / n);
+}
+
+/**
+ * Mede, para cada amostrador, quantas amostras por píxel ele precisa para
+ * que o erro (RMSE) em relação à referência fique abaixo de ALVO_RMSE. A
+ * primeira referência (do amostrador aleatório) já deve ter sido pedida;
+ * a segunda é a do Sobol, e cada amostrador é comparado com a da outra
+ * família, já que as suas primeiras amostras são as da sua própria
+ * referência.
+ */
+void medir_amostradores(float *referencias[2], float *quadro, 
+    int largura_quadro, int altura_quadro)
+{
+    int a, n, amostras, ultima;
+    double inicio, erro;
+    
+    n = 3 * largura_quadro * altura_quadro;
+    for(a = 0; a < 2; a++)
+    {
+        if(a == 1)
         {
-            free(pixels);
-            pixels = NULL;
+            pedir_quadro_amostrador(AMOSTRADOR_SOBOL);
         }
-        
-        pixels = (float *) malloc(altura * largura * 3 * sizeof(float));
+        do
+        {
+            usleep(INTERVALO_COMPARACAO);
+        } while(copiar_quadro(referencias[a], largura_quadro, 
+            altura_quadro) < MONTE_CARLO_MAX_AMOSTRAS);
     }
- # ifdef PARALELO
-        # pragma omp parallel for num_threads(NUM_THREADS) default(none) \
-            shared(pixels, altura, luz_ambiente, luz_local, largura, \
-            model_view, projection, view_port, objetos) private(win_x, win_y, \
-            x_near, y_near, z_near, x_far, y_far, z_far, origem, dir, pixel, i, j)  collapse(2) schedule(dynamic,1)
-# endif   
-    for(i = 0; i < altura; i++) // Percorre as linhas (altura)
+    printf("Referências com %d amostras por píxel (RMSE %.4f entre elas)\n",
+        MONTE_CARLO_MAX_AMOSTRAS, 
+        erro_quadros(referencias[0], referencias[1], n));
+    
+    for(a = 0; a < NUM_AMOSTRADORES; a++)
     {
-        for(j = 0; j < largura; j++) // Percorre as colunas (largura)
+        inicio = omp_get_wtime();
+        pedir_quadro_amostrador(a);
+        
+        // Cada amostra publicada é comparada; depois de metade do máximo, o
+        // erro da própria referência passa a pesar.
+        ultima = 0;
+        erro = INFINITO;
+        while(erro > ALVO_RMSE && ultima < MONTE_CARLO_MAX_AMOSTRAS / 2)
         {
-            win_x = j;
-            win_y = i;
-            
-            // Obtém o ponto no plano near.
-            gluUnProject(win_x, win_y, 0.0, model_view, projection, view_port, &x_near, &y_near, &z_near);
-            
-            // Obtém o ponto no plano far.
-            gluUnProject(win_x, win_y, 1.0, model_view, projection, view_port, &x_far, &y_far, &z_far);
-            
-            // Cria o vetor origem
-            origem.x = x_near;
-            origem.y = y_near;
-            origem.z = z_near;
-            
-            // Cria o vetor direção.
-            dir.x = x_far - x_near;
-            dir.y = y_far - y_near;
-            dir.z = z_far - z_near;
-
-            // Normaliza o vetor direção.
-            dir = normalizar(&dir);
-            
-            // Faz o raytracing.
-            pixel = raytrace(&origem, &dir, &luz_local, &luz_ambiente,  objetos, NUM_OBJETOS, 0, MAX_REC);
-            
-            // Verifica se veio alguma cor (se não, não houve insersecção.
-            if(pixel.x != -1)
+            amostras = copiar_quadro(quadro, largura_quadro, altura_quadro);
+            if(amostras > ultima)
             {
-                pixels[(i * largura * 3) + (j * 3) + 0] = pixel.x;
-                pixels[(i * largura * 3) + (j * 3) + 1] = pixel.y;
-                pixels[(i * largura * 3) + (j * 3) + 2] = pixel.z;    
+                ultima = amostras;
+                erro = erro_quadros(quadro, 
+                    referencias[a == AMOSTRADOR_ALEATORIO], n);
             }
             else
             {
-                pixels[(i * largura * 3) + (j * 3) + 0] = FUNDO_R;
-                pixels[(i * largura * 3) + (j * 3) + 1] = FUNDO_G;
-                pixels[(i * largura * 3) + (j * 3) + 2] = FUNDO_B;                  
+                usleep(INTERVALO_COMPARACAO);
             }
-            
+        }
+        
+        if(erro <= ALVO_RMSE)
+        {
+            printf("%s: RMSE %.4f com %d amostras por píxel (%.2f s)\n",
+                amostrador_nome(a), erro, ultima, omp_get_wtime() - inicio);
+        }
+        else
+        {
+            printf("%s: RMSE %.4f com %d amostras por píxel, acima de "
+                "%.4f\n", amostrador_nome(a), erro, ultima, ALVO_RMSE);
         }
     }
-
-    glDrawPixels(largura, altura, GL_RGB, GL_FLOAT, pixels);
-    glPopMatrix();
-    glutSwapBuffers();
-    glutSwapBuffers();
-
 }
 
-void reshape (int w, int h)
+/**
+ * Compara os amostradores no modo de Monte Carlo, com a câmera atual e a
+ * resolução completa (medir_amostradores()), e volta à configuração da
+ * interface. A interface fica parada durante a comparação.
+ */
+void comparar_amostradores(void)
 {
-    glViewport(0, 0, (GLsizei) w, (GLsizei) h); 
-    glMatrixMode (GL_PROJECTION);
-    glLoadIdentity ();
-    gluPerspective(60.0, (GLfloat) w/(GLfloat) h, Z_NEAR, Z_FAR);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    gluLookAt (LF_X, LF_Y, LF_Z, LA_X, LA_Y, LA_Z, 0.0, 1.0, 0.0);
+    int largura_quadro, altura_quadro, n;
+    float *referencias[2], *quadro;
+    
+    renderizador_orcamento(renderizador, 0.0);
+    renderizador_monte_carlo(renderizador, 1);
+    renderizador_filtragem(renderizador, 0);
+    pedir_quadro_amostrador(AMOSTRADOR_ALEATORIO);
+    
+    renderizador_travar_quadro(renderizador, &largura_quadro, &altura_quadro);
+    renderizador_soltar(renderizador);
+    n = 3 * largura_quadro * altura_quadro;
+    referencias[0] = malloc(n * sizeof(float));
+    referencias[1] = malloc(n * sizeof(float));
+    quadro = malloc(n * sizeof(float));
+    if(referencias[0] == NULL || referencias[1] == NULL || quadro == NULL)
+    {
+        fprintf(stderr, "Erro ao alocar os quadros da comparação\n");
+    }
+    else
+    {
+        medir_amostradores(referencias, quadro, largura_quadro, 
+            altura_quadro);
+    }
+    free(referencias[0]);
+    free(referencias[1]);
+    free(quadro);
+    
+    renderizador_amostrador(renderizador, amostrador);
+    renderizador_monte_carlo(renderizador, monte_carlo);
+    renderizador_filtragem(renderizador, filtragem);
+    renderizador_orcamento(renderizador, 
+        governador ? ORCAMENTO_QUADRO / 1000.0 : 0.0);
 }
 
 void keyboard (unsigned char key, int x, int y)
@@ -222,17 +470,82 @@ void keyboard (unsigned char key, int x, int y)
     case 'l':
         glRotatef(PASSO_GIRO, 0.0, 0.0, 1.0);
         break;    
-    default:
+    case 'r':
+        progressivo = !progressivo;
+        renderizador_progressivo(renderizador, progressivo);
+        break;
+    case 'g':
+        governador = !governador;
+        renderizador_orcamento(renderizador, 
+            governador ? ORCAMENTO_QUADRO / 1000.0 : 0.0);
+        break;
+    case 'c':
+        reprojecao = !reprojecao;
+        renderizador_reprojecao(renderizador, reprojecao);
+        break;
+    case 'x':
+        suavizacao = !suavizacao;
+        renderizador_suavizacao(renderizador, suavizacao);
+        break;
+    case 'v':
+        rasterizacao = !rasterizacao;
+        renderizador_rasterizacao(renderizador, rasterizacao);
+        break;
+    case 'f':
+        ondas = !ondas;
+        renderizador_ondas(renderizador, ondas);
+        break;
+    case 'b':
+        sombras_em_pacote = !sombras_em_pacote;
+        renderizador_sombras_em_pacote(renderizador, sombras_em_pacote);
+        break;
+    case 'm':
+        monte_carlo = !monte_carlo;
+        renderizador_monte_carlo(renderizador, monte_carlo);
+        break;
+    case 'n':
+        amostrador = (amostrador + 1) % NUM_AMOSTRADORES;
+        renderizador_amostrador(renderizador, amostrador);
+        printf("Amostrador: %s\n", amostrador_nome(amostrador));
+        break;
+    case 'e':
+        filtragem = !filtragem;
+        renderizador_filtragem(renderizador, filtragem);
+        break;
+    case 'i':
+        irradiancia = !irradiancia;
+        renderizador_irradiancia(renderizador, irradiancia);
         break;
+    case 'u':
+        causticas = !causticas;
+        renderizador_fotons(renderizador, causticas ? NUM_FOTONS : 0, 
+            VIZINHOS_FOTONS);
+        break;
+    case 'z':
+        comparar_amostradores();
+        break;
+    case 't':
+        imprimir_estatisticas();
+        return;
+    default:
+        return;
     }
-         
-    glutPostRedisplay();
+    
+    // A câmera mudou: o quadro em andamento é descartado.
+    pedir_quadro();
 
 }
 
 int main(int argc, char** argv)
 {
-    int i;
+    int i, k;
+    real_t matriz[12]; // Transformação de cada instância.
+    vetor_t eixo, posicao;
+    int indices_piramide[12] = {0, 1, 2, 0, 1, 3, 0, 2, 3, 1, 2, 3};
+    double inicio; // Início da carga de cada malha.
+    int compactar = 0; // Se as malhas carregadas devem ser compactadas.
+    cor_t fundo; // Cor dos píxels que não tocam nenhum objeto.
+    luz_t *luzes; // Luzes pontuais extras (copiadas para a cena).
     // Criação dos objetos.
     
     objetos[0].tipo = ESFERA;
@@ -267,6 +580,8 @@ int main(int argc, char** argv)
     objetos[2].cor.y = 0.1;
     objetos[2].cor.z = 0.1;
     objetos[2].refletivel = 1; 
+    objetos[2].transparencia = 0.8; // Esfera de vidro.
+    objetos[2].indice_refracao = 1.5;
 
     objetos[3].tipo = ESFERA;
     objetos[3].esfera = malloc(sizeof(esfera_t));
@@ -355,6 +670,37 @@ int main(int argc, char** argv)
     objetos[6].cor.z = 1.0;
     
     objetos[6].refletivel = 1; 
+    
+    // Instâncias: a geometria da pirâmide é guardada uma única vez e cada
+    // cópia guarda apenas a sua transformação.
+    malha_piramide = malha_criar(objetos[4].piramide->vertices, 4, 
+        indices_piramide, 4);
+    
+    eixo.x = 0.0;
+    eixo.y = 1.0;
+    eixo.z = 0.0;
+    
+    for(i = 0; i < NUM_INSTANCIAS; i++)
+    {
+        k = NUM_OBJETOS - NUM_INSTANCIAS + i;
+        
+        posicao.x = ESPACO_INSTANCIAS * (i % INSTANCIAS_POR_LINHA - 
+            INSTANCIAS_POR_LINHA / 2);
+        posicao.y = -4.0;
+        posicao.z = -ESPACO_INSTANCIAS * (i / INSTANCIAS_POR_LINHA);
+        matriz_transformacao(matriz, ESCALA_INSTANCIAS, &eixo, 
+            (i * 37) % 360, &posicao);
+        
+        objetos[k].tipo = INSTANCIA;
+        objetos[k].instancia = malloc(sizeof(instancia_t));
+        instancia_definir(objetos[k].instancia, malha_piramide, matriz);
+        objetos[k].cor.x = (i % 3) / 2.0;
+        objetos[k].cor.y = 0.5;
+        objetos[k].cor.z = 1.0 - (i % 3) / 2.0;
+        objetos[k].refletivel = 1;
+    }
+    
+    num_objetos = NUM_OBJETOS;
         
     // Parâmetros da equação de Phong.
     ka = 0.1;
@@ -363,14 +709,19 @@ int main(int argc, char** argv)
 
     eta = 1.0;
     os = 1.0;
+    kr = 0.3;
     
-    // Luz pontual.
+    // Luz local.
     luz_local.posicao.x = 0.0; 
     luz_local.posicao.y = -0.5;  
     luz_local.posicao.z = 10.0; 
     luz_local.cor.x = 1.0;
     luz_local.cor.y = 1.0;
     luz_local.cor.z = 1.0;
+    luz_local.forma = FORMA_LUZ;
+    luz_local.lado_u.x = TAMANHO_LUZ;
+    luz_local.lado_v.y = TAMANHO_LUZ;
+    luz_local.raio = TAMANHO_LUZ;
     
     // Luz ambiente.
     luz_ambiente.cor.x = 1.0;
@@ -381,9 +732,118 @@ int main(int argc, char** argv)
     largura = 400;
     altura = 400;
 
-    pixels = (float *) malloc(altura * largura * 3 * sizeof(float));
-    
     glutInit(&argc, argv);
+    
+    // Os argumentos que sobram após o glutInit são malhas a carregar
+    // ('.obj' ou binário). "-b arquivo" salva a última malha em binário e
+    // "-c" compacta as malhas carregadas depois dele.
+    for(i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-c") == 0)
+        {
+            compactar = 1;
+            continue;
+        }
+        
+        if(strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+        {
+            if(num_objetos == NUM_OBJETOS || !malha_salvar_binario(
+                objetos[num_objetos - 1].malha, argv[i + 1]))
+            {
+                fprintf(stderr, "Erro ao salvar a malha em %s\n", argv[i + 1]);
+            }
+            i++;
+            continue;
+        }
+        
+        if(num_objetos == NUM_OBJETOS + MAX_MALHAS)
+        {
+            fprintf(stderr, "Limite de %d malhas atingido\n", MAX_MALHAS);
+            break;
+        }
+        
+        inicio = omp_get_wtime();
+        objetos[num_objetos].malha = malha_carregar(argv[i]);
+        
+        if(objetos[num_objetos].malha == NULL)
+        {
+            fprintf(stderr, "Erro ao carregar a malha %s\n", argv[i]);
+            continue;
+        }
+        
+        if(compactar && !malha_compactar(objetos[num_objetos].malha))
+        {
+            fprintf(stderr, "Erro ao compactar a malha %s\n", argv[i]);
+        }
+        
+        printf("Malha %s: %d vértices, %d triângulos em %.3f s "
+            "(%.1f bytes por triângulo)\n", argv[i], 
+            objetos[num_objetos].malha->num_vertices, 
+            objetos[num_objetos].malha->num_triangulos, 
+            omp_get_wtime() - inicio, 
+            (double) malha_memoria(objetos[num_objetos].malha) / 
+            objetos[num_objetos].malha->num_triangulos);
+        
+        objetos[num_objetos].tipo = MALHA;
+        objetos[num_objetos].cor.x = 0.8;
+        objetos[num_objetos].cor.y = 0.8;
+        objetos[num_objetos].cor.z = 0.8;
+        objetos[num_objetos].refletivel = 1;
+        num_objetos++;
+    }
+    
+    // Constrói a BVH de objetos.
+    if(!cena_construir(&cena, objetos, num_objetos))
+    {
+        fprintf(stderr, "Erro ao construir a cena\n");
+        return 1;
+    }
+    
+    // Luzes pontuais extras, numa grade no plano y = ALTURA_LUZES.
+    if(NUM_LUZES > 0)
+    {
+        luzes = malloc(NUM_LUZES * sizeof(luz_t));
+        for(i = 0; luzes != NULL && i < NUM_LUZES; i++)
+        {
+            luzes[i].posicao.x = ESPACO_LUZES * 
+                (i % LUZES_POR_LINHA - LUZES_POR_LINHA / 2);
+            luzes[i].posicao.y = ALTURA_LUZES;
+            luzes[i].posicao.z = 5.0 - ESPACO_LUZES * (i / LUZES_POR_LINHA);
+            luzes[i].cor.x = ENERGIA_LUZES / max(NUM_LUZES, 1);
+            luzes[i].cor.y = luzes[i].cor.x;
+            luzes[i].cor.z = luzes[i].cor.x;
+        }
+        
+        if(luzes == NULL || !cena_definir_luzes(&cena, luzes, NUM_LUZES))
+        {
+            fprintf(stderr, "Erro ao criar as luzes\n");
+        }
+        free(luzes);
+    }
+    
+    // Os quadros são traçados por uma thread própria.
+    fundo.x = FUNDO_R;
+    fundo.y = FUNDO_G;
+    fundo.z = FUNDO_B;
+#ifdef PARALELO
+    renderizador = renderizador_criar(&cena, &luz_local, &luz_ambiente, 
+        fundo, MAX_REC, NUM_THREADS);
+#else
+    renderizador = renderizador_criar(&cena, &luz_local, &luz_ambiente, 
+        fundo, MAX_REC, 1);
+#endif
+    if(renderizador == NULL)
+    {
+        fprintf(stderr, "Erro ao criar o renderizador\n");
+        return 1;
+    }
+    renderizador_orcamento(renderizador, ORCAMENTO_QUADRO / 1000.0);
+    renderizador_amostrador(renderizador, amostrador);
+    renderizador_filtragem(renderizador, filtragem);
+    renderizador_irradiancia(renderizador, irradiancia);
+    renderizador_fotons(renderizador, causticas ? NUM_FOTONS : 0, 
+        VIZINHOS_FOTONS);
+    
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
     glutInitWindowSize(largura, altura); 
     glutInitWindowPosition (100, 100);
@@ -395,8 +855,8 @@ int main(int argc, char** argv)
     glutMainLoop();
 
     // Libera a memória alocada ao final.
-    free(pixels);
-    for(i = 0; i < NUM_OBJETOS; i++)
+    renderizador_liberar(renderizador);
+    for(i = 0; i < num_objetos; i++)
     {
         if (objetos[i].tipo == ESFERA)
         {
@@ -414,7 +874,18 @@ int main(int argc, char** argv)
         {
             free(objetos[i].plano);
         }        
+        else if (objetos[i].tipo == INSTANCIA)        
+        {
+            free(objetos[i].instancia);
+        }        
+        else if (objetos[i].tipo == MALHA)        
+        {
+            malha_liberar(objetos[i].malha);
+        }        
     }
+    
+    cena_liberar(&cena);
+    malha_liberar(malha_piramide);
 
     return 0;
 }
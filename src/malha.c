@@ -0,0 +1,591 @@
+#include "malha.h"
+#include "bvh.h"
+#include "malha_compacta.h"
+#include "onda.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/**
+ * Cria uma malha de triângulos e constrói a sua BVH (nível de baixo).
+ * Os arrays são copiados, então podem ser liberados após a chamada.
+ *
+ * @param vertices Array de vértices no espaço do objeto.
+ * @param num_vertices Número de vértices.
+ * @param indices Array de índices (3 por triângulo).
+ * @param num_triangulos Número de triângulos.
+ * @return Ponteiro para a malha criada ou NULL caso falte memória.
+ */
+malha_t *malha_criar(ponto_t *vertices, int num_vertices, int *indices,
+    int num_triangulos)
+{
+    ponto_t *copia_vertices;
+    int *copia_indices;
+
+    copia_vertices = malloc(num_vertices * sizeof(ponto_t));
+    copia_indices = malloc(3 * num_triangulos * sizeof(int));
+
+    if(copia_vertices == NULL || copia_indices == NULL)
+    {
+        free(copia_vertices);
+        free(copia_indices);
+        return NULL;
+    }
+
+    memcpy(copia_vertices, vertices, num_vertices * sizeof(ponto_t));
+    memcpy(copia_indices, indices, 3 * num_triangulos * sizeof(int));
+
+    return malha_adotar(copia_vertices, num_vertices, copia_indices,
+        num_triangulos);
+}
+
+/**
+ * Cria uma malha de triângulos usando os próprios arrays recebidos (sem
+ * cópia) e constrói a sua BVH. Os arrays passam a pertencer à malha e são
+ * liberados por malha_liberar(), mesmo em caso de erro.
+ *
+ * @param vertices Array de vértices alocado com malloc.
+ * @param num_vertices Número de vértices.
+ * @param indices Array de índices (3 por triângulo) alocado com malloc.
+ * @param num_triangulos Número de triângulos.
+ * @return Ponteiro para a malha criada ou NULL caso falte memória.
+ */
+malha_t *malha_adotar(ponto_t *vertices, int num_vertices, int *indices,
+    int num_triangulos)
+{
+    int i, k;
+    malha_t *malha;
+    caixa_t *caixas;
+
+    malha = malloc(sizeof(malha_t));
+    caixas = malloc(num_triangulos * sizeof(caixa_t));
+
+    if(malha == NULL || caixas == NULL)
+    {
+        free(caixas);
+        free(malha);
+        free(vertices);
+        free(indices);
+        return NULL;
+    }
+
+    malha->vertices = vertices;
+    malha->num_vertices = num_vertices;
+    malha->indices = indices;
+    malha->num_triangulos = num_triangulos;
+    malha->mapa = NULL;
+    malha->tamanho_mapa = 0;
+    malha->compacta = NULL;
+
+    // Caixa envolvente de cada triângulo.
+    # pragma omp parallel for private(k) if(num_triangulos > 65536)
+    for(i = 0; i < num_triangulos; i++)
+    {
+        caixas[i] = caixa_vazia();
+        for(k = 0; k < 3; k++)
+        {
+            caixa_expandir(&caixas[i], &vertices[indices[3 * i + k]]);
+        }
+    }
+
+    if(!bvh_construir(&malha->bvh, caixas, num_triangulos))
+    {
+        free(caixas);
+        malha_liberar(malha);
+        return NULL;
+    }
+
+    free(caixas);
+    return malha;
+}
+
+/**
+ * Libera a memória de uma malha (não pode haver mais instâncias dela).
+ *
+ * @param malha Ponteiro para a malha.
+ */
+void malha_liberar(malha_t *malha)
+{
+    if(malha == NULL)
+    {
+        return;
+    }
+
+    // Malhas mapeadas de arquivo não possuem arrays próprios.
+    if(malha->mapa != NULL)
+    {
+        munmap(malha->mapa, malha->tamanho_mapa);
+    }
+    else
+    {
+        bvh_liberar(&malha->bvh);
+        free(malha->vertices);
+        free(malha->indices);
+    }
+
+    liberar_compacta(malha->compacta);
+    free(malha);
+}
+
+/**
+ * Calcula quantos bytes a geometria e a BVH de uma malha ocupam.
+ *
+ * @param malha Ponteiro para a malha.
+ * @return Número de bytes.
+ */
+size_t malha_memoria(malha_t *malha)
+{
+    size_t bytes;
+
+    bytes = malha->bvh.num_nos * sizeof(no_bvh_t) +
+        malha->bvh.num_primitivos * sizeof(int);
+
+    if(malha->compacta != NULL)
+    {
+        bytes += malha->compacta->num_aglomerados * sizeof(aglomerado_t) +
+            malha->compacta->num_grupos * sizeof(grupo_compacto_t) +
+            3 * malha->num_vertices * sizeof(unsigned short) +
+            3 * malha->num_triangulos * sizeof(unsigned char);
+    }
+    else
+    {
+        bytes += malha->num_vertices * sizeof(ponto_t) +
+            3 * malha->num_triangulos * sizeof(int);
+    }
+
+    return bytes;
+}
+
+/**
+ * Teste de interseção de Möller-Trumbore com um triângulo de uma malha.
+ * Só aceita interseções com 0 <= t < tmax.
+ *
+ * @param origem_raio Ponteiro para o ponto de onde o raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio (não precisa estar normalizado).
+ * @param v0 Ponteiro para o primeiro vértice.
+ * @param v1 Ponteiro para o segundo vértice.
+ * @param v2 Ponteiro para o terceiro vértice.
+ * @param tmax Distância máxima aceita.
+ * @param t0 Ponteiro para a distância até o ponto de interseção (é
+ * modificada na função).
+ * @return 1 se o raio intersecta o triângulo, 0 caso contrário.
+ */
+int intersecao_triangulo_malha(ponto_t *origem_raio,
+    vetor_t *direcao_raio, ponto_t *v0, ponto_t *v1, ponto_t *v2,
+    real_t tmax, real_t *t0)
+{
+    vetor_t aresta1, aresta2, p, q, s;
+    real_t det, inv_det, u, v, t;
+
+    aresta1 = sub_v(v1, v0);
+    aresta2 = sub_v(v2, v0);
+    p = prod_v(direcao_raio, &aresta2);
+    det = prod_e(&aresta1, &p);
+
+    // Raio paralelo ao triângulo.
+    if(fabs(det) < 1.0e-12)
+    {
+        return 0;
+    }
+
+    inv_det = 1.0 / det;
+    s = sub_v(origem_raio, v0);
+    u = prod_e(&s, &p) * inv_det;
+    if(u < 0.0 || u > 1.0)
+    {
+        return 0;
+    }
+
+    q = prod_v(&s, &aresta1);
+    v = prod_e(direcao_raio, &q) * inv_det;
+    if(v < 0.0 || u + v > 1.0)
+    {
+        return 0;
+    }
+
+    t = prod_e(&aresta2, &q) * inv_det;
+    if(t < 0.0 || t >= tmax)
+    {
+        return 0;
+    }
+
+    *t0 = t;
+    return 1;
+}
+
+/**
+ * Verifica se um raio (no espaço do objeto) intersecta uma malha,
+ * percorrendo a sua BVH.
+ *
+ * @param origem_raio Ponteiro para o ponto de onde o raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio (não precisa estar normalizado).
+ * @param malha Ponteiro para a malha a ser intersectada.
+ * @param t0 Ponteiro para a distância até o triângulo mais perto (é
+ * modificada na função).
+ * @param normal Ponteiro para o vetor normal (não normalizado) do
+ * triângulo mais perto.
+ * @return 1 se o raio intersecta a malha, 0 caso contrário.
+ */
+int intersecao_malha(ponto_t *origem_raio, vetor_t *direcao_raio,
+    malha_t *malha, real_t *t0, vetor_t *normal)
+{
+    int k, topo, indice, triangulo_perto;
+    int pilha[BVH_MAX_PILHA];
+    int *tri;
+    real_t tperto, t_temp;
+    vetor_t inv_direcao, aresta1, aresta2;
+    no_bvh_t *no;
+
+    if(malha->compacta != NULL)
+    {
+        return intersecao_malha_compacta(origem_raio, direcao_raio, malha,
+            t0, normal);
+    }
+
+    if(malha->bvh.num_nos == 0)
+    {
+        return 0;
+    }
+
+    inv_direcao.x = 1.0 / direcao_raio->x;
+    inv_direcao.y = 1.0 / direcao_raio->y;
+    inv_direcao.z = 1.0 / direcao_raio->z;
+
+    tperto = INFINITO;
+    triangulo_perto = -1;
+    topo = 0;
+    pilha[topo++] = 0;
+
+    while(topo > 0)
+    {
+        indice = pilha[--topo];
+        no = &malha->bvh.nos[indice];
+
+        if(!intersecao_caixa(origem_raio, &inv_direcao, &no->caixa, tperto,
+            &t_temp))
+        {
+            continue;
+        }
+
+        if(no->quantidade > 0)
+        {
+            for(k = no->inicio; k < no->inicio + no->quantidade; k++)
+            {
+                tri = &malha->indices[3 * malha->bvh.primitivos[k]];
+                if(intersecao_triangulo_malha(origem_raio, direcao_raio,
+                    &malha->vertices[tri[0]], &malha->vertices[tri[1]],
+                    &malha->vertices[tri[2]], tperto, &t_temp))
+                {
+                    tperto = t_temp;
+                    triangulo_perto = malha->bvh.primitivos[k];
+                }
+            }
+            continue;
+        }
+
+        pilha[topo++] = no->inicio;
+        pilha[topo++] = indice + 1;
+    }
+
+    if(triangulo_perto < 0)
+    {
+        return 0;
+    }
+
+    // A normal só é calculada para o triângulo mais perto.
+    tri = &malha->indices[3 * triangulo_perto];
+    aresta1 = sub_v(&malha->vertices[tri[1]], &malha->vertices[tri[0]]);
+    aresta2 = sub_v(&malha->vertices[tri[2]], &malha->vertices[tri[0]]);
+    *normal = prod_v(&aresta1, &aresta2);
+    *t0 = tperto;
+    return 1;
+}
+
+/**
+ * Verifica quais raios de uma lista, tirados de um pacote de raios de
+ * sombra (no espaço do objeto), são bloqueados por uma malha sem
+ * compactação, percorrendo a BVH dela uma vez só para a lista (como em
+ * oclusao_cena_pacote()). Basta um triângulo a menos de tmax para
+ * bloquear o raio; os raios bloqueados são marcados em pacote->ocluido.
+ *
+ * @param malha Ponteiro para a malha.
+ * @param pacote Ponteiro para o pacote.
+ * @param candidatos Posições no pacote dos raios a testar.
+ * @param num_candidatos Número de raios a testar.
+ * @param tmax Distância máxima a ser considerada.
+ * @return Número de raios bloqueados pela malha.
+ */
+int oclusao_malha_pacote(malha_t *malha, pacote_sombra_t *pacote,
+    unsigned char *candidatos, int num_candidatos, real_t tmax)
+{
+    int i, k, m, topo, indice, inicio, num, fim, bloqueados;
+    int pilha[BVH_MAX_PILHA], inicios[BVH_MAX_PILHA], quantos[BVH_MAX_PILHA];
+    int *tri;
+    unsigned char raios[BVH_MAX_PILHA * PACOTE_MAX_RAIOS];
+    real_t t_temp;
+    ponto_t origem;
+    vetor_t direcao;
+    no_bvh_t *no;
+
+    if(malha->bvh.num_nos == 0 || num_candidatos == 0)
+    {
+        return 0;
+    }
+
+    memcpy(raios, candidatos, num_candidatos);
+    bloqueados = 0;
+    topo = 0;
+    pilha[topo] = 0;
+    inicios[topo] = 0;
+    quantos[topo++] = num_candidatos;
+
+    while(topo > 0 && bloqueados < num_candidatos)
+    {
+        topo--;
+        indice = pilha[topo];
+        no = &malha->bvh.nos[indice];
+        inicio = inicios[topo];
+        fim = inicio + quantos[topo];
+
+        num = 0;
+        for(m = inicio; m < fim; m++)
+        {
+            k = raios[m];
+            if(!pacote->ocluido[k] &&
+                intersecao_caixa_pacote(pacote, k, &no->caixa, tmax))
+            {
+                raios[fim + num++] = k;
+            }
+        }
+        if(num == 0)
+        {
+            continue;
+        }
+
+        if(no->quantidade > 0)
+        {
+            // Cada triângulo é testado contra todos os raios que chegaram.
+            for(i = no->inicio; i < no->inicio + no->quantidade; i++)
+            {
+                tri = &malha->indices[3 * malha->bvh.primitivos[i]];
+                for(m = fim; m < fim + num; m++)
+                {
+                    k = raios[m];
+                    if(pacote->ocluido[k])
+                    {
+                        continue;
+                    }
+
+                    origem.x = pacote->origem_x[k];
+                    origem.y = pacote->origem_y[k];
+                    origem.z = pacote->origem_z[k];
+                    direcao.x = pacote->direcao_x[k];
+                    direcao.y = pacote->direcao_y[k];
+                    direcao.z = pacote->direcao_z[k];
+                    if(intersecao_triangulo_malha(&origem, &direcao,
+                        &malha->vertices[tri[0]], &malha->vertices[tri[1]],
+                        &malha->vertices[tri[2]], tmax, &t_temp))
+                    {
+                        pacote->ocluido[k] = 1;
+                        bloqueados++;
+                    }
+                }
+            }
+            continue;
+        }
+
+        pilha[topo] = no->inicio;
+        inicios[topo] = fim;
+        quantos[topo++] = num;
+        pilha[topo] = indice + 1;
+        inicios[topo] = fim;
+        quantos[topo++] = num;
+    }
+
+    return bloqueados;
+}
+
+/**
+ * Monta uma matriz de transformação 3x4 (linha a linha) que aplica,
+ * nesta ordem, escala uniforme, rotação em torno de um eixo e translação.
+ *
+ * @param matriz Matriz a ser preenchida.
+ * @param escala Fator de escala uniforme.
+ * @param eixo Ponteiro para o eixo de rotação (não precisa estar
+ * normalizado).
+ * @param angulo Ângulo de rotação em graus.
+ * @param translacao Ponteiro para o vetor de translação.
+ */
+void matriz_transformacao(real_t matriz[12], real_t escala, vetor_t *eixo,
+    real_t angulo, vetor_t *translacao)
+{
+    vetor_t a;
+    real_t c, s, t;
+
+    a = normalizar(eixo);
+    c = cos(angulo * PI / 180.0);
+    s = sin(angulo * PI / 180.0);
+    t = 1.0 - c;
+
+    // Fórmula de Rodrigues (mesma convenção do glRotate).
+    matriz[0] = escala * (t * a.x * a.x + c);
+    matriz[1] = escala * (t * a.x * a.y - s * a.z);
+    matriz[2] = escala * (t * a.x * a.z + s * a.y);
+    matriz[3] = translacao->x;
+
+    matriz[4] = escala * (t * a.x * a.y + s * a.z);
+    matriz[5] = escala * (t * a.y * a.y + c);
+    matriz[6] = escala * (t * a.y * a.z - s * a.x);
+    matriz[7] = translacao->y;
+
+    matriz[8] = escala * (t * a.x * a.z - s * a.y);
+    matriz[9] = escala * (t * a.y * a.z + s * a.x);
+    matriz[10] = escala * (t * a.z * a.z + c);
+    matriz[11] = translacao->z;
+}
+
+/**
+ * Aplica uma matriz 3x4 a um ponto.
+ *
+ * @param m Matriz 3x4 (linha a linha).
+ * @param p Ponteiro para o ponto.
+ * @return Ponto transformado.
+ */
+ponto_t transformar_ponto(real_t m[12], ponto_t *p)
+{
+    ponto_t r;
+    r.x = m[0] * p->x + m[1] * p->y + m[2] * p->z + m[3];
+    r.y = m[4] * p->x + m[5] * p->y + m[6] * p->z + m[7];
+    r.z = m[8] * p->x + m[9] * p->y + m[10] * p->z + m[11];
+    return r;
+}
+
+/**
+ * Aplica apenas a parte linear de uma matriz 3x4 a um vetor.
+ */
+static vetor_t transformar_vetor(real_t m[12], vetor_t *v)
+{
+    vetor_t r;
+    r.x = m[0] * v->x + m[1] * v->y + m[2] * v->z;
+    r.y = m[4] * v->x + m[5] * v->y + m[6] * v->z;
+    r.z = m[8] * v->x + m[9] * v->y + m[10] * v->z;
+    return r;
+}
+
+/**
+ * Define uma instância de uma malha: guarda a transformação, calcula a
+ * inversa e a caixa envolvente no mundo.
+ *
+ * @param instancia Ponteiro para a instância a ser preenchida.
+ * @param malha Ponteiro para a malha compartilhada.
+ * @param matriz Matriz 3x4 que leva do espaço do objeto para o mundo.
+ * @return 1 em caso de sucesso, 0 se a matriz não for inversível.
+ */
+int instancia_definir(instancia_t *instancia, malha_t *malha,
+    real_t matriz[12])
+{
+    int i;
+    real_t det, inv_det;
+    real_t *m, *r;
+    ponto_t canto, canto_mundo;
+    caixa_t *caixa_objeto;
+
+    m = matriz;
+    r = instancia->inversa;
+
+    det = m[0] * (m[5] * m[10] - m[6] * m[9])
+        - m[1] * (m[4] * m[10] - m[6] * m[8])
+        + m[2] * (m[4] * m[9] - m[5] * m[8]);
+
+    if(fabs(det) < 1.0e-12)
+    {
+        return 0;
+    }
+
+    inv_det = 1.0 / det;
+
+    // Inversa da parte linear (matriz adjunta dividida pelo determinante).
+    r[0] = (m[5] * m[10] - m[6] * m[9]) * inv_det;
+    r[1] = (m[2] * m[9] - m[1] * m[10]) * inv_det;
+    r[2] = (m[1] * m[6] - m[2] * m[5]) * inv_det;
+    r[4] = (m[6] * m[8] - m[4] * m[10]) * inv_det;
+    r[5] = (m[0] * m[10] - m[2] * m[8]) * inv_det;
+    r[6] = (m[2] * m[4] - m[0] * m[6]) * inv_det;
+    r[8] = (m[4] * m[9] - m[5] * m[8]) * inv_det;
+    r[9] = (m[1] * m[8] - m[0] * m[9]) * inv_det;
+    r[10] = (m[0] * m[5] - m[1] * m[4]) * inv_det;
+
+    // Translação inversa: -R^-1 * t.
+    r[3] = -(r[0] * m[3] + r[1] * m[7] + r[2] * m[11]);
+    r[7] = -(r[4] * m[3] + r[5] * m[7] + r[6] * m[11]);
+    r[11] = -(r[8] * m[3] + r[9] * m[7] + r[10] * m[11]);
+
+    memcpy(instancia->matriz, matriz, 12 * sizeof(real_t));
+    instancia->malha = malha;
+
+    // Caixa no mundo a partir dos 8 cantos da caixa da raiz da BVH.
+    instancia->caixa = caixa_vazia();
+    if(malha->bvh.num_nos == 0)
+    {
+        return 1;
+    }
+
+    caixa_objeto = &malha->bvh.nos[0].caixa;
+    for(i = 0; i < 8; i++)
+    {
+        canto.x = (i & 1) ? caixa_objeto->max.x : caixa_objeto->min.x;
+        canto.y = (i & 2) ? caixa_objeto->max.y : caixa_objeto->min.y;
+        canto.z = (i & 4) ? caixa_objeto->max.z : caixa_objeto->min.z;
+        canto_mundo = transformar_ponto(matriz, &canto);
+        caixa_expandir(&instancia->caixa, &canto_mundo);
+    }
+
+    return 1;
+}
+
+/**
+ * Verifica se um raio (no mundo) intersecta uma instância. O raio é
+ * levado para o espaço do objeto sem ser normalizado, de modo que a
+ * distância retornada vale também no mundo.
+ *
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param instancia Ponteiro para a instância a ser intersectada.
+ * @param t0 Ponteiro para a distância até o ponto de interseção (é
+ * modificada na função).
+ * @param normal Ponteiro para o vetor normal (no mundo) a ser retornado.
+ * @return 1 se o raio intersecta a instância, 0 caso contrário.
+ */
+int intersecao_instancia(ponto_t *origem_raio, vetor_t *direcao_raio,
+    instancia_t *instancia, real_t *t0, vetor_t *normal)
+{
+    ponto_t origem_objeto;
+    vetor_t direcao_objeto, normal_objeto;
+    real_t *r;
+
+    origem_objeto = transformar_ponto(instancia->inversa, origem_raio);
+    direcao_objeto = transformar_vetor(instancia->inversa, direcao_raio);
+
+    if(!intersecao_malha(&origem_objeto, &direcao_objeto, instancia->malha,
+        t0, &normal_objeto))
+    {
+        return 0;
+    }
+
+    // A normal volta para o mundo pela transposta da inversa.
+    r = instancia->inversa;
+    normal->x = r[0] * normal_objeto.x + r[4] * normal_objeto.y +
+        r[8] * normal_objeto.z;
+    normal->y = r[1] * normal_objeto.x + r[5] * normal_objeto.y +
+        r[9] * normal_objeto.z;
+    normal->z = r[2] * normal_objeto.x + r[6] * normal_objeto.y +
+        r[10] * normal_objeto.z;
+    *normal = normalizar(normal);
+
+    return 1;
+}
@@ -0,0 +1,153 @@
+#ifndef MALHA_H
+#define MALHA_H
+
+#include "geometria.h"
+
+/** 
+ * Cria uma malha de triângulos e constrói a sua BVH (nível de baixo). 
+ * Os arrays são copiados, então podem ser liberados após a chamada.
+ * 
+ * @param vertices Array de vértices no espaço do objeto.
+ * @param num_vertices Número de vértices.
+ * @param indices Array de índices (3 por triângulo).
+ * @param num_triangulos Número de triângulos.
+ * @return Ponteiro para a malha criada ou NULL caso falte memória.
+ */
+malha_t *malha_criar(ponto_t *vertices, int num_vertices, int *indices, 
+    int num_triangulos);
+
+/** 
+ * Cria uma malha de triângulos usando os próprios arrays recebidos (sem 
+ * cópia) e constrói a sua BVH. Os arrays passam a pertencer à malha e são 
+ * liberados por malha_liberar(), mesmo em caso de erro.
+ * 
+ * @param vertices Array de vértices alocado com malloc.
+ * @param num_vertices Número de vértices.
+ * @param indices Array de índices (3 por triângulo) alocado com malloc.
+ * @param num_triangulos Número de triângulos.
+ * @return Ponteiro para a malha criada ou NULL caso falte memória.
+ */
+malha_t *malha_adotar(ponto_t *vertices, int num_vertices, int *indices, 
+    int num_triangulos);
+
+/** 
+ * Libera a memória de uma malha (não pode haver mais instâncias dela).
+ * 
+ * @param malha Ponteiro para a malha.
+ */
+void malha_liberar(malha_t *malha);
+
+/** 
+ * Calcula quantos bytes a geometria e a BVH de uma malha ocupam.
+ * 
+ * @param malha Ponteiro para a malha.
+ * @return Número de bytes.
+ */
+size_t malha_memoria(malha_t *malha);
+
+/** 
+ * Teste de interseção de Möller-Trumbore com um triângulo de uma malha. 
+ * Só aceita interseções com 0 <= t < tmax.
+ * 
+ * @param origem_raio Ponteiro para o ponto de onde o raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio (não precisa estar normalizado).
+ * @param v0 Ponteiro para o primeiro vértice.
+ * @param v1 Ponteiro para o segundo vértice.
+ * @param v2 Ponteiro para o terceiro vértice.
+ * @param tmax Distância máxima aceita.
+ * @param t0 Ponteiro para a distância até o ponto de interseção (é 
+ * modificada na função).
+ * @return 1 se o raio intersecta o triângulo, 0 caso contrário.
+ */ 
+int intersecao_triangulo_malha(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    ponto_t *v0, ponto_t *v1, ponto_t *v2, real_t tmax, real_t *t0);
+
+/**
+ * Verifica se um raio (no espaço do objeto) intersecta uma malha, 
+ * percorrendo a sua BVH.
+ * 
+ * @param origem_raio Ponteiro para o ponto de onde o raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio (não precisa estar normalizado).
+ * @param malha Ponteiro para a malha a ser intersectada.
+ * @param t0 Ponteiro para a distância até o triângulo mais perto (é 
+ * modificada na função).
+ * @param normal Ponteiro para o vetor normal (não normalizado) do 
+ * triângulo mais perto.
+ * @return 1 se o raio intersecta a malha, 0 caso contrário.
+ */ 
+int intersecao_malha(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    malha_t *malha, real_t *t0, vetor_t *normal);
+
+/**
+ * Verifica quais raios de uma lista, tirados de um pacote de raios de
+ * sombra (no espaço do objeto), são bloqueados por uma malha sem
+ * compactação, percorrendo a BVH dela uma vez só para a lista (como em
+ * oclusao_cena_pacote()). Basta um triângulo a menos de tmax para
+ * bloquear o raio; os raios bloqueados são marcados em pacote->ocluido.
+ *
+ * @param malha Ponteiro para a malha.
+ * @param pacote Ponteiro para o pacote.
+ * @param candidatos Posições no pacote dos raios a testar.
+ * @param num_candidatos Número de raios a testar.
+ * @param tmax Distância máxima a ser considerada.
+ * @return Número de raios bloqueados pela malha.
+ */
+int oclusao_malha_pacote(malha_t *malha, pacote_sombra_t *pacote,
+    unsigned char *candidatos, int num_candidatos, real_t tmax);
+
+/** 
+ * Monta uma matriz de transformação 3x4 (linha a linha) que aplica, 
+ * nesta ordem, escala uniforme, rotação em torno de um eixo e translação.
+ * 
+ * @param matriz Matriz a ser preenchida.
+ * @param escala Fator de escala uniforme.
+ * @param eixo Ponteiro para o eixo de rotação (não precisa estar 
+ * normalizado).
+ * @param angulo Ângulo de rotação em graus.
+ * @param translacao Ponteiro para o vetor de translação.
+ */
+void matriz_transformacao(real_t matriz[12], real_t escala, vetor_t *eixo, 
+    real_t angulo, vetor_t *translacao);
+
+/** 
+ * Aplica uma matriz 3x4 a um ponto.
+ * 
+ * @param m Matriz 3x4 (linha a linha).
+ * @param p Ponteiro para o ponto.
+ * @return Ponto transformado.
+ */
+ponto_t transformar_ponto(real_t m[12], ponto_t *p);
+
+/** 
+ * Define uma instância de uma malha: guarda a transformação, calcula a 
+ * inversa e a caixa envolvente no mundo.
+ * 
+ * @param instancia Ponteiro para a instância a ser preenchida.
+ * @param malha Ponteiro para a malha compartilhada.
+ * @param matriz Matriz 3x4 que leva do espaço do objeto para o mundo.
+ * @return 1 em caso de sucesso, 0 se a matriz não for inversível.
+ */
+int instancia_definir(instancia_t *instancia, malha_t *malha, 
+    real_t matriz[12]);
+
+/**
+ * Verifica se um raio (no mundo) intersecta uma instância. O raio é 
+ * levado para o espaço do objeto sem ser normalizado, de modo que a 
+ * distância retornada vale também no mundo.
+ * 
+ * @param origem_raio Ponteiro para o ponto no espaço de onde o 
+ * raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio.
+ * @param instancia Ponteiro para a instância a ser intersectada.
+ * @param t0 Ponteiro para a distância até o ponto de interseção (é 
+ * modificada na função).
+ * @param normal Ponteiro para o vetor normal (no mundo) a ser retornado.
+ * @return 1 se o raio intersecta a instância, 0 caso contrário.
+ */ 
+int intersecao_instancia(ponto_t *origem_raio, vetor_t *direcao_raio, 
+    instancia_t *instancia, real_t *t0, vetor_t *normal);
+
+#endif // MALHA_H
@@ -0,0 +1,514 @@
+#include "malha_compacta.h"
+#include "malha.h"
+#include "bvh.h"
+#include <math.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/**
+ * Maior coordenada quantizada. Sobra uma pequena folga abaixo de 65535
+ * para o arredondamento dos cantos na grade.
+ */
+#define MAX_QUANTIZADO 65533.0
+
+/**
+ * Converte uma posição na grade da malha para um ponto.
+ */
+static ponto_t ponto_grade(malha_compacta_t *compacta, real_t x, real_t y,
+    real_t z)
+{
+    ponto_t p;
+    p.x = compacta->base.x + x * compacta->escala.x;
+    p.y = compacta->base.y + y * compacta->escala.y;
+    p.z = compacta->base.z + z * compacta->escala.z;
+    return p;
+}
+
+/**
+ * Decodifica um vértice (índice local) de um aglomerado.
+ */
+static ponto_t decodificar_vertice(malha_compacta_t *compacta,
+    aglomerado_t *aglomerado, int local)
+{
+    unsigned short *q;
+
+    q = &compacta->vertices[3 * (aglomerado->primeiro_vertice + local)];
+    return ponto_grade(compacta, (real_t) (aglomerado->origem[0] + q[0]),
+        (real_t) (aglomerado->origem[1] + q[1]),
+        (real_t) (aglomerado->origem[2] + q[2]));
+}
+
+/**
+ * Caixa envolvente de um aglomerado.
+ */
+static caixa_t caixa_aglomerado(malha_compacta_t *compacta,
+    aglomerado_t *aglomerado)
+{
+    caixa_t caixa;
+    int *o;
+
+    o = aglomerado->origem;
+    caixa.min = ponto_grade(compacta, (real_t) o[0], (real_t) o[1],
+        (real_t) o[2]);
+    caixa.max = ponto_grade(compacta,
+        (real_t) (o[0] + aglomerado->extensao[0]),
+        (real_t) (o[1] + aglomerado->extensao[1]),
+        (real_t) (o[2] + aglomerado->extensao[2]));
+    return caixa;
+}
+
+/**
+ * Caixa envolvente de um grupo (conservadora: a caixa de 8 bits cobre o
+ * intervalo inteiro da última célula).
+ */
+static caixa_t caixa_grupo(malha_compacta_t *compacta,
+    aglomerado_t *aglomerado, grupo_compacto_t *grupo)
+{
+    caixa_t caixa;
+    int *o;
+    unsigned char *d;
+
+    o = aglomerado->origem;
+    d = aglomerado->deslocamento;
+    caixa.min = ponto_grade(compacta,
+        (real_t) (o[0] + (grupo->caixa[0] << d[0])),
+        (real_t) (o[1] + (grupo->caixa[1] << d[1])),
+        (real_t) (o[2] + (grupo->caixa[2] << d[2])));
+    caixa.max = ponto_grade(compacta,
+        (real_t) (o[0] + ((grupo->caixa[3] + 1) << d[0])),
+        (real_t) (o[1] + ((grupo->caixa[4] + 1) << d[1])),
+        (real_t) (o[2] + ((grupo->caixa[5] + 1) << d[2])));
+    return caixa;
+}
+
+/**
+ * Libera uma geometria compactada e os seus arrays.
+ *
+ * @param compacta Ponteiro para a geometria (pode ser NULL).
+ */
+void liberar_compacta(malha_compacta_t *compacta)
+{
+    if(compacta == NULL)
+    {
+        return;
+    }
+
+    free(compacta->aglomerados);
+    free(compacta->grupos);
+    free(compacta->vertices);
+    free(compacta->indices);
+    free(compacta);
+}
+
+/**
+ * Compacta a geometria de uma malha: os triângulos são agrupados, na
+ * ordem das folhas da BVH, em aglomerados de até 256 vértices, cujos
+ * vértices são quantizados em 16 bits e cujos índices passam a ter 8
+ * bits. A BVH é refeita sobre os aglomerados e os arrays originais são
+ * liberados (ou o arquivo desmapeado). Em caso de erro a malha não muda.
+ *
+ * @param malha Ponteiro para a malha.
+ * @return 1 em caso de sucesso, 0 caso contrário.
+ */
+int malha_compactar(malha_t *malha)
+{
+    int i, j, k, n, eixo, a, v, novos, num_folhas, num_vertices;
+    int num_aglomerados, tri_aglomerado, vert_aglomerado, sucesso;
+    int *marca, *local, *originais;
+    long long g, gmin[3], gmax[3];
+    double extensao, maior_extensao[3];
+    malha_compacta_t *compacta;
+    aglomerado_t *aglomerado;
+    grupo_compacto_t *grupo;
+    no_bvh_t *no;
+    caixa_t *caixas, caixa_malha;
+    caixa_t *caixas_reais;
+    bvh_t bvh;
+    unsigned short *q;
+
+    if(malha->compacta != NULL || malha->bvh.num_nos == 0)
+    {
+        return 0;
+    }
+
+    // Cada folha da BVH vira um grupo.
+    num_folhas = 0;
+    for(i = 0; i < malha->bvh.num_nos; i++)
+    {
+        if(malha->bvh.nos[i].quantidade > 0)
+        {
+            num_folhas++;
+        }
+    }
+
+    compacta = calloc(1, sizeof(malha_compacta_t));
+    marca = malloc(malha->num_vertices * sizeof(int));
+    local = malloc(malha->num_vertices * sizeof(int));
+    originais = malloc(3 * malha->num_triangulos * sizeof(int));
+    caixas_reais = malloc(num_folhas * sizeof(caixa_t));
+    caixas = NULL;
+    sucesso = 0;
+
+    if(compacta == NULL || marca == NULL || local == NULL ||
+        originais == NULL || caixas_reais == NULL)
+    {
+        goto fim;
+    }
+
+    compacta->aglomerados = malloc(num_folhas * sizeof(aglomerado_t));
+    compacta->grupos = malloc(num_folhas * sizeof(grupo_compacto_t));
+    compacta->indices = malloc(3 * malha->num_triangulos);
+
+    if(compacta->aglomerados == NULL || compacta->grupos == NULL ||
+        compacta->indices == NULL)
+    {
+        goto fim;
+    }
+
+    for(i = 0; i < malha->num_vertices; i++)
+    {
+        marca[i] = -1;
+    }
+
+    // Primeira passada: percorre as folhas (os nós estão em ordem de
+    // profundidade, então folhas vizinhas são próximas no espaço) e as
+    // junta em aglomerados enquanto couberem, guardando os vértices
+    // originais de cada um.
+    num_aglomerados = 0;
+    num_vertices = 0;
+    tri_aglomerado = AGLOMERADO_MAX_TRIANGULOS;
+    vert_aglomerado = AGLOMERADO_MAX_VERTICES;
+    aglomerado = NULL;
+    n = 0;
+
+    for(i = 0; i < malha->bvh.num_nos; i++)
+    {
+        no = &malha->bvh.nos[i];
+        if(no->quantidade == 0)
+        {
+            continue;
+        }
+
+        // Conta (por cima) os vértices que a folha acrescentaria.
+        novos = 0;
+        for(k = no->inicio; k < no->inicio + no->quantidade; k++)
+        {
+            for(j = 0; j < 3; j++)
+            {
+                v = malha->indices[3 * malha->bvh.primitivos[k] + j];
+                novos += (marca[v] != num_aglomerados - 1);
+            }
+        }
+
+        if(tri_aglomerado + no->quantidade > AGLOMERADO_MAX_TRIANGULOS ||
+            vert_aglomerado + novos > AGLOMERADO_MAX_VERTICES ||
+            aglomerado->num_grupos == UCHAR_MAX)
+        {
+            aglomerado = &compacta->aglomerados[num_aglomerados++];
+            aglomerado->primeiro_vertice = num_vertices;
+            aglomerado->primeiro_triangulo = n;
+            aglomerado->primeiro_grupo = compacta->num_grupos;
+            aglomerado->num_grupos = 0;
+            caixas_reais[num_aglomerados - 1] = caixa_vazia();
+            tri_aglomerado = 0;
+            vert_aglomerado = 0;
+        }
+
+        grupo = &compacta->grupos[compacta->num_grupos++];
+        grupo->inicio = tri_aglomerado;
+        grupo->quantidade = no->quantidade;
+        aglomerado->num_grupos++;
+
+        for(k = no->inicio; k < no->inicio + no->quantidade; k++)
+        {
+            for(j = 0; j < 3; j++)
+            {
+                v = malha->indices[3 * malha->bvh.primitivos[k] + j];
+                if(marca[v] != num_aglomerados - 1)
+                {
+                    marca[v] = num_aglomerados - 1;
+                    local[v] = vert_aglomerado++;
+                    originais[num_vertices++] = v;
+                    caixa_expandir(&caixas_reais[num_aglomerados - 1],
+                        &malha->vertices[v]);
+                }
+                compacta->indices[3 * n + j] = local[v];
+            }
+            tri_aglomerado++;
+            n++;
+        }
+    }
+
+    compacta->num_aglomerados = num_aglomerados;
+
+    // A grade é a mesma para todos os aglomerados: o passo é escolhido
+    // para que o maior deles caiba em 16 bits.
+    caixa_malha = malha->bvh.nos[0].caixa;
+    compacta->base = caixa_malha.min;
+    maior_extensao[0] = maior_extensao[1] = maior_extensao[2] = 0.0;
+    for(a = 0; a < num_aglomerados; a++)
+    {
+        for(eixo = 0; eixo < 3; eixo++)
+        {
+            extensao = componente(&caixas_reais[a].max, eixo) -
+                componente(&caixas_reais[a].min, eixo);
+            maior_extensao[eixo] = max(maior_extensao[eixo], extensao);
+        }
+    }
+    compacta->escala.x = maior_extensao[0] > 0.0 ?
+        maior_extensao[0] / MAX_QUANTIZADO : 1.0;
+    compacta->escala.y = maior_extensao[1] > 0.0 ?
+        maior_extensao[1] / MAX_QUANTIZADO : 1.0;
+    compacta->escala.z = maior_extensao[2] > 0.0 ?
+        maior_extensao[2] / MAX_QUANTIZADO : 1.0;
+
+    // As posições na grade precisam caber em um int.
+    for(eixo = 0; eixo < 3; eixo++)
+    {
+        if((componente(&caixa_malha.max, eixo) -
+            componente(&caixa_malha.min, eixo)) /
+            componente(&compacta->escala, eixo) >= INT_MAX - 65536.0)
+        {
+            goto fim;
+        }
+    }
+
+    compacta->vertices = malloc(3 * num_vertices * sizeof(unsigned short));
+    caixas = malloc(num_aglomerados * sizeof(caixa_t));
+    if(compacta->vertices == NULL || caixas == NULL)
+    {
+        goto fim;
+    }
+
+    // Segunda passada: quantiza os vértices e as caixas dos grupos.
+    # pragma omp parallel for private(i, j, k, eixo, v, g, gmin, gmax, \
+        aglomerado, grupo, q) if(num_aglomerados > 1024)
+    for(a = 0; a < num_aglomerados; a++)
+    {
+        aglomerado = &compacta->aglomerados[a];
+        k = (a + 1 < num_aglomerados ?
+            compacta->aglomerados[a + 1].primeiro_vertice : num_vertices) -
+            aglomerado->primeiro_vertice;
+
+        for(eixo = 0; eixo < 3; eixo++)
+        {
+            gmin[eixo] = LLONG_MAX;
+            gmax[eixo] = LLONG_MIN;
+            for(i = 0; i < k; i++)
+            {
+                v = originais[aglomerado->primeiro_vertice + i];
+                g = llround((componente(&malha->vertices[v], eixo) -
+                    componente(&compacta->base, eixo)) /
+                    componente(&compacta->escala, eixo));
+                gmin[eixo] = g < gmin[eixo] ? g : gmin[eixo];
+                gmax[eixo] = g > gmax[eixo] ? g : gmax[eixo];
+            }
+
+            aglomerado->origem[eixo] = (int) gmin[eixo];
+            aglomerado->extensao[eixo] =
+                (unsigned short) (gmax[eixo] - gmin[eixo]);
+            for(i = 0; i < k; i++)
+            {
+                v = originais[aglomerado->primeiro_vertice + i];
+                g = llround((componente(&malha->vertices[v], eixo) -
+                    componente(&compacta->base, eixo)) /
+                    componente(&compacta->escala, eixo));
+                compacta->vertices[3 * (aglomerado->primeiro_vertice + i) +
+                    eixo] = (unsigned short) (g - gmin[eixo]);
+            }
+
+            aglomerado->deslocamento[eixo] = 0;
+            while((aglomerado->extensao[eixo] >>
+                aglomerado->deslocamento[eixo]) > UCHAR_MAX)
+            {
+                aglomerado->deslocamento[eixo]++;
+            }
+        }
+
+        for(i = 0; i < aglomerado->num_grupos; i++)
+        {
+            grupo = &compacta->grupos[aglomerado->primeiro_grupo + i];
+            for(eixo = 0; eixo < 3; eixo++)
+            {
+                grupo->caixa[eixo] = UCHAR_MAX;
+                grupo->caixa[eixo + 3] = 0;
+            }
+            for(j = 3 * (aglomerado->primeiro_triangulo + grupo->inicio);
+                j < 3 * (aglomerado->primeiro_triangulo + grupo->inicio +
+                grupo->quantidade); j++)
+            {
+                q = &compacta->vertices[3 * (aglomerado->primeiro_vertice +
+                    compacta->indices[j])];
+                for(eixo = 0; eixo < 3; eixo++)
+                {
+                    v = q[eixo] >> aglomerado->deslocamento[eixo];
+                    grupo->caixa[eixo] = min(grupo->caixa[eixo], v);
+                    grupo->caixa[eixo + 3] = max(grupo->caixa[eixo + 3], v);
+                }
+            }
+        }
+
+        caixas[a] = caixa_aglomerado(compacta, aglomerado);
+    }
+
+    if(!bvh_construir(&bvh, caixas, num_aglomerados))
+    {
+        goto fim;
+    }
+
+    // A geometria original deixa de ser usada.
+    if(malha->mapa != NULL)
+    {
+        munmap(malha->mapa, malha->tamanho_mapa);
+        malha->mapa = NULL;
+        malha->tamanho_mapa = 0;
+    }
+    else
+    {
+        bvh_liberar(&malha->bvh);
+        free(malha->vertices);
+        free(malha->indices);
+    }
+
+    malha->vertices = NULL;
+    malha->indices = NULL;
+    malha->num_vertices = num_vertices;
+    malha->bvh = bvh;
+    malha->compacta = compacta;
+    compacta = NULL;
+    sucesso = 1;
+
+fim:
+    liberar_compacta(compacta);
+    free(marca);
+    free(local);
+    free(originais);
+    free(caixas_reais);
+    free(caixas);
+    return sucesso;
+}
+
+/**
+ * Verifica se um raio (no espaço do objeto) intersecta uma malha
+ * compactada. Os triângulos são decodificados durante o teste.
+ *
+ * @param origem_raio Ponteiro para o ponto de onde o raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio (não precisa estar normalizado).
+ * @param malha Ponteiro para a malha a ser intersectada.
+ * @param t0 Ponteiro para a distância até o triângulo mais perto (é
+ * modificada na função).
+ * @param normal Ponteiro para o vetor normal (não normalizado) do
+ * triângulo mais perto.
+ * @return 1 se o raio intersecta a malha, 0 caso contrário.
+ */
+int intersecao_malha_compacta(ponto_t *origem_raio, vetor_t *direcao_raio,
+    malha_t *malha, real_t *t0, vetor_t *normal)
+{
+    int i, k, t, topo, indice, triangulo_perto;
+    int pilha[BVH_MAX_PILHA];
+    unsigned char *tri;
+    real_t tperto, t_temp;
+    vetor_t inv_direcao, aresta1, aresta2;
+    ponto_t v0, v1, v2;
+    no_bvh_t *no;
+    malha_compacta_t *compacta;
+    aglomerado_t *aglomerado, *aglomerado_perto;
+    grupo_compacto_t *grupo;
+    caixa_t caixa;
+
+    compacta = malha->compacta;
+    if(malha->bvh.num_nos == 0)
+    {
+        return 0;
+    }
+
+    inv_direcao.x = 1.0 / direcao_raio->x;
+    inv_direcao.y = 1.0 / direcao_raio->y;
+    inv_direcao.z = 1.0 / direcao_raio->z;
+
+    tperto = INFINITO;
+    triangulo_perto = -1;
+    aglomerado_perto = NULL;
+    topo = 0;
+    pilha[topo++] = 0;
+
+    while(topo > 0)
+    {
+        indice = pilha[--topo];
+        no = &malha->bvh.nos[indice];
+
+        if(!intersecao_caixa(origem_raio, &inv_direcao, &no->caixa, tperto,
+            &t_temp))
+        {
+            continue;
+        }
+
+        if(no->quantidade == 0)
+        {
+            pilha[topo++] = no->inicio;
+            pilha[topo++] = indice + 1;
+            continue;
+        }
+
+        for(k = no->inicio; k < no->inicio + no->quantidade; k++)
+        {
+            aglomerado = &compacta->aglomerados[malha->bvh.primitivos[k]];
+            if(no->quantidade > 1)
+            {
+                caixa = caixa_aglomerado(compacta, aglomerado);
+                if(!intersecao_caixa(origem_raio, &inv_direcao, &caixa,
+                    tperto, &t_temp))
+                {
+                    continue;
+                }
+            }
+
+            for(i = 0; i < aglomerado->num_grupos; i++)
+            {
+                grupo = &compacta->grupos[aglomerado->primeiro_grupo + i];
+                caixa = caixa_grupo(compacta, aglomerado, grupo);
+                if(!intersecao_caixa(origem_raio, &inv_direcao, &caixa,
+                    tperto, &t_temp))
+                {
+                    continue;
+                }
+
+                for(t = grupo->inicio; t < grupo->inicio + grupo->quantidade;
+                    t++)
+                {
+                    tri = &compacta->indices[3 *
+                        (aglomerado->primeiro_triangulo + t)];
+                    v0 = decodificar_vertice(compacta, aglomerado, tri[0]);
+                    v1 = decodificar_vertice(compacta, aglomerado, tri[1]);
+                    v2 = decodificar_vertice(compacta, aglomerado, tri[2]);
+                    if(intersecao_triangulo_malha(origem_raio, direcao_raio,
+                        &v0, &v1, &v2, tperto, &t_temp))
+                    {
+                        tperto = t_temp;
+                        triangulo_perto = t;
+                        aglomerado_perto = aglomerado;
+                    }
+                }
+            }
+        }
+    }
+
+    if(triangulo_perto < 0)
+    {
+        return 0;
+    }
+
+    // A normal só é calculada para o triângulo mais perto.
+    tri = &compacta->indices[3 *
+        (aglomerado_perto->primeiro_triangulo + triangulo_perto)];
+    v0 = decodificar_vertice(compacta, aglomerado_perto, tri[0]);
+    v1 = decodificar_vertice(compacta, aglomerado_perto, tri[1]);
+    v2 = decodificar_vertice(compacta, aglomerado_perto, tri[2]);
+    aresta1 = sub_v(&v1, &v0);
+    aresta2 = sub_v(&v2, &v0);
+    *normal = prod_v(&aresta1, &aresta2);
+    *t0 = tperto;
+    return 1;
+}
@@ -0,0 +1,45 @@
+#ifndef MALHA_COMPACTA_H
+#define MALHA_COMPACTA_H
+
+#include "geometria.h"
+
+#define AGLOMERADO_MAX_VERTICES 256 // Limite dos índices locais de 8 bits.
+#define AGLOMERADO_MAX_TRIANGULOS 128 // Triângulos por aglomerado.
+
+/**
+ * Compacta a geometria de uma malha: os triângulos são agrupados, na
+ * ordem das folhas da BVH, em aglomerados de até 256 vértices, cujos
+ * vértices são quantizados em 16 bits e cujos índices passam a ter 8
+ * bits. A BVH é refeita sobre os aglomerados e os arrays originais são
+ * liberados (ou o arquivo desmapeado). Em caso de erro a malha não muda.
+ *
+ * @param malha Ponteiro para a malha.
+ * @return 1 em caso de sucesso, 0 caso contrário.
+ */
+int malha_compactar(malha_t *malha);
+
+/**
+ * Libera uma geometria compactada e os seus arrays.
+ *
+ * @param compacta Ponteiro para a geometria (pode ser NULL).
+ */
+void liberar_compacta(malha_compacta_t *compacta);
+
+/**
+ * Verifica se um raio (no espaço do objeto) intersecta uma malha
+ * compactada. Os triângulos são decodificados durante o teste.
+ *
+ * @param origem_raio Ponteiro para o ponto de onde o raio parte.
+ * @param direcao_raio Ponteiro para o vetor que determina a direção
+ * do raio (não precisa estar normalizado).
+ * @param malha Ponteiro para a malha a ser intersectada.
+ * @param t0 Ponteiro para a distância até o triângulo mais perto (é
+ * modificada na função).
+ * @param normal Ponteiro para o vetor normal (não normalizado) do
+ * triângulo mais perto.
+ * @return 1 se o raio intersecta a malha, 0 caso contrário.
+ */
+int intersecao_malha_compacta(ponto_t *origem_raio, vetor_t *direcao_raio,
+    malha_t *malha, real_t *t0, vetor_t *normal);
+
+#endif // MALHA_COMPACTA_H
@@ -0,0 +1,579 @@
+#include "onda.h"
+#include "cena.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+/** Bits da chave ordenados por passada da ordenação (radix). */
+#define ONDA_BITS_PASSADA 10
+
+/** Chave dos raios de sombra que não existem (vão para o fim da fila). */
+#define ONDA_CHAVE_VAZIA (1u << (3 + 3 * ONDA_BITS_CELULA))
+
+/**
+ * Espalha os 10 bits menos significativos de x, deixando dois zeros entre
+ * eles (código de Morton em 3 dimensões).
+ */
+static unsigned int espalhar_bits(unsigned int x)
+{
+    x &= 0x3ff;
+    x = (x | x << 16) & 0x30000ff;
+    x = (x | x << 8) & 0x300f00f;
+    x = (x | x << 4) & 0x30c30c3;
+    x = (x | x << 2) & 0x9249249;
+    return x;
+}
+
+/**
+ * Retorna a célula (num eixo) de uma coordenada; as que estão fora da
+ * caixa da cena (nos planos) ficam nas células da borda.
+ */
+static unsigned int celula(real_t x, real_t inicio, real_t escala)
+{
+    int c;
+
+    c = (int) ((x - inicio) * escala);
+    return (unsigned int) max(0, min(c, (1 << ONDA_BITS_CELULA) - 1));
+}
+
+/**
+ * Calcula a chave de ordenação de um raio: o octante da direção nos bits
+ * mais significativos e o código de Morton da célula da origem nos demais.
+ */
+static unsigned int chave_raio(onda_t *onda, ponto_t *origem,
+    vetor_t *direcao)
+{
+    unsigned int octante;
+
+    octante = (direcao->x < 0) | (direcao->y < 0) << 1 |
+        (direcao->z < 0) << 2;
+    return octante << (3 * ONDA_BITS_CELULA) |
+        espalhar_bits(celula(origem->x, onda->caixa.min.x,
+        onda->escala.x)) << 2 |
+        espalhar_bits(celula(origem->y, onda->caixa.min.y,
+        onda->escala.y)) << 1 |
+        espalhar_bits(celula(origem->z, onda->caixa.min.z,
+        onda->escala.z));
+}
+
+/**
+ * Ajusta a grade de células à caixa da cena (sem objetos limitados, todas
+ * as origens caem na mesma célula).
+ */
+static void ajustar_grade(onda_t *onda, cena_t *cena)
+{
+    caixa_t *caixa;
+    real_t n;
+
+    n = 1 << ONDA_BITS_CELULA;
+    caixa = &onda->caixa;
+    if(cena->bvh.num_nos == 0)
+    {
+        caixa->min.x = caixa->min.y = caixa->min.z = 0.0;
+        caixa->max = caixa->min;
+    }
+    else
+    {
+        *caixa = cena->bvh.nos[0].caixa;
+    }
+
+    onda->escala.x = caixa->max.x > caixa->min.x ?
+        n / (caixa->max.x - caixa->min.x) : 0.0;
+    onda->escala.y = caixa->max.y > caixa->min.y ?
+        n / (caixa->max.y - caixa->min.y) : 0.0;
+    onda->escala.z = caixa->max.z > caixa->min.z ?
+        n / (caixa->max.z - caixa->min.z) : 0.0;
+}
+
+/**
+ * Ordena os índices 0..n-1 pelas chaves (radix, estável). O resultado
+ * fica em onda->ordem.
+ */
+static void ordenar_chaves(onda_t *onda, int n)
+{
+    int contagem[1 << ONDA_BITS_PASSADA];
+    int i, passada, soma, temp_i;
+    unsigned int b, *temp;
+
+    for(i = 0; i < n; i++)
+    {
+        onda->ordem[i] = i;
+    }
+
+    for(passada = 0; ONDA_CHAVE_VAZIA >> (passada * ONDA_BITS_PASSADA);
+        passada++)
+    {
+        memset(contagem, 0, sizeof(contagem));
+        for(i = 0; i < n; i++)
+        {
+            b = onda->chaves[i] >> (passada * ONDA_BITS_PASSADA);
+            contagem[b & ((1 << ONDA_BITS_PASSADA) - 1)]++;
+        }
+
+        soma = 0;
+        for(i = 0; i < 1 << ONDA_BITS_PASSADA; i++)
+        {
+            temp_i = contagem[i];
+            contagem[i] = soma;
+            soma += temp_i;
+        }
+
+        for(i = 0; i < n; i++)
+        {
+            b = onda->chaves[i] >> (passada * ONDA_BITS_PASSADA);
+            b &= (1 << ONDA_BITS_PASSADA) - 1;
+            onda->chaves_temp[contagem[b]] = onda->chaves[i];
+            onda->ordem_temp[contagem[b]] = onda->ordem[i];
+            contagem[b]++;
+        }
+
+        temp = onda->chaves;
+        onda->chaves = onda->chaves_temp;
+        onda->chaves_temp = temp;
+        temp = onda->ordem;
+        onda->ordem = onda->ordem_temp;
+        onda->ordem_temp = temp;
+    }
+}
+
+/**
+ * Garante espaço para ondas de n raios (e para os 2 raios que cada um
+ * pode gerar).
+ *
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+static int reservar(onda_t *onda, int n)
+{
+    int nova;
+
+    if(n <= onda->capacidade)
+    {
+        return 1;
+    }
+
+    nova = max(1024, onda->capacidade);
+    while(nova < n)
+    {
+        nova *= 2;
+    }
+
+    if(!realocar((void **) &onda->raios, 2 * nova, sizeof(raio_onda_t)) ||
+        !realocar((void **) &onda->indices, nova, sizeof(unsigned int)) ||
+        !realocar((void **) &onda->proximos, 2 * nova,
+        sizeof(raio_onda_t)) ||
+        !realocar((void **) &onda->chaves_proximos, 2 * nova,
+        sizeof(unsigned int)) ||
+        !realocar((void **) &onda->filhos, nova, 1) ||
+        !realocar((void **) &onda->sombras, nova, sizeof(raio_sombra_t)) ||
+        !realocar((void **) &onda->chaves, nova, sizeof(unsigned int)) ||
+        !realocar((void **) &onda->ordem, nova, sizeof(unsigned int)) ||
+        !realocar((void **) &onda->chaves_temp, nova,
+        sizeof(unsigned int)) ||
+        !realocar((void **) &onda->ordem_temp, nova, sizeof(unsigned int)) ||
+        !realocar((void **) &onda->visiveis, nova, sizeof(float)))
+    {
+        return 0;
+    }
+
+    onda->capacidade = nova;
+    return 1;
+}
+
+/**
+ * Calcula o ponto tocado por um raio e a normal virada para o lado de
+ * onde ele vem.
+ *
+ * @return 1 se o raio vem de dentro do objeto, 0 caso contrário.
+ */
+static int ponto_tocado(raio_onda_t *raio, ponto_t *ponto, vetor_t *normal)
+{
+    vetor_t temp;
+    int dentro;
+
+    *normal = raio->normal;
+    dentro = prod_e(&raio->direcao, normal) > 0;
+    if(dentro)
+    {
+        *normal = neg_v(normal);
+    }
+
+    temp = mult_e(&raio->direcao, raio->t);
+    *ponto = soma_v(&raio->origem, &temp);
+    return dentro;
+}
+
+/**
+ * Soma uma cor ao píxel.
+ */
+static void somar_cor(float *cores, int pixel, cor_t *cor, real_t peso)
+{
+    float *p;
+
+    p = &cores[3 * pixel];
+    # pragma omp atomic
+    p[0] += cor->x * peso;
+    # pragma omp atomic
+    p[1] += cor->y * peso;
+    # pragma omp atomic
+    p[2] += cor->z * peso;
+}
+
+/**
+ * Intersecta os raios da onda com a cena na ordem das suas chaves. Os que
+ * escapam somam o fundo ao píxel.
+ */
+static void intersectar(onda_t *onda, cena_t *cena, cor_t *fundo,
+    int num_threads, float *cores)
+{
+    int i, n;
+    raio_onda_t *raio;
+
+    n = onda->num_raios;
+    ordenar_chaves(onda, n);
+
+    // Os raios vizinhos na fila ficam com a mesma thread.
+    # pragma omp parallel for num_threads(num_threads) private(raio) \
+        schedule(dynamic, 256)
+    for(i = 0; i < n; i++)
+    {
+        raio = &onda->raios[onda->indices[onda->ordem[i]]];
+        raio->objeto = intersecao_cena(cena, &raio->origem, &raio->direcao,
+            &raio->t, &raio->normal);
+        if(raio->objeto == NULL)
+        {
+            somar_cor(cores, raio->pixel, fundo, raio->peso);
+        }
+    }
+}
+
+/**
+ * Traça os raios de sombra dos pontos tocados pela onda (na ordem das
+ * suas chaves; com a luz de área, os de visibilidade_luz()) e soma a cor
+ * local de cada ponto ao píxel do raio.
+ */
+static void sombrear(onda_t *onda, cena_t *cena, luz_t *luz_local,
+    luz_t *luz_ambiente, int num_threads, float *cores)
+{
+    int i, n, num_sombras;
+    vetor_t normal;
+    ponto_t ponto;
+    raio_onda_t *raio;
+    raio_sombra_t *sombra;
+    cor_t cor;
+
+    n = onda->num_raios;
+    num_sombras = 0;
+
+    # pragma omp parallel num_threads(num_threads) \
+        private(i, raio, sombra, ponto, normal, cor)
+    {
+        // Um raio de sombra por ponto tocado, partindo um pouco afastado
+        // da superfície, do lado da luz.
+        # pragma omp for schedule(static) reduction(+:num_sombras)
+        for(i = 0; i < n; i++)
+        {
+            raio = &onda->raios[onda->indices[i]];
+            if(raio->objeto == NULL)
+            {
+                onda->chaves[i] = ONDA_CHAVE_VAZIA;
+                continue;
+            }
+
+            sombra = &onda->sombras[i];
+            ponto_tocado(raio, &ponto, &normal);
+            sombra->direcao = sub_v(&luz_local->posicao, &ponto);
+            sombra->direcao = normalizar(&sombra->direcao);
+            sombra->origem = deslocar_ponto(&ponto, &normal,
+                &sombra->direcao);
+            sombra->objeto = raio->objeto;
+            onda->chaves[i] = chave_raio(onda, &sombra->origem,
+                &sombra->direcao);
+            num_sombras++;
+        }
+
+        # pragma omp single
+        ordenar_chaves(onda, n);
+
+        // Os raios que não existem ficaram no fim da fila. Com a luz de
+        // área, o raio até o centro só serve para a ordem.
+        # pragma omp for schedule(dynamic, 256)
+        for(i = 0; i < num_sombras; i++)
+        {
+            sombra = &onda->sombras[onda->ordem[i]];
+            if(luz_local->forma == LUZ_PONTUAL)
+            {
+                onda->visiveis[onda->ordem[i]] = !oclusao_cena(cena,
+                    &sombra->origem, &sombra->direcao, INFINITO,
+                    sombra->objeto);
+                continue;
+            }
+
+            raio = &onda->raios[onda->indices[onda->ordem[i]]];
+            ponto_tocado(raio, &ponto, &normal);
+            onda->visiveis[onda->ordem[i]] = visibilidade_luz(cena,
+                luz_local, &ponto, &normal, raio->objeto);
+        }
+
+        // Cor local (equação de Phong) de cada ponto.
+        # pragma omp for schedule(static)
+        for(i = 0; i < n; i++)
+        {
+            raio = &onda->raios[onda->indices[i]];
+            if(raio->objeto == NULL)
+            {
+                continue;
+            }
+
+            ponto_tocado(raio, &ponto, &normal);
+            cor = iluminar_ponto(&raio->origem, luz_local, luz_ambiente,
+                cena, raio->objeto, &ponto, &normal, onda->visiveis[i]);
+            somar_cor(cores, raio->pixel, &cor,
+                raio->peso * (1.0 - raio->objeto->transparencia));
+        }
+    }
+
+    onda->sombras_tracadas += num_sombras;
+}
+
+/**
+ * Gera as reflexões e refrações dos pontos tocados, aplicando a roleta
+ * russa e o limite de raios de cada píxel, e faz deles a onda seguinte
+ * (com as suas chaves). Se faltar memória, os raios que não cabem são
+ * descartados.
+ */
+static void gerar_proximos(onda_t *onda, int max_raios, int num_threads)
+{
+    raio_pendente_t secundarios[2];
+    int i, m, n, num, contagem, dentro;
+    unsigned int semente;
+    real_t peso;
+    vetor_t normal;
+    ponto_t ponto;
+    raio_onda_t *raio, *proximo;
+
+    n = onda->num_raios;
+
+    # pragma omp parallel for num_threads(num_threads) \
+        private(secundarios, m, num, contagem, dentro, semente, peso, \
+        normal, ponto, raio, proximo) schedule(static)
+    for(i = 0; i < n; i++)
+    {
+        raio = &onda->raios[onda->indices[i]];
+        onda->filhos[i] = 0;
+        if(raio->objeto == NULL)
+        {
+            continue;
+        }
+
+        dentro = ponto_tocado(raio, &ponto, &normal);
+        num = raios_secundarios(raio->objeto, &raio->direcao, &ponto,
+            &normal, dentro, secundarios);
+        semente = raio->semente;
+        for(m = 0; m < num; m++)
+        {
+            # pragma omp atomic read
+            contagem = onda->raios_pixel[raio->pixel];
+            if(contagem >= max_raios)
+            {
+                break;
+            }
+
+            peso = roleta_russa(raio->peso * secundarios[m].peso, &semente);
+            if(peso <= 0.0)
+            {
+                continue;
+            }
+
+            # pragma omp atomic capture
+            contagem = onda->raios_pixel[raio->pixel]++;
+            if(contagem >= max_raios)
+            {
+                break;
+            }
+
+            proximo = &onda->proximos[2 * i + onda->filhos[i]];
+            proximo->origem = secundarios[m].origem;
+            proximo->direcao = secundarios[m].direcao;
+            proximo->peso = peso;
+            proximo->pixel = raio->pixel;
+            proximo->semente = semente;
+            onda->chaves_proximos[2 * i + onda->filhos[i]] = chave_raio(onda,
+                &proximo->origem, &proximo->direcao);
+            onda->filhos[i]++;
+        }
+    }
+
+    num = 0;
+    for(i = 0; i < n; i++)
+    {
+        num += onda->filhos[i];
+    }
+    if(!reservar(onda, num))
+    {
+        num = onda->capacidade;
+    }
+
+    // Os raios gerados passam a ser a onda atual.
+    raio = onda->raios;
+    onda->raios = onda->proximos;
+    onda->proximos = raio;
+
+    m = 0;
+    for(i = 0; i < n && m < num; i++)
+    {
+        if(onda->filhos[i] > 0)
+        {
+            onda->chaves[m] = onda->chaves_proximos[2 * i];
+            onda->indices[m++] = 2 * i;
+        }
+        if(onda->filhos[i] > 1 && m < num)
+        {
+            onda->chaves[m] = onda->chaves_proximos[2 * i + 1];
+            onda->indices[m++] = 2 * i + 1;
+        }
+    }
+    onda->num_raios = m;
+}
+
+/**
+ * Cria uma onda vazia.
+ *
+ * @return Ponteiro para a onda ou NULL se faltar memória.
+ */
+onda_t *onda_criar(void)
+{
+    return calloc(1, sizeof(onda_t));
+}
+
+/**
+ * Prepara a onda para os raios primários de num_pixels píxels: o raio do
+ * píxel k deve ser escrito em raios[k] (com o objeto tocado); os que
+ * ficarem com o objeto NULL são ignorados.
+ *
+ * @param onda Ponteiro para a onda.
+ * @param num_pixels Número de píxels.
+ * @return Array dos raios primários ou NULL se faltar memória.
+ */
+raio_onda_t *onda_preparar(onda_t *onda, int num_pixels)
+{
+    int i;
+    void *temp;
+
+    if(!reservar(onda, num_pixels))
+    {
+        return NULL;
+    }
+
+    if(num_pixels > onda->num_pixels)
+    {
+        if((temp = realloc(onda->raios_pixel, num_pixels * sizeof(int))) ==
+            NULL)
+        {
+            return NULL;
+        }
+        onda->raios_pixel = temp;
+    }
+    onda->num_pixels = num_pixels;
+
+    for(i = 0; i < num_pixels; i++)
+    {
+        onda->raios[i].objeto = NULL;
+    }
+
+    return onda->raios;
+}
+
+/**
+ * Traça os raios secundários gerados a partir dos raios primários
+ * escritos desde onda_preparar(), somando a cor de cada ponto tocado ao
+ * píxel do raio (a cor local dos pontos tocados pelos raios primários já
+ * deve estar no píxel). O limite de raios secundários e a roleta russa são
+ * os de colorir_caminho().
+ *
+ * @param onda Ponteiro para a onda.
+ * @param cena Ponteiro para a cena.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param fundo Ponteiro para a cor dos raios secundários que escapam.
+ * @param max_recursoes Número máximo de reflexões (ou refrações) seguidas.
+ * @param max_raios Número máximo de raios secundários por píxel.
+ * @param num_threads Número de threads usadas.
+ * @param cancelar Ponteiro para a flag que interrompe o traçado (ou NULL).
+ * @param cores Buffer de 3 canais (RGB) por píxel em que as cores são
+ * somadas.
+ * @return 1 se o traçado foi completado, 0 se foi cancelado.
+ */
+int onda_colorir(onda_t *onda, cena_t *cena, luz_t *luz_local,
+    luz_t *luz_ambiente, cor_t *fundo, int max_recursoes, int max_raios,
+    int num_threads, atomic_int *cancelar, float *cores)
+{
+    int i, n, profundidade;
+
+    onda->raios_tracados = 0;
+    onda->sombras_tracadas = 0;
+    ajustar_grade(onda, cena);
+
+    // A primeira onda são os raios primários que tocaram algum objeto.
+    n = 0;
+    for(i = 0; i < onda->num_pixels; i++)
+    {
+        onda->raios_pixel[i] = 0;
+        if(onda->raios[i].objeto != NULL)
+        {
+            onda->indices[n++] = i;
+        }
+    }
+    onda->num_raios = n;
+
+    for(profundidade = 1; profundidade <= max_recursoes; profundidade++)
+    {
+        gerar_proximos(onda, max_raios, num_threads);
+        if(onda->num_raios == 0)
+        {
+            break;
+        }
+
+        intersectar(onda, cena, fundo, num_threads, cores);
+        onda->raios_tracados += onda->num_raios;
+        if(cancelar != NULL && atomic_load(cancelar))
+        {
+            return 0;
+        }
+
+        sombrear(onda, cena, luz_local, luz_ambiente, num_threads, cores);
+        if(cancelar != NULL && atomic_load(cancelar))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Libera a memória da onda.
+ *
+ * @param onda Ponteiro para a onda.
+ */
+void onda_liberar(onda_t *onda)
+{
+    if(onda == NULL)
+    {
+        return;
+    }
+
+    free(onda->raios);
+    free(onda->indices);
+    free(onda->proximos);
+    free(onda->chaves_proximos);
+    free(onda->filhos);
+    free(onda->sombras);
+    free(onda->chaves);
+    free(onda->ordem);
+    free(onda->chaves_temp);
+    free(onda->ordem_temp);
+    free(onda->visiveis);
+    free(onda->raios_pixel);
+    free(onda);
+}
@@ -0,0 +1,150 @@
+#ifndef ONDA_H
+#define ONDA_H
+
+#include <stdatomic.h>
+#include "geometria.h"
+
+/** Bits por eixo da grade de células usada para ordenar as origens. */
+#define ONDA_BITS_CELULA 8
+
+/**
+ * Raio secundário à espera de ser traçado: a origem, a direção, o peso
+ * da sua cor na do raio original e quantas reflexões levaram até ele.
+ */
+struct raio_pendente {
+    ponto_t origem;
+    vetor_t direcao;
+    real_t peso;
+    int profundidade;
+};
+
+/**
+ * Raio de uma onda: de onde parte, o peso da sua cor na do píxel e, depois
+ * de traçado, o objeto, a distância e a normal do ponto tocado.
+ */
+typedef struct {
+    ponto_t origem;
+    vetor_t direcao;
+    vetor_t normal;
+    real_t peso;
+    real_t t;
+    objeto_t *objeto; // Objeto tocado (NULL se o raio escapou).
+    int pixel;
+    unsigned int semente; // Estado da roleta russa deste caminho.
+} raio_onda_t;
+
+/**
+ * Raio de sombra do ponto tocado por um raio da onda.
+ */
+typedef struct {
+    ponto_t origem;
+    vetor_t direcao;
+    objeto_t *objeto; // Objeto de onde o raio parte.
+} raio_sombra_t;
+
+/** Número máximo de raios num pacote de sombra (até 256, já que as listas
+ * de raios do percurso guardam as posições em 8 bits). */
+#define PACOTE_MAX_RAIOS 256
+
+/**
+ * Pacote de raios de sombra guardado por componente (um array para cada
+ * coordenada da origem, da direção e do inverso da direção), para que os
+ * testes de caixa de todos os raios contra um mesmo nó da BVH sejam feitos
+ * num laço só. O pacote é esvaziado zerando num_raios.
+ */
+struct pacote_sombra {
+    real_t origem_x[PACOTE_MAX_RAIOS];
+    real_t origem_y[PACOTE_MAX_RAIOS];
+    real_t origem_z[PACOTE_MAX_RAIOS];
+    real_t direcao_x[PACOTE_MAX_RAIOS];
+    real_t direcao_y[PACOTE_MAX_RAIOS];
+    real_t direcao_z[PACOTE_MAX_RAIOS];
+    real_t inv_x[PACOTE_MAX_RAIOS];
+    real_t inv_y[PACOTE_MAX_RAIOS];
+    real_t inv_z[PACOTE_MAX_RAIOS];
+    objeto_t *ignorar[PACOTE_MAX_RAIOS]; // Objeto de onde cada raio parte.
+    unsigned char ocluido[PACOTE_MAX_RAIOS]; // Resultado de cada raio.
+    int num_raios;
+};
+
+/**
+ * Traçado em ondas dos raios secundários.
+ *
+ * Em vez de seguir cada caminho até o fim (em profundidade), os raios
+ * secundários de todos os píxels são traçados em estágios, um por
+ * reflexão (ou refração): cada estágio ordena os raios pela chave (octante
+ * da direção, célula da origem numa grade sobre a caixa da cena) e os
+ * intersecta nessa ordem, de modo que raios vizinhos na fila percorram os
+ * mesmos nós da BVH. Os raios de sombra dos pontos tocados formam outra
+ * fila, ordenada e traçada da mesma forma; a cor de cada ponto é somada ao
+ * píxel do raio, e as reflexões e refrações formam a onda seguinte.
+ */
+typedef struct {
+    raio_onda_t *raios; // Raios da onda atual (com posições vagas).
+    unsigned int *indices; // Posições dos raios da onda em 'raios'.
+    int num_raios, capacidade;
+    raio_onda_t *proximos; // Raios gerados pela onda (2 por raio).
+    unsigned int *chaves_proximos; // Chaves dos raios gerados.
+    unsigned char *filhos; // Quantos raios cada raio da onda gerou.
+    raio_sombra_t *sombras; // Um por raio da onda.
+    unsigned int *chaves, *ordem, *chaves_temp, *ordem_temp;
+    float *visiveis; // Fração da luz que chega ao ponto de cada raio.
+    int *raios_pixel; // Raios secundários gerados por cada píxel.
+    int num_pixels;
+    caixa_t caixa; // Caixa da cena, dividida na grade de células.
+    vetor_t escala; // Células por unidade de comprimento em cada eixo.
+
+    long long raios_tracados; // Raios secundários da última chamada.
+    long long sombras_tracadas; // Idem, de sombra.
+} onda_t;
+
+/**
+ * Cria uma onda vazia.
+ *
+ * @return Ponteiro para a onda ou NULL se faltar memória.
+ */
+onda_t *onda_criar(void);
+
+/**
+ * Prepara a onda para os raios primários de num_pixels píxels: o raio do
+ * píxel k deve ser escrito em raios[k] (com o objeto tocado); os que
+ * ficarem com o objeto NULL são ignorados.
+ *
+ * @param onda Ponteiro para a onda.
+ * @param num_pixels Número de píxels.
+ * @return Array dos raios primários ou NULL se faltar memória.
+ */
+raio_onda_t *onda_preparar(onda_t *onda, int num_pixels);
+
+/**
+ * Traça os raios secundários gerados a partir dos raios primários
+ * escritos desde onda_preparar(), somando a cor de cada ponto tocado ao
+ * píxel do raio (a cor local dos pontos tocados pelos raios primários já
+ * deve estar no píxel). O limite de raios secundários e a roleta russa são
+ * os de colorir_caminho().
+ *
+ * @param onda Ponteiro para a onda.
+ * @param cena Ponteiro para a cena.
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param fundo Ponteiro para a cor dos raios secundários que escapam.
+ * @param max_recursoes Número máximo de reflexões (ou refrações) seguidas.
+ * @param max_raios Número máximo de raios secundários por píxel.
+ * @param num_threads Número de threads usadas.
+ * @param cancelar Ponteiro para a flag que interrompe o traçado (ou NULL).
+ * @param cores Buffer de 3 canais (RGB) por píxel em que as cores são
+ * somadas.
+ * @return 1 se o traçado foi completado, 0 se foi cancelado.
+ */
+int onda_colorir(onda_t *onda, cena_t *cena, luz_t *luz_local,
+    luz_t *luz_ambiente, cor_t *fundo, int max_recursoes, int max_raios,
+    int num_threads, atomic_int *cancelar, float *cores);
+
+/**
+ * Libera a memória da onda.
+ *
+ * @param onda Ponteiro para a onda.
+ */
+void onda_liberar(onda_t *onda);
+
+#endif // ONDA_H
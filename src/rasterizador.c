@@ -0,0 +1,544 @@
+#include "rasterizador.h"
+#include "malha.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+/** Faces das pirâmides (as mesmas de intersecao_piramide()). */
+static const int faces_piramide[4][3] = {
+    {0, 1, 2}, {0, 1, 3}, {0, 2, 3}, {1, 2, 3}
+};
+
+/** Faces dos cubos (as mesmas de intersecao_cubo_triangulos()). */
+static const int faces_cubo[12][3] = {
+    {0, 1, 3}, {3, 2, 0}, {4, 2, 0}, {6, 4, 2}, {4, 5, 6}, {5, 6, 7},
+    {1, 3, 5}, {3, 5, 7}, {2, 3, 7}, {2, 6, 7}, {0, 4, 5}, {0, 1, 5}
+};
+
+/**
+ * Retorna quantos triângulos de um objeto são rasterizados (0 para os
+ * que não têm triângulos ou cuja malha está compactada).
+ */
+static int contar_triangulos(objeto_t *objeto)
+{
+    malha_t *malha;
+
+    switch(objeto->tipo)
+    {
+    case PIRAMIDE:
+        return 4;
+    case CUBO:
+        return 12;
+    case MALHA:
+    case INSTANCIA:
+        malha = objeto->tipo == MALHA ? objeto->malha :
+            objeto->instancia->malha;
+        return malha->compacta != NULL ? 0 : malha->num_triangulos;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Retorna os vértices (no mundo) do triângulo k de um objeto.
+ */
+static void triangulo_objeto(objeto_t *objeto, int k, ponto_t v[3])
+{
+    int m;
+    malha_t *malha;
+
+    for(m = 0; m < 3; m++)
+    {
+        switch(objeto->tipo)
+        {
+        case PIRAMIDE:
+            v[m] = objeto->piramide->vertices[faces_piramide[k][m]];
+            break;
+        case CUBO:
+            v[m] = objeto->cubo->vertices[faces_cubo[k][m]];
+            break;
+        case MALHA:
+            malha = objeto->malha;
+            v[m] = malha->vertices[malha->indices[3 * k + m]];
+            break;
+        case INSTANCIA:
+            malha = objeto->instancia->malha;
+            v[m] = transformar_ponto(objeto->instancia->matriz,
+                &malha->vertices[malha->indices[3 * k + m]]);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/**
+ * Calcula as linhas e colunas da grade cobertas por um retângulo (em
+ * píxels traçados). O resultado é vazio se ele estiver fora da grade.
+ */
+static void cobrir(rasterizador_t *r, double xmin, double ymin, double xmax,
+    double ymax, int caixa[4])
+{
+    caixa[0] = (int) max(0.0, ceil(ymin));
+    caixa[1] = (int) min(r->altura - 1.0, floor(ymax));
+    caixa[2] = (int) max(0.0, ceil(xmin));
+    caixa[3] = (int) min(r->largura - 1.0, floor(xmax));
+}
+
+/**
+ * Projeta um triângulo. Retorna 0 se algum vértice estiver atrás do olho.
+ */
+static int preparar_triangulo(rasterizador_t *r, camera_t *camera,
+    ponto_t v[3], double fator_x, double fator_y, primitivo_raster_t *p)
+{
+    int m;
+    double x, y, w;
+    vetor_t a, b, n;
+    real_t d;
+
+    for(m = 0; m < 3; m++)
+    {
+        if(!camera_projetar(camera, &v[m], &x, &y, &w))
+        {
+            return 0;
+        }
+        p->x[m] = x / fator_x;
+        p->y[m] = y / fator_y;
+    }
+
+    cobrir(r, min(p->x[0], min(p->x[1], p->x[2])),
+        min(p->y[0], min(p->y[1], p->y[2])),
+        max(p->x[0], max(p->x[1], p->x[2])),
+        max(p->y[0], max(p->y[1], p->y[2])), p->caixa);
+
+    // O ponto perto + s * dir está no plano do triângulo (n . p = d).
+    a = sub_v(&v[1], &v[0]);
+    b = sub_v(&v[2], &v[0]);
+    n = prod_v(&a, &b);
+    d = prod_e(&n, &v[0]);
+    p->numerador[0] = d - prod_e(&n, &r->perto);
+    p->numerador[1] = -prod_e(&n, &r->perto_x);
+    p->numerador[2] = -prod_e(&n, &r->perto_y);
+    p->denominador[0] = prod_e(&n, &r->dir);
+    p->denominador[1] = prod_e(&n, &r->dir_x);
+    p->denominador[2] = prod_e(&n, &r->dir_y);
+    p->raio = 0.0;
+    return 1;
+}
+
+/**
+ * Projeta a caixa envolvente de uma esfera. Retorna 0 se algum canto
+ * estiver atrás do olho.
+ */
+static int preparar_esfera(rasterizador_t *r, camera_t *camera,
+    esfera_t *esfera, double fator_x, double fator_y, primitivo_raster_t *p)
+{
+    int m;
+    double x, y, w, xmin, ymin, xmax, ymax;
+    ponto_t canto;
+
+    xmin = ymin = INFINITO;
+    xmax = ymax = -INFINITO;
+    for(m = 0; m < 8; m++)
+    {
+        canto.x = esfera->centro.x + ((m & 1) ? esfera->raio : -esfera->raio);
+        canto.y = esfera->centro.y + ((m & 2) ? esfera->raio : -esfera->raio);
+        canto.z = esfera->centro.z + ((m & 4) ? esfera->raio : -esfera->raio);
+        if(!camera_projetar(camera, &canto, &x, &y, &w))
+        {
+            return 0;
+        }
+        xmin = min(xmin, x / fator_x);
+        xmax = max(xmax, x / fator_x);
+        ymin = min(ymin, y / fator_y);
+        ymax = max(ymax, y / fator_y);
+    }
+
+    cobrir(r, xmin, ymin, xmax, ymax, p->caixa);
+    p->centro = esfera->centro;
+    p->raio = esfera->raio;
+    return 1;
+}
+
+/**
+ * Garante a capacidade de um array (que cresce em potências de 2).
+ */
+static int reservar(void **array, int *capacidade, int necessaria,
+    size_t tamanho)
+{
+    int nova;
+    void *temp;
+
+    if(necessaria <= *capacidade)
+    {
+        return 1;
+    }
+
+    nova = max(16, *capacidade);
+    while(nova < necessaria)
+    {
+        nova *= 2;
+    }
+
+    temp = realloc(*array, (size_t) nova * tamanho);
+    if(temp == NULL)
+    {
+        return 0;
+    }
+
+    *array = temp;
+    *capacidade = nova;
+    return 1;
+}
+
+/**
+ * Projeta os objetos da cena: esferas e triângulos viram primitivos e os
+ * demais (ou os que cruzam o plano do olho) passam a ser traçados.
+ */
+static int projetar_objetos(rasterizador_t *r, cena_t *cena,
+    camera_t *camera, double fator_x, double fator_y, int num_threads)
+{
+    int i, k, n, total, inicio, falhou;
+    ponto_t v[3];
+    objeto_t *objeto;
+
+    total = 0;
+    for(i = 0; i < cena->num_objetos; i++)
+    {
+        total += cena->objetos[i].tipo == ESFERA ? 1 :
+            contar_triangulos(&cena->objetos[i]);
+    }
+
+    if(!reservar((void **) &r->primitivos, &r->capacidade_primitivos, total,
+        sizeof(primitivo_raster_t)) ||
+        !reservar((void **) &r->tracados, &r->capacidade_tracados,
+        cena->num_objetos, sizeof(int)))
+    {
+        return 0;
+    }
+
+    r->num_primitivos = 0;
+    r->num_tracados = 0;
+
+    for(i = 0; i < cena->num_objetos; i++)
+    {
+        objeto = &cena->objetos[i];
+        inicio = r->num_primitivos;
+
+        if(objeto->tipo == ESFERA)
+        {
+            if(preparar_esfera(r, camera, objeto->esfera, fator_x, fator_y,
+                &r->primitivos[inicio]))
+            {
+                r->primitivos[inicio].objeto = i;
+                r->num_primitivos++;
+            }
+            else
+            {
+                r->tracados[r->num_tracados++] = i;
+            }
+            continue;
+        }
+
+        n = contar_triangulos(objeto);
+        if(n == 0)
+        {
+            r->tracados[r->num_tracados++] = i;
+            continue;
+        }
+
+        falhou = 0;
+
+        # pragma omp parallel for num_threads(num_threads) private(v) \
+            reduction(|:falhou)
+        for(k = 0; k < n; k++)
+        {
+            triangulo_objeto(objeto, k, v);
+            falhou |= !preparar_triangulo(r, camera, v, fator_x, fator_y,
+                &r->primitivos[inicio + k]);
+            r->primitivos[inicio + k].objeto = i;
+        }
+
+        // Um triângulo atrás do olho não tem projeção: o objeto é traçado.
+        if(falhou)
+        {
+            r->tracados[r->num_tracados++] = i;
+        }
+        else
+        {
+            r->num_primitivos += n;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Distribui os primitivos nos ladrilhos que a sua caixa cobre.
+ */
+static int distribuir_primitivos(rasterizador_t *r)
+{
+    int i, k, l, t, total;
+    int *cursor;
+    primitivo_raster_t *p;
+
+    memset(r->inicio_ladrilhos, 0, (r->num_ladrilhos + 1) * sizeof(int));
+
+    for(i = 0; i < r->num_primitivos; i++)
+    {
+        p = &r->primitivos[i];
+        for(k = p->caixa[0] / RASTER_LADRILHO;
+            k <= p->caixa[1] / RASTER_LADRILHO && p->caixa[0] <= p->caixa[1];
+            k++)
+        {
+            for(l = p->caixa[2] / RASTER_LADRILHO;
+                l <= p->caixa[3] / RASTER_LADRILHO; l++)
+            {
+                r->inicio_ladrilhos[k * r->num_x + l + 1]++;
+            }
+        }
+    }
+
+    for(t = 0; t < r->num_ladrilhos; t++)
+    {
+        r->inicio_ladrilhos[t + 1] += r->inicio_ladrilhos[t];
+    }
+    total = r->inicio_ladrilhos[r->num_ladrilhos];
+
+    cursor = malloc(r->num_ladrilhos * sizeof(int));
+    if(cursor == NULL || !reservar((void **) &r->indices,
+        &r->capacidade_indices, total, sizeof(int)))
+    {
+        free(cursor);
+        return 0;
+    }
+    memcpy(cursor, r->inicio_ladrilhos, r->num_ladrilhos * sizeof(int));
+
+    for(i = 0; i < r->num_primitivos; i++)
+    {
+        p = &r->primitivos[i];
+        for(k = p->caixa[0] / RASTER_LADRILHO;
+            k <= p->caixa[1] / RASTER_LADRILHO && p->caixa[0] <= p->caixa[1];
+            k++)
+        {
+            for(l = p->caixa[2] / RASTER_LADRILHO;
+                l <= p->caixa[3] / RASTER_LADRILHO; l++)
+            {
+                r->indices[cursor[k * r->num_x + l]++] = i;
+            }
+        }
+    }
+
+    free(cursor);
+    return 1;
+}
+
+/**
+ * Calcula o s do raio do píxel (i, j) no primitivo, ou -1 se o raio não o
+ * toca (ou o toca antes do plano near).
+ */
+static double profundidade_primitivo(rasterizador_t *r, primitivo_raster_t *p,
+    int i, int j)
+{
+    double e0, e1, e2, denominador, a, b, c, delta, s;
+    ponto_t perto;
+    vetor_t dir, temp;
+
+    if(p->raio > 0.0)
+    {
+        temp = mult_e(&r->perto_x, j);
+        perto = soma_v(&r->perto, &temp);
+        temp = mult_e(&r->perto_y, i);
+        perto = soma_v(&perto, &temp);
+        temp = mult_e(&r->dir_x, j);
+        dir = soma_v(&r->dir, &temp);
+        temp = mult_e(&r->dir_y, i);
+        dir = soma_v(&dir, &temp);
+
+        temp = sub_v(&perto, &p->centro);
+        a = prod_e(&dir, &dir);
+        b = prod_e(&dir, &temp);
+        c = prod_e(&temp, &temp) - p->raio * p->raio;
+        delta = b * b - a * c;
+        if(delta < 0.0)
+        {
+            return -1.0;
+        }
+
+        s = (-b - sqrt(delta)) / a;
+        return s >= 0.0 ? s : (-b + sqrt(delta)) / a;
+    }
+
+    // Funções de aresta (aceita os dois sentidos e inclui as arestas).
+    e0 = (p->x[1] - p->x[0]) * (i - p->y[0]) -
+        (p->y[1] - p->y[0]) * (j - p->x[0]);
+    e1 = (p->x[2] - p->x[1]) * (i - p->y[1]) -
+        (p->y[2] - p->y[1]) * (j - p->x[1]);
+    e2 = (p->x[0] - p->x[2]) * (i - p->y[2]) -
+        (p->y[0] - p->y[2]) * (j - p->x[2]);
+    if(!((e0 >= 0 && e1 >= 0 && e2 >= 0) || (e0 <= 0 && e1 <= 0 && e2 <= 0)))
+    {
+        return -1.0;
+    }
+
+    denominador = p->denominador[0] + p->denominador[1] * j +
+        p->denominador[2] * i;
+    if(fabs(denominador) < EPSILON)
+    {
+        return -1.0;
+    }
+
+    return (p->numerador[0] + p->numerador[1] * j + p->numerador[2] * i) /
+        denominador;
+}
+
+/**
+ * Cria um rasterizador vazio.
+ *
+ * @return Ponteiro para o rasterizador ou NULL se faltar memória.
+ */
+rasterizador_t *rasterizador_criar(void)
+{
+    return calloc(1, sizeof(rasterizador_t));
+}
+
+/**
+ * Desenha a cena vista por uma câmera numa grade de largura x altura
+ * píxels, em que o píxel (i, j) é a posição (j * fator_x, i * fator_y)
+ * da janela.
+ *
+ * @param rasterizador Ponteiro para o rasterizador.
+ * @param cena Ponteiro para a cena.
+ * @param camera Ponteiro para a câmera.
+ * @param largura Largura da grade.
+ * @param altura Altura da grade.
+ * @param fator_x Píxels da janela por píxel da grade (horizontal).
+ * @param fator_y Píxels da janela por píxel da grade (vertical).
+ * @param num_threads Número de threads usadas.
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+int rasterizador_desenhar(rasterizador_t *rasterizador, cena_t *cena,
+    camera_t *camera, int largura, int altura, double fator_x,
+    double fator_y, int num_threads)
+{
+    int i, j, k, n, t;
+    double s;
+    void *temp;
+    ponto_t longe, perto_x, longe_x, perto_y, longe_y;
+    primitivo_raster_t *p;
+    rasterizador_t *r;
+
+    r = rasterizador;
+
+    if(largura != r->largura || altura != r->altura)
+    {
+        n = largura * altura;
+        r->largura = r->altura = 0;
+        r->num_x = (largura + RASTER_LADRILHO - 1) / RASTER_LADRILHO;
+        r->num_ladrilhos = r->num_x *
+            ((altura + RASTER_LADRILHO - 1) / RASTER_LADRILHO);
+
+        if((temp = realloc(r->visiveis, n * sizeof(objeto_t *))) == NULL)
+        {
+            return 0;
+        }
+        r->visiveis = temp;
+        if((temp = realloc(r->profundidades, n * sizeof(double))) == NULL)
+        {
+            return 0;
+        }
+        r->profundidades = temp;
+        if((temp = realloc(r->inicio_ladrilhos,
+            (r->num_ladrilhos + 1) * sizeof(int))) == NULL)
+        {
+            return 0;
+        }
+        r->inicio_ladrilhos = temp;
+        r->largura = largura;
+        r->altura = altura;
+    }
+
+    // Os pontos dos planos near e far são funções afins da posição.
+    r->perto = camera_desprojetar(camera, 0.0, 0.0, 0.0);
+    longe = camera_desprojetar(camera, 0.0, 0.0, 1.0);
+    perto_x = camera_desprojetar(camera, fator_x, 0.0, 0.0);
+    longe_x = camera_desprojetar(camera, fator_x, 0.0, 1.0);
+    perto_y = camera_desprojetar(camera, 0.0, fator_y, 0.0);
+    longe_y = camera_desprojetar(camera, 0.0, fator_y, 1.0);
+    r->perto_x = sub_v(&perto_x, &r->perto);
+    r->perto_y = sub_v(&perto_y, &r->perto);
+    r->dir = sub_v(&longe, &r->perto);
+    r->dir_x = sub_v(&longe_x, &perto_x);
+    r->dir_x = sub_v(&r->dir_x, &r->dir);
+    r->dir_y = sub_v(&longe_y, &perto_y);
+    r->dir_y = sub_v(&r->dir_y, &r->dir);
+
+    if(!projetar_objetos(r, cena, camera, fator_x, fator_y, num_threads) ||
+        !distribuir_primitivos(r))
+    {
+        return 0;
+    }
+
+    # pragma omp parallel for num_threads(num_threads) \
+        private(i, j, k, s, p) schedule(dynamic, 1)
+    for(t = 0; t < r->num_ladrilhos; t++)
+    {
+        for(i = t / r->num_x * RASTER_LADRILHO;
+            i < min(altura, (t / r->num_x + 1) * RASTER_LADRILHO); i++)
+        {
+            for(j = t % r->num_x * RASTER_LADRILHO;
+                j < min(largura, (t % r->num_x + 1) * RASTER_LADRILHO); j++)
+            {
+                r->visiveis[i * largura + j] = NULL;
+                r->profundidades[i * largura + j] = INFINITO;
+            }
+        }
+
+        for(k = r->inicio_ladrilhos[t]; k < r->inicio_ladrilhos[t + 1]; k++)
+        {
+            p = &r->primitivos[r->indices[k]];
+
+            for(i = max(p->caixa[0], t / r->num_x * RASTER_LADRILHO);
+                i <= min(p->caixa[1],
+                (t / r->num_x + 1) * RASTER_LADRILHO - 1); i++)
+            {
+                for(j = max(p->caixa[2], t % r->num_x * RASTER_LADRILHO);
+                    j <= min(p->caixa[3],
+                    (t % r->num_x + 1) * RASTER_LADRILHO - 1); j++)
+                {
+                    s = profundidade_primitivo(r, p, i, j);
+                    if(s >= 0.0 && s < r->profundidades[i * largura + j])
+                    {
+                        r->profundidades[i * largura + j] = s;
+                        r->visiveis[i * largura + j] =
+                            &cena->objetos[p->objeto];
+                    }
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Libera a memória do rasterizador.
+ *
+ * @param rasterizador Ponteiro para o rasterizador.
+ */
+void rasterizador_liberar(rasterizador_t *rasterizador)
+{
+    if(rasterizador == NULL)
+    {
+        return;
+    }
+
+    free(rasterizador->primitivos);
+    free(rasterizador->inicio_ladrilhos);
+    free(rasterizador->indices);
+    free(rasterizador->tracados);
+    free(rasterizador->visiveis);
+    free(rasterizador->profundidades);
+    free(rasterizador);
+}
@@ -0,0 +1,91 @@
+#ifndef RASTERIZADOR_H
+#define RASTERIZADOR_H
+
+#include "geometria.h"
+#include "camera.h"
+
+/** Lado (em píxels) dos ladrilhos em que os primitivos são distribuídos. */
+#define RASTER_LADRILHO 16
+
+/**
+ * Primitivo projetado na grade de píxels traçados: um triângulo ou uma
+ * esfera (cujo retângulo envolvente na tela é percorrido).
+ *
+ * Os raios dos píxels são escritos como perto + s * (longe - perto), onde
+ * perto e longe estão nos planos near e far. Num triângulo, s é a razão
+ * entre duas funções afins das coordenadas do píxel.
+ */
+typedef struct {
+    double x[3], y[3]; // Vértices do triângulo (em píxels traçados).
+    double numerador[3]; // Termo constante e coeficientes em x e y.
+    double denominador[3];
+    ponto_t centro; // Centro da esfera.
+    real_t raio; // Raio da esfera (0 nos triângulos).
+    int caixa[4]; // Menor e maior linha, menor e maior coluna cobertas.
+    int objeto; // Índice do objeto na cena.
+} primitivo_raster_t;
+
+/**
+ * Rasterizador da visibilidade primária.
+ *
+ * Os triângulos das pirâmides, cubos, malhas e instâncias e as esferas
+ * são projetados, distribuídos em ladrilhos e desenhados (em paralelo, um
+ * ladrilho por vez) num buffer de profundidade, que guarda em cada píxel o
+ * objeto mais perto. Os objetos que não podem ser rasterizados (planos,
+ * malhas compactadas e objetos que cruzam o plano do olho) são listados
+ * em 'tracados' para que os raios os testem diretamente.
+ */
+typedef struct {
+    primitivo_raster_t *primitivos;
+    int num_primitivos, capacidade_primitivos;
+    int *inicio_ladrilhos; // Primeiro índice de cada ladrilho (e o fim).
+    int *indices; // Primitivos de cada ladrilho.
+    int capacidade_indices;
+    int *tracados;
+    int num_tracados, capacidade_tracados;
+
+    // Resultado do último desenho.
+    objeto_t **visiveis; // Objeto visto em cada píxel (ou NULL).
+    double *profundidades; // Valor de s do objeto visto.
+    int largura, altura, num_x, num_ladrilhos;
+
+    // Raio de um píxel: perto + x * perto_x + y * perto_y e a direção
+    // (não normalizada) dir + x * dir_x + y * dir_y.
+    ponto_t perto;
+    vetor_t perto_x, perto_y, dir, dir_x, dir_y;
+} rasterizador_t;
+
+/**
+ * Cria um rasterizador vazio.
+ *
+ * @return Ponteiro para o rasterizador ou NULL se faltar memória.
+ */
+rasterizador_t *rasterizador_criar(void);
+
+/**
+ * Desenha a cena vista por uma câmera numa grade de largura x altura
+ * píxels, em que o píxel (i, j) é a posição (j * fator_x, i * fator_y)
+ * da janela.
+ *
+ * @param rasterizador Ponteiro para o rasterizador.
+ * @param cena Ponteiro para a cena.
+ * @param camera Ponteiro para a câmera.
+ * @param largura Largura da grade.
+ * @param altura Altura da grade.
+ * @param fator_x Píxels da janela por píxel da grade (horizontal).
+ * @param fator_y Píxels da janela por píxel da grade (vertical).
+ * @param num_threads Número de threads usadas.
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+int rasterizador_desenhar(rasterizador_t *rasterizador, cena_t *cena,
+    camera_t *camera, int largura, int altura, double fator_x,
+    double fator_y, int num_threads);
+
+/**
+ * Libera a memória do rasterizador.
+ *
+ * @param rasterizador Ponteiro para o rasterizador.
+ */
+void rasterizador_liberar(rasterizador_t *rasterizador);
+
+#endif // RASTERIZADOR_H
@@ -0,0 +1,2165 @@
+#include "renderizador.h"
+#include "amostrador.h"
+#include "cena.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <omp.h>
+
+/**
+ * Seleciona os objetos vistos por um ladrilho, com um píxel de folga para
+ * as amostras deslocadas dentro dos píxels.
+ */
+static void recortar_ladrilho(renderizador_t *r, camera_t *camera,
+    ladrilho_t *ladrilho, recorte_t *recorte)
+{
+    tronco_t tronco;
+
+    camera_tronco(camera, (ladrilho->j0 - 1) * r->fator_x,
+        (ladrilho->i0 - 1) * r->fator_y, ladrilho->j1 * r->fator_x,
+        ladrilho->i1 * r->fator_y, &tronco);
+    cena_recortar(r->cena, &tronco, recorte);
+}
+
+/**
+ * Espalha os 16 bits mais baixos de um número pelos bits pares.
+ */
+static unsigned int espalhar_bits(unsigned int x)
+{
+    x &= 0x0000ffffu;
+    x = (x | (x << 8)) & 0x00ff00ffu;
+    x = (x | (x << 4)) & 0x0f0f0f0fu;
+    x = (x | (x << 2)) & 0x33333333u;
+    x = (x | (x << 1)) & 0x55555555u;
+    return x;
+}
+
+/**
+ * Junta os bits pares de um número nos 16 bits mais baixos (o inverso de
+ * espalhar_bits()).
+ */
+static unsigned int juntar_bits(unsigned int x)
+{
+    x &= 0x55555555u;
+    x = (x | (x >> 1)) & 0x33333333u;
+    x = (x | (x >> 2)) & 0x0f0f0f0fu;
+    x = (x | (x >> 4)) & 0x00ff00ffu;
+    x = (x | (x >> 8)) & 0x0000ffffu;
+    return x;
+}
+
+/**
+ * Intercala os bits de uma linha e de uma coluna no código de Morton da
+ * posição (a coluna fica nos bits pares e a linha, nos ímpares).
+ */
+static unsigned int morton_codificar(unsigned int i, unsigned int j)
+{
+    return espalhar_bits(j) | (espalhar_bits(i) << 1);
+}
+
+/**
+ * Separa a linha e a coluna de um código de Morton. Percorrer os códigos
+ * de 0 a lado * lado - 1 (com o lado uma potência de 2) visita um
+ * quadrado em Z, de modo que raios consecutivos são vizinhos na tela e
+ * tocam os mesmos objetos e nós da BVH.
+ */
+static void morton_decodificar(unsigned int codigo, int *i, int *j)
+{
+    *j = juntar_bits(codigo);
+    *i = juntar_bits(codigo >> 1);
+}
+
+/**
+ * Compara dois ladrilhos pela posição em ordem de Morton.
+ */
+static int comparar_posicoes(const void *a, const void *b)
+{
+    const ladrilho_t *la, *lb;
+    unsigned int ca, cb;
+
+    la = a;
+    lb = b;
+    ca = morton_codificar(la->i0, la->j0);
+    cb = morton_codificar(lb->i0, lb->j0);
+    return ca < cb ? -1 : ca > cb;
+}
+
+/**
+ * Compara dois ladrilhos pelo custo previsto (o mais caro primeiro) e,
+ * no empate, pela posição, para que a ordem não dependa do qsort().
+ */
+static int comparar_ladrilhos(const void *a, const void *b)
+{
+    const ladrilho_t *la, *lb;
+
+    la = a;
+    lb = b;
+    if(la->custo != lb->custo)
+    {
+        return la->custo < lb->custo ? 1 : -1;
+    }
+    return comparar_posicoes(a, b);
+}
+
+/**
+ * Monta a ordem dos ladrilhos da próxima passada (no tamanho do cache) a
+ * partir dos custos da última passada completa: os que custam mais que
+ * ESCALONAMENTO_DIVISAO do trabalho médio de uma thread são divididos em
+ * partes de LADRILHO_LADO_DIVIDIDO, e todos são ordenados do mais caro
+ * para o mais barato. Sem custos medidos, a ordem é a de Morton.
+ */
+static void planejar_ladrilhos(renderizador_t *r)
+{
+    int i, j, n, m, lado, largura, altura, num_x, num_ladrilhos;
+    double total, limite, area;
+    ladrilho_t *ladrilho;
+
+    largura = r->largura_cache;
+    altura = r->altura_cache;
+    num_x = (largura + LADRILHO_LADO - 1) / LADRILHO_LADO;
+    num_ladrilhos = num_x * ((altura + LADRILHO_LADO - 1) / LADRILHO_LADO);
+
+    total = 0.0;
+    for(n = 0; n < num_ladrilhos; n++)
+    {
+        total += r->custos[n];
+    }
+    limite = ESCALONAMENTO_DIVISAO * total / r->num_threads;
+
+    m = 0;
+    for(n = 0; n < num_ladrilhos; n++)
+    {
+        i = n / num_x * LADRILHO_LADO;
+        j = n % num_x * LADRILHO_LADO;
+        lado = total > 0.0 && r->custos[n] > limite ?
+            LADRILHO_LADO_DIVIDIDO : LADRILHO_LADO;
+        area = (min(altura, i + LADRILHO_LADO) - i) *
+            (min(largura, j + LADRILHO_LADO) - j);
+
+        for(i = n / num_x * LADRILHO_LADO;
+            i < min(altura, (n / num_x + 1) * LADRILHO_LADO); i += lado)
+        {
+            for(j = n % num_x * LADRILHO_LADO;
+                j < min(largura, (n % num_x + 1) * LADRILHO_LADO); j += lado)
+            {
+                ladrilho = &r->ladrilhos[m++];
+                ladrilho->i0 = i;
+                ladrilho->j0 = j;
+                ladrilho->i1 = min(altura, i + lado);
+                ladrilho->j1 = min(largura, j + lado);
+                ladrilho->lado = lado;
+                ladrilho->ladrilho = n;
+                ladrilho->custo = r->custos[n] * (ladrilho->i1 - i) *
+                    (ladrilho->j1 - j) / area;
+            }
+        }
+
+        r->custos_novos[n] = 0.0;
+    }
+
+    // Com uma só thread não há o que equilibrar, e a ordem de Morton
+    // aproveita melhor o cache.
+    qsort(r->ladrilhos, m, sizeof(ladrilho_t), r->num_threads > 1 ?
+        comparar_ladrilhos : comparar_posicoes);
+    r->num_ladrilhos = m;
+}
+
+/**
+ * Retorna o tempo de processador usado pela thread atual (que, ao
+ * contrário do tempo real, não conta as preempções), em segundos.
+ */
+static double tempo_thread(void)
+{
+    struct timespec agora;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &agora);
+    return agora.tv_sec + 1.0e-9 * agora.tv_nsec;
+}
+
+/**
+ * Soma ao custo do ladrilho o tempo gasto desde 'inicio' (as partes de um
+ * ladrilho dividido podem terminar ao mesmo tempo em threads diferentes).
+ */
+static void medir_ladrilho(renderizador_t *r, ladrilho_t *ladrilho,
+    double inicio)
+{
+    double tempo;
+
+    tempo = tempo_thread() - inicio;
+
+    # pragma omp atomic
+    r->custos_novos[ladrilho->ladrilho] += tempo;
+}
+
+/**
+ * Passa a usar os custos da passada que acabou de ser completada.
+ */
+static void concluir_medicao(renderizador_t *r)
+{
+    double *custos;
+
+    custos = r->custos;
+    r->custos = r->custos_novos;
+    r->custos_novos = custos;
+}
+
+/**
+ * Traça o raio que passa por uma posição (em píxels traçados, não da
+ * janela), testando só os objetos do recorte, e retorna a sua cor. A
+ * semente da roleta russa vem da posição (em 1/64 de píxel) e do número
+ * da amostra; o caminho de Monte Carlo lê a sequência da amostra no
+ * píxel mais próximo, a partir da dimensão 2 (as dimensões 0 e 1 são as
+ * do deslocamento dentro do píxel).
+ */
+static cor_t tracar_raio(renderizador_t *r, camera_t *camera,
+    recorte_t *recorte, double x, double y, unsigned int amostra)
+{
+    ponto_t origem;
+    vetor_t dir, normal;
+    real_t t;
+    objeto_t *objeto;
+    unsigned int semente;
+    sequencia_t sequencia;
+
+    camera_raio(camera, x * r->fator_x, y * r->fator_y, &origem, &dir);
+    objeto = intersecao_recorte(r->cena, recorte, &origem, &dir, &t, &normal);
+    if(objeto == NULL)
+    {
+        return r->fundo;
+    }
+
+    if(r->em_monte_carlo)
+    {
+        sequencia_iniciar(&sequencia, r->amostrador_quadro,
+            (int) floor(y + 0.5), (int) floor(x + 0.5), amostra, 2);
+        return colorir_monte_carlo(&origem, &dir, r->luz_local, r->cena,
+            &r->fundo, objeto, t, &normal, r->recursoes, &sequencia);
+    }
+
+    semente = amostrador_misturar((int) floor(64.0 * y),
+        (int) floor(64.0 * x), amostra, 2);
+    return colorir_caminho(&origem, &dir, r->luz_local, r->luz_ambiente,
+        r->cena, &r->fundo, objeto, t, &normal, -1, r->recursoes,
+        MAX_RAIOS_SECUNDARIOS, &semente);
+}
+
+/**
+ * Guarda no cache o resultado do raio do píxel k e calcula a sua cor (no
+ * traçado em ondas, só a cor local, e o raio é guardado na onda). Se a
+ * visibilidade da luz local no ponto tocado já foi calculada, luz_direta
+ * é a fração da luz que chega a ele (de 0 a 1); senão, é -1.
+ */
+static cor_t colorir_pixel(renderizador_t *r, int k, ponto_t *origem,
+    vetor_t *dir, objeto_t *objeto, real_t t, vetor_t *normal,
+    real_t luz_direta)
+{
+    vetor_t temp;
+    unsigned int semente;
+    sequencia_t sequencia;
+    raio_onda_t *raio;
+    cor_t cor;
+
+    r->acertos_novos[k] = objeto;
+    if(r->em_filtragem)
+    {
+        filtro_guia(r->filtro, k, objeto, t, normal);
+    }
+    if(objeto == NULL)
+    {
+        return r->fundo;
+    }
+
+    temp = mult_e(dir, t);
+    r->pontos_novos[k] = soma_v(origem, &temp);
+    semente = amostrador_misturar(k, 0, 0, 2);
+
+    if(r->em_monte_carlo)
+    {
+        sequencia_iniciar(&sequencia, r->amostrador_quadro,
+            k / r->largura_tras, k % r->largura_tras, 0, 2);
+        return colorir_monte_carlo(origem, dir, r->luz_local, r->cena,
+            &r->fundo, objeto, t, normal, r->recursoes, &sequencia);
+    }
+
+    // No traçado em ondas, só a cor local é calculada agora; a dos raios
+    // secundários é somada ao píxel depois da passada.
+    if(r->em_ondas)
+    {
+        raio = &r->onda->raios[k];
+        raio->origem = *origem;
+        raio->direcao = *dir;
+        raio->normal = *normal;
+        raio->peso = 1.0;
+        raio->t = t;
+        raio->objeto = objeto;
+        raio->pixel = k;
+        raio->semente = semente;
+        cor = colorir_intersecao(origem, dir, r->luz_local, r->luz_ambiente,
+            r->cena, objeto, t, normal, luz_direta);
+        return mult_e(&cor, 1.0 - objeto->transparencia);
+    }
+
+    return colorir_caminho(origem, dir, r->luz_local, r->luz_ambiente,
+        r->cena, &r->fundo, objeto, t, normal, luz_direta, r->recursoes,
+        MAX_RAIOS_SECUNDARIOS, &semente);
+}
+
+/**
+ * Preenche com uma cor o bloco de bloco x bloco píxels do buffer de trás
+ * cujo canto é o píxel (i, j).
+ */
+static void preencher_bloco(renderizador_t *r, int i, int j, int bloco,
+    cor_t *cor)
+{
+    int k, l;
+    float *pixel;
+
+    for(k = i; k < i + bloco && k < r->altura_tras; k++)
+    {
+        for(l = j; l < j + bloco && l < r->largura_tras; l++)
+        {
+            pixel = &r->tras[3 * (k * r->largura_tras + l)];
+            pixel[0] = cor->x;
+            pixel[1] = cor->y;
+            pixel[2] = cor->z;
+        }
+    }
+}
+
+/**
+ * Traça os píxels de um ladrilho (um por bloco), cada um até o fim do seu
+ * caminho antes do seguinte.
+ */
+static void tracar_ladrilho(renderizador_t *r, camera_t *camera,
+    ladrilho_t *ladrilho, recorte_t *recorte, int bloco, int reaproveitar)
+{
+    int i, j, lado;
+    unsigned int codigo;
+    float *pixel;
+    ponto_t origem;
+    vetor_t dir, normal;
+    real_t t;
+    objeto_t *objeto;
+    cor_t cor;
+
+    lado = ladrilho->lado / bloco;
+    for(codigo = 0; codigo < lado * lado; codigo++)
+    {
+        morton_decodificar(codigo, &i, &j);
+        i = ladrilho->i0 + i * bloco;
+        j = ladrilho->j0 + j * bloco;
+        if(i >= ladrilho->i1 || j >= ladrilho->j1)
+        {
+            continue;
+        }
+
+        pixel = &r->tras[3 * (i * r->largura_tras + j)];
+
+        if(reaproveitar && i % (2 * bloco) == 0 && j % (2 * bloco) == 0)
+        {
+            cor.x = pixel[0];
+            cor.y = pixel[1];
+            cor.z = pixel[2];
+        }
+        else
+        {
+            camera_raio(camera, j * r->fator_x, i * r->fator_y, &origem,
+                &dir);
+            objeto = intersecao_recorte(r->cena, recorte, &origem, &dir, &t,
+                &normal);
+            cor = colorir_pixel(r, i * r->largura_tras + j, &origem, &dir,
+                objeto, t, &normal, -1);
+        }
+
+        preencher_bloco(r, i, j, bloco, &cor);
+    }
+}
+
+/**
+ * Píxel de um ladrilho à espera do resultado do seu raio de sombra.
+ */
+typedef struct {
+    int i, j;
+    ponto_t origem;
+    vetor_t dir, normal;
+    real_t t;
+    objeto_t *objeto;
+    int sombra; // Posição do raio de sombra no pacote (-1 se não há).
+} pixel_pendente_t;
+
+/**
+ * Traça os píxels de um ladrilho (um por bloco) em três etapas: primeiro
+ * os raios primários de até PACOTE_MAX_RAIOS píxels, guardando os raios
+ * de sombra dos pontos tocados num pacote; depois o pacote inteiro contra
+ * a cena, enquanto a parte da BVH que os raios (todos a caminho da mesma
+ * luz) atravessam está no cache; por fim, a cor de cada píxel, com a
+ * visibilidade da luz já conhecida.
+ */
+static void tracar_ladrilho_em_pacote(renderizador_t *r, camera_t *camera,
+    ladrilho_t *ladrilho, recorte_t *recorte, int bloco, int reaproveitar)
+{
+    int i, j, m, lado, num_pendentes;
+    unsigned int codigo;
+    float *pixel;
+    ponto_t ponto, origem_sombra;
+    vetor_t normal, dir_sombra, temp;
+    real_t luz_direta;
+    cor_t cor;
+    pixel_pendente_t pendentes[PACOTE_MAX_RAIOS], *p;
+    pacote_sombra_t pacote;
+
+    lado = ladrilho->lado / bloco;
+    codigo = 0;
+    while(codigo < lado * lado)
+    {
+        num_pendentes = 0;
+        pacote.num_raios = 0;
+
+        for(; codigo < lado * lado && num_pendentes < PACOTE_MAX_RAIOS;
+            codigo++)
+        {
+            morton_decodificar(codigo, &i, &j);
+            i = ladrilho->i0 + i * bloco;
+            j = ladrilho->j0 + j * bloco;
+            if(i >= ladrilho->i1 || j >= ladrilho->j1)
+            {
+                continue;
+            }
+
+            if(reaproveitar && i % (2 * bloco) == 0 &&
+                j % (2 * bloco) == 0)
+            {
+                pixel = &r->tras[3 * (i * r->largura_tras + j)];
+                cor.x = pixel[0];
+                cor.y = pixel[1];
+                cor.z = pixel[2];
+                preencher_bloco(r, i, j, bloco, &cor);
+                continue;
+            }
+
+            p = &pendentes[num_pendentes++];
+            p->i = i;
+            p->j = j;
+            p->sombra = -1;
+            camera_raio(camera, j * r->fator_x, i * r->fator_y, &p->origem,
+                &p->dir);
+            p->objeto = intersecao_recorte(r->cena, recorte, &p->origem,
+                &p->dir, &p->t, &p->normal);
+            if(p->objeto == NULL)
+            {
+                continue;
+            }
+
+            // O mesmo raio de sombra que calcular_iluminacao() traçaria (a
+            // sombra da luz de área, com várias amostras, fica para ela).
+            if(r->luz_local->forma != LUZ_PONTUAL)
+            {
+                continue;
+            }
+            normal = p->normal;
+            if(prod_e(&p->dir, &normal) > 0)
+            {
+                normal = neg_v(&normal);
+            }
+            temp = mult_e(&p->dir, p->t);
+            ponto = soma_v(&p->origem, &temp);
+            raio_sombra(r->luz_local, &ponto, &normal, &origem_sombra,
+                &dir_sombra);
+            p->sombra = pacote_sombra_adicionar(&pacote, &origem_sombra,
+                &dir_sombra, p->objeto);
+        }
+
+        oclusao_cena_pacote(r->cena, &pacote, INFINITO);
+
+        for(m = 0; m < num_pendentes; m++)
+        {
+            p = &pendentes[m];
+            luz_direta = -1.0;
+            if(p->sombra >= 0)
+            {
+                luz_direta = pacote.ocluido[p->sombra] ? 0.0 : 1.0;
+            }
+            cor = colorir_pixel(r, p->i * r->largura_tras + p->j, &p->origem,
+                &p->dir, p->objeto, p->t, &p->normal, luz_direta);
+            preencher_bloco(r, p->i, p->j, bloco, &cor);
+        }
+    }
+}
+
+/**
+ * Passa para a octree do cache de irradiância (se o quadro o usa) os
+ * registros criados pelas threads na passada anterior. Sem memória para
+ * eles, o quadro segue sem esses registros.
+ */
+static void mesclar_irradiancia(renderizador_t *r)
+{
+    cache_irradiancia_t *cache;
+
+    cache = r->cena->irradiancia;
+    if(cache == NULL)
+    {
+        return;
+    }
+
+    irradiancia_mesclar(cache);
+    pthread_mutex_lock(&r->trava);
+    r->registros_irradiancia = cache->num_registros;
+    r->interpolacao_irradiancia = cache->consultas == 0 ? 0.0 :
+        (double) cache->interpoladas / cache->consultas;
+    pthread_mutex_unlock(&r->trava);
+}
+
+/**
+ * Liga na cena o mapa de fótons do quadro (se as cáusticas estão ligadas),
+ * refazendo-o se o número de fótons mudou, e copia as estatísticas dele.
+ * Sem memória para o mapa, o quadro segue sem cáusticas.
+ */
+static void preparar_fotons(renderizador_t *r)
+{
+    int num_fotons;
+    mapa_fotons_t *mapa;
+
+    mapa = r->mapa_fotons;
+    num_fotons = atomic_load(&r->num_fotons);
+    r->cena->fotons = NULL;
+    if(num_fotons <= 0 || (mapa->num_emitidos != num_fotons &&
+        !fotons_preparar(mapa, r->cena, r->luz_local, num_fotons)))
+    {
+        return;
+    }
+
+    mapa->vizinhos = atomic_load(&r->vizinhos_fotons);
+    fotons_somar_consultas(mapa);
+    pthread_mutex_lock(&r->trava);
+    r->fotons_guardados = mapa->num_fotons;
+    r->tracado_fotons = mapa->segundos_tracado;
+    r->construcao_fotons = mapa->segundos_construcao;
+    r->consulta_fotons = mapa->consultas == 0 ? 0.0 :
+        mapa->segundos_consultas / mapa->consultas;
+    pthread_mutex_unlock(&r->trava);
+    r->cena->fotons = mapa;
+}
+
+/**
+ * Traça uma passada do quadro no buffer de trás: um raio por bloco de
+ * bloco x bloco píxels (no canto do bloco), cuja cor preenche o bloco
+ * inteiro. Os cantos que também são cantos da passada anterior (bloco
+ * dobrado) já foram traçados e só têm a cor reaproveitada. Os ladrilhos
+ * são distribuídos dinamicamente entre as threads; se o quadro for
+ * cancelado, os ladrilhos restantes são pulados. Com as sombras em
+ * pacote, os raios de sombra de cada ladrilho são testados juntos.
+ *
+ * @return 1 se a passada foi completada, 0 se foi cancelada.
+ */
+static int tracar_passada(renderizador_t *r, camera_t *camera, int bloco,
+    int reaproveitar)
+{
+    int n, em_pacote;
+    double inicio;
+    recorte_t recorte;
+    ladrilho_t *ladrilho;
+
+    em_pacote = atomic_load(&r->sombras_em_pacote);
+
+    mesclar_irradiancia(r);
+    # pragma omp parallel for num_threads(r->num_threads) \
+        private(recorte, ladrilho, inicio) schedule(dynamic, 1)
+    for(n = 0; n < r->num_ladrilhos; n++)
+    {
+        if(atomic_load_explicit(&r->cancelar, memory_order_relaxed))
+        {
+            continue;
+        }
+
+        ladrilho = &r->ladrilhos[n];
+        inicio = tempo_thread();
+
+        recortar_ladrilho(r, camera, ladrilho, &recorte);
+
+        if(em_pacote)
+        {
+            tracar_ladrilho_em_pacote(r, camera, ladrilho, &recorte, bloco,
+                reaproveitar);
+        }
+        else
+        {
+            tracar_ladrilho(r, camera, ladrilho, &recorte, bloco,
+                reaproveitar);
+        }
+
+        medir_ladrilho(r, ladrilho, inicio);
+    }
+
+    return !atomic_load(&r->cancelar);
+}
+
+/**
+ * Retorna o objeto que pode ser reaproveitado no píxel (i, j): o píxel e
+ * todos os seus vizinhos (dentro da imagem) precisam ter recebido pontos
+ * do mesmo objeto. Assim as bordas entre objetos e os buracos, por onde
+ * um objeto antes escondido pode aparecer, são sempre traçados de novo.
+ */
+static objeto_t *candidato_reprojecao(renderizador_t *r, int i, int j)
+{
+    int k, l, fonte, largura, altura;
+    objeto_t *objeto;
+
+    largura = r->largura_tras;
+    altura = r->altura_tras;
+
+    fonte = r->fontes[i * largura + j];
+    if(fonte < 0)
+    {
+        return NULL;
+    }
+
+    objeto = r->acertos[fonte];
+    for(k = max(0, i - 1); k <= min(altura - 1, i + 1); k++)
+    {
+        for(l = max(0, j - 1); l <= min(largura - 1, j + 1); l++)
+        {
+            fonte = r->fontes[k * largura + l];
+            if(fonte < 0 || r->acertos[fonte] != objeto)
+            {
+                return NULL;
+            }
+        }
+    }
+
+    return objeto;
+}
+
+/**
+ * Traça um quadro reaproveitando o anterior. Os pontos do último quadro
+ * completo são projetados na nova câmera (o mais perto vence em cada
+ * píxel). Os píxels com um candidato testam o raio contra o objeto dele e
+ * o aceitam se a distância for próxima à do ponto projetado e se nenhum
+ * outro objeto do recorte do ladrilho estiver na frente: um objeto que
+ * estava fora do quadro anterior e entra mais depressa que o fundo (por
+ * estar mais perto) cai sobre píxels do fundo cujos vizinhos concordam.
+ * Os outros píxels são traçados contra a cena inteira.
+ *
+ * @param reaproveitados Ponteiro para o número de píxels cujo ponto mais
+ * perto não foi procurado na cena (é modificado).
+ * @return 1 se o quadro foi completado, 0 se foi cancelado.
+ */
+static int reprojetar_quadro(renderizador_t *r, camera_t *camera,
+    long long *reaproveitados)
+{
+    int i, j, k, n, largura, altura, fonte;
+    unsigned int codigo;
+    long long total;
+    double x, y, profundidade, inicio;
+    float *pixel;
+    ponto_t origem;
+    vetor_t dir, normal, temp;
+    real_t t, esperado;
+    objeto_t *objeto;
+    cor_t cor;
+    recorte_t recorte;
+    ladrilho_t *ladrilho;
+
+    largura = r->largura_tras;
+    altura = r->altura_tras;
+    n = largura * altura;
+
+    // A projeção é sequencial, pois vários pontos podem cair no mesmo píxel.
+    for(k = 0; k < n; k++)
+    {
+        r->fontes[k] = -1;
+    }
+
+    for(k = 0; k < n; k++)
+    {
+        if(r->acertos[k] == NULL ||
+            !camera_projetar(camera, &r->pontos[k], &x, &y, &profundidade))
+        {
+            continue;
+        }
+
+        j = (int) floor(x / r->fator_x + 0.5);
+        i = (int) floor(y / r->fator_y + 0.5);
+        if(i < 0 || i >= altura || j < 0 || j >= largura)
+        {
+            continue;
+        }
+
+        if(r->fontes[i * largura + j] < 0 ||
+            profundidade < r->profundidades[i * largura + j])
+        {
+            r->fontes[i * largura + j] = k;
+            r->profundidades[i * largura + j] = profundidade;
+        }
+    }
+
+    total = 0;
+
+    mesclar_irradiancia(r);
+    # pragma omp parallel for num_threads(r->num_threads) \
+        private(i, j, k, fonte, pixel, origem, dir, normal, temp, t, \
+        esperado, objeto, cor, recorte, ladrilho, inicio, codigo) \
+        reduction(+:total) schedule(dynamic, 1)
+    for(n = 0; n < r->num_ladrilhos; n++)
+    {
+        if(atomic_load_explicit(&r->cancelar, memory_order_relaxed))
+        {
+            continue;
+        }
+
+        ladrilho = &r->ladrilhos[n];
+        inicio = tempo_thread();
+
+        recortar_ladrilho(r, camera, ladrilho, &recorte);
+
+        for(codigo = 0; codigo < ladrilho->lado * ladrilho->lado; codigo++)
+        {
+            morton_decodificar(codigo, &i, &j);
+            i += ladrilho->i0;
+            j += ladrilho->j0;
+            if(i >= ladrilho->i1 || j >= ladrilho->j1)
+            {
+                continue;
+            }
+
+            k = i * largura + j;
+            camera_raio(camera, j * r->fator_x, i * r->fator_y,
+                &origem, &dir);
+
+            objeto = candidato_reprojecao(r, i, j);
+            if(objeto != NULL)
+            {
+                fonte = r->fontes[k];
+                temp = sub_v(&r->pontos[fonte], &origem);
+                esperado = prod_e(&temp, &dir);
+
+                if(intersecao_objeto(&origem, &dir, objeto, &t,
+                    &normal) && fabs(t - esperado) <=
+                    REPROJECAO_TOLERANCIA * esperado &&
+                    !oclusao_recorte(r->cena, &recorte, &origem, &dir, t,
+                    objeto))
+                {
+                    total++;
+                }
+                else
+                {
+                    objeto = NULL;
+                }
+            }
+
+            if(objeto == NULL)
+            {
+                objeto = intersecao_recorte(r->cena, &recorte, &origem,
+                    &dir, &t, &normal);
+            }
+
+            cor = colorir_pixel(r, k, &origem, &dir, objeto, t, &normal,
+                -1);
+            pixel = &r->tras[3 * k];
+            pixel[0] = cor.x;
+            pixel[1] = cor.y;
+            pixel[2] = cor.z;
+        }
+
+        medir_ladrilho(r, ladrilho, inicio);
+    }
+
+    *reaproveitados = total;
+    return !atomic_load(&r->cancelar);
+}
+
+/**
+ * Traça um quadro com a visibilidade primária rasterizada: em cada píxel,
+ * o raio é intersectado com o objeto visto pelo rasterizador e com os
+ * objetos que não foram rasterizados. Se o raio não tocar o objeto
+ * rasterizado (por arredondamento, na silhueta), o píxel é traçado
+ * contra a cena inteira.
+ *
+ * @return 1 se o quadro foi completado, 0 se foi cancelado.
+ */
+static int rasterizar_quadro(renderizador_t *r, camera_t *camera)
+{
+    int i, j, k, m, n, largura, altura, recortado;
+    unsigned int codigo;
+    double inicio;
+    float *pixel;
+    ponto_t origem;
+    vetor_t dir, normal, normal_temp;
+    real_t t, t_temp;
+    objeto_t *objeto, *outro;
+    cor_t cor;
+    recorte_t recorte;
+    ladrilho_t *ladrilho;
+    rasterizador_t *raster;
+
+    largura = r->largura_tras;
+    altura = r->altura_tras;
+    raster = r->rasterizador;
+
+    if(!rasterizador_desenhar(raster, r->cena, camera, largura, altura,
+        r->fator_x, r->fator_y, r->num_threads))
+    {
+        return tracar_passada(r, camera, 1, 0);
+    }
+
+    mesclar_irradiancia(r);
+    # pragma omp parallel for num_threads(r->num_threads) \
+        private(i, j, k, m, pixel, origem, dir, normal, normal_temp, t, \
+        t_temp, objeto, outro, cor, recorte, recortado, ladrilho, inicio, \
+        codigo) schedule(dynamic, 1)
+    for(n = 0; n < r->num_ladrilhos; n++)
+    {
+        if(atomic_load_explicit(&r->cancelar, memory_order_relaxed))
+        {
+            continue;
+        }
+
+        ladrilho = &r->ladrilhos[n];
+        inicio = tempo_thread();
+
+        recortado = 0;
+
+        for(codigo = 0; codigo < ladrilho->lado * ladrilho->lado; codigo++)
+        {
+            morton_decodificar(codigo, &i, &j);
+            i += ladrilho->i0;
+            j += ladrilho->j0;
+            if(i >= ladrilho->i1 || j >= ladrilho->j1)
+            {
+                continue;
+            }
+
+            k = i * largura + j;
+            camera_raio(camera, j * r->fator_x, i * r->fator_y,
+                &origem, &dir);
+
+            objeto = raster->visiveis[k];
+            t = INFINITO;
+            if(objeto != NULL &&
+                !intersecao_objeto(&origem, &dir, objeto, &t, &normal))
+            {
+                if(!recortado)
+                {
+                    recortar_ladrilho(r, camera, ladrilho, &recorte);
+                    recortado = 1;
+                }
+                objeto = intersecao_recorte(r->cena, &recorte, &origem,
+                    &dir, &t, &normal);
+            }
+            else
+            {
+                for(m = 0; m < raster->num_tracados; m++)
+                {
+                    outro = &r->cena->objetos[raster->tracados[m]];
+                    if(intersecao_objeto(&origem, &dir, outro, &t_temp,
+                        &normal_temp) && t_temp < t)
+                    {
+                        t = t_temp;
+                        objeto = outro;
+                        normal = normal_temp;
+                    }
+                }
+            }
+
+            cor = colorir_pixel(r, k, &origem, &dir, objeto, t, &normal,
+                -1);
+            pixel = &r->tras[3 * k];
+            pixel[0] = cor.x;
+            pixel[1] = cor.y;
+            pixel[2] = cor.z;
+        }
+
+        medir_ladrilho(r, ladrilho, inicio);
+    }
+
+    return !atomic_load(&r->cancelar);
+}
+
+/**
+ * Ajusta o tamanho do cache de reprojeção (e dos custos dos ladrilhos),
+ * que é invalidado se mudar.
+ *
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+static int preparar_cache(renderizador_t *r, int largura, int altura)
+{
+    int n, num_ladrilhos;
+    void *temp;
+
+    if(largura == r->largura_cache && altura == r->altura_cache)
+    {
+        return 1;
+    }
+
+    r->cache_valido = 0;
+    r->largura_cache = r->altura_cache = 0;
+    n = largura * altura;
+
+    if((temp = realloc(r->pontos, n * sizeof(ponto_t))) == NULL)
+    {
+        return 0;
+    }
+    r->pontos = temp;
+    if((temp = realloc(r->pontos_novos, n * sizeof(ponto_t))) == NULL)
+    {
+        return 0;
+    }
+    r->pontos_novos = temp;
+    if((temp = realloc(r->acertos, n * sizeof(objeto_t *))) == NULL)
+    {
+        return 0;
+    }
+    r->acertos = temp;
+    if((temp = realloc(r->acertos_novos, n * sizeof(objeto_t *))) == NULL)
+    {
+        return 0;
+    }
+    r->acertos_novos = temp;
+    if((temp = realloc(r->fontes, n * sizeof(int))) == NULL)
+    {
+        return 0;
+    }
+    r->fontes = temp;
+    if((temp = realloc(r->profundidades, n * sizeof(double))) == NULL)
+    {
+        return 0;
+    }
+    r->profundidades = temp;
+    if((temp = realloc(r->bordas, n)) == NULL)
+    {
+        return 0;
+    }
+    r->bordas = temp;
+
+    // Os custos medidos no tamanho antigo não servem mais.
+    num_ladrilhos = ((largura + LADRILHO_LADO - 1) / LADRILHO_LADO) *
+        ((altura + LADRILHO_LADO - 1) / LADRILHO_LADO);
+    if((temp = realloc(r->custos, num_ladrilhos * sizeof(double))) == NULL)
+    {
+        return 0;
+    }
+    r->custos = temp;
+    if((temp = realloc(r->custos_novos, num_ladrilhos * sizeof(double))) ==
+        NULL)
+    {
+        return 0;
+    }
+    r->custos_novos = temp;
+    if((temp = realloc(r->ladrilhos, 4 * num_ladrilhos * sizeof(ladrilho_t)))
+        == NULL)
+    {
+        return 0;
+    }
+    r->ladrilhos = temp;
+    memset(r->custos, 0, num_ladrilhos * sizeof(double));
+
+    r->largura_cache = largura;
+    r->altura_cache = altura;
+    return 1;
+}
+
+/**
+ * Troca o cache pelo do quadro que acabou de ser completado e soma os
+ * raios às estatísticas.
+ */
+static void atualizar_cache(renderizador_t *r, long long reaproveitados)
+{
+    ponto_t *pontos;
+    objeto_t **acertos;
+
+    pontos = r->pontos;
+    r->pontos = r->pontos_novos;
+    r->pontos_novos = pontos;
+    acertos = r->acertos;
+    r->acertos = r->acertos_novos;
+    r->acertos_novos = acertos;
+    r->cache_valido = 1;
+
+    pthread_mutex_lock(&r->trava);
+    r->raios_primarios += (long long) r->largura_cache * r->altura_cache;
+    r->raios_reaproveitados += reaproveitados;
+    pthread_mutex_unlock(&r->trava);
+}
+
+/**
+ * Publica o buffer de trás: no modo progressivo ele é copiado para a
+ * frente (a próxima passada continua a partir dele); caso contrário os
+ * buffers são apenas trocados.
+ *
+ * @return 1 em caso de sucesso, 0 se faltar memória.
+ */
+static int publicar(renderizador_t *r, int copiar)
+{
+    float *temp;
+    int largura, altura;
+
+    pthread_mutex_lock(&r->trava);
+
+    if(copiar)
+    {
+        if(r->largura_frente != r->largura_tras ||
+            r->altura_frente != r->altura_tras)
+        {
+            temp = realloc(r->frente,
+                3 * r->largura_tras * r->altura_tras * sizeof(float));
+            if(temp == NULL)
+            {
+                pthread_mutex_unlock(&r->trava);
+                return 0;
+            }
+            r->frente = temp;
+            r->largura_frente = r->largura_tras;
+            r->altura_frente = r->altura_tras;
+        }
+        memcpy(r->frente, r->tras,
+            3 * r->largura_tras * r->altura_tras * sizeof(float));
+    }
+    else
+    {
+        temp = r->frente;
+        r->frente = r->tras;
+        r->tras = temp;
+        largura = r->largura_frente;
+        altura = r->altura_frente;
+        r->largura_frente = r->largura_tras;
+        r->altura_frente = r->altura_tras;
+        r->largura_tras = largura;
+        r->altura_tras = altura;
+    }
+
+    r->amostras_frente = r->amostras + 1;
+    atomic_fetch_add(&r->versao, 1);
+    pthread_mutex_unlock(&r->trava);
+    return 1;
+}
+
+/**
+ * Retorna a maior diferença entre os canais de duas cores.
+ */
+static double contraste(cor_t *a, cor_t *b)
+{
+    return max(fabs(a->x - b->x), max(fabs(a->y - b->y), fabs(a->z - b->z)));
+}
+
+/**
+ * Amostra uma região quadrada de lado 'lado' (em píxels traçados) centrada
+ * em (x, y) com um raio no centro de cada quadrante. Os quadrantes cuja
+ * cor se afasta da média da região são subdivididos da mesma forma, até
+ * SUAVIZACAO_MAX_NIVEL.
+ */
+static cor_t amostrar_regiao(renderizador_t *r, camera_t *camera,
+    recorte_t *recorte, double x, double y, double lado, int nivel, int *raios)
+{
+    int q;
+    double qx[4], qy[4];
+    cor_t cores[4], media, refinada;
+
+    media.x = media.y = media.z = 0.0;
+    for(q = 0; q < 4; q++)
+    {
+        qx[q] = x + ((q & 1) ? 0.25 : -0.25) * lado;
+        qy[q] = y + ((q & 2) ? 0.25 : -0.25) * lado;
+        cores[q] = tracar_raio(r, camera, recorte, qx[q], qy[q], 0);
+        media = soma_v(&media, &cores[q]);
+    }
+    media = mult_e(&media, 0.25);
+    *raios += 4;
+
+    refinada.x = refinada.y = refinada.z = 0.0;
+    for(q = 0; q < 4; q++)
+    {
+        if(nivel < SUAVIZACAO_MAX_NIVEL &&
+            contraste(&cores[q], &media) > SUAVIZACAO_LIMIAR)
+        {
+            cores[q] = amostrar_regiao(r, camera, recorte, qx[q], qy[q],
+                lado / 2.0, nivel + 1, raios);
+        }
+        refinada = soma_v(&refinada, &cores[q]);
+    }
+
+    return mult_e(&refinada, 0.25);
+}
+
+/**
+ * Superamostra as bordas do quadro no buffer de trás: os píxels cuja cor
+ * difere de algum vizinho (acima, abaixo, à esquerda ou à direita) além
+ * de SUAVIZACAO_LIMIAR, ou cujo objeto é outro, são marcados e depois
+ * trocados pela média de amostrar_regiao() sobre o píxel.
+ *
+ * @return 1 se a passada foi completada, 0 se foi cancelada.
+ */
+static int suavizar_bordas(renderizador_t *r, camera_t *camera)
+{
+    int i, j, k, l, m, n, largura, altura, raios, recortado;
+    unsigned int codigo;
+    double inicio;
+    int vizinhos[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    float *pixel, *outro;
+    cor_t cor, cor_outro;
+    recorte_t recorte;
+    ladrilho_t *ladrilho;
+
+    if(!atomic_load(&r->suavizacao) || r->em_monte_carlo)
+    {
+        return !atomic_load(&r->cancelar);
+    }
+
+    largura = r->largura_tras;
+    altura = r->altura_tras;
+
+    mesclar_irradiancia(r);
+    # pragma omp parallel for num_threads(r->num_threads) \
+        private(j, k, l, m, pixel, outro, cor, cor_outro)
+    for(i = 0; i < altura; i++)
+    {
+        for(j = 0; j < largura; j++)
+        {
+            k = i * largura + j;
+            pixel = &r->tras[3 * k];
+            cor.x = pixel[0];
+            cor.y = pixel[1];
+            cor.z = pixel[2];
+            r->bordas[k] = 0;
+
+            for(m = 0; m < 4 && !r->bordas[k]; m++)
+            {
+                l = (i + vizinhos[m][0]) * largura + j + vizinhos[m][1];
+                if(i + vizinhos[m][0] < 0 || i + vizinhos[m][0] >= altura ||
+                    j + vizinhos[m][1] < 0 || j + vizinhos[m][1] >= largura)
+                {
+                    continue;
+                }
+
+                outro = &r->tras[3 * l];
+                cor_outro.x = outro[0];
+                cor_outro.y = outro[1];
+                cor_outro.z = outro[2];
+                r->bordas[k] = r->acertos_novos[k] != r->acertos_novos[l] ||
+                    contraste(&cor, &cor_outro) > SUAVIZACAO_LIMIAR;
+            }
+        }
+    }
+
+    raios = 0;
+
+    # pragma omp parallel for num_threads(r->num_threads) \
+        private(i, j, k, pixel, cor, recorte, recortado, ladrilho, inicio, \
+        codigo) reduction(+:raios) \
+        schedule(dynamic, 1)
+    for(n = 0; n < r->num_ladrilhos; n++)
+    {
+        if(atomic_load_explicit(&r->cancelar, memory_order_relaxed))
+        {
+            continue;
+        }
+
+        ladrilho = &r->ladrilhos[n];
+        inicio = tempo_thread();
+
+        // O recorte só é feito se o ladrilho tiver alguma borda.
+        recortado = 0;
+
+        for(codigo = 0; codigo < ladrilho->lado * ladrilho->lado; codigo++)
+        {
+            morton_decodificar(codigo, &i, &j);
+            i += ladrilho->i0;
+            j += ladrilho->j0;
+            if(i >= ladrilho->i1 || j >= ladrilho->j1)
+            {
+                continue;
+            }
+
+            k = i * largura + j;
+            if(!r->bordas[k])
+            {
+                continue;
+            }
+
+            if(!recortado)
+            {
+                recortar_ladrilho(r, camera, ladrilho, &recorte);
+                recortado = 1;
+            }
+
+            cor = amostrar_regiao(r, camera, &recorte, j, i, 1.0, 1,
+                &raios);
+            pixel = &r->tras[3 * k];
+            pixel[0] = cor.x;
+            pixel[1] = cor.y;
+            pixel[2] = cor.z;
+        }
+
+        medir_ladrilho(r, ladrilho, inicio);
+    }
+
+    if(atomic_load(&r->cancelar))
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&r->trava);
+    r->amostras_por_pixel = 1.0 + (double) raios / (largura * altura);
+    pthread_mutex_unlock(&r->trava);
+    return 1;
+}
+
+/**
+ * Liga, se o traçado em ondas estiver ligado, a coleta dos raios da
+ * próxima passada (na resolução final). Sem memória para a onda, os
+ * caminhos são traçados em profundidade.
+ */
+static void iniciar_ondas(renderizador_t *r)
+{
+    r->em_ondas = !r->em_monte_carlo && atomic_load(&r->ondas) &&
+        onda_preparar(r->onda, r->largura_tras * r->altura_tras) != NULL;
+}
+
+/**
+ * Traça em ondas os raios secundários dos raios coletados na última
+ * passada, somando as cores ao buffer de trás.
+ *
+ * @return 1 se o traçado foi completado, 0 se foi cancelado.
+ */
+static int terminar_ondas(renderizador_t *r)
+{
+    if(!r->em_ondas)
+    {
+        return 1;
+    }
+
+    r->em_ondas = 0;
+    mesclar_irradiancia(r);
+    return onda_colorir(r->onda, r->cena, r->luz_local, r->luz_ambiente,
+        &r->fundo, r->recursoes, MAX_RAIOS_SECUNDARIOS, r->num_threads,
+        &r->cancelar, r->tras);
+}
+
+/**
+ * Tira o ruído do buffer de trás (com a média de 'amostras' amostras por
+ * píxel) antes de publicá-lo, se o quadro é filtrado.
+ */
+static void filtrar(renderizador_t *r, int amostras)
+{
+    if(r->em_filtragem)
+    {
+        filtro_aplicar(r->filtro, r->tras, amostras, r->num_threads);
+    }
+}
+
+/**
+ * Traça um quadro no buffer de trás e o publica. Se houver um quadro
+ * anterior no cache, ele é reprojetado; senão, ele é rasterizado (se a
+ * rasterização estiver ligada) ou, no modo progressivo, refinado em
+ * passadas (8x8, 4x4, 2x2 e 1x1), cada uma publicada assim que termina.
+ * No traçado em ondas, os caminhos da passada na resolução final são
+ * traçados depois dela. Por fim as bordas são suavizadas.
+ *
+ * @param reaproveitados Ponteiro para o número de píxels que não foram
+ * traçados contra a cena (é modificado).
+ * @return 1 se o quadro foi completado, 0 se foi cancelado.
+ */
+static int tracar_quadro(renderizador_t *r, camera_t *camera,
+    long long *reaproveitados)
+{
+    int bloco;
+
+    planejar_ladrilhos(r);
+    *reaproveitados = 0;
+    r->em_ondas = 0;
+    r->em_monte_carlo = atomic_load(&r->monte_carlo);
+    r->amostrador_quadro = atomic_load(&r->amostrador);
+    r->em_filtragem = r->em_monte_carlo && atomic_load(&r->filtragem) &&
+        filtro_preparar(r->filtro, r->largura_tras, r->altura_tras,
+        r->num_threads);
+    r->cena->irradiancia = !r->em_monte_carlo &&
+        atomic_load(&r->irradiancia) ? r->cache_irradiancia : NULL;
+    preparar_fotons(r);
+    if(r->cache_valido && atomic_load(&r->reprojecao))
+    {
+        iniciar_ondas(r);
+        if(!reprojetar_quadro(r, camera, reaproveitados) ||
+            !terminar_ondas(r))
+        {
+            return 0;
+        }
+    }
+    else if(atomic_load(&r->rasterizacao))
+    {
+        iniciar_ondas(r);
+        if(!rasterizar_quadro(r, camera) || !terminar_ondas(r))
+        {
+            return 0;
+        }
+    }
+    else if(!atomic_load(&r->progressivo))
+    {
+        iniciar_ondas(r);
+        if(!tracar_passada(r, camera, 1, 0) || !terminar_ondas(r))
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        for(bloco = PROGRESSIVO_BLOCO_INICIAL; bloco >= 1; bloco /= 2)
+        {
+            if(bloco == 1)
+            {
+                iniciar_ondas(r);
+            }
+            if(!tracar_passada(r, camera, bloco,
+                bloco < PROGRESSIVO_BLOCO_INICIAL) || !terminar_ondas(r))
+            {
+                return 0;
+            }
+            if(bloco == 1)
+            {
+                filtrar(r, 1);
+            }
+            if(!publicar(r, 1))
+            {
+                return 0;
+            }
+        }
+
+        // A suavização, se ligada, é mais uma passada.
+        if(!atomic_load(&r->suavizacao) || r->em_monte_carlo)
+        {
+            return 1;
+        }
+    }
+
+    if(!suavizar_bordas(r, camera))
+    {
+        return 0;
+    }
+    filtrar(r, 1);
+    return publicar(r, 0);
+}
+
+/**
+ * Gera, pelo amostrador do quadro, um deslocamento em [-0,5; 0,5) para a
+ * amostra de um píxel.
+ */
+static double deslocamento_amostra(renderizador_t *r, unsigned int i,
+    unsigned int j, unsigned int amostra, unsigned int eixo)
+{
+    return amostrador_valor(r->amostrador_quadro, i, j, amostra, eixo) - 0.5;
+}
+
+/**
+ * Diz se a passada de acumulação atual deve ser publicada. Com a
+ * filtragem, que custa mais que uma passada, só são publicadas as passadas
+ * em que o número de amostras por píxel dobra.
+ */
+static int publicavel(renderizador_t *r)
+{
+    int amostras;
+
+    amostras = r->amostras + 1;
+    return !r->em_filtragem || (amostras & (amostras - 1)) == 0;
+}
+
+/**
+ * Traça mais uma amostra por píxel do último quadro, deslocada dentro do
+ * píxel, soma-a ao acumulado e escreve a média no buffer de trás (filtrada,
+ * se a passada for publicada).
+ *
+ * @return 1 se a passada foi completada, 0 se foi cancelada.
+ */
+static int acumular_passada(renderizador_t *r)
+{
+    int i, j, k, n, largura, altura;
+    unsigned int codigo;
+    double inicio, passada;
+    float *pixel, *soma;
+    cor_t cor;
+    recorte_t recorte;
+    ladrilho_t *ladrilho;
+
+    // Depois de uma troca, o buffer de trás pode ter o tamanho antigo.
+    largura = r->largura_frente;
+    altura = r->altura_frente;
+    if(largura != r->largura_tras || altura != r->altura_tras)
+    {
+        pixel = realloc(r->tras, 3 * largura * altura * sizeof(float));
+        if(pixel == NULL)
+        {
+            r->acumulando = 0;
+            return 0;
+        }
+        r->tras = pixel;
+        r->largura_tras = largura;
+        r->altura_tras = altura;
+    }
+
+    // Os ladrilhos são os do último quadro, que tem o tamanho do cache.
+    if(largura != r->largura_cache || altura != r->altura_cache)
+    {
+        r->acumulando = 0;
+        return 0;
+    }
+    planejar_ladrilhos(r);
+    passada = omp_get_wtime();
+
+    mesclar_irradiancia(r);
+    # pragma omp parallel for num_threads(r->num_threads) \
+        private(i, j, k, pixel, soma, cor, recorte, ladrilho, inicio, \
+        codigo) schedule(dynamic, 1)
+    for(n = 0; n < r->num_ladrilhos; n++)
+    {
+        if(atomic_load_explicit(&r->cancelar, memory_order_relaxed))
+        {
+            continue;
+        }
+
+        ladrilho = &r->ladrilhos[n];
+        inicio = tempo_thread();
+
+        recortar_ladrilho(r, &r->camera_atual, ladrilho, &recorte);
+
+        for(codigo = 0; codigo < ladrilho->lado * ladrilho->lado; codigo++)
+        {
+            morton_decodificar(codigo, &i, &j);
+            i += ladrilho->i0;
+            j += ladrilho->j0;
+            if(i >= ladrilho->i1 || j >= ladrilho->j1)
+            {
+                continue;
+            }
+
+            cor = tracar_raio(r, &r->camera_atual, &recorte,
+                j + deslocamento_amostra(r, i, j, r->amostras, 0),
+                i + deslocamento_amostra(r, i, j, r->amostras, 1),
+                r->amostras);
+
+            k = 3 * (i * largura + j);
+            soma = &r->acumulado[k];
+            soma[0] += cor.x;
+            soma[1] += cor.y;
+            soma[2] += cor.z;
+
+            pixel = &r->tras[k];
+            for(k = 0; k < 3; k++)
+            {
+                pixel[k] = soma[k] / (r->amostras + 1);
+            }
+            if(r->em_filtragem)
+            {
+                filtro_somar_amostra(r->filtro, i * largura + j, &cor);
+            }
+        }
+
+        medir_ladrilho(r, ladrilho, inicio);
+    }
+
+    if(atomic_load(&r->cancelar))
+    {
+        return 0;
+    }
+
+    // Vazão do modo de Monte Carlo: um caminho por píxel nesta passada.
+    if(r->em_monte_carlo)
+    {
+        passada = omp_get_wtime() - passada;
+        pthread_mutex_lock(&r->trava);
+        r->amostras_por_segundo = largura * altura /
+            (passada * r->num_threads);
+        pthread_mutex_unlock(&r->trava);
+    }
+
+    if(publicavel(r))
+    {
+        filtrar(r, r->amostras + 1);
+    }
+    return 1;
+}
+
+/**
+ * Começa a média com o quadro que acabou de ser publicado. Um quadro com
+ * píxels reaproveitados da reprojeção não entra na média: ela começa
+ * vazia, e a primeira passada de acumulação traça de novo a amostra 0.
+ */
+static void iniciar_acumulacao(renderizador_t *r, camera_t *camera,
+    long long reaproveitados)
+{
+    float *temp;
+    int n;
+
+    n = 3 * r->largura_frente * r->altura_frente;
+    temp = realloc(r->acumulado, n * sizeof(float));
+    if(temp == NULL)
+    {
+        return;
+    }
+
+    // Só esta thread escreve no buffer da frente, então ele pode ser lido
+    // (se ele foi filtrado, a imagem original ficou no filtro).
+    r->acumulado = temp;
+    r->camera_atual = *camera;
+    r->acumulando = 1;
+    if(reaproveitados > 0)
+    {
+        memset(r->acumulado, 0, n * sizeof(float));
+        r->amostras = 0;
+        return;
+    }
+
+    memcpy(r->acumulado, r->em_filtragem ? r->filtro->entrada : r->frente,
+        n * sizeof(float));
+    r->amostras = 1;
+}
+
+/**
+ * Ajusta a qualidade dos próximos quadros a partir do tempo do último.
+ * O custo é proporcional ao número de píxels, então a escala (linear) é
+ * corrigida pela raiz da razão entre o tempo alvo (um pouco abaixo do
+ * orçamento) e o tempo medido. A redução é imediata e o aumento é
+ * amortecido, para não oscilar. Com a escala no mínimo, as reflexões são
+ * reduzidas; na volta, elas são restauradas antes da resolução.
+ */
+static void governar(renderizador_t *r, double orcamento, double tempo)
+{
+    double alvo;
+
+    if(orcamento <= 0.0)
+    {
+        r->escala = 1.0;
+        r->recursoes = r->max_recursoes;
+        return;
+    }
+
+    alvo = r->escala * sqrt(GOVERNADOR_ALVO * orcamento / tempo);
+
+    if(tempo > orcamento)
+    {
+        if(r->escala > GOVERNADOR_ESCALA_MINIMA)
+        {
+            r->escala = max(GOVERNADOR_ESCALA_MINIMA, alvo);
+        }
+        else if(r->recursoes > 0)
+        {
+            r->recursoes--;
+        }
+    }
+    else if(tempo < GOVERNADOR_FOLGA * orcamento)
+    {
+        if(r->recursoes < r->max_recursoes)
+        {
+            r->recursoes++;
+        }
+        else if(r->escala < 1.0)
+        {
+            r->escala = min(1.0, 0.5 * (r->escala + alvo));
+        }
+    }
+}
+
+/**
+ * Guarda o tempo de um quadro completo para as estatísticas.
+ */
+static void registrar_tempo(renderizador_t *r, double tempo)
+{
+    pthread_mutex_lock(&r->trava);
+    r->tempos[r->num_tempos % NUM_TEMPOS] = tempo;
+    r->num_tempos++;
+    pthread_mutex_unlock(&r->trava);
+}
+
+/**
+ * Laço da thread do renderizador: espera um pedido e traça o quadro
+ * (publicando-o se ele não for cancelado). Sem pedidos, acumula amostras
+ * do último quadro até o limite.
+ */
+static void *laco_renderizador(void *arg)
+{
+    renderizador_t *r;
+    camera_t camera;
+    float *temp;
+    int largura, altura;
+    double orcamento, inicio, tempo;
+    long long reaproveitados;
+
+    r = arg;
+
+    while(1)
+    {
+        pthread_mutex_lock(&r->trava);
+        while(!r->pedido && !r->terminar && (!r->acumulando ||
+            r->amostras >= (r->em_monte_carlo ? MONTE_CARLO_MAX_AMOSTRAS :
+            ACUMULACAO_MAX_AMOSTRAS)))
+        {
+            pthread_cond_wait(&r->sinal, &r->trava);
+        }
+
+        if(r->terminar)
+        {
+            pthread_mutex_unlock(&r->trava);
+            break;
+        }
+
+        // Sem pedidos, o tempo livre é usado para acumular amostras.
+        if(!r->pedido)
+        {
+            atomic_store(&r->cancelar, 0);
+            pthread_mutex_unlock(&r->trava);
+
+            if(acumular_passada(r) && (!publicavel(r) || publicar(r, 0)))
+            {
+                concluir_medicao(r);
+                r->amostras++;
+            }
+            continue;
+        }
+
+        camera = r->camera_pedida;
+        orcamento = r->orcamento;
+        r->pedido = 0;
+        r->amostras = 0;
+        r->acumulando = 0;
+        atomic_store(&r->cancelar, 0);
+        pthread_mutex_unlock(&r->trava);
+
+        // Sem governador a resolução e as reflexões são as completas.
+        if(orcamento <= 0.0)
+        {
+            governar(r, orcamento, 0.0);
+        }
+
+        // O buffer de trás só é usado por esta thread.
+        largura = max(1, (int) (r->escala * camera.viewport[2] + 0.5));
+        altura = max(1, (int) (r->escala * camera.viewport[3] + 0.5));
+        r->fator_x = (double) camera.viewport[2] / largura;
+        r->fator_y = (double) camera.viewport[3] / altura;
+        if(largura != r->largura_tras || altura != r->altura_tras)
+        {
+            temp = realloc(r->tras, 3 * largura * altura * sizeof(float));
+            if(temp == NULL)
+            {
+                continue;
+            }
+            r->tras = temp;
+            r->largura_tras = largura;
+            r->altura_tras = altura;
+        }
+        if(!preparar_cache(r, largura, altura))
+        {
+            continue;
+        }
+
+        inicio = omp_get_wtime();
+        if(tracar_quadro(r, &camera, &reaproveitados))
+        {
+            tempo = omp_get_wtime() - inicio;
+            atualizar_cache(r, reaproveitados);
+            concluir_medicao(r);
+            iniciar_acumulacao(r, &camera, reaproveitados);
+            registrar_tempo(r, tempo);
+            governar(r, orcamento, tempo);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Cria um renderizador e inicia a sua thread.
+ *
+ * @param cena Ponteiro para a cena (não pode mudar enquanto houver
+ * quadros em andamento).
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param fundo Cor dos píxels que não tocam nenhum objeto.
+ * @param max_recursoes Número máximo de reflexões.
+ * @param num_threads Número de threads que traçam cada quadro.
+ * @return Ponteiro para o renderizador ou NULL em caso de erro.
+ */
+renderizador_t *renderizador_criar(cena_t *cena, luz_t *luz_local,
+    luz_t *luz_ambiente, cor_t fundo, int max_recursoes, int num_threads)
+{
+    renderizador_t *r;
+
+    r = calloc(1, sizeof(renderizador_t));
+    if(r == NULL)
+    {
+        return NULL;
+    }
+
+    r->rasterizador = rasterizador_criar();
+    r->onda = onda_criar();
+    r->filtro = filtro_criar();
+    r->cache_irradiancia = irradiancia_criar(num_threads);
+    r->mapa_fotons = fotons_criar(num_threads);
+    if(r->rasterizador == NULL || r->onda == NULL || r->filtro == NULL ||
+        r->cache_irradiancia == NULL || r->mapa_fotons == NULL)
+    {
+        rasterizador_liberar(r->rasterizador);
+        onda_liberar(r->onda);
+        filtro_liberar(r->filtro);
+        irradiancia_liberar(r->cache_irradiancia);
+        fotons_liberar(r->mapa_fotons);
+        free(r);
+        return NULL;
+    }
+
+    r->cena = cena;
+    r->luz_local = luz_local;
+    r->luz_ambiente = luz_ambiente;
+    r->fundo = fundo;
+    r->max_recursoes = max_recursoes;
+    r->num_threads = num_threads;
+    r->escala = 1.0;
+    r->recursoes = max_recursoes;
+    atomic_init(&r->cancelar, 0);
+    atomic_init(&r->versao, 0);
+    atomic_init(&r->progressivo, 1);
+    atomic_init(&r->reprojecao, 1);
+    atomic_init(&r->suavizacao, 1);
+    atomic_init(&r->rasterizacao, 0);
+    atomic_init(&r->ondas, 0);
+    atomic_init(&r->sombras_em_pacote, 0);
+    atomic_init(&r->monte_carlo, 0);
+    atomic_init(&r->amostrador, AMOSTRADOR_ALEATORIO);
+    atomic_init(&r->filtragem, 0);
+    atomic_init(&r->irradiancia, 0);
+    atomic_init(&r->num_fotons, 0);
+    atomic_init(&r->vizinhos_fotons, 1);
+    amostrador_iniciar();
+
+    pthread_mutex_init(&r->trava, NULL);
+    pthread_cond_init(&r->sinal, NULL);
+
+    if(pthread_create(&r->thread, NULL, laco_renderizador, r) != 0)
+    {
+        pthread_mutex_destroy(&r->trava);
+        pthread_cond_destroy(&r->sinal);
+        rasterizador_liberar(r->rasterizador);
+        onda_liberar(r->onda);
+        filtro_liberar(r->filtro);
+        irradiancia_liberar(r->cache_irradiancia);
+        fotons_liberar(r->mapa_fotons);
+        free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+/**
+ * Pede um novo quadro com a câmera dada, cancelando o que estiver em
+ * andamento.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param camera Ponteiro para a câmera (é copiada).
+ */
+void renderizador_pedir(renderizador_t *renderizador, camera_t *camera)
+{
+    pthread_mutex_lock(&renderizador->trava);
+    renderizador->camera_pedida = *camera;
+    renderizador->pedido = 1;
+    atomic_store(&renderizador->cancelar, 1);
+    pthread_cond_signal(&renderizador->sinal);
+    pthread_mutex_unlock(&renderizador->trava);
+}
+
+/**
+ * Liga ou desliga o modo progressivo (vale a partir do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param progressivo 1 para refinar os quadros em passadas, 0 para
+ * traçá-los direto na resolução final.
+ */
+void renderizador_progressivo(renderizador_t *renderizador, int progressivo)
+{
+    atomic_store(&renderizador->progressivo, progressivo);
+}
+
+/**
+ * Liga ou desliga a reprojeção do último quadro (vale a partir do próximo
+ * quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param reprojecao 1 para reaproveitar os raios primários do último
+ * quadro, 0 para traçar todos os píxels.
+ */
+void renderizador_reprojecao(renderizador_t *renderizador, int reprojecao)
+{
+    atomic_store(&renderizador->reprojecao, reprojecao);
+}
+
+/**
+ * Liga ou desliga a superamostragem adaptativa das bordas (vale a partir
+ * do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param suavizacao 1 para superamostrar as bordas, 0 para usar um raio
+ * por píxel.
+ */
+void renderizador_suavizacao(renderizador_t *renderizador, int suavizacao)
+{
+    atomic_store(&renderizador->suavizacao, suavizacao);
+}
+
+/**
+ * Liga ou desliga a rasterização da visibilidade primária (vale a partir
+ * do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param rasterizacao 1 para rasterizar os objetos vistos em cada píxel,
+ * 0 para traçar os raios primários.
+ */
+void renderizador_rasterizacao(renderizador_t *renderizador, int rasterizacao)
+{
+    atomic_store(&renderizador->rasterizacao, rasterizacao);
+}
+
+/**
+ * Liga ou desliga o traçado em ondas dos raios secundários (vale a partir
+ * do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param ondas 1 para traçar os raios secundários em ondas ordenadas, 0
+ * para traçar cada caminho em profundidade.
+ */
+void renderizador_ondas(renderizador_t *renderizador, int ondas)
+{
+    atomic_store(&renderizador->ondas, ondas);
+}
+
+/**
+ * Liga ou desliga o teste em pacote dos raios de sombra dos raios
+ * primários (vale a partir da próxima passada).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param sombras_em_pacote 1 para testar as sombras de cada ladrilho num
+ * pacote só, 0 para testar cada uma logo depois do seu raio primário.
+ */
+void renderizador_sombras_em_pacote(renderizador_t *renderizador,
+    int sombras_em_pacote)
+{
+    atomic_store(&renderizador->sombras_em_pacote, sombras_em_pacote);
+}
+
+/**
+ * Liga ou desliga o traçado de caminhos por Monte Carlo (vale a partir do
+ * próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param monte_carlo 1 para traçar um caminho com iluminação global por
+ * amostra, 0 para o traçado de raios com a luz ambiente.
+ */
+void renderizador_monte_carlo(renderizador_t *renderizador, int monte_carlo)
+{
+    atomic_store(&renderizador->monte_carlo, monte_carlo);
+}
+
+/**
+ * Liga ou desliga a filtragem das imagens do modo de Monte Carlo (vale a
+ * partir do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param filtragem 1 para tirar o ruído de cada imagem publicada, 0 para
+ * publicar a média das amostras.
+ */
+void renderizador_filtragem(renderizador_t *renderizador, int filtragem)
+{
+    atomic_store(&renderizador->filtragem, filtragem);
+}
+
+/**
+ * Liga ou desliga o cache de irradiância, que troca a luz ambiente pela
+ * indireta difusa fora do modo de Monte Carlo (vale a partir do próximo
+ * quadro). Os registros do cache continuam valendo quando ele é religado.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param irradiancia 1 para usar o cache, 0 para a luz ambiente.
+ */
+void renderizador_irradiancia(renderizador_t *renderizador, int irradiancia)
+{
+    atomic_store(&renderizador->irradiancia, irradiancia);
+}
+
+/**
+ * Liga, desliga ou ajusta as cáusticas do mapa de fótons (vale a partir
+ * do próximo quadro, que refaz o mapa se o número de fótons mudou).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param num_fotons Fótons emitidos pela luz local (0 desliga).
+ * @param vizinhos Fótons usados em cada estimativa (de 1 a
+ * FOTONS_MAX_VIZINHOS).
+ */
+void renderizador_fotons(renderizador_t *renderizador, int num_fotons,
+    int vizinhos)
+{
+    atomic_store(&renderizador->num_fotons, num_fotons);
+    atomic_store(&renderizador->vizinhos_fotons,
+        min(FOTONS_MAX_VIZINHOS, max(1, vizinhos)));
+}
+
+/**
+ * Escolhe o amostrador dos deslocamentos dentro dos píxels e dos caminhos
+ * de Monte Carlo (vale a partir do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param amostrador AMOSTRADOR_ALEATORIO, AMOSTRADOR_SOBOL ou
+ * AMOSTRADOR_RUIDO_AZUL.
+ */
+void renderizador_amostrador(renderizador_t *renderizador, int amostrador)
+{
+    atomic_store(&renderizador->amostrador, amostrador);
+}
+
+/**
+ * Define o orçamento de tempo por quadro do governador.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param segundos Tempo máximo desejado por quadro (0 desliga o
+ * governador e volta à resolução e às reflexões completas).
+ */
+void renderizador_orcamento(renderizador_t *renderizador, double segundos)
+{
+    pthread_mutex_lock(&renderizador->trava);
+    renderizador->orcamento = segundos;
+    pthread_mutex_unlock(&renderizador->trava);
+}
+
+/**
+ * Compara dois tempos (para o qsort).
+ */
+static int comparar_tempos(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Calcula os percentis dos tempos dos últimos quadros completos.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param p50 Ponteiro para a mediana (em segundos, é modificada).
+ * @param p95 Ponteiro para o percentil 95 (em segundos, é modificado).
+ * @param p99 Ponteiro para o percentil 99 (em segundos, é modificado).
+ * @return Número de quadros considerados (0 se ainda não houver).
+ */
+int renderizador_estatisticas(renderizador_t *renderizador, double *p50,
+    double *p95, double *p99)
+{
+    double tempos[NUM_TEMPOS];
+    int n;
+
+    pthread_mutex_lock(&renderizador->trava);
+    n = min(renderizador->num_tempos, NUM_TEMPOS);
+    memcpy(tempos, renderizador->tempos, n * sizeof(double));
+    pthread_mutex_unlock(&renderizador->trava);
+
+    if(n == 0)
+    {
+        return 0;
+    }
+
+    qsort(tempos, n, sizeof(double), comparar_tempos);
+    *p50 = tempos[(int) (0.50 * (n - 1) + 0.5)];
+    *p95 = tempos[(int) (0.95 * (n - 1) + 0.5)];
+    *p99 = tempos[(int) (0.99 * (n - 1) + 0.5)];
+    return n;
+}
+
+/**
+ * Retorna a fração dos raios primários dos quadros completos que foi
+ * reaproveitada por reprojeção (sem procurar o ponto mais perto na cena).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @return Fração entre 0 e 1 (0 se ainda não houver quadros).
+ */
+double renderizador_reaproveitamento(renderizador_t *renderizador)
+{
+    double fracao;
+
+    pthread_mutex_lock(&renderizador->trava);
+    fracao = renderizador->raios_primarios == 0 ? 0.0 :
+        (double) renderizador->raios_reaproveitados /
+        renderizador->raios_primarios;
+    pthread_mutex_unlock(&renderizador->trava);
+    return fracao;
+}
+
+/**
+ * Retorna o número médio de raios primários por píxel do último quadro
+ * completo com a suavização ligada.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @return Raios por píxel (0 se ainda não houver quadros suavizados).
+ */
+double renderizador_amostras_por_pixel(renderizador_t *renderizador)
+{
+    double media;
+
+    pthread_mutex_lock(&renderizador->trava);
+    media = renderizador->amostras_por_pixel;
+    pthread_mutex_unlock(&renderizador->trava);
+    return media;
+}
+
+/**
+ * Retorna quantas amostras (caminhos) por segundo cada thread traçou na
+ * última passada de acumulação do modo de Monte Carlo.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @return Amostras por segundo por thread (0 se ainda não houver).
+ */
+double renderizador_amostras_por_segundo(renderizador_t *renderizador)
+{
+    double vazao;
+
+    pthread_mutex_lock(&renderizador->trava);
+    vazao = renderizador->amostras_por_segundo;
+    pthread_mutex_unlock(&renderizador->trava);
+    return vazao;
+}
+
+/**
+ * Retorna o tamanho do cache de irradiância e a fração das consultas a
+ * ele que foram interpoladas (em vez de criar um registro novo), desde que
+ * ele foi criado.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param interpolacao Ponteiro para a fração (é modificada).
+ * @return Número de registros na octree do cache.
+ */
+int renderizador_irradiancia_estatisticas(renderizador_t *renderizador,
+    double *interpolacao)
+{
+    int registros;
+
+    pthread_mutex_lock(&renderizador->trava);
+    registros = renderizador->registros_irradiancia;
+    *interpolacao = renderizador->interpolacao_irradiancia;
+    pthread_mutex_unlock(&renderizador->trava);
+    return registros;
+}
+
+/**
+ * Retorna o tamanho do mapa de fótons, os tempos do seu último preparo e
+ * o tempo médio de uma consulta a ele (até o começo do último quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param tracado Ponteiro para os segundos do traçado dos fótons (é
+ * modificado).
+ * @param construcao Ponteiro para os segundos da construção da árvore (é
+ * modificado).
+ * @param consulta Ponteiro para os segundos por consulta (é modificado).
+ * @return Número de fótons no mapa.
+ */
+int renderizador_fotons_estatisticas(renderizador_t *renderizador,
+    double *tracado, double *construcao, double *consulta)
+{
+    int fotons;
+
+    pthread_mutex_lock(&renderizador->trava);
+    fotons = renderizador->fotons_guardados;
+    *tracado = renderizador->tracado_fotons;
+    *construcao = renderizador->construcao_fotons;
+    *consulta = renderizador->consulta_fotons;
+    pthread_mutex_unlock(&renderizador->trava);
+    return fotons;
+}
+
+/**
+ * Retorna quantas amostras por píxel tem o último quadro publicado (a
+ * média que ele mostra).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @return Amostras por píxel (0 se nada foi publicado ainda).
+ */
+int renderizador_amostras(renderizador_t *renderizador)
+{
+    int amostras;
+
+    pthread_mutex_lock(&renderizador->trava);
+    amostras = renderizador->amostras_frente;
+    pthread_mutex_unlock(&renderizador->trava);
+    return amostras;
+}
+
+/**
+ * Trava e retorna o último quadro (ou passada) publicado. Deve ser seguido de
+ * renderizador_soltar(), mesmo que o retorno seja NULL.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param largura Ponteiro para a largura do quadro (é modificada).
+ * @param altura Ponteiro para a altura do quadro (é modificada).
+ * @return Píxels do quadro (RGB) ou NULL se nada foi publicado ainda.
+ */
+float *renderizador_travar_quadro(renderizador_t *renderizador,
+    int *largura, int *altura)
+{
+    pthread_mutex_lock(&renderizador->trava);
+    *largura = renderizador->largura_frente;
+    *altura = renderizador->altura_frente;
+    return renderizador->frente;
+}
+
+/**
+ * Solta o quadro obtido com renderizador_travar_quadro().
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ */
+void renderizador_soltar(renderizador_t *renderizador)
+{
+    pthread_mutex_unlock(&renderizador->trava);
+}
+
+/**
+ * Retorna o número de quadros (ou passadas) já publicados.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @return Versão do buffer da frente.
+ */
+int renderizador_versao(renderizador_t *renderizador)
+{
+    return atomic_load(&renderizador->versao);
+}
+
+/**
+ * Cancela o quadro em andamento, encerra a thread e libera a memória.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ */
+void renderizador_liberar(renderizador_t *renderizador)
+{
+    if(renderizador == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&renderizador->trava);
+    renderizador->terminar = 1;
+    atomic_store(&renderizador->cancelar, 1);
+    pthread_cond_signal(&renderizador->sinal);
+    pthread_mutex_unlock(&renderizador->trava);
+
+    pthread_join(renderizador->thread, NULL);
+    renderizador->cena->irradiancia = NULL;
+    renderizador->cena->fotons = NULL;
+    pthread_mutex_destroy(&renderizador->trava);
+    pthread_cond_destroy(&renderizador->sinal);
+    free(renderizador->frente);
+    free(renderizador->tras);
+    free(renderizador->pontos);
+    free(renderizador->pontos_novos);
+    free(renderizador->acertos);
+    free(renderizador->acertos_novos);
+    free(renderizador->fontes);
+    free(renderizador->profundidades);
+    free(renderizador->bordas);
+    free(renderizador->acumulado);
+    free(renderizador->custos);
+    free(renderizador->custos_novos);
+    free(renderizador->ladrilhos);
+    rasterizador_liberar(renderizador->rasterizador);
+    onda_liberar(renderizador->onda);
+    filtro_liberar(renderizador->filtro);
+    irradiancia_liberar(renderizador->cache_irradiancia);
+    fotons_liberar(renderizador->mapa_fotons);
+    free(renderizador);
+}
@@ -0,0 +1,502 @@
+#ifndef RENDERIZADOR_H
+#define RENDERIZADOR_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "geometria.h"
+#include "camera.h"
+#include "rasterizador.h"
+#include "onda.h"
+#include "filtro.h"
+#include "fotons.h"
+#include "irradiancia.h"
+
+/** Lado (em píxels traçados) dos ladrilhos em que os quadros são divididos. */
+#define LADRILHO_LADO 16
+
+/** Lado (em píxels traçados) das partes em que os ladrilhos caros são
+ * divididos (múltiplo do bloco inicial do modo progressivo). */
+#define LADRILHO_LADO_DIVIDIDO 8
+
+/** Fração do custo médio por thread acima da qual um ladrilho é dividido. */
+#define ESCALONAMENTO_DIVISAO 0.25
+
+/** Tamanho dos blocos da primeira passada do modo progressivo. */
+#define PROGRESSIVO_BLOCO_INICIAL 8
+
+/** Menor escala da resolução interna usada pelo governador. */
+#define GOVERNADOR_ESCALA_MINIMA 0.25
+
+/** Fração do orçamento que o governador procura usar. */
+#define GOVERNADOR_ALVO 0.9
+
+/** Fração do orçamento abaixo da qual a qualidade volta a subir. */
+#define GOVERNADOR_FOLGA 0.8
+
+/** Número de tempos de quadro guardados para as estatísticas. */
+#define NUM_TEMPOS 256
+
+/** Diferença de cor (em qualquer canal) que indica uma borda. */
+#define SUAVIZACAO_LIMIAR 0.1
+
+/** Níveis de subdivisão das bordas (até 4^n amostras por píxel). */
+#define SUAVIZACAO_MAX_NIVEL 2
+
+/** Amostras por píxel acumuladas com a câmera parada. */
+#define ACUMULACAO_MAX_AMOSTRAS 64
+
+/** Amostras por píxel acumuladas com a câmera parada no modo de Monte
+ * Carlo. */
+#define MONTE_CARLO_MAX_AMOSTRAS 1024
+
+/** Diferença relativa de profundidade aceita ao reaproveitar um píxel. */
+#define REPROJECAO_TOLERANCIA 0.05
+
+/**
+ * Região de um quadro traçada por uma thread de cada vez: um ladrilho
+ * inteiro ou uma das partes de um ladrilho dividido. Os píxels de cada
+ * ladrilho são percorridos em ordem de Morton (Z).
+ */
+typedef struct {
+    int i0, j0; // Primeira linha e primeira coluna.
+    int i1, j1; // Fim (exclusivo) das linhas e das colunas.
+    int lado; // Lado antes do corte pela borda (uma potência de 2).
+    int ladrilho; // Índice do ladrilho (de LADRILHO_LADO) a que pertence.
+    double custo; // Custo previsto (em segundos).
+} ladrilho_t;
+
+/**
+ * Renderizador assíncrono.
+ *
+ * Uma thread própria espera pedidos de quadro e os traça com um time de
+ * threads do OpenMP em um buffer de trás, em ladrilhos de 16x16 píxels.
+ * Antes de traçar um ladrilho, a cena é recortada pelo tronco de visão
+ * dele, e os raios primários testam só os objetos que sobraram. Ao
+ * terminar, troca os buffers e incrementa a versão, de modo que a thread
+ * da interface apenas envia o buffer da frente para a tela. Um novo
+ * pedido cancela o quadro em andamento (os ladrilhos restantes são
+ * pulados) e o recomeça na hora.
+ *
+ * No modo progressivo, cada quadro é traçado primeiro com um raio por 
+ * bloco de 8x8 píxels e depois refinado (4x4, 2x2 e 1x1), reaproveitando 
+ * os raios já traçados; cada passada é publicada assim que termina.
+ *
+ * Com um orçamento de tempo por quadro, o governador mede cada quadro 
+ * completo e ajusta a resolução interna (o quadro é ampliado na tela) e, 
+ * se ela já estiver no mínimo, o número de reflexões, para ficar dentro 
+ * do orçamento.
+ *
+ * Com a reprojeção ligada, o ponto e o objeto tocados pelo raio de cada
+ * píxel do último quadro completo são guardados e, no quadro seguinte,
+ * projetados na nova câmera. Um píxel cujo vizinho 3x3 inteiro recebeu
+ * pontos de um mesmo objeto testa o raio contra esse objeto e aceita o
+ * resultado se a profundidade bater e nada do recorte ficar na frente
+ * dele; os demais (bordas, regiões desoclusas e píxels invalidados) são
+ * traçados contra a cena inteira. Um quadro reprojetado não entra na
+ * média das amostras acumuladas.
+ *
+ * Com a suavização ligada, os píxels cuja cor ou objeto diferem dos
+ * vizinhos são amostrados de novo com 4 raios estratificados; os
+ * quadrantes que ainda se afastam da média são subdivididos da mesma
+ * forma, até SUAVIZACAO_MAX_NIVEL níveis.
+ *
+ * Com a rasterização ligada, a visibilidade primária dos quadros que não
+ * são reprojetados vem do rasterizador: cada raio só é intersectado com o
+ * objeto visto no píxel e com os objetos que não foram rasterizados.
+ *
+ * Com o traçado em ondas ligado, as passadas na resolução final só
+ * calculam a cor local dos pontos tocados pelos raios primários; as
+ * reflexões e refrações de todos os píxels (e as suas sombras) são
+ * traçadas depois, em estágios ordenados (onda_t). As passadas grossas do
+ * modo progressivo e a suavização continuam traçando cada caminho em
+ * profundidade.
+ *
+ * Com as sombras em pacote, as passadas traçam primeiro os raios primários
+ * de cada ladrilho e juntam os raios de sombra dos pontos tocados (todos a
+ * caminho da mesma luz, e portanto coerentes) num pacote, testado de uma
+ * vez contra a cena; só então as cores são calculadas.
+ *
+ * O tempo gasto em cada ladrilho é medido, e a passada seguinte traça
+ * os ladrilhos do mais caro para o mais barato (segundo a medida do último
+ * quadro ou amostra completa), dividindo em 4 os que custam mais que uma
+ * fração do trabalho de cada thread, para que elas terminem juntas.
+ *
+ * Enquanto não chegam pedidos, a thread continua traçando o último quadro
+ * com amostras deslocadas dentro de cada píxel e publica a média delas,
+ * até ACUMULACAO_MAX_AMOSTRAS. Qualquer pedido recomeça a média.
+ *
+ * No modo de Monte Carlo, a cor de cada amostra vem de um caminho só
+ * (colorir_monte_carlo()), com a iluminação global difusa no lugar da luz
+ * ambiente, e a média vai até MONTE_CARLO_MAX_AMOSTRAS. Os números
+ * aleatórios de cada caminho (e os deslocamentos dentro dos píxels) saem
+ * do amostrador escolhido (amostrador.h), indexado pelo píxel e pela
+ * amostra, sem estado compartilhado entre as threads, de modo que a
+ * imagem não depende do número de threads nem da ordem dos ladrilhos.
+ * Nesse modo não há ondas nem suavização das bordas, e cada imagem
+ * publicada pode passar pelo filtro (filtro.h), guiado pela normal, pela
+ * profundidade e pelo albedo que os raios primários do quadro guardam (a
+ * média das amostras continua sem filtro e, com ele, só é publicada quando
+ * o número de amostras dobra).
+ *
+ * Fora desse modo, a luz ambiente pode dar lugar à indireta difusa de um
+ * cache de irradiância (irradiancia.h), que a thread liga na cena durante
+ * os seus quadros. O cache fica no espaço do mundo e vale de um quadro
+ * para outro; os registros criados numa passada entram na octree antes da
+ * passada seguinte.
+ *
+ * Em qualquer modo, um mapa de fótons (fotons.h) pode somar as cáusticas
+ * à luz direta. Ele é refeito no começo do primeiro quadro depois que o
+ * número de fótons muda, e os tempos do traçado, da construção e das
+ * consultas ficam nas estatísticas.
+ */
+typedef struct {
+    // Parâmetros fixos do traçado.
+    cena_t *cena;
+    luz_t *luz_local;
+    luz_t *luz_ambiente;
+    cor_t fundo;
+    int max_recursoes;
+    int num_threads;
+
+    // Buffers de 3 canais (RGB) e seus tamanhos.
+    float *frente;
+    int largura_frente, altura_frente;
+    float *tras;
+    int largura_tras, altura_tras;
+
+    // Estado compartilhado, protegido por 'trava'.
+    pthread_t thread;
+    pthread_mutex_t trava;
+    pthread_cond_t sinal;
+    camera_t camera_pedida;
+    int pedido;
+    int terminar;
+
+    double orcamento; // Segundos por quadro (0 desliga o governador).
+    double tempos[NUM_TEMPOS]; // Últimos tempos de quadro (circular).
+    int num_tempos;
+
+    // Estado do governador (só usado pela thread do renderizador).
+    double escala; // Fração da resolução da janela que é traçada.
+    int recursoes; // Reflexões usadas nos quadros atuais.
+    double fator_x, fator_y; // Píxels da janela por píxel traçado.
+
+    // Cache de reprojeção (só usado pela thread do renderizador): ponto e
+    // objeto tocados pelo raio de cada píxel do último quadro completo e
+    // os do quadro em andamento.
+    ponto_t *pontos, *pontos_novos;
+    objeto_t **acertos, **acertos_novos;
+    int *fontes; // Píxel do quadro anterior projetado em cada píxel.
+    unsigned char *bordas; // Píxels a suavizar no quadro em andamento.
+    double *profundidades; // Profundidade do ponto projetado.
+    int largura_cache, altura_cache;
+    int cache_valido;
+
+    // Soma das amostras do último quadro (só usada pela thread do
+    // renderizador) e quantas ela tem; sem acumulando, não há o que
+    // acumular.
+    float *acumulado;
+    int amostras;
+    int acumulando;
+    camera_t camera_atual;
+
+    // Escalonamento (só usado pela thread do renderizador): custo de cada
+    // ladrilho na última passada completa e na passada em andamento, e a
+    // ordem em que os ladrilhos (ou suas partes) são distribuídos.
+    double *custos, *custos_novos;
+    ladrilho_t *ladrilhos;
+    int num_ladrilhos;
+
+    rasterizador_t *rasterizador; // Só usado pela thread do renderizador.
+    onda_t *onda; // Idem.
+    filtro_t *filtro; // Idem.
+    cache_irradiancia_t *cache_irradiancia; // Idem.
+    mapa_fotons_t *mapa_fotons; // Idem.
+    int em_ondas; // Se a passada em andamento guarda os raios na onda.
+    int em_monte_carlo; // Se o último quadro é traçado por Monte Carlo.
+    int amostrador_quadro; // Amostrador do último quadro.
+    int em_filtragem; // Se as imagens do último quadro são filtradas.
+    int amostras_frente; // Amostras por píxel do quadro publicado.
+
+    long long raios_primarios; // Píxels dos quadros completos.
+    long long raios_reaproveitados; // Dos quais não foram traçados.
+    double amostras_por_pixel; // Média do último quadro suavizado.
+    double amostras_por_segundo; // Caminhos por segundo e por thread.
+    int registros_irradiancia; // Registros na octree do cache.
+    double interpolacao_irradiancia; // Fração das consultas interpoladas.
+    int fotons_guardados; // Fótons no mapa.
+    double tracado_fotons, construcao_fotons; // Segundos do último preparo.
+    double consulta_fotons; // Segundos por consulta ao mapa.
+
+    atomic_int cancelar; // Lido pelas threads durante o quadro.
+    atomic_int versao; // Número de quadros (ou passadas) publicados.
+    atomic_int progressivo; // Se os quadros são refinados em passadas.
+    atomic_int reprojecao; // Se o último quadro é reaproveitado.
+    atomic_int suavizacao; // Se as bordas são superamostradas.
+    atomic_int rasterizacao; // Se a visibilidade primária é rasterizada.
+    atomic_int ondas; // Se os raios secundários são traçados em ondas.
+    atomic_int sombras_em_pacote; // Se as sombras primárias vão em pacotes.
+    atomic_int monte_carlo; // Se os píxels são traçados por Monte Carlo.
+    atomic_int amostrador; // Amostrador dos próximos quadros.
+    atomic_int filtragem; // Se as imagens de Monte Carlo são filtradas.
+    atomic_int irradiancia; // Se a luz indireta vem do cache.
+    atomic_int num_fotons; // Fótons emitidos para as cáusticas (0 desliga).
+    atomic_int vizinhos_fotons; // Fótons de cada estimativa.
+} renderizador_t;
+
+/**
+ * Cria um renderizador e inicia a sua thread.
+ *
+ * @param cena Ponteiro para a cena (não pode mudar enquanto houver
+ * quadros em andamento).
+ * @param luz_local Ponteiro para a luz local (pontual).
+ * @param luz_ambiente Ponteiro para a luz ambiente.
+ * @param fundo Cor dos píxels que não tocam nenhum objeto.
+ * @param max_recursoes Número máximo de reflexões.
+ * @param num_threads Número de threads que traçam cada quadro.
+ * @return Ponteiro para o renderizador ou NULL em caso de erro.
+ */
+renderizador_t *renderizador_criar(cena_t *cena, luz_t *luz_local,
+    luz_t *luz_ambiente, cor_t fundo, int max_recursoes, int num_threads);
+
+/**
+ * Pede um novo quadro com a câmera dada, cancelando o que estiver em
+ * andamento.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param camera Ponteiro para a câmera (é copiada).
+ */
+void renderizador_pedir(renderizador_t *renderizador, camera_t *camera);
+
+/**
+ * Liga ou desliga o modo progressivo (vale a partir do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param progressivo 1 para refinar os quadros em passadas, 0 para
+ * traçá-los direto na resolução final.
+ */
+void renderizador_progressivo(renderizador_t *renderizador, int progressivo);
+
+/**
+ * Liga ou desliga a reprojeção do último quadro (vale a partir do próximo
+ * quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param reprojecao 1 para reaproveitar os raios primários do último
+ * quadro, 0 para traçar todos os píxels.
+ */
+void renderizador_reprojecao(renderizador_t *renderizador, int reprojecao);
+
+/**
+ * Liga ou desliga a superamostragem adaptativa das bordas (vale a partir
+ * do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param suavizacao 1 para superamostrar as bordas, 0 para usar um raio
+ * por píxel.
+ */
+void renderizador_suavizacao(renderizador_t *renderizador, int suavizacao);
+
+/**
+ * Liga ou desliga a rasterização da visibilidade primária (vale a partir
+ * do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param rasterizacao 1 para rasterizar os objetos vistos em cada píxel,
+ * 0 para traçar os raios primários.
+ */
+void renderizador_rasterizacao(renderizador_t *renderizador, int rasterizacao);
+
+/**
+ * Liga ou desliga o traçado em ondas dos raios secundários (vale a partir
+ * do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param ondas 1 para traçar os raios secundários em ondas ordenadas, 0
+ * para traçar cada caminho em profundidade.
+ */
+void renderizador_ondas(renderizador_t *renderizador, int ondas);
+
+/**
+ * Liga ou desliga o teste em pacote dos raios de sombra dos raios
+ * primários (vale a partir da próxima passada).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param sombras_em_pacote 1 para testar as sombras de cada ladrilho num
+ * pacote só, 0 para testar cada uma logo depois do seu raio primário.
+ */
+void renderizador_sombras_em_pacote(renderizador_t *renderizador,
+    int sombras_em_pacote);
+
+/**
+ * Liga ou desliga o traçado de caminhos por Monte Carlo (vale a partir do
+ * próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param monte_carlo 1 para traçar um caminho com iluminação global por
+ * amostra, 0 para o traçado de raios com a luz ambiente.
+ */
+void renderizador_monte_carlo(renderizador_t *renderizador, int monte_carlo);
+
+/**
+ * Liga ou desliga a filtragem das imagens do modo de Monte Carlo (vale a
+ * partir do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param filtragem 1 para tirar o ruído de cada imagem publicada, 0 para
+ * publicar a média das amostras.
+ */
+void renderizador_filtragem(renderizador_t *renderizador, int filtragem);
+
+/**
+ * Liga ou desliga o cache de irradiância, que troca a luz ambiente pela
+ * indireta difusa fora do modo de Monte Carlo (vale a partir do próximo
+ * quadro). Os registros do cache continuam valendo quando ele é religado.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param irradiancia 1 para usar o cache, 0 para a luz ambiente.
+ */
+void renderizador_irradiancia(renderizador_t *renderizador, int irradiancia);
+
+/**
+ * Liga, desliga ou ajusta as cáusticas do mapa de fótons (vale a partir
+ * do próximo quadro, que refaz o mapa se o número de fótons mudou).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param num_fotons Fótons emitidos pela luz local (0 desliga).
+ * @param vizinhos Fótons usados em cada estimativa (de 1 a
+ * FOTONS_MAX_VIZINHOS).
+ */
+void renderizador_fotons(renderizador_t *renderizador, int num_fotons,
+    int vizinhos);
+
+/**
+ * Escolhe o amostrador dos deslocamentos dentro dos píxels e dos caminhos
+ * de Monte Carlo (vale a partir do próximo quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param amostrador AMOSTRADOR_ALEATORIO, AMOSTRADOR_SOBOL ou
+ * AMOSTRADOR_RUIDO_AZUL.
+ */
+void renderizador_amostrador(renderizador_t *renderizador, int amostrador);
+
+/**
+ * Define o orçamento de tempo por quadro do governador.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param segundos Tempo máximo desejado por quadro (0 desliga o
+ * governador e volta à resolução e às reflexões completas).
+ */
+void renderizador_orcamento(renderizador_t *renderizador, double segundos);
+
+/**
+ * Calcula os percentis dos tempos dos últimos quadros completos.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param p50 Ponteiro para a mediana (em segundos, é modificada).
+ * @param p95 Ponteiro para o percentil 95 (em segundos, é modificado).
+ * @param p99 Ponteiro para o percentil 99 (em segundos, é modificado).
+ * @return Número de quadros considerados (0 se ainda não houver).
+ */
+int renderizador_estatisticas(renderizador_t *renderizador, double *p50,
+    double *p95, double *p99);
+
+/**
+ * Retorna a fração dos raios primários dos quadros completos que foi
+ * reaproveitada por reprojeção (sem procurar o ponto mais perto na cena).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @return Fração entre 0 e 1 (0 se ainda não houver quadros).
+ */
+double renderizador_reaproveitamento(renderizador_t *renderizador);
+
+/**
+ * Retorna o número médio de raios primários por píxel do último quadro
+ * completo com a suavização ligada.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @return Raios por píxel (0 se ainda não houver quadros suavizados).
+ */
+double renderizador_amostras_por_pixel(renderizador_t *renderizador);
+
+/**
+ * Retorna quantas amostras (caminhos) por segundo cada thread traçou na
+ * última passada de acumulação do modo de Monte Carlo.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @return Amostras por segundo por thread (0 se ainda não houver).
+ */
+double renderizador_amostras_por_segundo(renderizador_t *renderizador);
+
+/**
+ * Retorna o tamanho do cache de irradiância e a fração das consultas a
+ * ele que foram interpoladas (em vez de criar um registro novo), desde que
+ * ele foi criado.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param interpolacao Ponteiro para a fração (é modificada).
+ * @return Número de registros na octree do cache.
+ */
+int renderizador_irradiancia_estatisticas(renderizador_t *renderizador,
+    double *interpolacao);
+
+/**
+ * Retorna o tamanho do mapa de fótons, os tempos do seu último preparo e
+ * o tempo médio de uma consulta a ele (até o começo do último quadro).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param tracado Ponteiro para os segundos do traçado dos fótons (é
+ * modificado).
+ * @param construcao Ponteiro para os segundos da construção da árvore (é
+ * modificado).
+ * @param consulta Ponteiro para os segundos por consulta (é modificado).
+ * @return Número de fótons no mapa.
+ */
+int renderizador_fotons_estatisticas(renderizador_t *renderizador,
+    double *tracado, double *construcao, double *consulta);
+
+/**
+ * Retorna quantas amostras por píxel tem o último quadro publicado (a
+ * média que ele mostra).
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @return Amostras por píxel (0 se nada foi publicado ainda).
+ */
+int renderizador_amostras(renderizador_t *renderizador);
+
+/**
+ * Trava e retorna o último quadro (ou passada) publicado. Deve ser seguido de
+ * renderizador_soltar(), mesmo que o retorno seja NULL.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @param largura Ponteiro para a largura do quadro (é modificada).
+ * @param altura Ponteiro para a altura do quadro (é modificada), que pode
+ * ser menor que a da janela se o governador reduziu a resolução.
+ * @return Píxels do quadro (RGB) ou NULL se nada foi publicado ainda.
+ */
+float *renderizador_travar_quadro(renderizador_t *renderizador,
+    int *largura, int *altura);
+
+/**
+ * Solta o quadro obtido com renderizador_travar_quadro().
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ */
+void renderizador_soltar(renderizador_t *renderizador);
+
+/**
+ * Retorna o número de quadros (ou passadas) já publicados.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ * @return Versão do buffer da frente.
+ */
+int renderizador_versao(renderizador_t *renderizador);
+
+/**
+ * Cancela o quadro em andamento, encerra a thread e libera a memória.
+ *
+ * @param renderizador Ponteiro para o renderizador.
+ */
+void renderizador_liberar(renderizador_t *renderizador);
+
+#endif // RENDERIZADOR_H